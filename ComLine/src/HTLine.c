@@ -435,6 +435,12 @@ int main (int argc, char ** argv)
 	    } else if (!strcasecomp(argv[arg], "-put")) {
 		method = METHOD_PUT;
 
+	    /* Compress what we upload */
+	    } else if (!strcasecomp(argv[arg], "-gzip")) {
+		long threshold = (arg+1 < argc && isdigit((int) *argv[arg+1])) ?
+		    atol(argv[++arg]) : HTMIMERequest_codingThreshold();
+		HTMIMERequest_setContentCoding(WWW_CODING_GZIP, threshold);
+
 	    /* OPTIONS Method */
 	    } else if (!strcasecomp(argv[arg], "-options")) {
 		method = METHOD_OPTIONS;
@@ -605,8 +611,21 @@ int main (int argc, char ** argv)
 	break;
 
     case METHOD_PUT:
-	status = HTPutDocumentAnchor(cl->anchor, (HTAnchor *) cl->dest,
-				     cl->request);
+	{
+	    char * addr = HTAnchor_address((HTAnchor *) cl->anchor);
+	    char * file = NULL;
+
+	    /* Local files are sent straight from disk */
+	    if (!strncmp(addr, "file:", 5) &&
+		(file = HTWWWToLocal(addr, "", NULL)) != NULL)
+		status = HTPutFileAnchor(file, (HTAnchor *) cl->dest,
+					 cl->request);
+	    else
+		status = HTPutDocumentAnchor(cl->anchor, (HTAnchor *) cl->dest,
+					     cl->request);
+	    HT_FREE(file);
+	    HT_FREE(addr);
+	}
 	break;
 
     case METHOD_OPTIONS:
@@ -0,0 +1,270 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Runs the same stream of requests through a small persistent cache
+**	once with each eviction policy and prints the hit ratios. The
+**	program is its own HTTP server on a local port which serves objects
+**	from half a kilobyte to 128K. The requests follow a Zipf distribution
+**	over the objects so some of them are much more popular than others.
+**	The cache is flushed between the runs and the second run of each
+**	policy starts from the index written by the first, so the entries
+**	which have not been used yet are evicted straight from the index.
+**
+**		cachebench [-n objects] [-r requests] [-size megabytes]
+**			   [-cache directory] [-v]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWCache.h"
+#include <math.h>
+
+#define DEFAULT_OBJECTS		1500
+#define DEFAULT_REQUESTS	6000
+#define DEFAULT_SIZE		5			  /* Megabytes */
+#define DEFAULT_CACHE		"/tmp/w3c-cachebench/"
+#define ZIPF_EXPONENT		0.8
+#define MIN_OBJECT		512
+#define SIZE_CLASSES		9	    /* Object sizes are 512 << 0..8 */
+#define LAST_MODIFIED		(30*24*3600)	   /* Make them look stable */
+
+typedef struct _Reply {
+    char *	data;
+    int		length;
+    int		sent;
+} Reply;
+
+PRIVATE SOCKET Listener = INVSOC;
+PRIVATE int HttpPort = 0;
+
+PRIVATE int objects = DEFAULT_OBJECTS;
+PRIVATE int requests = DEFAULT_REQUESTS;
+PRIVATE double * popularity = NULL;		     /* Cumulative weights */
+PRIVATE unsigned long seed;
+PRIVATE int issued = 0;
+
+/*
+**	A small linear congruential generator so that both policies get the
+**	same requests
+*/
+PRIVATE double next_random (void)
+{
+    seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+    return (double) seed / 0x80000000UL;
+}
+
+PRIVATE long object_size (int object)
+{
+    unsigned long hash = (unsigned long) object * 2654435761UL;
+    return (long) MIN_OBJECT << ((hash >> 16) % SIZE_CLASSES);
+}
+
+PRIVATE int next_object (void)
+{
+    double r = next_random() * popularity[objects-1];
+    int low = 0;
+    int high = objects - 1;
+    while (low < high) {
+	int mid = (low + high) / 2;
+	if (popularity[mid] < r) low = mid + 1; else high = mid;
+    }
+    return low;
+}
+
+PRIVATE SOCKET local_socket (int * port)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    SOCKET s = socket(AF_INET, SOCK_STREAM, 0);
+    memset((void *) &sin, '\0', sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (s == INVSOC || bind(s, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+	getsockname(s, (struct sockaddr *) &sin, &len) < 0 || listen(s, 16) < 0) {
+	perror("cachebench");
+	exit(1);
+    }
+    *port = ntohs(sin.sin_port);
+    return s;
+}
+
+/*
+**	The server writes the reply as the client takes it as they share the
+**	event loop
+*/
+PRIVATE int http_reply (SOCKET s, void * param, HTEventType type)
+{
+    Reply * me = (Reply *) param;
+    int status = send(s, me->data + me->sent, me->length - me->sent, 0);
+    if (status > 0) me->sent += status;
+    if (me->sent >= me->length || (status < 0 && socerrno != EAGAIN)) {
+	HTEvent * event = HTEventList_lookup(s, HTEvent_WRITE);
+	HTEvent_unregister(s, HTEvent_WRITE);
+	NETCLOSE(s);
+	HTEvent_delete(event);
+	HT_FREE(me->data);
+	HT_FREE(me);
+    }
+    return HT_OK;
+}
+
+PRIVATE int http_request (SOCKET s, void * param, HTEventType type)
+{
+    char buf[1024];
+    HTEvent * event = HTEventList_lookup(s, HTEvent_READ);
+    int len = recv(s, buf, sizeof(buf)-1, 0);
+    int object = -1;
+    HTEvent_unregister(s, HTEvent_READ);
+    HTEvent_delete(event);
+    if (len > 0) {
+	buf[len] = '\0';
+	if (!strncmp(buf, "GET /o", 6)) object = atoi(buf + 6);
+    }
+    if (object >= 0 && object < objects) {
+	long size = object_size(object);
+	time_t now = time(NULL);
+	time_t lm = now - LAST_MODIFIED;
+	Reply * me;
+	char * header = NULL;
+	if ((me = (Reply *) HT_CALLOC(1, sizeof(Reply))) == NULL ||
+	    (header = (char *) HT_MALLOC(256)) == NULL)
+	    HT_OUTOFMEM("cachebench");
+	sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\nDate: %s\r\n",
+		size, HTDateTimeStr(&now, NO));
+	sprintf(header + strlen(header), "Last-Modified: %s\r\n\r\n",
+		HTDateTimeStr(&lm, NO));
+	me->length = strlen(header) + size;
+	if ((me->data = (char *) HT_MALLOC(me->length)) == NULL)
+	    HT_OUTOFMEM("cachebench");
+	strcpy(me->data, header);
+	memset(me->data + strlen(header), 'a' + object % 26, size);
+	HT_FREE(header);
+	fcntl(s, F_SETFL, O_NONBLOCK);
+	HTEvent_register(s, HTEvent_WRITE,
+			 HTEvent_new(http_reply, me, HT_PRIORITY_MAX, -1));
+    } else
+	NETCLOSE(s);
+    return HT_OK;
+}
+
+PRIVATE int http_accept (SOCKET s, void * param, HTEventType type)
+{
+    SOCKET c = accept(s, NULL, NULL);
+    if (c != INVSOC)
+	HTEvent_register(c, HTEvent_READ,
+			 HTEvent_new(http_request, NULL, HT_PRIORITY_MAX, -1));
+    return HT_OK;
+}
+
+PRIVATE BOOL next_request (void)
+{
+    if (issued < requests) {
+	char url[64];
+	HTRequest * request = HTRequest_new();
+	sprintf(url, "http://127.0.0.1:%d/o%d", HttpPort, next_object());
+	HTRequest_setOutputFormat(request, WWW_SOURCE);
+	HTRequest_setContext(request, HTLoadToChunk(url, request));
+	issued++;
+	return YES;
+    }
+    return NO;
+}
+
+PRIVATE int terminate_handler (HTRequest * request, HTResponse * response,
+			       void * param, int status)
+{
+    HTChunk * chunk = (HTChunk *) HTRequest_context(request);
+    if (status != 200 && status != 304) {
+	char * url = HTAnchor_address((HTAnchor *) HTRequest_anchor(request));
+	printf("%s failed with status %d\n", url, status);
+	HT_FREE(url);
+    }
+    HTChunk_delete(chunk);
+    HTRequest_delete(request);
+    if (!next_request()) HTEventList_stopLoop();
+    return HT_OK;
+}
+
+PRIVATE void run (HTCacheEviction policy, unsigned long start, BOOL flush)
+{
+    ms_t t = HTGetTimeInMillis();
+    if (flush) HTCache_flushAll();
+    HTCacheMode_setEviction(policy);
+    HTCacheMode_resetRatios();
+    seed = start;
+    issued = 0;
+    if (next_request()) HTEventList_loop(NULL);
+    printf("%s %-5s  hit ratio %.3f  byte hit ratio %.3f  %lu ms\n",
+	   policy == HT_EVICT_GDSF ? "GDSF" : "SLRU", flush ? "cold" : "warm",
+	   HTCacheMode_hitRatio(), HTCacheMode_byteHitRatio(),
+	   HTGetTimeInMillis() - t);
+}
+
+int main (int argc, char ** argv)
+{
+    const char * cache = DEFAULT_CACHE;
+    int size = DEFAULT_SIZE;
+    double sum = 0.0;
+    int arg;
+    int i;
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc)
+	    objects = atoi(argv[++arg]);
+	else if (!strcmp(argv[arg], "-r") && arg+1 < argc)
+	    requests = atoi(argv[++arg]);
+	else if (!strcmp(argv[arg], "-size") && arg+1 < argc)
+	    size = atoi(argv[++arg]);
+	else if (!strcmp(argv[arg], "-cache") && arg+1 < argc)
+	    cache = argv[++arg];
+	else if (!strcmp(argv[arg], "-v"))
+	    HTSetTraceMessageMask("c");
+	else {
+	    fprintf(stderr, "Usage: %s [-n objects] [-r requests] [-size megabytes] [-cache directory] [-v]\n", argv[0]);
+	    return -1;
+	}
+    }
+    if (objects < 1) objects = DEFAULT_OBJECTS;
+    if ((popularity = (double *) HT_MALLOC(objects * sizeof(double))) == NULL)
+	HT_OUTOFMEM("cachebench");
+    for (i = 0; i < objects; i++) {
+	sum += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+	popularity[i] = sum;
+    }
+
+    HTProfile_newNoCacheClient("cachebench", "1.0");
+    HTAlert_setInteractive(NO);
+    HTNet_addAfter(terminate_handler, NULL, NULL, HT_ALL, HT_FILTER_LAST);
+    Listener = local_socket(&HttpPort);
+    HTEvent_register(Listener, HTEvent_READ,
+		     HTEvent_new(http_accept, NULL, HT_PRIORITY_MAX, -1));
+    HTCacheInit(cache, size);
+
+    /*
+    **  Each policy first runs from an empty cache and then once more with
+    **  other requests on top of what the first run left. The cache is
+    **  closed in between so that the second run starts from the index.
+    */
+    for (i = 0; i < 2; i++) {
+	HTCacheEviction policy = i ? HT_EVICT_SLRU : HT_EVICT_GDSF;
+	run(policy, 1, YES);
+	HTCacheTerminate();
+	HTCacheInit(cache, size);
+	run(policy, 2, NO);
+    }
+    HTCache_flushAll();
+    HTProfile_delete();
+    HT_FREE(popularity);
+    return 0;
+}
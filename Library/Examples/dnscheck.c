@@ -0,0 +1,223 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Checks that the asynchronous resolver only believes its name server.
+**	The program is its own name server on a local UDP port and before
+**	each real answer it sends two forged ones: one with the right id from
+**	another port and one from the name server port with the wrong id. The
+**	forged answers point at 127.0.0.2 where nobody listens whereas the
+**	real ones point at a tiny HTTP server on 127.0.0.1 which is also run
+**	by the program, so a load only works if the forged answers were
+**	ignored. It also counts the different query ids and source ports.
+**
+**		dnscheck [-n count] [-v]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTTP.h"
+
+#define MAX_QUERIES		256
+#define REAL_ADDRESS		"127.0.0.1"
+#define FORGED_ADDRESS		"127.0.0.2"
+
+#define HTTP_REPLY \
+	"HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 3\r\n\r\nok\n"
+
+PRIVATE SOCKET NameServer = INVSOC;
+PRIVATE SOCKET Forger = INVSOC;
+PRIVATE SOCKET Listener = INVSOC;
+PRIVATE int HttpPort = 0;
+
+PRIVATE unsigned short Ids[2*MAX_QUERIES];
+PRIVATE int NIds = 0;
+PRIVATE unsigned short Ports[MAX_QUERIES];
+PRIVATE int NPorts = 0;
+
+PRIVATE int loading = 0;
+PRIVATE int loaded = 0;
+
+PRIVATE void remember (unsigned short * set, int * cnt, int max, unsigned short value)
+{
+    int i;
+    for (i = 0; i < *cnt; i++) if (set[i] == value) return;
+    if (*cnt < max) set[(*cnt)++] = value;
+}
+
+PRIVATE SOCKET local_socket (int type, int * port)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    SOCKET s = socket(AF_INET, type, 0);
+    memset((void *) &sin, '\0', sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = inet_addr(REAL_ADDRESS);
+    if (s == INVSOC || bind(s, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+	getsockname(s, (struct sockaddr *) &sin, &len) < 0) {
+	perror("dnscheck");
+	exit(1);
+    }
+    if (port) *port = ntohs(sin.sin_port);
+    return s;
+}
+
+/*
+**	Turn the query into an answer with a single A record. The question
+**	is left as it is and the record points back at it.
+*/
+PRIVATE int make_answer (unsigned char * buf, int len, unsigned short id,
+			 const char * address)
+{
+    unsigned long addr = inet_addr(address);
+    unsigned char * ptr = buf + len;
+    buf[0] = (unsigned char) (id >> 8);
+    buf[1] = (unsigned char) (id & 0xFF);
+    buf[2] = 0x81;					/* QR and RD */
+    buf[3] = 0x80;						 /* RA */
+    buf[7] = 1;						  /* One answer */
+    *ptr++ = 0xC0; *ptr++ = 12;				/* The question */
+    *ptr++ = 0; *ptr++ = 1;					  /* A */
+    *ptr++ = 0; *ptr++ = 1;					 /* IN */
+    *ptr++ = 0; *ptr++ = 0; *ptr++ = 0; *ptr++ = 60;		 /* TTL */
+    *ptr++ = 0; *ptr++ = 4;
+    memcpy(ptr, (void *) &addr, 4);
+    return ptr + 4 - buf;
+}
+
+PRIVATE int name_server (SOCKET s, void * param, HTEventType type)
+{
+    unsigned char query[512];
+    unsigned char answer[600];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    unsigned short id;
+    int pos = 12;
+    int len = recvfrom(s, (char *) query, sizeof(query), 0,
+		       (struct sockaddr *) &from, &fromlen);
+    if (len <= 12) return HT_OK;
+    while (pos < len && query[pos]) pos += query[pos] + 1;
+    if (pos + 5 > len) return HT_OK;
+    len = pos + 5;
+    id = (query[0] << 8) | query[1];
+    remember(Ids, &NIds, 2*MAX_QUERIES, id);
+    remember(Ports, &NPorts, MAX_QUERIES, ntohs(from.sin_port));
+    memcpy(answer, query, len);
+    if (query[pos+2] == 1) {
+	int alen = make_answer(answer, len, id, FORGED_ADDRESS);
+	sendto(Forger, (char *) answer, alen, 0, (struct sockaddr *) &from, fromlen);
+	alen = make_answer(answer, len, (unsigned short) (id + 1), FORGED_ADDRESS);
+	sendto(NameServer, (char *) answer, alen, 0, (struct sockaddr *) &from, fromlen);
+	alen = make_answer(answer, len, id, REAL_ADDRESS);
+	sendto(NameServer, (char *) answer, alen, 0, (struct sockaddr *) &from, fromlen);
+    } else {
+	answer[2] = 0x81;					 /* No data */
+	answer[3] = 0x80;
+	sendto(NameServer, (char *) answer, len, 0, (struct sockaddr *) &from, fromlen);
+    }
+    return HT_OK;
+}
+
+/*
+**	The HTTP server reads the request before answering so that closing
+**	the connection doesn't reset it
+*/
+PRIVATE int http_request (SOCKET s, void * param, HTEventType type)
+{
+    char buf[1024];
+    HTEvent * event = HTEventList_lookup(s, HTEvent_READ);
+    if (recv(s, buf, sizeof(buf), 0) > 0)
+	send(s, HTTP_REPLY, strlen(HTTP_REPLY), 0);
+    HTEvent_unregister(s, HTEvent_READ);
+    NETCLOSE(s);
+    HTEvent_delete(event);
+    return HT_OK;
+}
+
+PRIVATE int http_accept (SOCKET s, void * param, HTEventType type)
+{
+    SOCKET c = accept(s, NULL, NULL);
+    if (c != INVSOC)
+	HTEvent_register(c, HTEvent_READ,
+			 HTEvent_new(http_request, NULL, HT_PRIORITY_MAX, -1));
+    return HT_OK;
+}
+
+PRIVATE int terminate_handler (HTRequest * request, HTResponse * response,
+			       void * param, int status)
+{
+    HTChunk * chunk = (HTChunk *) HTRequest_context(request);
+    if (status == 200 && chunk && !strcmp(HTChunk_data(chunk), "ok\n"))
+	loaded++;
+    else {
+	char * url = HTAnchor_address((HTAnchor *) HTRequest_anchor(request));
+	printf("%s failed with status %d\n", url, status);
+	HT_FREE(url);
+    }
+    HTChunk_delete(chunk);
+    HTRequest_delete(request);
+    if (--loading <= 0) HTEventList_stopLoop();
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    int count = 20;
+    int port;
+    int arg;
+    int i;
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc)
+	    count = atoi(argv[++arg]);
+	else if (!strcmp(argv[arg], "-v"))
+	    HTSetTraceMessageMask("pt");
+	else {
+	    fprintf(stderr, "Usage: %s [-n count] [-v]\n", argv[0]);
+	    return -1;
+	}
+    }
+    if (count < 1 || count > MAX_QUERIES) count = MAX_QUERIES;
+    HTProfile_newNoCacheClient("dnscheck", "1.0");
+    HTAlert_setInteractive(NO);
+    HTNet_addAfter(terminate_handler, NULL, NULL, HT_ALL, HT_FILTER_LAST);
+
+    /* Our name server, the forger and the HTTP server */
+    NameServer = local_socket(SOCK_DGRAM, &port);
+    Forger = local_socket(SOCK_DGRAM, NULL);
+    Listener = local_socket(SOCK_STREAM, &HttpPort);
+    listen(Listener, 16);
+    HTEvent_register(NameServer, HTEvent_READ,
+		     HTEvent_new(name_server, NULL, HT_PRIORITY_MAX, -1));
+    HTEvent_register(Listener, HTEvent_READ,
+		     HTEvent_new(http_accept, NULL, HT_PRIORITY_MAX, -1));
+
+    HTResolver_setAsync(YES);
+    HTResolver_setHostsFile("/dev/null");
+    HTResolver_addServer(REAL_ADDRESS, port);
+    HTResolver_setTimeout(2000);
+
+    for (i = 0; i < count; i++) {
+	char url[128];
+	HTRequest * request = HTRequest_new();
+	sprintf(url, "http://host%d.dnscheck.test:%d/", i, HttpPort);
+	HTRequest_setOutputFormat(request, WWW_SOURCE);
+	HTRequest_setContext(request, HTLoadToChunk(url, request));
+	loading++;
+    }
+    HTEventList_loop(NULL);
+    printf("loaded %d of %d, %d different ids in %d queries, %d different ports\n",
+	   loaded, count, NIds, 2*count, NPorts);
+    HTProfile_delete();
+    return loaded == count ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Loads all the URLs given on the command line at the same time over
+**	HTTP/2 with prior knowledge and prints the status, the size and a
+**	checksum of each body so that they can be compared with the files on
+**	the server. With -pause the body stream pauses every few blocks and
+**	is resumed from a timer, which checks that the transport keeps what
+**	the stream doesn't take and only opens the flow control windows as
+**	the data is used. Run it against a cleartext HTTP/2 server, for
+**	example
+**
+**		nghttpd --no-tls -d <directory> 8080
+**		h2check [-pause] http://localhost:8080/file ...
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTTP.h"
+
+#define PAUSE_EVERY		8		  /* Blocks between pauses */
+#define PAUSE_TIME		20			     /* In millis */
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    HTRequest *			request;
+    long			size;
+    unsigned long		sum;
+    int				blocks;
+    BOOL			paused;
+    HTTimer *			timer;
+};
+
+PRIVATE int loading = 0;
+PRIVATE BOOL pausing = NO;
+
+PRIVATE int resume (HTTimer * timer, void * param, HTEventType type)
+{
+    HTStream * me = (HTStream *) param;
+    HTNet * net = HTRequest_net(me->request);
+    HTTimer_delete(timer);
+    me->timer = NULL;
+    if (net) HTNet_execute(net, HTEvent_READ);
+    return HT_OK;
+}
+
+/*
+**	FNV-1a which is good enough to tell whether two bodies are the same
+*/
+PRIVATE int check_put_block (HTStream * me, const char * b, int l)
+{
+    if (pausing && !me->paused && ++me->blocks % PAUSE_EVERY == 0) {
+	me->paused = YES;
+	me->timer = HTTimer_new(NULL, resume, me, PAUSE_TIME, YES, NO);
+	return HT_PAUSE;
+    }
+    me->paused = NO;
+    me->size += l;
+    while (l-- > 0) me->sum = (me->sum ^ (unsigned char) *b++) * 16777619UL;
+    me->sum &= 0xFFFFFFFFUL;
+    return HT_OK;
+}
+
+PRIVATE int check_put_character (HTStream * me, char c)
+{
+    return check_put_block(me, &c, 1);
+}
+
+PRIVATE int check_put_string (HTStream * me, const char * s)
+{
+    return check_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE int check_flush (HTStream * me)
+{
+    return HT_OK;
+}
+
+PRIVATE int check_free (HTStream * me)
+{
+    char * url = HTAnchor_address((HTAnchor *) HTRequest_anchor(me->request));
+    printf("%s %ld %08lx\n", url, me->size, me->sum);
+    HT_FREE(url);
+    if (me->timer) HTTimer_delete(me->timer);
+    HT_FREE(me);
+    return HT_OK;
+}
+
+PRIVATE int check_abort (HTStream * me, HTList * e)
+{
+    if (me->timer) HTTimer_delete(me->timer);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+PRIVATE const HTStreamClass CheckClass =
+{
+    "H2Check",
+    check_flush,
+    check_free,
+    check_abort,
+    check_put_character,
+    check_put_string,
+    check_put_block
+};
+
+PRIVATE int terminate_handler (HTRequest * request, HTResponse * response,
+			       void * param, int status)
+{
+    char * url = HTAnchor_address((HTAnchor *) HTRequest_anchor(request));
+    printf("%s status %d\n", url, status);
+    HT_FREE(url);
+    HTRequest_delete(request);
+    if (--loading <= 0) HTEventList_stopLoop();
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    int arg;
+    HTProfile_newNoCacheClient("h2check", "1.0");
+    HTTP_setConnectionMode(HTTP_20_PRIOR_KNOWLEDGE);
+    HTAlert_setInteractive(NO);
+    HTNet_addAfter(terminate_handler, NULL, NULL, HT_ALL, HT_FILTER_LAST);
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-pause")) {
+	    pausing = YES;
+	} else if (!strcmp(argv[arg], "-v")) {
+	    HTSetTraceMessageMask("pt");
+	} else {
+	    HTRequest * request = HTRequest_new();
+	    HTStream * me;
+	    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+		HT_OUTOFMEM("h2check");
+	    me->isa = &CheckClass;
+	    me->request = request;
+	    me->sum = 2166136261UL;
+	    HTRequest_setOutputFormat(request, WWW_SOURCE);
+	    HTRequest_setOutputStream(request, me);
+	    if (HTLoadAbsolute(argv[arg], request) == YES) loading++;
+	}
+    }
+    if (!loading) {
+	fprintf(stderr, "Usage: %s [-pause] [-v] url ...\n", argv[0]);
+	return -1;
+    }
+    HTEventList_loop(NULL);
+    HTProfile_delete();
+    return 0;
+}
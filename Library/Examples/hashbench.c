@@ -0,0 +1,110 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Inserts URL like keys into a hash table and looks them up again,
+**	both keys that are there and keys that aren't. This is what the
+**	anchor, host and cache registries do. Reports the time spent in each
+**	phase for each table size given on the command line (default 10000,
+**	1000000 and 10000000 keys).
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+
+#define KEY_LENGTH		64
+
+PRIVATE char * make_keys (int count)
+{
+    char * keys;
+    int cnt;
+    if ((keys = (char *) HT_MALLOC(count * KEY_LENGTH)) == NULL)
+	HT_OUTOFMEM("make_keys");
+    for (cnt = 0; cnt < count; cnt++)
+	sprintf(keys + cnt * KEY_LENGTH, "http://www%d.example.org/dir/%d.html",
+		cnt % 997, cnt);
+    return keys;
+}
+
+PRIVATE void run (int count)
+{
+    char * keys = make_keys(count);
+    char miss[KEY_LENGTH];
+    HTHashtable * table;
+    ms_t start;
+    int cnt, found;
+
+    fprintf(stderr, "%d keys\n", count);
+
+    /* Insert all the keys. Start small so that we also measure growing */
+    start = HTGetTimeInMillis();
+    table = HTHashtable_newWithFlags(0, HT_HASH_KEYREF);
+    for (cnt = 0; cnt < count; cnt++)
+	HTHashtable_addObject(table, keys + cnt * KEY_LENGTH,
+			      keys + cnt * KEY_LENGTH);
+    fprintf(stderr, "  Inserted  %d keys in %lu ms\n",
+	    count, HTGetTimeInMillis() - start);
+
+    /* Look them up in random order */
+    start = HTGetTimeInMillis();
+    for (cnt = 0, found = 0; cnt < count; cnt++) {
+	char * key = keys + (rand() % count) * KEY_LENGTH;
+	if (HTHashtable_object(table, key) == key) found++;
+    }
+    fprintf(stderr, "  Found     %d of %d keys in %lu ms\n",
+	    found, count, HTGetTimeInMillis() - start);
+
+    /* Look up keys that aren't there */
+    start = HTGetTimeInMillis();
+    for (cnt = 0, found = 0; cnt < count; cnt++) {
+	sprintf(miss, "http://www%d.example.org/dir/%d.htm", cnt % 997, cnt);
+	if (HTHashtable_object(table, miss)) found++;
+    }
+    fprintf(stderr, "  Missed    %d keys (%d found) in %lu ms\n",
+	    count, found, HTGetTimeInMillis() - start);
+
+    /* Remove every other key */
+    start = HTGetTimeInMillis();
+    for (cnt = 0; cnt < count; cnt += 2)
+	HTHashtable_removeObject(table, keys + cnt * KEY_LENGTH);
+    fprintf(stderr, "  Removed   %d keys in %lu ms, %d left\n",
+	    (count+1) / 2, HTGetTimeInMillis() - start,
+	    HTHashtable_count(table));
+
+    HTHashtable_delete(table);
+    HT_FREE(keys);
+}
+
+int main (int argc, char ** argv)
+{
+    HTLibInit("hashbench", "1.0");
+    srand(1);
+    if (argc > 1) {
+	int arg;
+	for (arg = 1; arg < argc; arg++) {
+	    int count = atoi(argv[arg]);
+	    if (count <= 0) {
+		fprintf(stderr, "Usage: %s [number of keys]...\n", argv[0]);
+		return -1;
+	    }
+	    run(count);
+	}
+    } else {
+	run(10000);
+	run(1000000);
+	run(10000000);
+    }
+    HTLibTerminate();
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Finds the links in the same HTML documents again and again, first
+**	through the HTML parser and the HText callbacks the way a browser or
+**	the robot used to do and then with the link extractor which the robot
+**	uses now, and reports the time per byte for both. Each document gets
+**	a new address every time so the anchors are created as in a crawl.
+**	The documents are the files given on the command line, or a page
+**	with text, links and images that the program makes up. Unless a
+**	count is given each document is parsed until about 16M bytes have
+**	gone through each path.
+**
+**		linkbench [-n count] [file ...]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTML.h"
+
+#define DEFAULT_BYTES		(16*1024*1024)
+#define MAX_LENGTH		(4*1024*1024)
+#define PAGE_LINKS		400
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+};
+
+struct _HText {
+    int				dummy;
+};
+
+PRIVATE long links = 0;
+
+PRIVATE HText * text_new (HTRequest * request, HTParentAnchor * anchor,
+			  HTStream * output)
+{
+    static HText text;
+    return &text;
+}
+
+PRIVATE BOOL text_delete (HText * me)
+{
+    return YES;
+}
+
+PRIVATE void text_link (HText * text, int element_number,
+			int attribute_number, HTChildAnchor * anchor,
+			const BOOL * present, const char ** value)
+{
+    links++;
+}
+
+PRIVATE void found_links (HTRequest * request, HTFoundLink * found, int count)
+{
+    links += count;
+}
+
+/*
+**	A page of running text with a link or an image now and then
+*/
+PRIVATE HTChunk * make_page (void)
+{
+    HTChunk * page = HTChunk_new(0x10000);
+    char buf[256];
+    int i;
+    HTChunk_puts(page, "<HTML><HEAD><TITLE>A made up page</TITLE>\n"
+		 "<META NAME=\"robots\" CONTENT=\"index, follow\"></HEAD>\n<BODY>\n");
+    for (i = 0; i < PAGE_LINKS; i++) {
+	HTChunk_puts(page, "<P>Some text which goes on for a while like text "
+		     "does, with <B>bold</B> words &amp; an entity or two.\n");
+	if (i % 4)
+	    sprintf(buf, "See <A HREF=\"/dir%d/page%d.html\" TITLE=\"page %d\">"
+		    "page %d</A> for more.\n", i % 17, i, i, i);
+	else
+	    sprintf(buf, "<IMG SRC=\"/images/img%d.gif\" ALT=\"image %d\" "
+		    "WIDTH=32 HEIGHT=32>\n", i, i);
+	HTChunk_puts(page, buf);
+    }
+    HTChunk_puts(page, "</BODY></HTML>\n");
+    return page;
+}
+
+/*
+**	Parse the document count times with the given converter and return
+**	the time in millis
+*/
+PRIVATE ms_t run (HTConverter * converter, HTChunk * document, int count)
+{
+    static int documents = 0;
+    ms_t t = HTGetTimeInMillis();
+    int i;
+    for (i = 0; i < count; i++) {
+	HTRequest * request = HTRequest_new();
+	HTParentAnchor * anchor;
+	HTStream * stream;
+	char url[64];
+	sprintf(url, "http://www.example.org/doc%d/index.html", documents++);
+	anchor = HTAnchor_parent(HTAnchor_findAddress(url));
+	HTRequest_setAnchor(request, (HTAnchor *) anchor);
+	stream = (*converter)(request, NULL, WWW_HTML, WWW_PRESENT, HTBlackHole());
+	(*stream->isa->put_block)(stream, HTChunk_data(document),
+				  HTChunk_size(document));
+	(*stream->isa->_free)(stream);
+	HTRequest_delete(request);
+    }
+    t = HTGetTimeInMillis() - t;
+    HTAnchor_deleteAll(NULL);
+    return t;
+}
+
+PRIVATE void bench (const char * name, HTChunk * document, int count)
+{
+    double bytes;
+    long found;
+    ms_t t;
+    if (!count) count = DEFAULT_BYTES / (HTChunk_size(document) + 1) + 1;
+    bytes = (double) HTChunk_size(document) * count;
+    printf("%s: %d bytes, %d times\n", name, HTChunk_size(document), count);
+
+    links = 0;
+    t = run(HTMLPresent, document, count);
+    found = links;
+    printf("  HTML and HText  %8ld links  %6.1f ns per byte\n",
+	   found / count, t * 1000000.0 / bytes);
+
+    links = 0;
+    t = run(HTMLToLinks, document, count);
+    printf("  Link extractor  %8ld links  %6.1f ns per byte\n",
+	   links / count, t * 1000000.0 / bytes);
+}
+
+int main (int argc, char ** argv)
+{
+    int count = 0;
+    BOOL files = NO;
+    int arg;
+
+    HTLibInit("linkbench", "1.0");
+    HText_registerCDCallback(text_new, text_delete);
+    HText_registerLinkCallback(text_link);
+    HTMLinks_setCallback(found_links);
+
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    count = atoi(argv[++arg]);
+	    if (count < 0) count = 0;
+	} else if (*argv[arg] == '-') {
+	    fprintf(stderr, "Usage: %s [-n count] [file ...]\n", argv[0]);
+	    return -1;
+	} else {
+	    FILE * fp = fopen(argv[arg], "rb");
+	    HTChunk * document;
+	    char data[4096];
+	    int len;
+	    if (!fp) {
+		perror(argv[arg]);
+		continue;
+	    }
+	    document = HTChunk_new(4096);
+	    while ((len = fread(data, 1, sizeof(data), fp)) > 0 &&
+		   HTChunk_size(document) < MAX_LENGTH)
+		HTChunk_putb(document, data, len);
+	    fclose(fp);
+	    bench(argv[arg], document, count);
+	    HTChunk_delete(document);
+	    files = YES;
+	}
+    }
+    if (!files) {
+	HTChunk * page = make_page();
+	bench("made up page", page, count);
+	HTChunk_delete(page);
+    }
+    HTLibTerminate();
+    return 0;
+}
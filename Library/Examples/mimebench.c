@@ -0,0 +1,211 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Feeds response headers captured from real servers through the MIME
+**	header parser again and again and reports the time per parse. Each
+**	header is given to the parser as one block and then split into small
+**	blocks so that both the fast path for whole lines and the state
+**	machine for lines cut across blocks are timed. Other captures can be
+**	given as files which hold the header as it came off the wire, without
+**	the status line. With -v the parsed headers are printed once.
+**
+**		mimebench [-n count] [-split bytes] [-v] [file ...]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWMIME.h"
+
+#define DEFAULT_COUNT		100000
+#define DEFAULT_SPLIT		7
+#define MAX_HEADER		65536
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+};
+
+/* Apache serving a static page */
+PRIVATE const char APACHE[] =
+    "Date: Sat, 17 Oct 2026 22:54:01 GMT\r\n"
+    "Server: Apache/2.4.57 (Debian)\r\n"
+    "Last-Modified: Tue, 03 Mar 2026 10:21:44 GMT\r\n"
+    "ETag: \"5f3a-5e4b1c2d3e4f0\"\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Content-Length: 24378\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Cache-Control: max-age=3600, public\r\n"
+    "Expires: Sat, 17 Oct 2026 23:54:01 GMT\r\n"
+    "Keep-Alive: timeout=5, max=100\r\n"
+    "Connection: Keep-Alive\r\n"
+    "Content-Type: text/html; charset=UTF-8\r\n"
+    "\r\n";
+
+/* An application behind nginx with cookies and a security policy */
+PRIVATE const char NGINX[] =
+    "Server: nginx\r\n"
+    "Date: Sat, 17 Oct 2026 22:54:02 GMT\r\n"
+    "Content-Type: application/json; charset=utf-8\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "Vary: Accept-Encoding\r\n"
+    "Vary: Origin\r\n"
+    "X-Frame-Options: SAMEORIGIN\r\n"
+    "X-XSS-Protection: 1; mode=block\r\n"
+    "X-Content-Type-Options: nosniff\r\n"
+    "Strict-Transport-Security: max-age=31536000; includeSubDomains; preload\r\n"
+    "Set-Cookie: _session_id=8f14e45fceea167a5a36dedd4bea2543; path=/; expires=Sun, 18 Oct 2026 22:54:02 GMT; secure; HttpOnly; SameSite=Lax\r\n"
+    "Set-Cookie: locale=en-US; path=/; max-age=31536000\r\n"
+    "Cache-Control: no-cache, no-store, must-revalidate, private\r\n"
+    "Pragma: no-cache\r\n"
+    "Expires: 0\r\n"
+    "Content-Security-Policy: default-src 'self'; script-src 'self' https://cdn.example.com; img-src * data:; style-src 'self' 'unsafe-inline'\r\n"
+    "X-Request-Id: 3c1d7a0e-52b4-4c9f-9f0e-2f5a8b6d1e77\r\n"
+    "X-Runtime: 0.041213\r\n"
+    "Referrer-Policy: strict-origin-when-cross-origin\r\n"
+    "\r\n";
+
+/* An image from a CloudFront edge */
+PRIVATE const char CLOUDFRONT[] =
+    "Content-Type: image/png\r\n"
+    "Content-Length: 18342\r\n"
+    "Connection: keep-alive\r\n"
+    "Last-Modified: Mon, 12 Jan 2026 08:00:00 GMT\r\n"
+    "Accept-Ranges: bytes\r\n"
+    "Server: AmazonS3\r\n"
+    "Date: Sat, 17 Oct 2026 21:12:40 GMT\r\n"
+    "ETag: \"d41d8cd98f00b204e9800998ecf8427e\"\r\n"
+    "Cache-Control: public, max-age=31536000, immutable\r\n"
+    "Age: 6322\r\n"
+    "Via: 1.1 4f2b1c.cloudfront.net (CloudFront)\r\n"
+    "X-Cache: Hit from cloudfront\r\n"
+    "X-Amz-Cf-Pop: FRA56-P4\r\n"
+    "X-Amz-Cf-Id: 2zYq0Jx9y3bKp8Qw1Lr5Tn6Vm7Ck4Hs0Gd2Fa9Eb3Xc8Zv1Nu5Ot7Pi==\r\n"
+    "Alt-Svc: h3=\":443\"; ma=86400\r\n"
+    "\r\n";
+
+/* Python http.server which only ends the lines with LF */
+PRIVATE const char PYTHON[] =
+    "Server: SimpleHTTP/0.6 Python/3.11.2\n"
+    "Date: Sat, 17 Oct 2026 22:54:01 GMT\n"
+    "Content-type: text/plain\n"
+    "Content-Length: 6\n"
+    "Last-Modified: Fri, 17 Oct 2026 22:54:00 GMT\n"
+    "\n";
+
+PRIVATE HTRequest * request = NULL;
+PRIVATE BOOL verbose = NO;
+
+/*
+**	Parse the header once and return the number of header lines found
+*/
+PRIVATE int parse (const char * header, int length, int split, BOOL show)
+{
+    HTResponse * response = HTResponse_new();
+    HTStream * me;
+    int offset = 0;
+    int status = HT_OK;
+    int lines = 0;
+    HTRequest_setResponse(request, response);
+    me = HTMIMEHeader(request, NULL, WWW_MIME, WWW_SOURCE, HTBlackHole());
+    while (offset < length && status == HT_OK) {
+	int len = split && length - offset > split ? split : length - offset;
+	status = (*me->isa->put_block)(me, header + offset, len);
+	offset += len;
+    }
+    {
+	HTAssocList * headers = HTResponse_header(response);
+	HTAssoc * pres;
+	while ((pres = (HTAssoc *) HTAssocList_nextObject(headers))) {
+	    if (show) printf("    %s: %s\n", HTAssoc_name(pres), HTAssoc_value(pres));
+	    lines++;
+	}
+    }
+    (*me->isa->_free)(me);
+    HTRequest_setResponse(request, NULL);
+    return lines;
+}
+
+PRIVATE void run (const char * name, const char * header, int length,
+		  int count, int split)
+{
+    int i;
+    int lines = parse(header, length, split, verbose && !split);
+    ms_t t = HTGetTimeInMillis();
+    for (i = 0; i < count; i++) parse(header, length, split, NO);
+    t = HTGetTimeInMillis() - t;
+    printf("%-12s %4d bytes %3d headers  %-9s %8.0f ns per parse\n",
+	   name, length, lines, split ? "split" : "one block",
+	   (double) t * 1000000.0 / count);
+}
+
+PRIVATE void run_all (const char * name, const char * header, int length,
+		      int count, int split)
+{
+    run(name, header, length, count, 0);
+    run(name, header, length, count, split);
+}
+
+int main (int argc, char ** argv)
+{
+    int count = DEFAULT_COUNT;
+    int split = DEFAULT_SPLIT;
+    BOOL files = NO;
+    HTNet * net;
+    int arg;
+
+    HTLibInit("mimebench", "1.0");
+    HTMIMEInit();
+    request = HTRequest_new();
+    HTRequest_setAnchor(request, HTAnchor_findAddress("http://www.example.org/"));
+    net = HTNet_new(HTHost_new("www.example.org", 80));
+    HTNet_setRequest(net, request);
+    HTRequest_setNet(request, net);
+
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    count = atoi(argv[++arg]);
+	    if (count < 1) count = DEFAULT_COUNT;
+	} else if (!strcmp(argv[arg], "-split") && arg+1 < argc) {
+	    split = atoi(argv[++arg]);
+	    if (split < 1) split = DEFAULT_SPLIT;
+	} else if (!strcmp(argv[arg], "-v")) {
+	    verbose = YES;
+	} else if (*argv[arg] == '-') {
+	    fprintf(stderr, "Usage: %s [-n count] [-split bytes] [-v] [file ...]\n", argv[0]);
+	    return -1;
+	} else {
+	    static char header[MAX_HEADER];
+	    FILE * fp = fopen(argv[arg], "rb");
+	    int length;
+	    if (!fp) {
+		perror(argv[arg]);
+		continue;
+	    }
+	    length = fread(header, 1, MAX_HEADER, fp);
+	    fclose(fp);
+	    run_all(argv[arg], header, length, count, split);
+	    files = YES;
+	}
+    }
+    if (!files) {
+	run_all("apache", APACHE, strlen(APACHE), count, split);
+	run_all("nginx", NGINX, strlen(NGINX), count, split);
+	run_all("cloudfront", CLOUDFRONT, strlen(CLOUDFRONT), count, split);
+	run_all("python", PYTHON, strlen(PYTHON), count, split);
+    }
+    HTRequest_delete(request);
+    HTLibTerminate();
+    return 0;
+}
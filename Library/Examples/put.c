@@ -48,6 +48,7 @@ int main (int argc, char ** argv)
     HTAnchor * dst = NULL;
     char * src_str = NULL;
     char * dst_str = NULL;
+    char * file = NULL;
     BOOL status = NO;
 
     /* Create a new premptive client */
@@ -92,8 +93,13 @@ int main (int argc, char ** argv)
 	src = HTAnchor_findAddress(full_src_str);
 	dst = HTAnchor_findAddress(dst_str);
 
-	/* PUT the source to the dest */
-	status = HTPutDocumentAnchor(HTAnchor_parent(src), dst, request);
+	/* PUT the source to the dest. Local files are sent from disk */
+	if (!strncmp(full_src_str, "file:", 5) &&
+	    (file = HTWWWToLocal(full_src_str, "", NULL)) != NULL) {
+	    status = HTPutFileAnchor(file, dst, request);
+	    HT_FREE(file);
+	} else
+	    status = HTPutDocumentAnchor(HTAnchor_parent(src), dst, request);
 
 	/* We don't need these anymore */
 	HT_FREE(cwd);
@@ -0,0 +1,331 @@
+/*
+**	@(#) $Id$
+**
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Differential fuzzing of the SGML parser. Each input is parsed twice
+**	with the HTML DTD, once with fast scanning turned off so that the
+**	parser looks at one character at a time and searches the DTD as it
+**	always did, and once with fast scanning on. Both parsers get the
+**	input in the same randomly sized blocks and every call they make to
+**	the structured stream is logged. The logs must be the same. The
+**	inputs are the files given on the command line, or a built in page,
+**	and randomly mutated copies of them. An input which gives different
+**	logs is saved as sgmlfuzz-<round>.html.
+**
+**		sgmlfuzz [-n rounds] [-seed seed] [-v] [file ...]
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+#include "WWWHTML.h"
+
+#define DEFAULT_ROUNDS		5000
+#define MAX_LENGTH		(1024*1024)
+
+/*
+**	Characters that the mutations put into the input. Most of them mean
+**	something to the parser.
+*/
+#define SPECIALS		"<>&#;/!-='\"\n\r\t ab1Z?"
+
+PRIVATE const char PAGE[] =
+    "<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\">\n"
+    "<HTML><HEAD><TITLE>Fuzz &amp; friends</TITLE>\n"
+    "<META http-equiv=\"Content-Type\" content=\"text/html; charset=iso-8859-1\">\n"
+    "<LINK rel=stylesheet href='style.css'>\n"
+    "</HEAD>\n"
+    "<BODY bgcolor=white text=\"#000000\">\n"
+    "<!-- a comment -- with -- dashes -->\n"
+    "<H1 align=center>Heading &lt;one&gt;</H1>\n"
+    "<P>Some plain text that goes on for a while without any markup in it\n"
+    "so that the parser can skip it, then an <A HREF=\"a.html#x\" NAME=x>anchor</A>\n"
+    "and an <IMG SRC=img.png ALT=\"An image\" WIDTH=10 HEIGHT=20 ISMAP>.\n"
+    "<UL><LI>One<LI>Two &#169; &#xA9; &copy &nbsp;<LI>Three</UL>\n"
+    "<TABLE border=1><TR><TD>cell<TD colspan=2>cell</TABLE>\n"
+    "<FORM action=\"/cgi-bin/x\" method=post><INPUT type=text name=q value=\"a b\">\n"
+    "<SELECT name=s><OPTION selected>x<OPTION>y</SELECT></FORM>\n"
+    "<PRE>\n  preformatted\ttext &amp; more\n</PRE>\n"
+    "<XMP><B>not a tag</B></XMP>\n"
+    "<UNKNOWN foo=bar>unknown</UNKNOWN><a href=\"x\"\nname=\"y\">lower</a>\n"
+    "<P><b>bold<i>both</b>italic</i> <BR/> <HR size=2 noshade>\n"
+    "</BODY></HTML>\n";
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+};
+
+struct _HTStructured {
+    const HTStructuredClass *	isa;
+    HTChunk *			log;
+};
+
+PRIVATE SGML_dtd * dtd = NULL;
+PRIVATE unsigned long seed = 1;
+
+PRIVATE unsigned long next_random (void)
+{
+    seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+    return seed >> 8;
+}
+
+/*
+**	The structured stream that logs everything
+*/
+PRIVATE void log_data (HTStructured * me, char type, const char * s, int l)
+{
+    char buf[16];
+    sprintf(buf, "%c%d:", type, l);
+    HTChunk_puts(me->log, buf);
+    HTChunk_putb(me->log, s, l);
+    HTChunk_putc(me->log, '\n');
+}
+
+PRIVATE int log_flush (HTStructured * me)
+{
+    return HT_OK;
+}
+
+PRIVATE int log_free (HTStructured * me)
+{
+    return HT_OK;
+}
+
+PRIVATE int log_abort (HTStructured * me, HTList * e)
+{
+    return HT_ERROR;
+}
+
+PRIVATE int log_put_character (HTStructured * me, char c)
+{
+    log_data(me, 'c', &c, 1);
+    return HT_OK;
+}
+
+PRIVATE int log_put_string (HTStructured * me, const char * s)
+{
+    log_data(me, 's', s, (int) strlen(s));
+    return HT_OK;
+}
+
+PRIVATE int log_put_block (HTStructured * me, const char * b, int l)
+{
+    log_data(me, 'b', b, l);
+    return HT_OK;
+}
+
+PRIVATE void log_start_element (HTStructured * me, int element,
+				const BOOL * present, const char ** value)
+{
+    HTTag * tag = SGML_findTag(dtd, element);
+    int i;
+    log_data(me, '<', tag->name, (int) strlen(tag->name));
+    for (i = 0; i < tag->number_of_attributes; i++) {
+	if (present[i]) {
+	    const char * name = tag->attributes[i].name;
+	    log_data(me, 'a', name, (int) strlen(name));
+	    if (value[i])
+		log_data(me, 'v', value[i], (int) strlen(value[i]));
+	}
+    }
+}
+
+PRIVATE void log_end_element (HTStructured * me, int element)
+{
+    HTTag * tag = SGML_findTag(dtd, element);
+    log_data(me, '>', tag->name, (int) strlen(tag->name));
+}
+
+PRIVATE void log_put_entity (HTStructured * me, int entity)
+{
+    char buf[16];
+    sprintf(buf, "%d", entity);
+    log_data(me, '&', buf, (int) strlen(buf));
+}
+
+PRIVATE int log_unparsed_begin (HTStructured * me, const char * b, int l)
+{
+    log_data(me, 'B', b, l);
+    return HT_OK;
+}
+
+PRIVATE int log_unparsed_end (HTStructured * me, const char * b, int l)
+{
+    log_data(me, 'E', b, l);
+    return HT_OK;
+}
+
+PRIVATE int log_unparsed_entity (HTStructured * me, const char * b, int l)
+{
+    log_data(me, 'U', b, l);
+    return HT_OK;
+}
+
+PRIVATE const HTStructuredClass LogClass =
+{
+    "SGMLFuzzLog",
+    log_flush,
+    log_free,
+    log_abort,
+    log_put_character,
+    log_put_string,
+    log_put_block,
+    log_start_element,
+    log_end_element,
+    log_put_entity,
+    log_unparsed_begin,
+    log_unparsed_end,
+    log_unparsed_entity
+};
+
+/*
+**	Parse the input in the given blocks and log what comes out
+*/
+PRIVATE void parse (HTStructured * target, BOOL fast,
+		    const char * input, int length, const int * blocks)
+{
+    HTStream * parser;
+    int offset = 0;
+    HTChunk_clear(target->log);
+    SGML_setFastScan(fast);
+    parser = SGML_new(dtd, target);
+    while (offset < length) {
+	int len = *blocks++;
+	if (len > length - offset) len = length - offset;
+	(*parser->isa->put_block)(parser, input + offset, len);
+	offset += len;
+    }
+    (*parser->isa->_free)(parser);
+}
+
+PRIVATE void mutate (char * input, int length)
+{
+    int i;
+    if (!length) return;
+    for (i = next_random() % 32 + 1; i > 0; i--)
+	input[next_random() % length] =
+	    SPECIALS[next_random() % (sizeof(SPECIALS) - 1)];
+    if (next_random() % 2)
+	for (i = next_random() % 8; i > 0; i--)
+	    input[next_random() % length] = (char) next_random();
+}
+
+/*
+**	Returns YES if both parsers gave the same log
+*/
+PRIVATE BOOL check (HTStructured * slow, HTStructured * fast,
+		    const char * input, int length, int * blocks)
+{
+    int i;
+    int max = next_random() % 4 ? 64 : length + 1;
+    for (i = 0; i < length; i++) blocks[i] = next_random() % max + 1;
+    parse(slow, NO, input, length, blocks);
+    parse(fast, YES, input, length, blocks);
+    return HTChunk_size(slow->log) == HTChunk_size(fast->log) &&
+	!memcmp(HTChunk_data(slow->log), HTChunk_data(fast->log),
+		HTChunk_size(slow->log));
+}
+
+int main (int argc, char ** argv)
+{
+    int rounds = DEFAULT_ROUNDS;
+    BOOL verbose = NO;
+    HTList * inputs = HTList_new();
+    HTStructured slow = { &LogClass, NULL };
+    HTStructured fast = { &LogClass, NULL };
+    HTChunk * input;
+    char * buf;
+    int * blocks;
+    int failed = 0;
+    int round;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++) {
+	if (!strcmp(argv[arg], "-n") && arg+1 < argc) {
+	    rounds = atoi(argv[++arg]);
+	} else if (!strcmp(argv[arg], "-seed") && arg+1 < argc) {
+	    seed = strtoul(argv[++arg], NULL, 10);
+	} else if (!strcmp(argv[arg], "-v")) {
+	    verbose = YES;
+	} else if (*argv[arg] == '-') {
+	    fprintf(stderr, "Usage: %s [-n rounds] [-seed seed] [-v] [file ...]\n", argv[0]);
+	    return -1;
+	} else {
+	    FILE * fp = fopen(argv[arg], "rb");
+	    char data[4096];
+	    int len;
+	    if (!fp) {
+		perror(argv[arg]);
+		continue;
+	    }
+	    input = HTChunk_new(4096);
+	    while ((len = fread(data, 1, sizeof(data), fp)) > 0 &&
+		   HTChunk_size(input) < MAX_LENGTH)
+		HTChunk_putb(input, data, len);
+	    fclose(fp);
+	    HTList_appendObject(inputs, input);
+	}
+    }
+    if (HTList_isEmpty(inputs)) {
+	input = HTChunk_new(sizeof(PAGE));
+	HTChunk_puts(input, PAGE);
+	HTList_appendObject(inputs, input);
+    }
+
+    HTLibInit("sgmlfuzz", "1.0");
+    dtd = HTML_dtd();
+    slow.log = HTChunk_new(4096);
+    fast.log = HTChunk_new(4096);
+    if ((buf = (char *) HT_MALLOC(MAX_LENGTH + 4096)) == NULL ||
+	(blocks = (int *) HT_MALLOC((MAX_LENGTH + 4096) * sizeof(int))) == NULL)
+	HT_OUTOFMEM("sgmlfuzz");
+
+    /*
+    **  The first rounds go through the inputs as they are, the others
+    **  through mutated copies of them
+    */
+    for (round = 0; round < rounds; round++) {
+	int count = HTList_count(inputs);
+	int length;
+	input = (HTChunk *) HTList_objectAt(inputs, round % count);
+	length = HTChunk_size(input);
+	memcpy(buf, HTChunk_data(input), length);
+	if (round >= count) mutate(buf, length);
+	if (!check(&slow, &fast, buf, length, blocks)) {
+	    char name[64];
+	    FILE * fp;
+	    sprintf(name, "sgmlfuzz-%d.html", round);
+	    if ((fp = fopen(name, "wb")) != NULL) {
+		fwrite(buf, 1, length, fp);
+		fclose(fp);
+	    }
+	    printf("Round %d: the logs differ, input saved as %s\n", round, name);
+	    failed++;
+	} else if (verbose)
+	    printf("Round %d: %d bytes, %d bytes logged\n",
+		   round, length, HTChunk_size(fast.log));
+    }
+    printf("%d rounds, %d failed\n", rounds, failed);
+
+    SGML_setFastScan(YES);
+    SGML_deleteAll();
+    while ((input = (HTChunk *) HTList_removeLastObject(inputs)))
+	HTChunk_delete(input);
+    HTList_delete(inputs);
+    HTChunk_delete(slow.log);
+    HTChunk_delete(fast.log);
+    HT_FREE(buf);
+    HT_FREE(blocks);
+    HTLibTerminate();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+/*
+**	@(#) $Id$
+**	
+**	Other libwww samples can be found at "http://www.w3.org/Library/Examples"
+**	
+**	Copyright (c) 1995-1998 World Wide Web Consortium, (Massachusetts
+**	Institute of Technology, Institut National de Recherche en
+**	Informatique et en Automatique, Keio University). All Rights
+**	Reserved. This program is distributed under the W3C's Software
+**	Intellectual Property License. This program is distributed in the hope
+**	that it will be useful, but WITHOUT ANY WARRANTY; without even the
+**	implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+**	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
+**	details.
+**
+**	Churns a large number of timers through the timer manager the way
+**	persistent connections do with their idle and active timeouts:
+**	create, refresh a few times, and delete or let expire. Reports the
+**	time spent in each phase. Give the number of timers on the command
+**	line (default 1000000).
+*/
+
+#include "WWWLib.h"
+#include "WWWInit.h"
+
+#define DEFAULT_TIMERS		1000000
+#define REFRESHES		4
+
+PRIVATE int fired = 0;
+
+PRIVATE int timeout_handler (HTTimer * timer, void * param, HTEventType type)
+{
+    fired++;
+    return HT_OK;
+}
+
+int main (int argc, char ** argv)
+{
+    int count = (argc > 1) ? atoi(argv[1]) : DEFAULT_TIMERS;
+    HTTimer ** timers;
+    ms_t start;
+    int cnt, round;
+
+    if (count <= 0) {
+	fprintf(stderr, "Usage: %s [number of timers]\n", argv[0]);
+	return -1;
+    }
+    HTLibInit("timers", "1.0");
+    if ((timers = (HTTimer **) HT_CALLOC(count, sizeof(HTTimer *))) == NULL)
+	HT_OUTOFMEM("timers");
+    srand(1);
+
+    /* Spread the timers out over a window so that they don't expire */
+    start = HTGetTimeInMillis();
+    for (cnt = 0; cnt < count; cnt++)
+	timers[cnt] = HTTimer_new(NULL, timeout_handler, NULL,
+				  60000 + rand() % 60000, YES, YES);
+    fprintf(stderr, "Created   %d timers in %lu ms\n",
+	    count, HTGetTimeInMillis() - start);
+
+    /* Refresh them in random order as when a socket sees activity */
+    start = HTGetTimeInMillis();
+    for (round = 0; round < REFRESHES; round++)
+	for (cnt = 0; cnt < count; cnt++)
+	    HTTimer_refresh(timers[rand() % count], 0);
+    fprintf(stderr, "Refreshed %d timers in %lu ms\n",
+	    count * REFRESHES, HTGetTimeInMillis() - start);
+
+    /* Delete every other timer as when a connection is closed */
+    start = HTGetTimeInMillis();
+    for (cnt = 0; cnt < count; cnt += 2) {
+	HTTimer_delete(timers[cnt]);
+	timers[cnt] = NULL;
+    }
+    fprintf(stderr, "Deleted   %d timers in %lu ms\n",
+	    (count+1) / 2, HTGetTimeInMillis() - start);
+
+    /* And let the rest expire */
+    start = HTGetTimeInMillis();
+    HTTimer_expireAll();
+    fprintf(stderr, "Expired   %d timers in %lu ms\n",
+	    fired, HTGetTimeInMillis() - start);
+
+    for (cnt = 1; cnt < count; cnt += 2) HTTimer_delete(timers[cnt]);
+    HT_FREE(timers);
+    HTLibTerminate();
+    return 0;
+}
@@ -34,10 +34,15 @@
 #include "HTProxy.h"
 #include "HTRules.h"
 #include "HTReqMan.h"
+#include "HTBind.h"
+#include "HTBufWrt.h"
+#include "HTMIMERq.h"
 #include "HTAccess.h"					 /* Implemented here */
 
 #define PUTBLOCK(b, l)	(*target->isa->put_block)(target, b, l)
 
+#define PUT_FILE_BLOCK	8192
+
 struct _HTStream {
     HTStreamClass * isa;
 };
@@ -954,6 +959,141 @@ PUBLIC BOOL HTPutAnchor (HTParentAnchor *	source,
     return NO;
 }
 
+/*
+**	Post callback for HTPutFileAnchor. The file is opened every time we
+**	are called so that redirections and authentication work. If the
+**	request goes out on a buffered socket writer then the file is queued
+**	on it and sent without copying. Otherwise we read it in blocks.
+*/
+PRIVATE int HTFileEntity_callback (HTRequest * request, HTStream * target)
+{
+    HTParentAnchor * entity = HTRequest_entityAnchor(request);
+    HTNet * net = HTRequest_net(request);
+    HTHost * host = HTNet_host(net);
+    long len = HTAnchor_length(entity);
+    char * class = HTHost_class(host);
+    char * file = NULL;
+    int status;
+    int fd;
+    if (!request || !entity || !target) return HT_ERROR;
+
+    /* Make sure that the header is sent before the body */
+    if ((status = PUTBLOCK(NULL, 0)) != HT_OK) {
+	HTTRACE(PROT_TRACE, "Posting File Target returns %d\n" _ status);
+	return status;
+    }
+    {
+	char * addr = HTAnchor_address((HTAnchor *) entity);
+	file = HTWWWToLocal(addr, "", HTRequest_userProfile(request));
+	HT_FREE(addr);
+    }
+#ifdef O_BINARY
+    fd = file ? open(file, O_RDONLY | O_BINARY) : -1;
+#else
+    fd = file ? open(file, O_RDONLY) : -1;
+#endif
+    if (fd < 0) {
+	HTTRACE(PROT_TRACE, "Posting File Can't open `%s\'\n" _ file ? file : "");
+	HTRequest_addSystemError(request, ERR_FATAL, errno, NO, "open");
+	HT_FREE(file);
+	return HT_ERROR;
+    }
+    HT_FREE(file);
+
+    /*
+    **  Hand the file to the socket writer if we can. Not if the body may
+    **  get a content coding as the coder must see the data.
+    */
+    if (len > 0 && class && !strcmp(class, "http") &&
+	!HTMIMERequest_contentCoding()) {
+	HTOutputStream * output = HTChannel_output(HTHost_channel(host));
+	if (HTBufferWriter_sendFile(output, fd, 0, len) == HT_OK) {
+	    HTTRACE(PROT_TRACE, "Posting File %ld bytes queued on %p\n" _ len _ output);
+	    (*target->isa->flush)(target);
+	    return HT_LOADED;
+	}
+    }
+
+    /* Otherwise push it down the stream */
+    {
+	char buf[PUT_FILE_BLOCK];
+	int b_read;
+	status = HT_OK;
+	while (status == HT_OK && (b_read = read(fd, buf, PUT_FILE_BLOCK)) > 0)
+	    status = PUTBLOCK(buf, b_read);
+	close(fd);
+	if (status == HT_OK || status == HT_LOADED) {
+	    HTTRACE(PROT_TRACE, "Posting File Target is SAVED\n");
+	    (*target->isa->flush)(target);
+	    return HT_LOADED;
+	}
+	HTTRACE(PROT_TRACE, "Posting File Target returns %d\n" _ status);
+	return status;
+    }
+}
+
+/*	Send a Local File using PUT from absolute name
+**	----------------------------------------------
+**	Upload a local file to a destination referenced by an absolute URL.
+**	The URL can NOT contain any fragment identifier!
+*/
+PUBLIC BOOL HTPutFileAbsolute (const char *	filename,
+			       const char *	destination,
+			       HTRequest *	request)
+{
+    if (filename && destination && request) {
+	HTAnchor * dest = HTAnchor_findAddress(destination);
+	return HTPutFileAnchor(filename, dest, request);
+    }
+    return NO;
+}
+
+/*	Send a Local File using PUT from an anchor
+**	------------------------------------------
+**	Upload a local file to a destination referenced by an anchor object.
+**	The file is not loaded into memory but read when the body is sent.
+*/
+PUBLIC BOOL HTPutFileAnchor (const char *	filename,
+			     HTAnchor *		destination,
+			     HTRequest *	request)
+{
+    HTParentAnchor * dest = HTAnchor_parent(destination);
+    if (filename && dest && request) {
+	HTParentAnchor * source;
+	struct stat file_info;
+	char * url;
+	if (HT_STAT(filename, &file_info) < 0 ||
+	    (file_info.st_mode & S_IFMT) != S_IFREG) {
+	    HTTRACE(APP_TRACE, "Put File.... `%s\' is not a plain file\n" _ filename);
+	    return NO;
+	}
+	if ((url = HTLocalToWWW(filename, "file:")) == NULL) return NO;
+	source = HTAnchor_parent(HTAnchor_findAddress(url));
+	HT_FREE(url);
+	HTAnchor_clearHeader(source);
+	HTAnchor_setLength(source, (long) file_info.st_size);
+	HTBind_getAnchorBindings(source);
+	if (setup_anchors(request, source, dest, METHOD_PUT) == YES) {
+
+	    /* Set up the request object */
+	    HTRequest_addGnHd(request, HT_G_DATE);
+	    HTRequest_setEntityAnchor(request, source);
+	    HTRequest_setMethod(request, METHOD_PUT);
+	    HTRequest_setAnchor(request, destination);
+
+            /* Setup preconditions */
+    	    set_preconditions(request);
+
+	    /* Add the entity callback function to send the file */
+	    HTRequest_setPostCallback(request, HTFileEntity_callback);
+
+	    /* Now start the load normally */
+	    return launch_request(request, NO);
+	}
+    }
+    return NO;
+}
+
 /*	Send an Anchor using POST from absolute name
 **	-------------------------------------------
 **	Upload a document referenced by an absolute URL appended.
@@ -28,7 +28,7 @@
 #define PARENT_HASH_SIZE	HT_XL_HASH_SIZE
 #define CHILD_HASH_SIZE		HT_L_HASH_SIZE
 
-PRIVATE HTList **adult_table=0;  /* Point to table of lists of all parents */
+PRIVATE HTHashtable * adult_table = NULL;	/* All parents keyed by address */
 
 /* ------------------------------------------------------------------------- */
 /*				Creation Methods			     */
@@ -150,42 +150,29 @@ PUBLIC HTAnchor * HTAnchor_findAddress (const char * address)
 	HT_FREE(tag);
 	return (HTAnchor *) child;
     } else {		       	     /* Else check whether we have this node */
-	int hash;
-	const char *p;
-	HTList * adults;
-	HTList *grownups;
 	HTParentAnchor * foundAnchor;
 	char *newaddr = NULL;
 	StrAllocCopy(newaddr, address);		         /* Get our own copy */
 	HT_FREE(tag);
 	newaddr = HTSimplify(&newaddr);
 
-	/* Select list from hash table */
-	for(p=newaddr, hash=0; *p; p++)
-	    hash = (int) ((hash * 3 + (*(unsigned char*)p)) % PARENT_HASH_SIZE);
-	if (!adult_table) {
-	    if ((adult_table = (HTList* *) HT_CALLOC(PARENT_HASH_SIZE, sizeof(HTList*))) == NULL)
-	        HT_OUTOFMEM("HTAnchor_findAddress");
-	}
-	if (!adult_table[hash]) adult_table[hash] = HTList_new();
-	adults = adult_table[hash];
-
-	/* Search list for anchor */
-	grownups = adults;
-	while ((foundAnchor = (HTParentAnchor *) HTList_nextObject(grownups))){
-	    if (!strcmp(foundAnchor->address, newaddr)) {
-		HTTRACE(ANCH_TRACE, "Find Parent. %p with address `%s' already exists.\n" _ 
-			    (void*) foundAnchor _ newaddr);
-		HT_FREE(newaddr);		       /* We already have it */
-		return (HTAnchor *) foundAnchor;
-	    }
+	/* Look up the anchor in the hash table. The address is the key */
+	if (!adult_table)
+	    adult_table = HTHashtable_newWithFlags(PARENT_HASH_SIZE,
+						   HT_HASH_KEYREF);
+	if ((foundAnchor = (HTParentAnchor *)
+	     HTHashtable_object(adult_table, newaddr))) {
+	    HTTRACE(ANCH_TRACE, "Find Parent. %p with address `%s' already exists.\n" _ 
+			(void*) foundAnchor _ newaddr);
+	    HT_FREE(newaddr);			       /* We already have it */
+	    return (HTAnchor *) foundAnchor;
 	}
 	
 	/* Node not found : create new anchor. */
 	foundAnchor = HTParentAnchor_new();
 	foundAnchor->address = newaddr;			/* Remember our copy */
-	HTList_addObject (adults, foundAnchor);
-	HTTRACE(ANCH_TRACE, "Find Parent. %p with hash %d and address `%s' created\n" _ (void*)foundAnchor _ hash _ newaddr);
+	HTHashtable_addObject(adult_table, newaddr, foundAnchor);
+	HTTRACE(ANCH_TRACE, "Find Parent. %p with address `%s' created\n" _ (void*)foundAnchor _ newaddr);
 	return (HTAnchor *) foundAnchor;
     }
 }
@@ -389,21 +376,16 @@ PRIVATE void * delete_family (HTAnchor * me)
 */
 PUBLIC BOOL HTAnchor_deleteAll (HTList * documents)
 {
-    int cnt;
-    HTList *cur;
+    int pos = 0;
+    HTParentAnchor * pres;
     if (!adult_table)
 	return NO;
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor *pres;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur)) != NULL){
-		void * doc = delete_family((HTAnchor *) pres);
-		if (doc && documents) HTList_addObject(documents, doc);
-	    }
-	}
-	HTList_delete(adult_table[cnt]);
+    while ((pres = (HTParentAnchor *) HTHashtable_nextObject(adult_table, &pos))) {
+	void * doc = delete_family((HTAnchor *) pres);
+	if (doc && documents) HTList_addObject(documents, doc);
     }
-    HT_FREE(adult_table);
+    HTHashtable_delete(adult_table);
+    adult_table = NULL;
     return YES;
 }
 
@@ -415,25 +397,20 @@ PUBLIC BOOL HTAnchor_deleteAll (HTList * documents)
 */
 PUBLIC BOOL HTAnchor_clearAll (HTList * documents)
 {
-    int cnt;
-    HTList * cur;
+    int pos = 0;
+    HTParentAnchor * pres;
     if (!adult_table) return NO;
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor * pres;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur))) {
+    while ((pres = (HTParentAnchor *) HTHashtable_nextObject(adult_table, &pos))) {
 
-		/* Then remove entity header information */
-		HTAnchor_clearHeader(pres);
+	/* Then remove entity header information */
+	HTAnchor_clearHeader(pres);
 
-		/* Delete the physical address */
-		HT_FREE(pres->physical);
+	/* Delete the physical address */
+	HT_FREE(pres->physical);
 
-		/* Register if we have a document on this anchor */
-		if (documents && pres->document)
-		    HTList_addObject(documents, pres->document);
-	    }
-	}
+	/* Register if we have a document on this anchor */
+	if (documents && pres->document)
+	    HTList_addObject(documents, pres->document);
     }
     return YES;
 }
@@ -514,32 +491,8 @@ PUBLIC BOOL HTAnchor_delete (HTParentAnchor * me)
        anchor. This caused a bug whenever requesting another anchor
        for the same URL.
     */
-    if (adult_table) {
-      int hash;
-      const char *p;
-      HTList * adults;
-      HTList * grownups;
-      HTList * last;
-      HTParentAnchor * foundAnchor;
-
-      /* Select list from hash table */
-      for(p=me->address, hash=0; *p; p++)
-	hash = (int) ((hash * 3 + (*(unsigned char*)p)) %
-		      PARENT_HASH_SIZE);
-      adults = adult_table[hash];
-
-      /* Search list for anchor */
-      grownups = adults;
-      last = grownups;
-      while ((foundAnchor = (HTParentAnchor *)
-	      HTList_nextObject(grownups))){
-	if (!strcmp(foundAnchor->address, me->address)) {
-	  HTList_quickRemoveElement (grownups, last);
-	  break;
-	}
-	last = grownups;
-      }
-    }
+    if (adult_table)
+      HTHashtable_removeEntry(adult_table, me->address, me);
 
     /* Now kill myself */
     delete_parent(me);
@@ -577,26 +530,21 @@ PUBLIC BOOL HTAnchor_delete (HTParentAnchor * me)
 */
 PUBLIC HTArray * HTAnchor_getArray (int growby)
 {
-    int cnt;
+    int pos = 0;
     HTArray * array = NULL;
-    HTList * cur = NULL;
+    HTParentAnchor * pres = NULL;
     if (!adult_table) return NULL;
 
     /* Allocate an array for the anchors */
-    if (growby <= 0) growby = PARENT_HASH_SIZE;
+    if (growby <= 0) growby = HTHashtable_count(adult_table) + 1;
     array = HTArray_new(growby);
 
     /* Traverse anchor structure */
-    for (cnt=0; cnt<PARENT_HASH_SIZE; cnt++) {
-	if ((cur = adult_table[cnt])) { 
-	    HTParentAnchor * pres = NULL;
-	    while ((pres = (HTParentAnchor *) HTList_nextObject(cur)) != NULL) {
-                if (HTArray_addObject(array, pres) == NO) {
-                    HTTRACE(ANCH_TRACE, "Anchor...... Can't add object %p to array %p\n" _ 
-				pres _ array);
-                    break;
-                }
-	    }
+    while ((pres = (HTParentAnchor *) HTHashtable_nextObject(adult_table, &pos))) {
+	if (HTArray_addObject(array, pres) == NO) {
+	    HTTRACE(ANCH_TRACE, "Anchor...... Can't add object %p to array %p\n" _ 
+			pres _ array);
+	    break;
 	}
     }
     return array;
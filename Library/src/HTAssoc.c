@@ -27,6 +27,8 @@
 #include "HTString.h"
 #include "HTAssoc.h"					 /* Implemented here */
 
+PRIVATE HTMemPool * AssocPool = NULL;
+
 PUBLIC HTAssocList * HTAssocList_new (void)
 {
     return HTList_new();
@@ -40,7 +42,7 @@ PUBLIC BOOL HTAssocList_delete (HTAssocList * list)
 	while (NULL != (assoc = (HTAssoc*)HTList_nextObject(cur))) {
 	    HT_FREE(assoc->name);
 	    HT_FREE(assoc->value);
-	    HT_FREE(assoc);
+	    HTMemPool_free(AssocPool, assoc);
 	}
 	return HTList_delete(list);
     }
@@ -52,7 +54,8 @@ PUBLIC BOOL HTAssocList_addObject (HTAssocList * list,
 {
     if (list && name) {
 	HTAssoc * assoc;
-	if ((assoc = (HTAssoc *) HT_CALLOC(1, sizeof(HTAssoc))) == NULL)
+	if (!AssocPool) AssocPool = HTMemPool_new("HTAssoc", sizeof(HTAssoc));
+	if ((assoc = (HTAssoc *) HTMemPool_alloc(AssocPool)) == NULL)
 	    HT_OUTOFMEM("HTAssoc_add");
 	StrAllocCopy(assoc->name, name);
 	if (value) StrAllocCopy(assoc->value, value);
@@ -149,7 +152,9 @@ PUBLIC BOOL HTAssocList_removeObject (HTAssocList * list, const char * name)
 	while ((assoc = (HTAssoc *) HTList_nextObject(cur))) {
 	    if (!strncasecomp(assoc->name, name, len)) {
 		HTList_removeObject(list, assoc);
-		HT_FREE(assoc);
+		HT_FREE(assoc->name);
+		HT_FREE(assoc->value);
+		HTMemPool_free(AssocPool, assoc);
 		found = YES;
 		cur = list;
 	    }
@@ -9,7 +9,7 @@
 **	so that they can be stored more efficiently, and comparisons
 **	for equality done more efficiently.
 **
-**	Atoms are kept in a hash table consisting of an array of linked lists.
+**	Atoms are kept in a caseless hash table keyed by the atom name.
 **
 ** Authors:
 **	TBL	Tim Berners-Lee, WorldWideWeb project, CERN
@@ -21,10 +21,25 @@
 #include "HTUtils.h"
 #include "HTString.h"
 #include "HTList.h"
+#include "HTHash.h"
 #include "HTAtom.h"
 
-PRIVATE HTAtom * hash_table[HT_XL_HASH_SIZE];
-PRIVATE BOOL initialised = NO;
+PRIVATE HTHashtable * AtomTable = NULL;
+
+/*
+**	Create a new atom and add it to the table
+*/
+PRIVATE HTAtom * HTAtom_new (const char * string)
+{
+    HTAtom * a;
+    if ((a = (HTAtom  *) HT_MALLOC(sizeof(*a))) == NULL)
+        HT_OUTOFMEM("HTAtom_for");
+    if ((a->name = (char  *) HT_MALLOC(strlen(string)+1)) == NULL)
+        HT_OUTOFMEM("HTAtom_for");
+    strcpy(a->name, string);
+    HTHashtable_addObject(AtomTable, a->name, a);
+    return a;
+}
 
 /*
 **	Finds an atom representation for a string. The atom doesn't have to be
@@ -32,28 +47,22 @@ PRIVATE BOOL initialised = NO;
 */
 PUBLIC HTAtom * HTAtom_for (const char * string)
 {
-    int hash;
-    const unsigned char * p;
     HTAtom * a;
+    int pos = 0;
 
     if (!string) return NULL;			/* prevent core dumps */
     
-    /*		First time around, clear hash table
-    */
-    if (!initialised) {
-        memset((void *) hash_table, '\0', sizeof(HTAtom *) * HT_XL_HASH_SIZE);
-	initialised = YES;
-    }
-    
-    /*		Generate hash function
+    /*		First time around, create the hash table. The table is
+    **		caseless so that both versions can share it and we
+    **		pick out the exact match here.
     */
-    for (p=string, hash=0; *p; p++) {
-        hash = (hash * 3 + TOLOWER(*p)) % HT_XL_HASH_SIZE;
-    }
+    if (!AtomTable)
+	AtomTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE,
+					     HT_HASH_CASELESS | HT_HASH_KEYREF);
     
-    /*		Search for the string in the list
+    /*		Search for the string in the table
     */
-    for (a=hash_table[hash]; a; a=a->next) {
+    while ((a = (HTAtom *) HTHashtable_nextMatch(AtomTable, string, &pos))) {
 	if (0==strcmp(a->name, string)) {
     	    /* HTTRACE(UTIL_TRACE, "HTAtom: Old atom %p for `%s'\n" _ a _ string); */
 	    return a;				/* Found: return it */
@@ -62,13 +71,7 @@ PUBLIC HTAtom * HTAtom_for (const char * string)
     
     /*		Generate a new entry
     */
-    if ((a = (HTAtom  *) HT_MALLOC(sizeof(*a))) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    if ((a->name = (char  *) HT_MALLOC(strlen(string)+1)) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    strcpy(a->name, string);
-    a->next = hash_table[hash];		/* Put onto the head of list */
-    hash_table[hash] = a;
+    a = HTAtom_new(string);
 /*    HTTRACE(UTIL_TRACE, "HTAtom: New atom %p for `%s'\n" _ a _ string); */
     return a;
 }
@@ -81,43 +84,24 @@ PUBLIC HTAtom * HTAtom_for (const char * string)
 */
 PUBLIC HTAtom * HTAtom_caseFor (const char * string)
 {
-    int hash;
-    const unsigned char * p;
     HTAtom * a;
 
     if (!string) return NULL;			/* prevent core dumps */
     
-    /*		First time around, clear hash table
+    /*		First time around, create the hash table
     */
-    if (!initialised) {
-        memset((void *) hash_table, '\0', sizeof(HTAtom *) * HT_XL_HASH_SIZE);
-	initialised = YES;
-    }
+    if (!AtomTable)
+	AtomTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE,
+					     HT_HASH_CASELESS | HT_HASH_KEYREF);
     
-    /*		Generate hash function
+    /*		Search for the string in the table
     */
-    for(p=string, hash=0; *p; p++) {
-        hash = (hash * 3 + TOLOWER(*p)) % HT_XL_HASH_SIZE;
-    }
-    
-    /*		Search for the string in the list
-    */
-    for (a=hash_table[hash]; a; a=a->next) {
-	if (!strcasecomp(a->name, string)) {
-	    return a;					/* Found: return it */
-	}
-    }
+    if ((a = (HTAtom *) HTHashtable_object(AtomTable, string)))
+	return a;					/* Found: return it */
     
     /*		Generate a new entry
     */
-    if ((a = (HTAtom  *) HT_MALLOC(sizeof(*a))) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    if ((a->name = (char  *) HT_MALLOC(strlen(string)+1)) == NULL)
-        HT_OUTOFMEM("HTAtom_for");
-    strcpy(a->name, string);
-    a->next = hash_table[hash];		/* Put onto the head of list */
-    hash_table[hash] = a;
-    return a;
+    return HTAtom_new(string);
 }
 
 
@@ -127,22 +111,16 @@ PUBLIC HTAtom * HTAtom_caseFor (const char * string)
 */
 PUBLIC void HTAtom_deleteAll (void)
 {
-    int i;
-    HTAtom *cur;
-    HTAtom *next;
-    
-    for (i=0; i<HT_XL_HASH_SIZE; i++) {
-	if (hash_table[i]) {
-	    cur = hash_table[i];
-	    while (cur) {
-		next = cur->next;
-		HT_FREE(cur->name);
-		HT_FREE(cur);
-		cur = next;	
-	    }	
+    if (AtomTable) {
+	HTAtom * cur;
+	int pos = 0;
+	while ((cur = (HTAtom *) HTHashtable_nextObject(AtomTable, &pos))) {
+	    HT_FREE(cur->name);
+	    HT_FREE(cur);
 	}
+	HTHashtable_delete(AtomTable);
+	AtomTable = NULL;
     }
-    initialised = NO;
 }
 
 
@@ -175,15 +153,13 @@ PUBLIC HTList *HTAtom_templateMatches (const char * templ)
 {
     HTList *matches = HTList_new();
 
-    if (initialised && templ) {
-	int i;
+    if (AtomTable && templ) {
 	HTAtom *cur;
+	int pos = 0;
 
-	for (i=0; i<HT_XL_HASH_SIZE; i++) {
-	    for (cur = hash_table[i];  cur;  cur=cur->next) {
-		if (mime_match(cur->name, templ))
-		    HTList_addObject(matches, (void*)cur);
-	    }
+	while ((cur = (HTAtom *) HTHashtable_nextObject(AtomTable, &pos))) {
+	    if (mime_match(cur->name, templ))
+		HTList_addObject(matches, (void*)cur);
 	}
     }
     return matches;
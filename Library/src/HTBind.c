@@ -52,7 +52,7 @@ typedef struct _HTBind {
 PRIVATE BOOL HTCaseSen = YES;		      /* Are suffixes case sensitive */
 PRIVATE char *HTDelimiters = NULL;			  /* Set of suffixes */
 
-PRIVATE HTList **HTBindings = NULL;   /* Point to table of lists of bindings */
+PRIVATE HTHashtable * HTBindings = NULL;     /* Bindings keyed by suffix */
 
 PRIVATE HTBind no_suffix = { "*", NULL, NULL, NULL, NULL, 0.5 };
 PRIVATE HTBind unknown_suffix = { "*.*", NULL, NULL, NULL, NULL, 0.5 };
@@ -64,10 +64,9 @@ PRIVATE HTBind unknown_suffix = { "*.*", NULL, NULL, NULL, NULL, 0.5 };
 */
 PUBLIC BOOL HTBind_init (void)
 {
-    if (!HTBindings) {
-	if (!(HTBindings = (HTList **) HT_CALLOC(HT_L_HASH_SIZE, sizeof(HTList *))))
-	    HT_OUTOFMEM("HTBind_init");
-    }
+    if (!HTBindings)
+	HTBindings = HTHashtable_newWithFlags(HT_L_HASH_SIZE,
+					      HT_HASH_CASELESS | HT_HASH_KEYREF);
     StrAllocCopy(HTDelimiters, DEFAULT_SUFFIXES);
     no_suffix.type = WWW_UNKNOWN;
     no_suffix.encoding = WWW_CODING_BINARY;
@@ -84,22 +83,16 @@ PUBLIC BOOL HTBind_init (void)
 */
 PUBLIC BOOL HTBind_deleteAll (void)
 {
-    int cnt;
-    HTList *cur;
+    HTBind *pres;
+    int pos = 0;
     if (!HTBindings)
 	return NO;
-    for (cnt=0; cnt<HT_L_HASH_SIZE; cnt++) {
-	if ((cur = HTBindings[cnt])) { 
-	    HTBind *pres;
-	    while ((pres = (HTBind *) HTList_nextObject(cur)) != NULL) {
-		HT_FREE(pres->suffix);
-		HT_FREE(pres);
-	    }
-	}
-	HTList_delete(HTBindings[cnt]);
-	HTBindings[cnt] = NULL;
+    while ((pres = (HTBind *) HTHashtable_nextObject(HTBindings, &pos)) != NULL) {
+	HT_FREE(pres->suffix);
+	HT_FREE(pres);
     }
-    HT_FREE(HTBindings);
+    HTHashtable_delete(HTBindings);
+    HTBindings = NULL;
     HT_FREE(HTDelimiters);
     return YES;
 }
@@ -187,23 +180,12 @@ PUBLIC BOOL HTBind_add (const char *	suffix,
     else if (!strcmp(suffix, "*.*"))
 	suff = &unknown_suffix;
     else {
-	HTList * suflist;
-	int hash;
-	const unsigned char * p;
-
-	/* Select list from hash table */
-	for (p=suffix, hash=0; *p; p++) {
-	    hash = (hash * 3 + TOLOWER(*p)) % HT_L_HASH_SIZE;
-	}
-
 	if (!HTBindings) HTBind_init();
-	if (!HTBindings[hash]) HTBindings[hash] = HTList_new();
-	suflist = HTBindings[hash];
 
-	/* Look for existing binding */
+	/* Look for existing binding. The table is caseless so check case */
 	{
-	    HTList *cur = suflist;
-	    while ((suff = (HTBind *) HTList_nextObject(cur)) != NULL) {
+	    int pos = 0;
+	    while ((suff = (HTBind *) HTHashtable_nextMatch(HTBindings, suffix, &pos)) != NULL) {
 		if (!strcmp(suff->suffix, suffix))
 		    break;
 	    }
@@ -213,8 +195,8 @@ PUBLIC BOOL HTBind_add (const char *	suffix,
 	if (!suff) {
 	    if ((suff = (HTBind *) HT_CALLOC(1, sizeof(HTBind))) == NULL)
 	        HT_OUTOFMEM("HTBind_add");
-	    HTList_addObject(suflist, (void *) suff);
 	    StrAllocCopy(suff->suffix, suffix);
+	    HTHashtable_addObject(HTBindings, suff->suffix, (void *) suff);
 	}
     }
 
@@ -274,8 +256,7 @@ PUBLIC BOOL HTBind_add (const char *	suffix,
 */
 PUBLIC char * HTBind_getSuffix (HTParentAnchor * anchor)
 {
-    int cnt;
-    HTList * cur;
+    int pos = 0;
     HTChunk * suffix = HTChunk_new(48);
     char delimiter = *HTDelimiters;
     char * ct=NULL, * ce=NULL, * cl=NULL;
@@ -284,30 +265,26 @@ PUBLIC char * HTBind_getSuffix (HTParentAnchor * anchor)
     HTList * language = HTAnchor_language(anchor);
     if (!HTBindings) HTBind_init();
     if (anchor) {
-	for (cnt=0; cnt<HT_L_HASH_SIZE; cnt++) {
-	    if ((cur = HTBindings[cnt])) { 
-		HTBind *pres;
-		while ((pres = (HTBind *) HTList_nextObject(cur))) {
-		    if (!ct && (pres->type && pres->type == format)){
-			ct = pres->suffix;
-		    } else if (!ce && pres->encoding && encoding) {
-			HTList * cur_enc = encoding;
-			HTEncoding pres_enc;
-			while ((pres_enc = (HTEncoding) HTList_nextObject(cur_enc))) {
-			    if (pres_enc == pres->encoding) {
-				ce = pres->suffix;
-				break;
-			    }
-			}
-		    } else if (!cl && pres->language && language) {
-			HTList * cur_lang = language;
-			HTLanguage pres_lang;
-			while ((pres_lang = (HTLanguage) HTList_nextObject(cur_lang))) {
-			    if (pres_lang == pres->language) {
-				cl = pres->suffix;
-				break;
-			    }
-			}
+	HTBind *pres;
+	while ((pres = (HTBind *) HTHashtable_nextObject(HTBindings, &pos))) {
+	    if (!ct && (pres->type && pres->type == format)){
+		ct = pres->suffix;
+	    } else if (!ce && pres->encoding && encoding) {
+		HTList * cur_enc = encoding;
+		HTEncoding pres_enc;
+		while ((pres_enc = (HTEncoding) HTList_nextObject(cur_enc))) {
+		    if (pres_enc == pres->encoding) {
+			ce = pres->suffix;
+			break;
+		    }
+		}
+	    } else if (!cl && pres->language && language) {
+		HTList * cur_lang = language;
+		HTLanguage pres_lang;
+		while ((pres_lang = (HTLanguage) HTList_nextObject(cur_lang))) {
+		    if (pres_lang == pres->language) {
+			cl = pres->suffix;
+			break;
 		    }
 		}
 	    }
@@ -448,32 +425,18 @@ PUBLIC BOOL HTBind_getFormat (const char *	filename,
 	while ((suffix=strtok(NULL, HTDelimiters)) != NULL) {
 #endif /* HT_REENTRANT */
 	    HTBind *suff=NULL;
-	    int hash;
-	    unsigned char * p;
 	    HTTRACE(BIND_TRACE, "Get Binding. Look for '%s\' " _ suffix);
 	    sufcnt++;
 
-	    /* Select list from hash table */
-	    for (p=suffix, hash=0; *p; p++) {
-		hash = (hash * 3 + TOLOWER(*p)) % HT_L_HASH_SIZE;
-	    }
-
-	    /* Now search list for entries (case or non case sensitive) */
-	    if (HTBindings[hash]) {
-		HTList *cur = HTBindings[hash];
-		while ((suff = (HTBind *) HTList_nextObject(cur))) {
-		    if ((HTCaseSen && !strcmp(suff->suffix, suffix)) ||
-			!strcasecomp(suff->suffix, suffix)) {
-			HTTRACE(BIND_TRACE, "Found!\n");
-			if (suff->type && format) *format = suff->type;
-			if (suff->encoding && enc) *enc = suff->encoding;
-			if (suff->transfer && cte) *cte = suff->transfer;
-			if (suff->language && lang) *lang = suff->language;
-			if (suff->quality > HT_EPSILON)
-			    *quality *= suff->quality;
-			break;
-		    }
-		}
+	    /* Now search the table for entries (the table is caseless) */
+	    if ((suff = (HTBind *) HTHashtable_object(HTBindings, suffix))) {
+		HTTRACE(BIND_TRACE, "Found!\n");
+		if (suff->type && format) *format = suff->type;
+		if (suff->encoding && enc) *enc = suff->encoding;
+		if (suff->transfer && cte) *cte = suff->transfer;
+		if (suff->language && lang) *lang = suff->language;
+		if (suff->quality > HT_EPSILON)
+		    *quality *= suff->quality;
 	    }
 	    if (!suff) {	/* We don't have this suffix - use default */
 		HTTRACE(BIND_TRACE, "Not found - use default for \'*.*\'\n");
@@ -0,0 +1,145 @@
+/*								     HTBrotli.c
+**	BROTLI DECODING MODULE
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	This module requires the brotli decoder library in order to
+**	compile/link
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "WWWCore.h"
+#include "HTBrotli.h"					 /* Implemented here */
+
+#ifdef HT_BROTLI
+
+#include <brotli/decode.h>
+
+#define OUTBUF_SIZE		32768
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    int				state;
+    HTRequest *			request;
+    HTStream *			target;			/* Our output target */
+    BrotliDecoderState *	decoder;		   /* Brotli decoder */
+    unsigned long		total_in;
+    unsigned long		total_out;
+    char 			outbuf [OUTBUF_SIZE];	 /* Decompressed data */
+};
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void Brotli_terminate (HTStream * me)
+{
+    HTTRACE(STREAM_TRACE, "Brotli Dec.. Terminating stream %p\n" _ me);
+    HTTRACE(STREAM_TRACE, "Results..... Decompressed incoming data: compressed %lu, decompressed %lu, factor %.2f\n" _
+	    me->total_in _ me->total_out _
+	    me->total_in == 0 ? 0.0 : (double) me->total_out / me->total_in);
+    BrotliDecoderDestroyInstance(me->decoder);
+    me->decoder = NULL;
+}
+
+PRIVATE int HTBrotliDecode_flush (HTStream * me)
+{
+    return (*me->target->isa->flush)(me->target);
+}
+
+PRIVATE int HTBrotliDecode_free (HTStream * me)
+{
+    int status = HT_OK;
+    if (me->decoder) Brotli_terminate(me);
+    if ((status = (*me->target->isa->_free)(me->target)) == HT_WOULD_BLOCK)
+	return HT_WOULD_BLOCK;
+    HTTRACE(STREAM_TRACE, "Brotli Dec.. FREEING...\n");
+    HT_FREE(me);
+    return status;
+}
+
+PRIVATE int HTBrotliDecode_abort (HTStream * me, HTList * e)
+{
+    HTTRACE(STREAM_TRACE, "Brotli Dec.. ABORTING...\n");
+    if (me->decoder) Brotli_terminate(me);
+    (*me->target->isa->abort)(me->target, NULL);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+/*
+**	The decoder tells us whether it wants more input or more room for
+**	output, so we go on until it has eaten all the input we have got.
+*/
+PRIVATE int HTBrotliDecode_write (HTStream * me, const char * buf, int len)
+{
+    const uint8_t * next_in = (const uint8_t *) buf;
+    size_t avail_in = len;
+    BrotliDecoderResult result;
+    if (me->state != HT_OK) return me->state;
+    do {
+	uint8_t * next_out = (uint8_t *) me->outbuf;
+	size_t avail_out = OUTBUF_SIZE;
+	result = BrotliDecoderDecompressStream(me->decoder, &avail_in, &next_in,
+					       &avail_out, &next_out, NULL);
+	if (result == BROTLI_DECODER_RESULT_ERROR) {
+	    HTTRACE(STREAM_TRACE, "Brotli Dec.. Failed: %s\n" _
+		    BrotliDecoderErrorString(BrotliDecoderGetErrorCode(me->decoder)));
+	    return (me->state = HT_ERROR);
+	}
+	if (avail_out < OUTBUF_SIZE) {
+	    int state = (*me->target->isa->put_block)(me->target, me->outbuf,
+						      OUTBUF_SIZE - avail_out);
+	    me->total_out += OUTBUF_SIZE - avail_out;
+	    if (state != HT_OK) return state;
+	}
+    } while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    if (result == BROTLI_DECODER_RESULT_SUCCESS && avail_in > 0) {
+	HTTRACE(STREAM_TRACE, "Brotli Dec.. Ignoring %d bytes after end of stream\n" _ (int) avail_in);
+    }
+    me->total_in += len;
+    return HT_OK;
+}
+
+PRIVATE int HTBrotliDecode_put_character (HTStream * me, char c)
+{
+    return HTBrotliDecode_write(me, &c, 1);
+}
+
+PRIVATE int HTBrotliDecode_put_string (HTStream * me, const char * s)
+{
+    return HTBrotliDecode_write(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass HTBrotliDecode =
+{
+    "BrotliDecode",
+    HTBrotliDecode_flush,
+    HTBrotliDecode_free,
+    HTBrotliDecode_abort,
+    HTBrotliDecode_put_character,
+    HTBrotliDecode_put_string,
+    HTBrotliDecode_write
+};
+
+PUBLIC HTStream * HTBrotli_decode (HTRequest *	request,
+				   void *	param,
+				   HTEncoding	coding,
+				   HTStream *	target)
+{
+    HTStream * me = NULL;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+	HT_OUTOFMEM("HTBrotli_decode");
+    me->isa = &HTBrotliDecode;
+    me->state = HT_OK;
+    me->request = request;
+    me->target = target ? target : HTErrorStream();
+    if ((me->decoder = BrotliDecoderCreateInstance(NULL, NULL, NULL)) == NULL)
+	HT_OUTOFMEM("HTBrotli_decode");
+    HTTRACE(STREAM_TRACE, "Brotli Dec.. Stream created\n");
+    return me;
+}
+
+#endif /* HT_BROTLI */
@@ -9,6 +9,13 @@
 **	stream without causing a write every time.  The data is first written
 **	into a buffer. Data is written to the actual stream only when the
 **	buffer is full, or when the stream is flushed.
+**
+**	When the target is the socket writer, blocks that are too big to be
+**	worth copying are not put into the buffer. If they live in a shared
+**	I/O buffer then we queue a reference to them, and files are queued
+**	as a file descriptor and a region. Blocks in a buffer which is a
+**	mapped file are queued as the region of the file. The queue and the
+**	buffer are written together using gather writes and sendfile().
 */
 
 /* Library include files */
@@ -18,8 +25,23 @@
 #include "HTNetMan.h"
 #include "HTWriter.h"
 #include "HTTimer.h"
+#include "HTIOBuf.h"
 #include "HTBufWrt.h"					 /* Implemented here */
 
+#define MAX_SEGMENTS	HT_IOV_MAX
+
+#define SEG_BUFFER	0			 /* Bytes in our own buffer */
+#define SEG_BLOCK	1		   /* Bytes in a shared I/O buffer */
+#define SEG_FILE	2				 /* Region of a file */
+
+typedef struct _HTSegment {
+    int				type;
+    long			offset;	    /* Into the buffer, block or file */
+    long			len;		      /* Bytes left to write */
+    HTIOBuffer *		buffer;	 /* SEG_BLOCK, SEG_FILE if mapped */
+    int				fd;				/* SEG_FILE */
+} HTSegment;
+
 struct _HTOutputStream {
     const HTOutputStreamClass *	isa;
     HTOutputStream *		target;		 /* Target for outgoing data */
@@ -34,12 +56,118 @@ struct _HTOutputStream {
 
     ms_t			lastFlushTime;	/* polar coordinates of the moon */
     HTTimer *			timer;
+
+    BOOL			vector;	       /* Target is the socket writer */
+    int				tail;	/* Start of 'data' not in a segment */
+    HTSegment			segments[MAX_SEGMENTS];
+    int				nsegments;
 };
 
 #define PUTBLOCK(b,l) (*me->target->isa->put_block)(me->target,(b),(l))
 
 /* ------------------------------------------------------------------------- */
 
+/*
+**  Release the segment at the head of the queue
+*/
+PRIVATE void HTBufferWriter_dropSegment (HTOutputStream * me)
+{
+    HTSegment * seg = me->segments;
+    if (seg->buffer)
+	HTIOBuffer_unref(seg->buffer);
+    else if (seg->type == SEG_FILE) {
+	HTTRACE(STREAM_TRACE, "Buffer...... Done with file %d\n" _ seg->fd);
+	close(seg->fd);
+    }
+    me->nsegments--;
+    memmove(seg, seg+1, me->nsegments * sizeof(HTSegment));
+}
+
+PRIVATE void HTBufferWriter_dropAll (HTOutputStream * me)
+{
+    while (me->nsegments > 0) HTBufferWriter_dropSegment(me);
+    me->read = me->data;
+    me->tail = 0;
+}
+
+/*
+**  Turn what has been copied into the buffer since the last segment into
+**  a segment of its own so that new segments are written after it.
+*/
+PRIVATE void HTBufferWriter_seal (HTOutputStream * me)
+{
+    int pending = me->read - me->data - me->tail;
+    if (pending > 0) {
+	HTSegment * seg = &me->segments[me->nsegments++];
+	seg->type = SEG_BUFFER;
+	seg->offset = me->tail;
+	seg->len = pending;
+	seg->buffer = NULL;
+	seg->fd = -1;
+	me->tail += pending;
+    }
+}
+
+/*
+**  Account for bytes written from the head of the queue
+*/
+PRIVATE void HTBufferWriter_consume (HTOutputStream * me, long bytes)
+{
+    while (bytes > 0 && me->nsegments > 0) {
+	HTSegment * seg = me->segments;
+	long done = bytes < seg->len ? bytes : seg->len;
+	seg->offset += done;
+	seg->len -= done;
+	bytes -= done;
+	if (!seg->len) HTBufferWriter_dropSegment(me);
+    }
+    me->tail += bytes;
+}
+
+/*
+**  Write the queue followed by the rest of the buffer. Consecutive blocks
+**  of memory are written with a single gather write and files are sent
+**  one at a time. We keep going until the socket would block.
+*/
+PRIVATE int HTBufferWriter_flushVector (HTOutputStream * me)
+{
+    me->lastFlushTime = HTGetTimeInMillis();
+    while (me->nsegments > 0 || me->read > me->data + me->tail) {
+	HTSegment * seg = me->segments;
+	int status;
+	if (me->nsegments > 0 && seg->type == SEG_FILE) {
+	    long written = 0;
+	    status = HTWriter_sendfile(me->target, seg->fd, seg->offset,
+				       seg->len, &written);
+	    if (status != HT_OK) return status;
+	    HTBufferWriter_consume(me, written);
+	} else {
+	    HTIOVec vec[HT_IOV_MAX];
+	    int count = 0;
+	    int written = 0;
+	    while (count < me->nsegments && seg[count].type != SEG_FILE) {
+		vec[count].base = seg[count].type == SEG_BLOCK ?
+		    HTIOBuffer_data(seg[count].buffer) + seg[count].offset :
+		    me->data + seg[count].offset;
+		vec[count].len = (int) seg[count].len;
+		count++;
+	    }
+	    if (count == me->nsegments && count < HT_IOV_MAX &&
+		me->read > me->data + me->tail) {
+		vec[count].base = me->data + me->tail;
+		vec[count].len = me->read - me->data - me->tail;
+		count++;
+	    }
+	    status = HTWriter_writev(me->target, vec, count, &written);
+	    if (status != HT_OK) return status;
+	    HTBufferWriter_consume(me, written);
+	}
+    }
+    me->read = me->data;
+    me->tail = 0;
+    return HT_OK;
+}
+
 /*
 **  This function is only called from either FlushEvent or HTBufferWriter_lazyFlush
 **  which means that only the host object or timeout can cause a flush
@@ -47,6 +175,7 @@ struct _HTOutputStream {
 PRIVATE int HTBufferWriter_flush (HTOutputStream * me)
 {
     int status = HT_OK;
+    if (me && me->vector) return HTBufferWriter_flushVector(me);
     if (me && me->read > me->data) {
 	me->lastFlushTime = HTGetTimeInMillis();
         if ((status = PUTBLOCK(me->data, me->read - me->data))==HT_WOULD_BLOCK)
@@ -81,7 +210,7 @@ PRIVATE int HTBufferWriter_lazyFlush (HTOutputStream * me)
     HTNet * net;
     int delay;
 
-    if (me->read <= me->data) {
+    if (me->read <= me->data && !me->nsegments) {
 	return HT_OK;			/* nothing to flush */
     }
     /*
@@ -161,13 +290,92 @@ PRIVATE int HTBufferWriter_abort (HTOutputStream * me, HTList * e)
 	HTTimer_delete(me->timer);
 	me->timer = NULL;
     }
+    HTBufferWriter_dropAll(me);
     if (me->target) (*me->target->isa->abort)(me->target, e);
     return HT_ERROR;
 }
 
+/*
+**  Writing when the target is the socket writer. Blocks smaller than the
+**  buffer are copied as usual. Bigger blocks are either queued by
+**  reference or written directly together with whatever is in the buffer
+**  so that we only copy what the socket doesn't take right away.
+*/
+PRIVATE int HTBufferWriter_writeVector (HTOutputStream * me, const char * buf, int len)
+{
+    int status;
+    if (len >= me->growby) {
+	HTIOBuffer * buffer;
+	if (me->nsegments + 2 <= MAX_SEGMENTS &&
+	    (buffer = HTIOBuffer_hold(buf, len)) != NULL) {
+	    HTSegment * seg;
+	    long offset = 0;
+	    int fd = HTIOBuffer_file(buffer, &offset);
+	    HTBufferWriter_seal(me);
+	    seg = &me->segments[me->nsegments++];
+	    seg->type = fd >= 0 ? SEG_FILE : SEG_BLOCK;
+	    seg->offset = buf - HTIOBuffer_data(buffer) + (fd >= 0 ? offset : 0);
+	    seg->len = len;
+	    seg->buffer = buffer;
+	    seg->fd = fd;
+	    HTTRACE(STREAM_TRACE, "Buffer...... Queued %d bytes by reference%s\n" _ 
+		    len _ fd >= 0 ? " to file" : "");
+	    status = HTBufferWriter_flushVector(me);
+	    return (status == HT_OK || status == HT_WOULD_BLOCK) ? HT_OK : HT_ERROR;
+	}
+	me->lastFlushTime = HTGetTimeInMillis();
+	while (!me->nsegments && len > 0) {
+	    HTIOVec vec[2];
+	    int pending = me->read - me->data - me->tail;
+	    int count = 0;
+	    int written = 0;
+	    if (pending > 0) {
+		vec[count].base = me->data + me->tail;
+		vec[count++].len = pending;
+	    }
+	    vec[count].base = buf;
+	    vec[count++].len = len;
+	    status = HTWriter_writev(me->target, vec, count, &written);
+	    if (status == HT_WOULD_BLOCK) break;
+	    if (status != HT_OK) return HT_ERROR;
+	    if (written < pending) {
+		me->tail += written;
+	    } else {
+		buf += written - pending;
+		len -= written - pending;
+		me->read = me->data;
+		me->tail = 0;
+	    }
+	}
+	if (!len) return HT_OK;
+    }
+    while (1) {
+	int available = me->data + me->allocated - me->read;
+	if (len <= available) {
+	    memcpy(me->read, buf, len);
+	    me->read += len;
+	    if (me->read - me->data - me->tail > me->growby) {
+		status = HTBufferWriter_flushVector(me);
+		return (status == HT_OK || status == HT_WOULD_BLOCK) ? HT_OK : HT_ERROR;
+	    }
+	    return HT_OK;
+	}
+	if (me->read > me->data || me->nsegments) {
+	    status = HTBufferWriter_flushVector(me);
+	    if (status == HT_OK) continue;
+	    if (status != HT_WOULD_BLOCK) return HT_ERROR;
+	}
+	HTBufferWriter_addBuffer(me, len);
+	memcpy(me->read, buf, len);
+	me->read += len;
+	return HT_OK;
+    }
+}
+
 PRIVATE int HTBufferWriter_write (HTOutputStream * me, const char * buf, int len)
 {
     int status;
+    if (me->vector) return HTBufferWriter_writeVector(me, buf, len);
     while (1) {
 	int available = me->data + me->allocated - me->read;
 
@@ -241,6 +449,7 @@ PRIVATE int HTBufferWriter_close (HTOutputStream * me)
 	    HTTimer_delete(me->timer);
 	    me->timer = NULL;
 	}
+	HTBufferWriter_dropAll(me);
 	if (me->target) (*me->target->isa->close)(me->target);
 	HT_FREE(me->data);
 	HT_FREE(me);
@@ -309,6 +518,9 @@ PUBLIC HTOutputStream * HTBufferWriter_new (HTHost *	       	host,
     HTOutputStream * me = buffer_new(host, ch, param, bufsize);
     if (me) {
 	me->target = HTWriter_new(host, ch, param, 0);
+#ifndef NOT_ASCII
+	me->vector = YES;
+#endif
 	return me;
     }
     return NULL;
@@ -329,3 +541,32 @@ PUBLIC HTOutputStream * HTBufferConverter_new (HTHost * 	host,
     }
     return NULL;
 }
+
+/*
+**  Queue a region of a file. We take over the file descriptor and close
+**  it when the region has been written or the stream is closed.
+*/
+PUBLIC int HTBufferWriter_sendFile (HTOutputStream * me, int fd,
+				    long offset, long length)
+{
+    if (me && me->isa == &HTBufferWriter && me->vector &&
+	fd >= 0 && offset >= 0 && length > 0) {
+	HTSegment * seg;
+	if (me->nsegments + 2 > MAX_SEGMENTS) {
+	    int status = HTBufferWriter_flushVector(me);
+	    if ((status != HT_OK && status != HT_WOULD_BLOCK) ||
+		me->nsegments + 2 > MAX_SEGMENTS)
+		return HT_ERROR;
+	}
+	HTBufferWriter_seal(me);
+	seg = &me->segments[me->nsegments++];
+	seg->type = SEG_FILE;
+	seg->offset = offset;
+	seg->len = length;
+	seg->buffer = NULL;
+	seg->fd = fd;
+	HTTRACE(STREAM_TRACE, "Buffer...... Queued %ld bytes from file %d\n" _ length _ fd);
+	return HT_OK;
+    }
+    return HT_ERROR;
+}
@@ -22,12 +22,25 @@
 #include "WWWApp.h"
 #include "HTCache.h"					 /* Implemented here */
 
+#ifdef HT_ZLIB
+#include "HTZip.h"
+#ifdef WWW_MSWINDOWS
+#define ZLIB_DLL
+#endif
+#include <zlib.h>
+#endif /* HT_ZLIB */
+
 /* This is the default cache directory: */
 #define HT_CACHE_LOC	"/tmp/"
 #define HT_CACHE_ROOT	"w3c-cache/"
-#define HT_CACHE_INDEX	".index"
+#define HT_CACHE_INDEX	".index"		     /* Old ASCII index */
+#define HT_CACHE_BINDEX	".index.bin"
+#define HT_CACHE_TMPINDEX ".index.tmp"
+#define HT_CACHE_JOURNAL ".journal"
+#define HT_CACHE_TMPJOURNAL ".journal.tmp"
 #define HT_CACHE_LOCK	".lock"
 #define HT_CACHE_META	".meta"
+#define HT_CACHE_BLOBS	".blobs/"		   /* Shared entity bodies */
 #define HT_CACHE_EMPTY_ETAG	"@w3c@"
 
 /* Default heuristics cache expirations - thanks to Jeff Mogul for good comments! */
@@ -44,7 +57,12 @@
 
 #define WARN_HEURISTICS		24*3600		  /* When to issue a warning */
 
-#define DUMP_FREQUENCY	10			 /* Dump index every x loads */
+#define INDEX_MAGIC		"W3CIDX1"
+#define INDEX_ORDER		0x01020304	      /* To check byte order */
+#define JOURNAL_MAGIC		0x57334a31
+#define JOURNAL_MIN_RECORDS	512	   /* Compact the index after this */
+#define JOURNAL_RATIO		16	    /* ... and 1/x of the entries */
+#define JOURNAL_MAX_RECORDS	4096	   /* ... but never more than this */
 
 #define MEGA			0x100000L
 #define HT_CACHE_TOTAL_SIZE	20		/* Default cache size is 20M */
@@ -53,6 +71,28 @@
 #define HT_MIN_CACHE_TOTAL_SIZE	 5			/* 5M Min cache size */
 #define HT_MAX_CACHE_ENTRY_SIZE	 3     /* 3M Max sixe of single cached entry */
 
+#define GC_INTERVAL		10		/* ms between gc time slices */
+#define GC_SLICE		5		/* ms we may spend in a slice */
+#define GC_CHECK		32	 /* Entries between looking at the clock */
+#define GDSF_PACKET		536	  /* Fetch cost is packets to send */
+#define SLRU_PROTECTED_PCT	80	   /* Size of SLRU protected segment */
+
+#define MAP_MIN_SIZE		HT_IOBUF_MAX   /* Map bodies bigger than this */
+
+#define HT_CACHE_MEMORY_SIZE	1	    /* 1M for entries kept in memory */
+#define HT_MAX_MEMORY_ENTRY_SIZE 16	  /* 16K max size of entry in memory */
+#define SKETCH_DEPTH		4		 /* Rows in TinyLFU sketch */
+#define SKETCH_MAX		15		   /* Counters saturate here */
+#define SKETCH_MIN_WIDTH	1024
+#define SKETCH_SAMPLE		10	  /* Halve counters after width*x adds */
+
+#define BLOB_HASH_SEED		2166136261U		/* FNV-1a, 32 bits */
+#define BLOB_HASH_PRIME		16777619U
+#define BLOB_COMPARE_SIZE	8192
+
+#define ZIP_BUFFER_SIZE		16384
+#define ZIP_MIN_SIZE		512	     /* Don't deflate smaller bodies */
+
 /* Final states have negative value */
 typedef enum _CacheState {
     CL_ERROR		= -3,
@@ -61,7 +101,8 @@ typedef enum _CacheState {
     CL_BEGIN		= 0,
     CL_NEED_BODY,
     CL_NEED_OPEN_FILE,
-    CL_NEED_CONTENT
+    CL_NEED_CONTENT,
+    CL_NEED_MEMORY
 } CacheState;
 
 /* This is the context structure for the this module */
@@ -71,8 +112,28 @@ typedef struct _cache_info {
     struct stat		stat_info;	      /* Contains actual file chosen */
     HTNet *		net;
     HTTimer *		timer;
+    HTIOBuffer *	buffer;			 /* If served from memory */
+    long		length;
+    HTStream *		target;
+    BOOL		deflated;	      /* Body was deflated by us */
 } cache_info;
 
+/*
+**  Small entries which are hit often are also kept in memory together with
+**  their metainformation so that a hit doesn't have to go to the file
+**  system. The body is followed by the meta file in the same buffer.
+*/
+typedef struct _MemoryObject MemoryObject;
+struct _MemoryObject {
+    HTIOBuffer *	buffer;
+    long		body;			     /* Length of the body */
+    long		meta;		 /* Length of the metainformation */
+    unsigned int	key;			       /* Hash of the URL */
+    HTCache *		cache;
+    MemoryObject *	prev;					/* LRU list */
+    MemoryObject *	next;
+};
+
 struct _HTCache {
     /* Location */
     int 		hash;
@@ -91,8 +152,115 @@ struct _HTCache {
     time_t		response_time;
     time_t		corrected_initial_age;
     HTRequest *		lock;
+
+    /* Eviction */
+    double		priority;			  /* GDSF priority */
+    int			heap;		/* Position in heap plus one, 0 if none */
+    int			segment;		   /* SLRU segment, 0 if none */
+    long		evict_size;	     /* Size known to the eviction policy */
+    HTCache *		prev;				    /* SLRU segment list */
+    HTCache *		next;
+
+    MemoryObject *	memory;			/* NULL if not in memory */
+    char *		blob;		  /* Shared body, NULL if own file */
+    BOOL		deflated;		/* Body stored deflated */
 };
 
+/*
+**  With deduplication, complete bodies are moved into a store where the
+**  file name is the hash and the size of the content. Entries with the same
+**  content share the file which is removed when the last entry goes. The
+**  reference counts are not saved but counted again from the index.
+*/
+typedef struct _Blob {
+    char *		name;
+    int			refs;
+    long		size;
+} Blob;
+
+/*
+**  An eviction policy keeps the cache objects in memory in some order and
+**  is told about every change which can move an object in that order, so
+**  that the next victim is always at hand. Entries which are still only in
+**  the binary index haven't been used since it was read, and the policy
+**  says whether such an entry goes before the objects it knows about.
+*/
+typedef struct _EvictionClass {
+    const char *	name;
+    void		(*add)		(HTCache * me);
+    void		(*touch)	(HTCache * me);		   /* Cache hit */
+    void		(*resize)	(HTCache * me);
+    void		(*remove)	(HTCache * me);
+    HTCache *		(*victim)	(void);
+    void		(*evicted)	(HTCache * me);
+    BOOL		(*cold)		(long size, int hits);
+    void		(*clear)	(void);
+} EvictionClass;
+
+typedef struct _SLRUSegment {
+    HTCache *		head;				  /* Most recently used */
+    HTCache *		tail;
+    long		bytes;
+} SLRUSegment;
+
+/*
+**  The binary index is a header, a hash table of entry numbers (plus one,
+**  0 is empty), the entries, and an area with the strings. It is mapped
+**  into memory as it is and entries are only turned into cache objects
+**  when they are used.
+*/
+typedef struct _IndexHead {
+    char		magic[8];
+    unsigned int	order;
+    unsigned int	longsize;
+    unsigned int	entrysize;
+    unsigned int	generation;	     /* Journal belonging to index */
+    unsigned int	count;			       /* Number of entries */
+    unsigned int	buckets;		   /* Hash buckets, power of 2 */
+    long		strings;		   /* Size of string area */
+    long		content;		/* Sum of the entity sizes */
+    long		length;			     /* Length of whole file */
+} IndexHead;
+
+#define ENTRY_RANGE		0x1
+#define ENTRY_REVALIDATE	0x2
+#define ENTRY_BLOB		0x4	/* Blob name follows the other strings */
+#define ENTRY_DEFLATED		0x8
+
+typedef struct _IndexEntry {
+    unsigned int	key;			       /* Hash of the URL */
+    unsigned int	url;		   /* Offsets into the string area */
+    unsigned int	cachename;
+    unsigned int	etag;			     /* 0 if there is no etag */
+    long		lm;
+    long		expires;
+    long		size;
+    long		freshness_lifetime;
+    long		response_time;
+    long		corrected_initial_age;
+    int			hash;
+    int			hits;
+    int			flags;
+} IndexEntry;
+
+/*
+**  Changes since the index was written are appended to the journal. Each
+**  record is a header and a payload. The first record starts the journal
+**  and has the generation of the index in place of the checksum.
+*/
+typedef enum _JournalOp {
+    JOURNAL_BEGIN	= 0,
+    JOURNAL_PUT,
+    JOURNAL_DELETE
+} JournalOp;
+
+typedef struct _JournalHead {
+    unsigned int	magic;
+    unsigned int	op;
+    unsigned int	length;			      /* Length of payload */
+    unsigned int	sum;			   /* Checksum of payload */
+} JournalHead;
+
 struct _HTStream {
     const HTStreamClass *	isa;
     FILE *			fp;
@@ -103,6 +271,12 @@ struct _HTStream {
     HTChunk *			buffer;			/* For index reading */
     HTEOLState			EOLstate;
     BOOL			append;		   /* Creating or appending? */
+    BOOL			dedup;		  /* Is the body to be shared? */
+    unsigned int		sum;		   /* Hash of what we wrote */
+#ifdef HT_ZLIB
+    z_stream *			zstream;	    /* If we deflate the body */
+    char *			zbuf;
+#endif
 };
 
 struct _HTInputStream {
@@ -121,7 +295,20 @@ PRIVATE HTDisconnectedMode DisconnectedMode = HT_DISCONNECT_NONE;
 PRIVATE int DefaultExpiration = NO_LM_EXPIRATION;
 
 /* List of cache entries */
-PRIVATE HTList ** 	CacheTable = NULL;
+PRIVATE HTHashtable *	CacheTable = NULL;	    /* Entries keyed by URL */
+
+/* The binary index and the journal */
+PRIVATE IndexHead *	IndexHeader = NULL;
+PRIVATE long		IndexLength = 0;
+PRIVATE BOOL		IndexMapped = NO;	   /* mmap()ed or read in */
+PRIVATE unsigned int *	IndexBuckets = NULL;
+PRIVATE IndexEntry *	IndexEntries = NULL;
+PRIVATE char *		IndexStrings = NULL;
+PRIVATE char *		IndexDropped = NULL;	 /* Entries not in the index */
+PRIVATE unsigned int	IndexLive = 0;	      /* Entries still in the index */
+PRIVATE unsigned int	IndexGeneration = 0;
+PRIVATE FILE *		JournalFp = NULL;
+PRIVATE long		JournalRecords = 0;
 
 /* Cache size variables */
 PRIVATE long		HTCacheTotalSize = HT_CACHE_TOTAL_SIZE*MEGA;
@@ -130,213 +317,2076 @@ PRIVATE long		HTCacheGCBuffer = (HT_CACHE_TOTAL_SIZE*MEGA)/HT_CACHE_GC_PCT;
 PRIVATE long		HTCacheContentSize = 0L;
 PRIVATE long		HTCacheMaxEntrySize = HT_MAX_CACHE_ENTRY_SIZE*MEGA;
 
-PRIVATE int		new_entries = 0;	   /* Number of new entries */
-
 PRIVATE HTNetBefore	HTCacheFilter;
 PRIVATE HTNetAfter	HTCacheUpdateFilter;
 PRIVATE HTNetAfter	HTCacheCheckFilter;
 
+/* Eviction */
+PRIVATE HTCache **	Heap = NULL;			 /* GDSF priority queue */
+PRIVATE int		HeapSize = 0;
+PRIVATE int		HeapAlloc = 0;
+PRIVATE double		Inflation = 0.0;   /* GDSF priority of last victim */
+PRIVATE SLRUSegment	Probation;
+PRIVATE SLRUSegment	Protected;
+PRIVATE HTTimer *	GCTimer = NULL;
+PRIVATE unsigned int	IndexCursor = 0;	/* Next index entry to look at */
+PRIVATE BOOL		GCIndexAll = NO;	 /* Evict all of the index */
+
+/* Hit ratios */
+PRIVATE long		CacheLookups = 0;
+PRIVATE long		CacheHits = 0;
+PRIVATE long		CacheHitBytes = 0;
+PRIVATE long		CacheMissBytes = 0;
+
+/* Memory tier */
+PRIVATE long		MemorySize = HT_CACHE_MEMORY_SIZE*MEGA;
+PRIVATE long		MemoryMaxEntrySize = HT_MAX_MEMORY_ENTRY_SIZE*1024L;
+PRIVATE long		MemoryUsed = 0;
+PRIVATE MemoryObject *	MemoryHead = NULL;		  /* Most recently used */
+PRIVATE MemoryObject *	MemoryTail = NULL;
+PRIVATE long		MemoryHits = 0;
+PRIVATE unsigned char *	Sketch = NULL;		    /* TinyLFU frequencies */
+PRIVATE unsigned int	SketchWidth = 0;
+PRIVATE long		SketchAdds = 0;
+
+/* Deduplication */
+PRIVATE BOOL		DedupEnabled = NO;
+PRIVATE HTHashtable *	BlobTable = NULL;
+PRIVATE long		BlobSaved = 0;	      /* Bytes not stored twice */
+
+/* Compressed bodies */
+PRIVATE HTCacheCompression Compression = HT_CACHE_COMPRESS_NONE;
+PRIVATE int		CompressionLevel = 1;		   /* Best speed */
+PRIVATE long		CompressionSaved = 0;
+
+PRIVATE BOOL delete_object (HTCache * me);
+PRIVATE IndexEntry * index_entry (unsigned int i);
+PRIVATE void index_evict (unsigned int i);
+PRIVATE BOOL journal_delete (const char * url);
+PRIVATE BOOL journal_due (void);
+PRIVATE void index_compact (void);
+PRIVATE void compact_abort (void);
+PRIVATE char * HTCache_metaLocation (HTCache * cache);
+
+/* ------------------------------------------------------------------------- */
+/*  			GREEDY DUAL SIZE FREQUENCY			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	The priority of an entry is its hit count times the cost of fetching
+**	it again divided by its size plus the priority of the last victim, so
+**	that entries which haven't been used for a long time eventually are
+**	evicted too. The cost is the number of packets it takes to send the
+**	entity plus two for setting up the connection.
+*/
+PRIVATE double gdsf_value (long size, int hits)
+{
+    double cost;
+    if (size <= 0) size = 1;
+    cost = 2.0 + (double) size / GDSF_PACKET;
+    return (hits + 1) * cost / size;
+}
+
+PRIVATE double gdsf_priority (HTCache * me)
+{
+    return Inflation + gdsf_value(me->size, me->hits);
+}
+
+PRIVATE void heap_set (int pos, HTCache * me)
+{
+    Heap[pos] = me;
+    me->heap = pos + 1;
+}
+
+PRIVATE void heap_up (int pos)
+{
+    HTCache * me = Heap[pos];
+    while (pos > 0) {
+	int parent = (pos - 1) / 2;
+	if (Heap[parent]->priority <= me->priority) break;
+	heap_set(pos, Heap[parent]);
+	pos = parent;
+    }
+    heap_set(pos, me);
+}
+
+PRIVATE void heap_down (int pos)
+{
+    HTCache * me = Heap[pos];
+    for (;;) {
+	int child = 2 * pos + 1;
+	if (child >= HeapSize) break;
+	if (child+1 < HeapSize && Heap[child+1]->priority < Heap[child]->priority)
+	    child++;
+	if (me->priority <= Heap[child]->priority) break;
+	heap_set(pos, Heap[child]);
+	pos = child;
+    }
+    heap_set(pos, me);
+}
+
+PRIVATE void gdsf_update (HTCache * me)
+{
+    if (me->heap) {
+	int pos = me->heap - 1;
+	me->priority = gdsf_priority(me);
+	me->evict_size = me->size;
+	heap_up(pos);
+	heap_down(me->heap - 1);
+    }
+}
+
+PRIVATE void gdsf_add (HTCache * me)
+{
+    if (HeapSize >= HeapAlloc) {
+	HeapAlloc = HeapAlloc ? 2 * HeapAlloc : 256;
+	if ((Heap = (HTCache **) HT_REALLOC(Heap, HeapAlloc * sizeof(HTCache *))) == NULL)
+	    HT_OUTOFMEM("gdsf_add");
+    }
+    me->priority = gdsf_priority(me);
+    me->evict_size = me->size;
+    heap_set(HeapSize++, me);
+    heap_up(HeapSize - 1);
+}
+
+PRIVATE void gdsf_remove (HTCache * me)
+{
+    if (me->heap) {
+	int pos = me->heap - 1;
+	HTCache * last = Heap[--HeapSize];
+	me->heap = 0;
+	if (last != me) {
+	    heap_set(pos, last);
+	    heap_up(pos);
+	    heap_down(last->heap - 1);
+	}
+    }
+}
+
+PRIVATE HTCache * gdsf_victim (void)
+{
+    return HeapSize ? Heap[0] : NULL;
+}
+
+PRIVATE void gdsf_evicted (HTCache * me)
+{
+    if (me->priority > Inflation) Inflation = me->priority;
+}
+
+/*
+**	An entry in the index was last given a priority before the index was
+**	read, so it has none of the inflation since. It goes if it isn't
+**	worth more than the next victim in memory.
+*/
+PRIVATE BOOL gdsf_cold (long size, int hits)
+{
+    double priority = gdsf_value(size, hits);
+    if (HeapSize && priority > Heap[0]->priority) return NO;
+    if (priority > Inflation) Inflation = priority;
+    return YES;
+}
+
+PRIVATE void gdsf_clear (void)
+{
+    HT_FREE(Heap);
+    HeapSize = HeapAlloc = 0;
+    Inflation = 0.0;
+}
+
+PRIVATE const EvictionClass GDSFClass =
+{
+    "GDSF",
+    gdsf_add,
+    gdsf_update,
+    gdsf_update,
+    gdsf_remove,
+    gdsf_victim,
+    gdsf_evicted,
+    gdsf_cold,
+    gdsf_clear
+};
+
+/* ------------------------------------------------------------------------- */
+/*  				SEGMENTED LRU				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	New entries go into the probation segment. An entry which is hit
+**	moves to the protected segment, and when that grows beyond its share
+**	of the cache its least recently used entries drop back into
+**	probation. Victims are taken from the end of probation first, so a
+**	burst of entries which are used only once can't push out the ones
+**	which are used again and again.
+*/
+PRIVATE SLRUSegment * slru_segment (HTCache * me)
+{
+    return me->segment == 1 ? &Probation :
+	me->segment == 2 ? &Protected : NULL;
+}
+
+PRIVATE void slru_unlink (HTCache * me)
+{
+    SLRUSegment * seg = slru_segment(me);
+    if (seg) {
+	if (me->prev) me->prev->next = me->next; else seg->head = me->next;
+	if (me->next) me->next->prev = me->prev; else seg->tail = me->prev;
+	seg->bytes -= me->evict_size;
+	me->prev = me->next = NULL;
+	me->segment = 0;
+    }
+}
+
+PRIVATE void slru_push (HTCache * me, int segment)
+{
+    SLRUSegment * seg;
+    me->segment = segment;
+    seg = slru_segment(me);
+    me->prev = NULL;
+    me->next = seg->head;
+    if (seg->head) seg->head->prev = me; else seg->tail = me;
+    seg->head = me;
+    me->evict_size = me->size;
+    seg->bytes += me->evict_size;
+}
+
+PRIVATE void slru_add (HTCache * me)
+{
+    slru_push(me, 1);
+}
+
+PRIVATE void slru_touch (HTCache * me)
+{
+    long limit = HTCacheTotalSize / 100 * SLRU_PROTECTED_PCT;
+    slru_unlink(me);
+    slru_push(me, 2);
+    while (Protected.bytes > limit && Protected.tail != me) {
+	HTCache * demote = Protected.tail;
+	slru_unlink(demote);
+	slru_push(demote, 1);
+    }
+}
+
+PRIVATE void slru_resize (HTCache * me)
+{
+    SLRUSegment * seg = slru_segment(me);
+    if (seg) {
+	seg->bytes += me->size - me->evict_size;
+	me->evict_size = me->size;
+    }
+}
+
+PRIVATE HTCache * slru_victim (void)
+{
+    return Probation.tail ? Probation.tail : Protected.tail;
+}
+
+/*
+**	An entry which hasn't been used since the index was read is older
+**	than anything in probation
+*/
+PRIVATE BOOL slru_cold (long size, int hits)
+{
+    return YES;
+}
+
+PRIVATE void slru_clear (void)
+{
+    memset(&Probation, 0, sizeof(SLRUSegment));
+    memset(&Protected, 0, sizeof(SLRUSegment));
+}
+
+PRIVATE const EvictionClass SLRUClass =
+{
+    "SLRU",
+    slru_add,
+    slru_touch,
+    slru_resize,
+    slru_unlink,
+    slru_victim,
+    NULL,
+    slru_cold,
+    slru_clear
+};
+
+PRIVATE const EvictionClass * Eviction = &GDSFClass;
+
+/*
+**	All cache objects go through here when they are added to the table
+*/
+PRIVATE void cache_add (HTCache * me)
+{
+    if (!CacheTable)
+	CacheTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE, HT_HASH_KEYREF);
+    HTHashtable_addObject(CacheTable, me->url, (void *) me);
+    Eviction->add(me);
+}
+
 /* ------------------------------------------------------------------------- */
 /*  			     CACHE GARBAGE COLLECTOR			     */
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Shared bodies only take up space once
+*/
 PRIVATE BOOL stopGC (void)
 {
-    return (HTCacheContentSize + HTCacheFolderSize < HTCacheTotalSize - HTCacheGCBuffer);
+    return (HTCacheContentSize - BlobSaved + HTCacheFolderSize <
+	    HTCacheTotalSize - HTCacheGCBuffer);
 }
 
 PRIVATE BOOL startGC (void)
 {
-    return (HTCacheContentSize + HTCacheFolderSize > HTCacheTotalSize);
+    return (HTCacheContentSize - BlobSaved + HTCacheFolderSize > HTCacheTotalSize);
+}
+
+/*
+**	Do garbage collection for at most `slice' milliseconds, or until done
+**	if it is 0. First we go through the entries which are still only in
+**	the binary index and evict those the policy finds cold without making
+**	cache objects of them. Then we remove victims until we are below the
+**	low water mark, and if that isn't enough we go through the index once
+**	more taking everything. Locked entries are skipped and put back
+**	afterwards. Returns YES when there is nothing more to do.
+*/
+PRIVATE BOOL cache_gc (ms_t slice)
+{
+    ms_t end = slice ? HTGetTimeInMillis() + slice : 0;
+    HTList * skipped = NULL;
+    BOOL timeout = NO;
+    int cnt = 0;
+    while (!timeout && !stopGC()) {
+	HTCache * pres;
+	if (IndexHeader && IndexLive && IndexCursor < IndexHeader->count) {
+	    IndexEntry * entry = index_entry(IndexCursor);
+	    if (entry && (GCIndexAll || Eviction->cold(entry->size, entry->hits))) {
+		journal_delete(IndexStrings + entry->url);
+		index_evict(IndexCursor);
+	    }
+	    IndexCursor++;
+	} else if ((pres = Eviction->victim()) != NULL) {
+	    if (HTCache_hasLock(pres)) {
+		Eviction->remove(pres);
+		if (!skipped) skipped = HTList_new();
+		HTList_addObject(skipped, pres);
+	    } else {
+		if (Eviction->evicted) Eviction->evicted(pres);
+		HTCache_remove(pres);
+	    }
+	} else if (!GCIndexAll && IndexHeader && IndexLive) {
+	    GCIndexAll = YES;
+	    IndexCursor = 0;
+	} else
+	    break;
+	timeout = end && ++cnt % GC_CHECK == 0 && HTGetTimeInMillis() >= end;
+    }
+    if (skipped) {
+	HTList * cur = skipped;
+	HTCache * next;
+	while ((next = (HTCache *) HTList_nextObject(cur)))
+	    Eviction->add(next);
+	HTList_delete(skipped);
+    }
+    return !timeout || stopGC();
+}
+
+PRIVATE void gc_reset (void)
+{
+    IndexCursor = 0;
+    GCIndexAll = NO;
+}
+
+PRIVATE void gc_done (long old_size)
+{
+    HTTRACE(CACHE_TRACE, "Cache....... Size reduced from %ld to %ld, hit ratio %.3f, byte hit ratio %.3f\n" _ 
+	    old_size _ HTCacheContentSize _
+	    HTCacheMode_hitRatio() _ HTCacheMode_byteHitRatio());
+}
+
+/*
+**	The incremental garbage collector runs a slice at a time from a
+**	timer so that we don't stop the event loop for a long time
+*/
+PRIVATE long GCStartSize = 0;
+
+PRIVATE int gc_timeout (HTTimer * timer, void * param, HTEventType type)
+{
+    if (cache_gc(GC_SLICE)) {
+	HTTimer_delete(GCTimer);
+	GCTimer = NULL;
+	gc_done(GCStartSize);
+	if (journal_due()) index_compact();
+    }
+    return HT_OK;
+}
+
+PRIVATE void gc_start (void)
+{
+    if (!GCTimer) {
+	HTAlertCallback * cbf = HTAlert_find(HT_PROG_OTHER);
+	if (cbf) (*cbf)(NULL, HT_PROG_OTHER, HT_MSG_NULL,NULL, NULL, NULL);
+	HTTRACE(CACHE_TRACE, "Cache....... Starting %s garbage collection\n" _ 
+		Eviction->name);
+	GCStartSize = HTCacheContentSize;
+	gc_reset();
+	GCTimer = HTTimer_new(NULL, gc_timeout, NULL, GC_INTERVAL, YES, YES);
+    }
+}
+
+PRIVATE void gc_stop (void)
+{
+    if (GCTimer) {
+	HTTimer_delete(GCTimer);
+	GCTimer = NULL;
+    }
 }
 
+/*
+**	Garbage collect all in one go. This is only done when the size limits
+**	are lowered.
+*/
 PRIVATE BOOL HTCacheGarbage (void)
 {
     long old_size = HTCacheContentSize;
     HTTRACE(CACHE_TRACE, "Cache....... Garbage collecting\n");
-    if (CacheTable) {
-	time_t cur_time = time(NULL);
-	HTList * cur;
-	int cnt;
-	int hits;
+    if (CacheTable || IndexHeader) {
+	HTCache * pres;
+	int pos = 0;
+	gc_stop();
 
 	/*
-	**  Tell the user that we're gc'ing.
+	**  Entries which have become too big go first
 	*/
-	{
-	    HTAlertCallback * cbf = HTAlert_find(HT_PROG_OTHER);
-	    if (cbf) (*cbf)(NULL, HT_PROG_OTHER, HT_MSG_NULL,NULL, NULL, NULL);
+	if (IndexHeader) {
+	    unsigned int i;
+	    for (i = 0; IndexLive && i < IndexHeader->count; i++) {
+		IndexEntry * entry = index_entry(i);
+		if (entry && entry->size > HTCacheMaxEntrySize) index_evict(i);
+	    }
 	}
+	while (CacheTable &&
+	       (pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos))) {
+	    if (pres->size > HTCacheMaxEntrySize)
+		HTCache_remove(pres);
+	}
+	gc_reset();
+	cache_gc(0);
+	gc_done(old_size);
 
 	/*
-	**  Walk through and delete all the expired entries. If this is not
-	**  sufficient then take the fresh ones which have the lowest cache
-	**  hit count. This algorithm could be made a lot fancier by including
-	**  the size and also the pain it took to get the document in the first
-	**  case. It could also include max_stale.
+	**  Dump the new content to the index file
 	*/
-	HTTRACE(CACHE_TRACE, "Cache....... Collecting Stale entries\n");
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = CacheTable[cnt])) { 
-		HTList * old_cur = cur;
-		HTCache * pres;
-		while ((pres = (HTCache *) HTList_nextObject(cur)) != NULL) {
-		    time_t resident_time = cur_time - pres->response_time;
-		    time_t current_age = pres->corrected_initial_age +
-			resident_time;
-		    /* 2000-08-08 Jens Meggers: HTCache_remove doesn't
-		       remove a cache entry if it's locked. To avoid
-		       an endless loop, we check the return value of 
-		       HTCache_remove before skipping the entry. */
-		    if ((pres->freshness_lifetime < current_age)
-			&& HTCache_remove(pres)) {
-			cur = old_cur;
-		    } else {
-			old_cur = cur;
-		    }
-		    if (stopGC()) break;
-		}
+	HTCacheIndex_write(HTCacheRoot);
+	return YES;
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			       SHARED BODIES				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	The name of a blob is its hash and size. As the hash is short we
+**	compare the content before sharing a blob so a collision only means
+**	that the body is stored on its own.
+*/
+PRIVATE char * blob_name (unsigned int sum, long size)
+{
+    char * name;
+    if ((name = (char *) HT_MALLOC(strlen(HTCacheRoot) +
+				   strlen(HT_CACHE_BLOBS) + 32)) == NULL)
+	HT_OUTOFMEM("blob_name");
+    sprintf(name, "%s%s%02x/%08x-%ld", HTCacheRoot, HT_CACHE_BLOBS,
+	    sum & 0xFF, sum, size);
+    return name;
+}
+
+PRIVATE Blob * blob_find (const char * name)
+{
+    return (BlobTable && name) ? (Blob *) HTHashtable_object(BlobTable, name) : NULL;
+}
+
+/*
+**	Add a reference to a blob. The size is taken from the name so that
+**	it is the same for all the entries sharing it.
+*/
+PRIVATE Blob * blob_ref (const char * name)
+{
+    Blob * me = blob_find(name);
+    if (!me) {
+	char * size = strrchr(name, '-');
+	if ((me = (Blob *) HT_CALLOC(1, sizeof(Blob))) == NULL)
+	    HT_OUTOFMEM("blob_ref");
+	StrAllocCopy(me->name, name);
+	me->size = size ? atol(size + 1) : 0;
+	if (!BlobTable)
+	    BlobTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE, HT_HASH_KEYREF);
+	HTHashtable_addObject(BlobTable, me->name, (void *) me);
+    } else
+	BlobSaved += me->size;
+    me->refs++;
+    return me;
+}
+
+/*
+**	Let go of the blob used by an entry. The file is removed when nobody
+**	uses it anymore, unless we are only dropping the entry from memory.
+**	If we don't know the blob then we leave the file alone.
+*/
+PRIVATE void blob_unref (HTCache * cache, BOOL remove)
+{
+    Blob * me = blob_find(cache->blob);
+    if (me) {
+	if (--me->refs > 0)
+	    BlobSaved -= me->size;
+	else {
+	    if (remove) {
+		HTTRACE(CACHE_TRACE, "Cache....... Removing blob `%s\'\n" _ me->name);
+		REMOVE(me->name);
 	    }
+	    HTHashtable_removeEntry(BlobTable, me->name, (void *) me);
+	    HT_FREE(me->name);
+	    HT_FREE(me);
 	}
+    }
+    HT_FREE(cache->blob);
+}
 
-	/*
-	**  We must at least free the min buffer size so that we don't
-	**  dead lock ourselves. We start from the bottom up by taking
-	**  all the documents with 0 hits, 1 hits, 2 hits, etc.
-	*/
-	HTTRACE(CACHE_TRACE, "Cache....... Collecting least used entries\n");
-	hits = 0;
-	while (startGC()) {
-	    BOOL removed = NO;
-	    HTTRACE(CACHE_TRACE, "Cache....... Collecting entries with %d hits\n" _ hits);
-	    for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-		if ((cur = CacheTable[cnt])) { 
-		    HTList * old_cur = cur;
-		    HTCache * pres;
-		    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-			/* 2000-08-08 Jens Meggers: HTCache_remove doesn't
-			   remove a cache entry if it's locked. To avoid
-			   going into an endless loop, we check the return
-			   value of  HTCache_remove before marking the
-			   object as removed. */
-			if ((pres->size > HTCacheMaxEntrySize 
-			     || pres->hits <= hits) 
-			    && HTCache_remove(pres)) {
-			    cur = old_cur;
-			    removed = YES;
-			} else {
-			    old_cur = cur;
-			}
-			if (stopGC()) break;
-		    }
-		}
-	    }
-	    if (!removed) break;
-	    hits++;
+PRIVATE void blob_release (HTCache * cache)
+{
+    blob_unref(cache, YES);
+}
+
+PRIVATE void blob_clear (void)
+{
+    if (BlobTable) {
+	Blob * pres;
+	int pos = 0;
+	while ((pres = (Blob *) HTHashtable_nextObject(BlobTable, &pos))) {
+	    HT_FREE(pres->name);
+	    HT_FREE(pres);
+	}
+	HTHashtable_delete(BlobTable);
+	BlobTable = NULL;
+    }
+    BlobSaved = 0;
+}
+
+PRIVATE BOOL blob_dir (unsigned int sum)
+{
+    char * path;
+    struct stat stat_info;
+    BOOL status = YES;
+    if ((path = (char *) HT_MALLOC(strlen(HTCacheRoot) +
+				   strlen(HT_CACHE_BLOBS) + 3)) == NULL)
+	HT_OUTOFMEM("blob_dir");
+    sprintf(path, "%s%s", HTCacheRoot, HT_CACHE_BLOBS);
+    path[strlen(path)-1] = '\0';
+    if (HT_STAT(path, &stat_info) == -1) MKDIR(path, 0777);
+    sprintf(path, "%s%s%02x", HTCacheRoot, HT_CACHE_BLOBS, sum & 0xFF);
+    if (HT_STAT(path, &stat_info) == -1 && MKDIR(path, 0777) < 0) {
+	HTTRACE(CACHE_TRACE, "Cache....... Can't create `%s\'\n" _ path);
+	status = NO;
+    }
+    HT_FREE(path);
+    return status;
+}
+
+PRIVATE BOOL files_equal (const char * a, const char * b)
+{
+    FILE * fa = fopen(a, "rb");
+    FILE * fb = fopen(b, "rb");
+    BOOL equal = fa && fb;
+    if (equal) {
+	char * ba;
+	char * bb;
+	size_t la, lb;
+	if ((ba = (char *) HT_MALLOC(2 * BLOB_COMPARE_SIZE)) == NULL)
+	    HT_OUTOFMEM("files_equal");
+	bb = ba + BLOB_COMPARE_SIZE;
+	do {
+	    la = fread(ba, 1, BLOB_COMPARE_SIZE, fa);
+	    lb = fread(bb, 1, BLOB_COMPARE_SIZE, fb);
+	    equal = (la == lb && !memcmp(ba, bb, la));
+	} while (equal && la == BLOB_COMPARE_SIZE);
+	HT_FREE(ba);
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return equal;
+}
+
+/*
+**	Move the body of a complete entry into the store, or remove it if
+**	the store already has the same content.
+*/
+PRIVATE BOOL blob_store (HTCache * cache, unsigned int sum)
+{
+    char * name;
+    Blob * blob;
+    if (!HTCacheRoot || cache->blob || cache->size <= 0) return NO;
+    name = blob_name(sum, cache->size);
+    if ((blob = blob_find(name)) != NULL) {
+	if (!files_equal(name, cache->cachename)) {
+	    HTTRACE(CACHE_TRACE, "Cache....... `%s\' differs from blob `%s\'\n" _ 
+		    cache->cachename _ name);
+	    HT_FREE(name);
+	    return NO;
+	}
+	REMOVE(cache->cachename);
+    } else {
+	if (!blob_dir(sum)) {
+	    HT_FREE(name);
+	    return NO;
+	}
+#ifdef WWW_MSWINDOWS
+	REMOVE(name);
+#endif
+	if (rename(cache->cachename, name) != 0) {
+	    HTTRACE(CACHE_TRACE, "Cache....... Can't move `%s\' to `%s\'\n" _ 
+		    cache->cachename _ name);
+	    HT_FREE(name);
+	    return NO;
+	}
+    }
+    blob = blob_ref(name);
+    HTTRACE(CACHE_TRACE, "Cache....... %p uses blob `%s\' with %d references\n" _ 
+	    cache _ name _ blob->refs);
+    cache->blob = name;
+    return YES;
+}
+
+/*
+**	Where the body of an entry is, and how to get rid of it
+*/
+PRIVATE const char * body_name (HTCache * cache)
+{
+    return cache->blob ? cache->blob : cache->cachename;
+}
+
+PRIVATE void body_remove (HTCache * cache)
+{
+    if (cache->blob)
+	blob_release(cache);
+    else
+	REMOVE(cache->cachename);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			      COMPRESSED BODIES				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	Write a block to the cache file. With deduplication we hash what
+**	goes into the file, so a deflated body is shared with other bodies
+**	which were deflated the same way.
+*/
+PRIVATE int cache_write (HTStream * me, const char * s, int l)
+{
+    int status = (fwrite(s, 1, l, me->fp) != l) ? HT_ERROR : HT_OK;
+    if (me->dedup) {
+	unsigned int sum = me->sum;
+	const unsigned char * p = (const unsigned char *) s;
+	const unsigned char * end = p + l;
+	while (p < end) sum = (sum ^ *p++) * BLOB_HASH_PRIME;
+	me->sum = sum;
+    }
+    return status;
+}
+
+#ifdef HT_ZLIB
+/*
+**	Text compresses well, most other types are compressed already
+*/
+PRIVATE BOOL zip_text (HTFormat format)
+{
+    const char * type = format ? HTAtom_name(format) : NULL;
+    int length = type ? strlen(type) : 0;
+    if (!type) return NO;
+    return (!strncasecomp(type, "text/", 5) ||
+	    (length > 4 && !strcasecomp(type + length - 4, "+xml")) ||
+	    !strcasecomp(type, "application/xml") ||
+	    !strcasecomp(type, "application/javascript") ||
+	    !strcasecomp(type, "application/x-javascript") ||
+	    !strcasecomp(type, "application/json") ||
+	    !strcasecomp(type, "application/postscript"));
+}
+
+/*
+**	Do we deflate this body when we store it? Not if it has a content
+**	coding already or we know that it is tiny.
+*/
+PRIVATE BOOL zip_wanted (HTParentAnchor * anchor)
+{
+    long length = HTAnchor_length(anchor);
+    if (Compression == HT_CACHE_COMPRESS_NONE ||
+	!HTList_isEmpty(HTAnchor_encoding(anchor)) ||
+	(length >= 0 && length < ZIP_MIN_SIZE))
+	return NO;
+    return Compression == HT_CACHE_COMPRESS_ALL ||
+	zip_text(HTAnchor_format(anchor));
+}
+
+PRIVATE BOOL zip_start (HTStream * me)
+{
+    int status;
+    if ((me->zstream = (z_stream *) HT_CALLOC(1, sizeof(z_stream))) == NULL ||
+	(me->zbuf = (char *) HT_MALLOC(ZIP_BUFFER_SIZE)) == NULL)
+	HT_OUTOFMEM("zip_start");
+    if ((status = deflateInit(me->zstream, CompressionLevel)) != Z_OK) {
+	HTTRACE(CACHE_TRACE, "Cache....... Can't deflate, zlib status %d\n" _ status);
+	HT_FREE(me->zstream);
+	HT_FREE(me->zbuf);
+	return NO;
+    }
+    HTTRACE(CACHE_TRACE, "Cache....... Deflating `%s\' with level %d\n" _ 
+	    me->cache->cachename _ CompressionLevel);
+    return YES;
+}
+
+/*
+**	Deflate a block into the cache file. Z_FINISH writes out the rest.
+*/
+PRIVATE int zip_write (HTStream * me, const char * s, int l, int flush)
+{
+    z_stream * z = me->zstream;
+    z->next_in = (Bytef *) s;
+    z->avail_in = l;
+    do {
+	z->next_out = (Bytef *) me->zbuf;
+	z->avail_out = ZIP_BUFFER_SIZE;
+	if (deflate(z, flush) == Z_STREAM_ERROR ||
+	    cache_write(me, me->zbuf, ZIP_BUFFER_SIZE - z->avail_out) != HT_OK)
+	    return HT_ERROR;
+    } while (z->avail_out == 0);
+    return HT_OK;
+}
+
+/*
+**	Returns the number of bytes we have written to the file
+*/
+PRIVATE long zip_end (HTStream * me)
+{
+    long written = (long) me->zstream->total_out;
+    HTTRACE(CACHE_TRACE, "Cache....... Deflated %lu bytes to %lu\n" _ 
+	    me->zstream->total_in _ me->zstream->total_out);
+    deflateEnd(me->zstream);
+    HT_FREE(me->zstream);
+    HT_FREE(me->zbuf);
+    return written;
+}
+
+/*
+**	Does the request take the deflate coding? Then it gets the body as
+**	if the origin server had sent it deflated.
+*/
+PRIVATE BOOL zip_accepted (HTRequest * request)
+{
+    HTList * codings[2];
+    int cnt;
+    codings[0] = HTRequest_encoding(request);
+    codings[1] = HTFormat_contentCoding();
+    for (cnt = 0; cnt < 2; cnt++) {
+	HTList * cur = codings[cnt];
+	HTCoding * pres;
+	while ((pres = (HTCoding *) HTList_nextObject(cur))) {
+	    if (!strcasecomp(HTCoding_name(pres), "deflate") &&
+		HTCoding_quality(pres) > 0.0)
+		return YES;
+	}
+    }
+    return NO;
+}
+#endif /* HT_ZLIB */
+
+/*
+**	Is the body in the file `local' one that we have deflated?
+*/
+PRIVATE BOOL body_deflated (HTParentAnchor * anchor, const char * local)
+{
+    HTCache * cache = HTCache_find(anchor, NULL);
+    return (cache && cache->deflated && cache->cachename &&
+	    !strcmp(body_name(cache), local));
+}
+
+/*
+**	Set up the stream stack for a cache hit. If we have deflated the body
+**	then it is either served like that or inflated on the way out. The
+**	anchor says which so that a proxy can send the right headers.
+*/
+PRIVATE HTStream * cache_stream (cache_info * cache, HTRequest * request)
+{
+    HTParentAnchor * anchor = HTRequest_anchor(request);
+    HTStream * target = HTStreamStack(HTAnchor_format(anchor),
+				      HTRequest_outputFormat(request),
+				      HTRequest_outputStream(request),
+				      request, YES);
+#ifdef HT_ZLIB
+    if (cache->deflated) {
+	HTEncoding deflate = HTAtom_for("deflate");
+	if (zip_accepted(request)) {
+	    HTTRACE(CACHE_TRACE, "Cache....... Serving `%s\' deflated\n" _ cache->local);
+	    HTAnchor_deleteEncoding(anchor, deflate);
+	    HTAnchor_addEncoding(anchor, deflate);
+	    HTAnchor_setLength(anchor, cache->buffer ? cache->length :
+			       (long) cache->stat_info.st_size);
+	    target = HTContentCodingStack(deflate, target, request, NULL, NO);
+	} else {
+	    HTTRACE(CACHE_TRACE, "Cache....... Inflating `%s\'\n" _ cache->local);
+	    if (HTAnchor_deleteEncoding(anchor, deflate))
+		HTAnchor_setLength(anchor, -1);
+	    target = HTZLib_inflate(request, NULL, deflate, target);
+	}
+    }
+#endif
+    return target;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			        MEMORY TIER				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	Admission is decided by TinyLFU. Every hit is counted in a count-min
+**	sketch of small saturating counters which are all halved now and then
+**	so that old popularity fades away. An entry only gets into memory if
+**	it has been used more often than the entries it would push out.
+*/
+PRIVATE unsigned int sketch_slot (unsigned int key, int row)
+{
+    unsigned int h = key * (0x9E3779B1U + 2*row);
+    h ^= h >> 15;
+    h *= 0x85EBCA77U;
+    h ^= h >> 13;
+    return (row * SketchWidth) + (h & (SketchWidth - 1));
+}
+
+PRIVATE int sketch_count (unsigned int key)
+{
+    int count = SKETCH_MAX;
+    int row;
+    if (!Sketch) return 0;
+    for (row = 0; row < SKETCH_DEPTH; row++) {
+	int value = Sketch[sketch_slot(key, row)];
+	if (value < count) count = value;
+    }
+    return count;
+}
+
+PRIVATE int sketch_add (unsigned int key)
+{
+    int count;
+    int row;
+    if (!Sketch) {
+	long entries = MemorySize / 256;
+	SketchWidth = SKETCH_MIN_WIDTH;
+	while ((long) SketchWidth < entries && SketchWidth < 0x100000)
+	    SketchWidth <<= 1;
+	if ((Sketch = (unsigned char *) HT_CALLOC(SKETCH_DEPTH, SketchWidth)) == NULL)
+	    HT_OUTOFMEM("sketch_add");
+	SketchAdds = 0;
+    }
+
+    /* Conservative update: only the smallest counters go up */
+    if ((count = sketch_count(key)) < SKETCH_MAX) {
+	for (row = 0; row < SKETCH_DEPTH; row++) {
+	    unsigned char * counter = Sketch + sketch_slot(key, row);
+	    if (*counter == count) (*counter)++;
+	}
+	count++;
+    }
+    if (++SketchAdds >= (long) SketchWidth * SKETCH_SAMPLE) {
+	unsigned int i;
+	for (i = 0; i < SKETCH_DEPTH * SketchWidth; i++) Sketch[i] >>= 1;
+	SketchAdds /= 2;
+    }
+    return count;
+}
+
+PRIVATE void memory_unlink (MemoryObject * me)
+{
+    if (me->prev) me->prev->next = me->next;
+    else MemoryHead = me->next;
+    if (me->next) me->next->prev = me->prev;
+    else MemoryTail = me->prev;
+    me->prev = me->next = NULL;
+}
+
+PRIVATE void memory_push (MemoryObject * me)
+{
+    me->prev = NULL;
+    me->next = MemoryHead;
+    if (MemoryHead) MemoryHead->prev = me;
+    else MemoryTail = me;
+    MemoryHead = me;
+}
+
+/*
+**	Take an entry out of memory. This must be done whenever the entry
+**	changes on disk. Requests that are being served from the buffer keep
+**	their own reference to it.
+*/
+PRIVATE void memory_drop (HTCache * cache)
+{
+    MemoryObject * me = cache ? cache->memory : NULL;
+    if (me) {
+	memory_unlink(me);
+	MemoryUsed -= HTIOBuffer_size(me->buffer);
+	HTIOBuffer_unref(me->buffer);
+	cache->memory = NULL;
+	HT_FREE(me);
+    }
+}
+
+PRIVATE void memory_clear (void)
+{
+    while (MemoryTail) memory_drop(MemoryTail->cache);
+    HT_FREE(Sketch);
+    SketchWidth = 0;
+}
+
+/*
+**	Make room for `size' bytes if the candidate has been used more often
+**	than every entry it would push out
+*/
+PRIVATE BOOL memory_admit (long size, int count)
+{
+    MemoryObject * victim = MemoryTail;
+    long room = MemorySize - MemoryUsed;
+    if (size > MemorySize) return NO;
+    while (room < size && victim) {
+	if (sketch_count(victim->key) >= count) return NO;
+	room += HTIOBuffer_size(victim->buffer);
+	victim = victim->prev;
+    }
+    while (MemoryUsed + size > MemorySize && MemoryTail)
+	memory_drop(MemoryTail->cache);
+    return YES;
+}
+
+PRIVATE long memory_readFile (const char * name, char * data, long length)
+{
+    FILE * fp;
+    long bytes = -1;
+    if (name && (fp = fopen(name, "rb")) != NULL) {
+	bytes = (long) fread(data, 1, length + 1, fp);
+	if (ferror(fp)) bytes = -1;
+	fclose(fp);
+    }
+    return bytes;
+}
+
+/*
+**	Read the body and the metainformation of an entry into memory. The
+**	files are small so we read them in one go.
+*/
+PRIVATE BOOL memory_load (HTCache * cache, unsigned int key, int count)
+{
+    char * name = HTCache_metaLocation(cache);
+    struct stat stat_info;
+    long meta;
+    MemoryObject * me;
+    HTIOBuffer * buffer;
+    if (!name || HT_STAT(name, &stat_info) == -1) {
+	HT_FREE(name);
+	return NO;
+    }
+    meta = (long) stat_info.st_size;
+    if (!memory_admit(cache->size + meta, count)) {
+	HTTRACE(CACHE_TRACE, "Cache....... Not admitting %p to memory\n" _ cache);
+	HT_FREE(name);
+	return NO;
+    }
+    buffer = HTIOBuffer_new((size_t) (cache->size + meta + 1));
+    if (memory_readFile(body_name(cache), HTIOBuffer_data(buffer), cache->size) != cache->size ||
+	memory_readFile(name, HTIOBuffer_data(buffer) + cache->size, meta) != meta) {
+	HTTRACE(CACHE_TRACE, "Cache....... Can't read %p into memory\n" _ cache);
+	HTIOBuffer_unref(buffer);
+	HT_FREE(name);
+	return NO;
+    }
+    HT_FREE(name);
+    if ((me = (MemoryObject *) HT_CALLOC(1, sizeof(MemoryObject))) == NULL)
+	HT_OUTOFMEM("memory_load");
+    me->buffer = buffer;
+    me->body = cache->size;
+    me->meta = meta;
+    me->key = key;
+    me->cache = cache;
+    cache->memory = me;
+    memory_push(me);
+    MemoryUsed += HTIOBuffer_size(buffer);
+    HTTRACE(CACHE_TRACE, "Cache....... Loaded %p into memory, %ld bytes in use\n" _ 
+	    cache _ MemoryUsed);
+    return YES;
+}
+
+/*
+**	Count a hit on the cache file `local' and return a reference to the
+**	body in memory if we have it or it is admitted now. Entries which are
+**	being written or only partly cached are left to the file system.
+*/
+PRIVATE HTIOBuffer * memory_find (HTParentAnchor * anchor, const char * local,
+				  long * length)
+{
+    HTCache * cache;
+    unsigned int key;
+    int count;
+    if (MemorySize <= 0 || !local ||
+	(cache = HTCache_find(anchor, NULL)) == NULL ||
+	!cache->cachename || strcmp(body_name(cache), local) ||
+	HTCache_hasLock(cache) || cache->range)
+	return NULL;
+    key = HTHash_string(cache->url, NO);
+    count = sketch_add(key);
+    if (cache->memory) {
+	memory_unlink(cache->memory);
+	memory_push(cache->memory);
+    } else if (cache->size <= 0 || cache->size > MemoryMaxEntrySize ||
+	       !memory_load(cache, key, count))
+	return NULL;
+    MemoryHits++;
+    *length = cache->memory->body;
+    return HTIOBuffer_ref(cache->memory->buffer);
+}
+
+/*
+**	Map a big cache file into a buffer. A socket writer which gets a
+**	block from this buffer can send it straight from the file.
+*/
+PRIVATE HTIOBuffer * map_file (const char * local, long size)
+{
+    HTIOBuffer * buffer = NULL;
+#ifdef O_BINARY
+    int fd = open(local, O_RDONLY | O_BINARY);
+#else
+    int fd = open(local, O_RDONLY);
+#endif
+    if (fd >= 0 && (buffer = HTIOBuffer_newFile(fd, 0, (size_t) size)) == NULL)
+	close(fd);
+    return buffer;
+}
+
+/*
+**	Push a body from memory or a mapped file down the stream. The target
+**	may not be able to take it all at once in which case we carry on
+**	later.
+*/
+PRIVATE int memory_put (cache_info * cache)
+{
+    HTIOBuffer * previous = HTIOBuffer_setCurrent(cache->buffer);
+    int status = (*cache->target->isa->put_block)(cache->target,
+						  HTIOBuffer_data(cache->buffer),
+						  (int) cache->length);
+    HTIOBuffer_setCurrent(previous);
+    if (status == HT_OK || status == HT_LOADED || status == HT_CONTINUE)
+	return HT_OK;
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			      CACHE INDEX				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE char * cache_file_name (const char * cache_root, const char * name)
+{
+    if (cache_root) {
+	char * location = NULL;
+	if ((location = (char *)
+	     HT_MALLOC(strlen(cache_root) + strlen(name) + 1)) == NULL)
+	    HT_OUTOFMEM("cache_file_name");
+	strcpy(location, cache_root);
+	strcat(location, name);
+	return location;
+    }
+    return NULL;
+}
+
+/*
+**  Remove the cache index files
+*/
+PUBLIC BOOL HTCacheIndex_delete (const char * cache_root)
+{
+    if (cache_root) {
+	const char * names[] = { HT_CACHE_INDEX, HT_CACHE_BINDEX,
+				 HT_CACHE_JOURNAL, HT_CACHE_TMPJOURNAL };
+	int cnt;
+	for (cnt = 0; cnt < 4; cnt++) {
+	    char * index = cache_file_name(cache_root, names[cnt]);
+	    REMOVE(index);
+	    HT_FREE(index);
+	}
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	Convert between cache objects and index entries. The strings of an
+**	entry are stored after each other starting at `base' and the string
+**	area always starts with an empty string so that offset 0 means none.
+**	The blob name has no offset of its own but comes after the last of
+**	the other strings if the entry has one.
+*/
+PRIVATE void object_to_entry (HTCache * me, IndexEntry * entry, unsigned int base)
+{
+    entry->key = HTHash_string(me->url, NO);
+    entry->url = base;
+    entry->cachename = base + strlen(me->url) + 1;
+    entry->etag = me->etag ?
+	entry->cachename + strlen(me->cachename) + 1 : 0;
+    entry->lm = (long) me->lm;
+    entry->expires = (long) me->expires;
+    entry->size = me->size;
+    entry->freshness_lifetime = (long) me->freshness_lifetime;
+    entry->response_time = (long) me->response_time;
+    entry->corrected_initial_age = (long) me->corrected_initial_age;
+    entry->hash = me->hash;
+    entry->hits = me->hits;
+    entry->flags = (me->range ? ENTRY_RANGE : 0) |
+	(me->must_revalidate ? ENTRY_REVALIDATE : 0) |
+	(me->blob ? ENTRY_BLOB : 0) |
+	(me->deflated ? ENTRY_DEFLATED : 0);
+}
+
+PRIVATE unsigned int entry_blob (IndexEntry * entry, const char * strings)
+{
+    unsigned int last = entry->etag ? entry->etag : entry->cachename;
+    return (entry->flags & ENTRY_BLOB) ? last + strlen(strings + last) + 1 : 0;
+}
+
+PRIVATE void entry_to_object (IndexEntry * entry, const char * strings,
+			      HTCache * me)
+{
+    StrAllocCopy(me->url, strings + entry->url);
+    StrAllocCopy(me->cachename, strings + entry->cachename);
+    if (entry->etag)
+	StrAllocCopy(me->etag, strings + entry->etag);
+    else
+	HT_FREE(me->etag);
+    me->lm = (time_t) entry->lm;
+    me->expires = (time_t) entry->expires;
+    me->size = entry->size;
+    me->freshness_lifetime = (time_t) entry->freshness_lifetime;
+    me->response_time = (time_t) entry->response_time;
+    me->corrected_initial_age = (time_t) entry->corrected_initial_age;
+    me->hash = entry->hash;
+    me->hits = entry->hits;
+    me->range = (entry->flags & ENTRY_RANGE) ? YES : NO;
+    me->must_revalidate = (entry->flags & ENTRY_REVALIDATE) ? YES : NO;
+    me->deflated = (entry->flags & ENTRY_DEFLATED) ? YES : NO;
+    if (entry->flags & ENTRY_BLOB)
+	StrAllocCopy(me->blob, strings + entry_blob(entry, strings));
+    else
+	HT_FREE(me->blob);
+}
+
+/*
+**	Fill in the anchor with what we know from the index unless it already
+**	has the real metainformation.
+*/
+PRIVATE void object_to_anchor (HTCache * me)
+{
+    HTParentAnchor * parent = HTAnchor_parent(HTAnchor_findAddress(me->url));
+    if (!HTAnchor_headerParsed(parent)) {
+	HTAnchor_setExpires(parent, me->expires);
+	HTAnchor_setLastModified(parent, me->lm);
+	if (me->etag) HTAnchor_setEtag(parent, me->etag);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			      BINARY INDEX				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void index_close (void)
+{
+    compact_abort();
+    if (IndexHeader) {
+#ifdef HAVE_MMAP
+	if (IndexMapped)
+	    munmap((void *) IndexHeader, IndexLength);
+	else
+#endif
+	    HT_FREE(IndexHeader);
+	HT_FREE(IndexDropped);
+	IndexHeader = NULL;
+	IndexBuckets = NULL;
+	IndexEntries = NULL;
+	IndexStrings = NULL;
+	IndexMapped = NO;
+	IndexLength = 0;
+	IndexLive = 0;
+	gc_reset();
+    }
+}
+
+/*
+**	Check that the index was written by a machine like ours and that it
+**	is complete. A partial file can't get here as it is only renamed into
+**	place once it has been written but we check the length anyway. The
+**	string area must start and end with a null so that no string can run
+**	off the end of it.
+*/
+PRIVATE BOOL index_check (IndexHead * head, long length)
+{
+    const char * strings;
+    if (length < (long) sizeof(IndexHead) ||
+	strncmp(head->magic, INDEX_MAGIC, sizeof(head->magic)) ||
+	head->order != INDEX_ORDER ||
+	head->longsize != sizeof(long) ||
+	head->entrysize != sizeof(IndexEntry) ||
+	head->length != length ||
+	head->buckets < 2 || (head->buckets & (head->buckets-1)) ||
+	head->count >= head->buckets || head->strings < 1 ||
+	(unsigned long) head->buckets > (unsigned long) length / sizeof(unsigned int) ||
+	(unsigned long) head->count > (unsigned long) length / sizeof(IndexEntry))
+	return NO;
+    if (sizeof(IndexHead) + head->buckets * sizeof(unsigned int) +
+	head->count * sizeof(IndexEntry) + head->strings != (size_t) length)
+	return NO;
+    strings = (const char *) head + length - head->strings;
+    return (*strings == '\0' && strings[head->strings-1] == '\0');
+}
+
+/*
+**	All the strings of an entry must be in the string area. As the area
+**	ends with a null we can then look for the blob name after the others.
+*/
+PRIVATE BOOL entry_valid (IndexEntry * entry)
+{
+    unsigned long strings = (unsigned long) IndexHeader->strings;
+    return (entry->url > 0 && entry->url < strings &&
+	    entry->cachename > 0 && entry->cachename < strings &&
+	    entry->etag < strings && entry->size >= 0 &&
+	    (!(entry->flags & ENTRY_BLOB) ||
+	     entry_blob(entry, IndexStrings) < strings));
+}
+
+/*
+**	Get an entry which is still in the binary index. An entry which isn't
+**	valid is dropped as if it had never been there.
+*/
+PRIVATE IndexEntry * index_entry (unsigned int i)
+{
+    if (!IndexDropped[i]) {
+	IndexEntry * entry = IndexEntries + i;
+	if (entry_valid(entry)) return entry;
+	HTTRACE(CACHE_TRACE, "Cache Index. Entry %u is not valid - dropped\n" _ i);
+	IndexDropped[i] = 1;
+	IndexLive--;
+    }
+    return NULL;
+}
+
+PRIVATE BOOL index_open (const char * cache_root)
+{
+    char * file = cache_file_name(cache_root, HT_CACHE_BINDEX);
+    struct stat stat_info;
+    char * data = NULL;
+    long length = 0;
+    int fd;
+#ifdef O_BINARY
+    fd = file ? open(file, O_RDONLY | O_BINARY) : -1;
+#else
+    fd = file ? open(file, O_RDONLY) : -1;
+#endif
+    HT_FREE(file);
+    if (fd < 0) return NO;
+    if (fstat(fd, &stat_info) == 0 && stat_info.st_size >= (long) sizeof(IndexHead)) {
+	length = (long) stat_info.st_size;
+#ifdef HAVE_MMAP
+	data = (char *) mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == (char *) MAP_FAILED)
+	    data = NULL;
+	else
+	    IndexMapped = YES;
+#endif
+	if (!data) {
+	    long got = 0;
+	    int b_read;
+	    if ((data = (char *) HT_MALLOC(length)) == NULL)
+		HT_OUTOFMEM("index_open");
+	    while (got < length && (b_read = read(fd, data+got, length-got)) > 0)
+		got += b_read;
+	    if (got != length) HT_FREE(data);
+	}
+    }
+    close(fd);
+    if (!data) return NO;
+    IndexHeader = (IndexHead *) data;
+    IndexLength = length;
+    if (!index_check(IndexHeader, length)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Binary index is not valid - ignored\n");
+	index_close();
+	return NO;
+    }
+    IndexBuckets = (unsigned int *) (data + sizeof(IndexHead));
+    IndexEntries = (IndexEntry *) (IndexBuckets + IndexHeader->buckets);
+    IndexStrings = (char *) (IndexEntries + IndexHeader->count);
+    if (IndexHeader->count &&
+	(IndexDropped = (char *) HT_CALLOC(IndexHeader->count, 1)) == NULL)
+	HT_OUTOFMEM("index_open");
+    IndexLive = IndexHeader->count;
+    HTCacheContentSize += IndexHeader->content;
+    HTTRACE(CACHE_TRACE, "Cache Index. %s binary index with %u entries\n" _ 
+	    IndexMapped ? "Mapped" : "Read" _ IndexHeader->count);
+    return YES;
+}
+
+/*
+**	Look up a URL in the binary index. Returns the entry number or -1 if
+**	not found or if the entry has already been taken out of the index
+*/
+PRIVATE int index_find (const char * url)
+{
+    if (IndexHeader && IndexLive && url) {
+	unsigned int key = HTHash_string(url, NO);
+	unsigned int mask = IndexHeader->buckets - 1;
+	unsigned int slot = key & mask;
+	unsigned int probes = 0;
+	unsigned int i;
+	while ((i = IndexBuckets[slot]) != 0 && i <= IndexHeader->count &&
+	       probes++ < IndexHeader->buckets) {
+	    IndexEntry * entry = IndexEntries + i - 1;
+	    if (entry->key == key && entry->url > 0 &&
+		(long) entry->url < IndexHeader->strings &&
+		!strcmp(IndexStrings + entry->url, url))
+		return index_entry(i-1) ? (int) i - 1 : -1;
+	    slot = (slot + 1) & mask;
+	}
+    }
+    return -1;
+}
+
+/*
+**	Take an entry out of the binary index and make it a cache object in
+**	the cache table. From then on the cache object is the real thing.
+*/
+PRIVATE HTCache * index_load (int i)
+{
+    HTCache * me;
+    if ((me = (HTCache *) HT_CALLOC(1, sizeof(HTCache))) == NULL)
+	HT_OUTOFMEM("index_load");
+    entry_to_object(IndexEntries + i, IndexStrings, me);
+    IndexDropped[i] = 1;
+    IndexLive--;
+    cache_add(me);
+    object_to_anchor(me);
+    return me;
+}
+
+/*
+**	Remove an entry which is still only in the binary index from disk
+**	without making a cache object of it
+*/
+PRIVATE void index_evict (unsigned int i)
+{
+    IndexEntry * entry = IndexEntries + i;
+    HTCache cache;
+    char * meta;
+    memset((void *) &cache, '\0', sizeof(HTCache));
+    cache.cachename = IndexStrings + entry->cachename;
+    if (entry->flags & ENTRY_BLOB)
+	StrAllocCopy(cache.blob, IndexStrings + entry_blob(entry, IndexStrings));
+    HTTRACE(CACHE_TRACE, "Cache....... Evicting `%s\' from the index\n" _ 
+	    IndexStrings + entry->url);
+    if ((meta = HTCache_metaLocation(&cache)) != NULL) {
+	REMOVE(meta);
+	HT_FREE(meta);
+    }
+    body_remove(&cache);
+    HTCacheContentSize -= entry->size;
+    IndexDropped[i] = 1;
+    IndexLive--;
+}
+
+/*
+**	Find a cache object whether it is in the cache table already or still
+**	only in the binary index.
+*/
+PRIVATE HTCache * cache_lookup (const char * url)
+{
+    HTCache * pres = CacheTable ?
+	(HTCache *) HTHashtable_object(CacheTable, url) : NULL;
+    if (!pres) {
+	int i = index_find(url);
+	if (i >= 0) pres = index_load(i);
+    }
+    return pres;
+}
+
+PRIVATE long cache_entries (void)
+{
+    return (long) IndexLive + (CacheTable ? HTHashtable_count(CacheTable) : 0);
+}
+
+/*
+**	Walk through all live entries, first those still in the binary index
+**	and then those in the cache table. Returns the entry and its four
+**	strings. The order is the same every time as long as nothing changes.
+*/
+typedef struct _IndexWalk {
+    unsigned int	map;
+    int			table;
+} IndexWalk;
+
+PRIVATE void entry_strings (IndexEntry * entry, const char * strings,
+			    const char ** url, const char ** name,
+			    const char ** etag, const char ** blob)
+{
+    *url = strings + entry->url;
+    *name = strings + entry->cachename;
+    *etag = entry->etag ? strings + entry->etag : NULL;
+    *blob = (entry->flags & ENTRY_BLOB) ?
+	strings + entry_blob(entry, strings) : NULL;
+}
+
+PRIVATE BOOL index_next (IndexWalk * walk, IndexEntry * entry,
+			 const char ** url, const char ** name, const char ** etag,
+			 const char ** blob)
+{
+    if (IndexHeader) {
+	while (walk->map < IndexHeader->count) {
+	    IndexEntry * pres = index_entry(walk->map++);
+	    if (pres) {
+		*entry = *pres;
+		entry_strings(entry, IndexStrings, url, name, etag, blob);
+		return YES;
+	    }
+	}
+    }
+    if (CacheTable) {
+	HTCache * pres = (HTCache *) HTHashtable_nextObject(CacheTable, &walk->table);
+	if (pres) {
+	    object_to_entry(pres, entry, 0);
+	    *url = pres->url;
+	    *name = pres->cachename;
+	    *etag = pres->etag;
+	    *blob = pres->blob;
+	    return YES;
+	}
+    }
+    return NO;
+}
+
+/*
+**	Count the references to the blobs after the index has been read
+*/
+PRIVATE void blob_count (void)
+{
+    IndexWalk walk;
+    IndexEntry entry;
+    const char *url, *name, *etag, *blob;
+    blob_clear();
+    memset(&walk, 0, sizeof(walk));
+    while (index_next(&walk, &entry, &url, &name, &etag, &blob))
+	if (blob) blob_ref(blob);
+    HTTRACE(CACHE_TRACE, "Cache Index. %d blobs saving %ld bytes\n" _ 
+	    BlobTable ? HTHashtable_count(BlobTable) : 0 _ BlobSaved);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			      INDEX JOURNAL				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE unsigned int journal_sum (const char * data, unsigned int length)
+{
+    unsigned int sum = 0;
+    while (length-- > 0) sum = sum * 31 + (unsigned char) *data++;
+    return sum;
+}
+
+PRIVATE void journal_close (void)
+{
+    if (JournalFp) {
+	fclose(JournalFp);
+	JournalFp = NULL;
+    }
+    JournalRecords = 0;
+}
+
+PRIVATE BOOL journal_begin (FILE * fp, unsigned int generation)
+{
+    JournalHead head;
+    head.magic = JOURNAL_MAGIC;
+    head.op = JOURNAL_BEGIN;
+    head.length = 0;
+    head.sum = generation;
+    return fwrite(&head, sizeof(head), 1, fp) == 1;
+}
+
+/*
+**	Start a new, empty journal for the given index generation
+*/
+PRIVATE BOOL journal_reset (const char * cache_root, unsigned int generation)
+{
+    char * file = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+    journal_close();
+    if (file && (JournalFp = fopen(file, "wb")) != NULL) {
+	if (!journal_begin(JournalFp, generation) || fflush(JournalFp)) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Can't write journal `%s\'\n" _ file);
+	    journal_close();
+	}
+    }
+    HT_FREE(file);
+    return JournalFp != NULL;
+}
+
+/*
+**	Keep appending to the journal we have replayed
+*/
+PRIVATE BOOL journal_append (const char * cache_root)
+{
+    char * file = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+    if (file && (JournalFp = fopen(file, "ab")) != NULL)
+	fseek(JournalFp, 0, SEEK_END);
+    HT_FREE(file);
+    return JournalFp != NULL;
+}
+
+PRIVATE BOOL journal_write (int op, const char * payload, unsigned int length)
+{
+    if (JournalFp) {
+	JournalHead head;
+	head.magic = JOURNAL_MAGIC;
+	head.op = op;
+	head.length = length;
+	head.sum = journal_sum(payload, length);
+	if (fwrite(&head, sizeof(head), 1, JournalFp) != 1 ||
+	    fwrite(payload, 1, length, JournalFp) != length ||
+	    fflush(JournalFp)) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Error writing journal\n");
+	    journal_close();
+	    return NO;
+	}
+	JournalRecords++;
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	The state of a cache object is an index entry followed by its strings
+*/
+PRIVATE void object_put (HTCache * me, HTChunk * chunk)
+{
+    IndexEntry entry;
+    object_to_entry(me, &entry, 1);
+    HTChunk_putb(chunk, (const char *) &entry, sizeof(entry));
+    HTChunk_putc(chunk, '\0');
+    HTChunk_putb(chunk, me->url, strlen(me->url) + 1);
+    HTChunk_putb(chunk, me->cachename, strlen(me->cachename) + 1);
+    if (me->etag) HTChunk_putb(chunk, me->etag, strlen(me->etag) + 1);
+    if (me->blob) HTChunk_putb(chunk, me->blob, strlen(me->blob) + 1);
+}
+
+/*
+**	Record the current state of a cache object
+*/
+PRIVATE BOOL journal_put (HTCache * me)
+{
+    if (JournalFp && me && me->url && me->cachename) {
+	HTChunk * payload = HTChunk_new(sizeof(IndexEntry) + 256);
+	BOOL status;
+	object_put(me, payload);
+	status = journal_write(JOURNAL_PUT, HTChunk_data(payload),
+			       HTChunk_size(payload));
+	HTChunk_delete(payload);
+	return status;
+    }
+    return NO;
+}
+
+PRIVATE BOOL journal_delete (const char * url)
+{
+    return (JournalFp && url) ?
+	journal_write(JOURNAL_DELETE, url, strlen(url) + 1) : NO;
+}
+
+/*
+**	The journal is replayed when the index is read, so we keep it short
+*/
+PRIVATE BOOL journal_due (void)
+{
+    return (JournalRecords > JOURNAL_MIN_RECORDS &&
+	    (JournalRecords > cache_entries() / JOURNAL_RATIO ||
+	     JournalRecords > JOURNAL_MAX_RECORDS));
+}
+
+PRIVATE BOOL journal_string (const char * strings, unsigned int length,
+			     unsigned int offset)
+{
+    return offset < length && memchr(strings + offset, '\0', length - offset);
+}
+
+PRIVATE void journal_apply (int op, char * payload, unsigned int length)
+{
+    if (op == JOURNAL_PUT && length > sizeof(IndexEntry)) {
+	IndexEntry entry;
+	const char * strings = payload + sizeof(IndexEntry);
+	unsigned int strlength = length - sizeof(IndexEntry);
+	HTCache * me;
+	memcpy(&entry, payload, sizeof(IndexEntry));
+	if (!journal_string(strings, strlength, entry.url) ||
+	    !journal_string(strings, strlength, entry.cachename) ||
+	    (entry.etag && !journal_string(strings, strlength, entry.etag)) ||
+	    ((entry.flags & ENTRY_BLOB) &&
+	     !journal_string(strings, strlength, entry_blob(&entry, strings))))
+	    return;
+	if ((me = cache_lookup(strings + entry.url)) != NULL) {
+	    HTCacheContentSize -= me->size;
+	    entry_to_object(&entry, strings, me);
+	    Eviction->resize(me);
+	} else {
+	    if ((me = (HTCache *) HT_CALLOC(1, sizeof(HTCache))) == NULL)
+		HT_OUTOFMEM("journal_apply");
+	    entry_to_object(&entry, strings, me);
+	    cache_add(me);
+	    object_to_anchor(me);
+	}
+	HTCacheContentSize += me->size;
+    } else if (op == JOURNAL_DELETE && length > 0 && payload[length-1] == '\0') {
+	HTCache * me = cache_lookup(payload);
+	if (me) delete_object(me);
+    }
+}
+
+/*
+**	Replay the journal on top of the index we just read. We stop at the
+**	first record that is not complete - that is where we crashed. A
+**	record that claims to be longer than what is left of the file is
+**	garbage and we stop there as well. The journal is only used if it
+**	belongs to the same generation as the index, otherwise it has
+**	already been merged into the index.
+**	Returns	HT_OK		if we can keep appending to the journal
+**		HT_IGNORE	if there was no journal we could use
+**		HT_ERROR	if the last record was incomplete
+*/
+PRIVATE int journal_replay (const char * cache_root, const char * name,
+			   unsigned int generation)
+{
+    char * file = cache_file_name(cache_root, name);
+    FILE * fp = file ? fopen(file, "rb") : NULL;
+    int status = HT_IGNORE;
+    HT_FREE(file);
+    if (fp) {
+	JournalHead head;
+	char * payload = NULL;
+	unsigned int size = 0;
+	int records = 0;
+	long left = -1;
+	if (fseek(fp, 0, SEEK_END) == 0) left = ftell(fp);
+	rewind(fp);
+	if (fread(&head, sizeof(head), 1, fp) != 1 || head.magic != JOURNAL_MAGIC ||
+	    head.op != JOURNAL_BEGIN || head.sum != generation) {
+	    HTTRACE(CACHE_TRACE, "Cache Index. Journal is from another generation - ignored\n");
+	    fclose(fp);
+	    return HT_IGNORE;
+	}
+	status = HT_OK;
+	left -= (long) sizeof(head);
+	while (fread(&head, sizeof(head), 1, fp) == 1) {
+	    left -= (long) sizeof(head);
+	    if (head.magic != JOURNAL_MAGIC || left < 0 ||
+		head.length > (unsigned long) left) {
+		status = HT_ERROR;
+		break;
+	    }
+	    left -= head.length;
+	    if (head.length > size) {
+		size = head.length;
+		if ((payload = (char *) HT_REALLOC(payload, size)) == NULL)
+		    HT_OUTOFMEM("journal_replay");
+	    }
+	    if (fread(payload, 1, head.length, fp) != head.length ||
+		journal_sum(payload, head.length) != head.sum) {
+		status = HT_ERROR;
+		break;
+	    }
+	    journal_apply(head.op, payload, head.length);
+	    records++;
+	}
+	HT_FREE(payload);
+	fclose(fp);
+	JournalRecords = records;
+	HTTRACE(CACHE_TRACE, "Cache Index. Replayed %d journal records%s\n" _ 
+		records _ status == HT_OK ? "" : ", last one is incomplete");
+    }
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  			     INDEX COMPACTION				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  The binary index is written a slice at a time from a timer so that a
+**  big cache doesn't stop the event loop. What goes into it is fixed when
+**  we start: the entries still in the old index, which stays mapped until
+**  we are done, and a copy of the cache objects. Changes made meanwhile are
+**  journaled as usual and the records written after the start are carried
+**  over into the journal of the new index.
+*/
+typedef enum _CompactPhase {
+    COMPACT_ENTRIES = 0,
+    COMPACT_STRINGS
+} CompactPhase;
+
+typedef struct _Compaction {
+    char *		root;
+    FILE *		fp;			       /* Temporary index */
+    CompactPhase	phase;
+    char *		dropped;	/* IndexDropped when we started */
+    unsigned int	map;			   /* Entries in old index */
+    HTChunk *		objects;	   /* Copies of the cache objects */
+    IndexWalk		walk;
+    unsigned int *	buckets;
+    unsigned int	nbuckets;
+    unsigned int	count;
+    long		strings;
+    long		content;
+    long		journal;     /* Journal length when we started or -1 */
+    long		records;
+    HTTimer *		timer;
+} Compaction;
+
+PRIVATE Compaction * Compactor = NULL;
+
+PRIVATE BOOL cache_rename (const char * cache_root, const char * from,
+			   const char * to)
+{
+    char * src = cache_file_name(cache_root, from);
+    char * dst = cache_file_name(cache_root, to);
+    BOOL status = NO;
+    if (src && dst) {
+#ifdef WWW_MSWINDOWS
+	REMOVE(dst);
+#endif
+	status = rename(src, dst) == 0;
+    }
+    HT_FREE(src);
+    HT_FREE(dst);
+    return status;
+}
+
+PRIVATE void compact_free (void)
+{
+    if (Compactor) {
+	if (Compactor->timer) HTTimer_delete(Compactor->timer);
+	if (Compactor->fp) fclose(Compactor->fp);
+	HTChunk_delete(Compactor->objects);
+	HT_FREE(Compactor->dropped);
+	HT_FREE(Compactor->buckets);
+	HT_FREE(Compactor->root);
+	HT_FREE(Compactor);
+    }
+}
+
+/*
+**	Throw away a compaction which hasn't finished. The old index and its
+**	journal are still what is on disk.
+*/
+PRIVATE void compact_abort (void)
+{
+    if (Compactor) {
+	char * tmp = cache_file_name(Compactor->root, HT_CACHE_TMPINDEX);
+	HTTRACE(CACHE_TRACE, "Cache Index. Compaction aborted\n");
+	compact_free();
+	REMOVE(tmp);
+	HT_FREE(tmp);
+    }
+}
+
+PRIVATE BOOL compact_start (const char * cache_root)
+{
+    char * tmp = cache_file_name(cache_root, HT_CACHE_TMPINDEX);
+    FILE * fp = tmp ? fopen(tmp, "wb") : NULL;
+    unsigned long entries = 0;
+    Compaction * me;
+    if (!fp) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Can't open `%s\' for writing\n" _ 
+		tmp ? tmp : "");
+	HT_FREE(tmp);
+	return NO;
+    }
+    HT_FREE(tmp);
+    if ((me = (Compaction *) HT_CALLOC(1, sizeof(Compaction))) == NULL)
+	HT_OUTOFMEM("compact_start");
+    StrAllocCopy(me->root, cache_root);
+    me->fp = fp;
+    Compactor = me;
+
+    /* Which entries of the old index are still there */
+    if (IndexHeader && IndexHeader->count) {
+	me->map = IndexHeader->count;
+	if ((me->dropped = (char *) HT_MALLOC(me->map)) == NULL)
+	    HT_OUTOFMEM("compact_start");
+	memcpy(me->dropped, IndexDropped, me->map);
+	entries += IndexLive;
+    }
+
+    /* Each cache object is the length of its state and the state */
+    if (CacheTable && HTHashtable_count(CacheTable) > 0) {
+	HTCache * pres;
+	int pos = 0;
+	me->objects = HTChunk_new(0x10000);
+	while ((pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos))) {
+	    if (pres->url && pres->cachename) {
+		int start = HTChunk_size(me->objects);
+		unsigned int length = 0;
+		HTChunk_putb(me->objects, (const char *) &length, sizeof(length));
+		object_put(pres, me->objects);
+		length = HTChunk_size(me->objects) - start - sizeof(length);
+		memcpy(HTChunk_data(me->objects) + start, &length, sizeof(length));
+		entries++;
+	    }
+	}
+    }
+
+    me->nbuckets = 2;
+    while (me->nbuckets < 2 * entries + 2) me->nbuckets <<= 1;
+    if ((me->buckets = (unsigned int *)
+	 HT_CALLOC(me->nbuckets, sizeof(unsigned int))) == NULL)
+	HT_OUTOFMEM("compact_start");
+    me->strings = 1;
+    me->journal = -1;
+    if (JournalFp && fflush(JournalFp) == 0) {
+	me->journal = ftell(JournalFp);
+	me->records = JournalRecords;
+    }
+
+    /* The header and the buckets are written when we know them */
+    if (fseek(fp, sizeof(IndexHead) + me->nbuckets * sizeof(unsigned int),
+	      SEEK_SET)) {
+	compact_abort();
+	return NO;
+    }
+    return YES;
+}
+
+/*
+**	Walk through what we are writing, first the old index and then the
+**	cache objects. The order is the same every time.
+*/
+PRIVATE BOOL compact_next (Compaction * me, IndexEntry * entry,
+			   const char ** url, const char ** name,
+			   const char ** etag, const char ** blob)
+{
+    while (me->walk.map < me->map) {
+	unsigned int i = me->walk.map++;
+	if (!me->dropped[i] && entry_valid(IndexEntries + i)) {
+	    *entry = IndexEntries[i];
+	    entry_strings(entry, IndexStrings, url, name, etag, blob);
+	    return YES;
 	}
-	HTTRACE(CACHE_TRACE, "Cache....... Size reduced from %ld to %ld\n" _ 
-		    old_size _ HTCacheContentSize);
-	/*
-	**  Dump the new content to the index file
-	*/
-	HTCacheIndex_write(HTCacheRoot);
-	new_entries = 0;
+    }
+    if (me->objects && me->walk.table < HTChunk_size(me->objects)) {
+	char * data = HTChunk_data(me->objects) + me->walk.table;
+	unsigned int length;
+	memcpy(&length, data, sizeof(length));
+	memcpy(entry, data + sizeof(length), sizeof(IndexEntry));
+	entry_strings(entry, data + sizeof(length) + sizeof(IndexEntry),
+		      url, name, etag, blob);
+	me->walk.table += sizeof(length) + length;
 	return YES;
     }
     return NO;
 }
 
-/* ------------------------------------------------------------------------- */
-/*  			      CACHE INDEX				     */
-/* ------------------------------------------------------------------------- */
+/*
+**	Copy the journal records written since we started into a new journal
+**	for the next generation
+*/
+PRIVATE BOOL journal_carry (const char * cache_root, long offset,
+			    unsigned int generation)
+{
+    char * from = cache_file_name(cache_root, HT_CACHE_JOURNAL);
+    char * to = cache_file_name(cache_root, HT_CACHE_TMPJOURNAL);
+    FILE * in = from ? fopen(from, "rb") : NULL;
+    FILE * out = to ? fopen(to, "wb") : NULL;
+    BOOL status = NO;
+    if (in && out && fseek(in, offset, SEEK_SET) == 0 &&
+	journal_begin(out, generation)) {
+	char buf[1024];
+	size_t len;
+	status = YES;
+	while (status && (len = fread(buf, 1, sizeof(buf), in)) > 0)
+	    status = fwrite(buf, 1, len, out) == len;
+	status = status && !ferror(in) && fflush(out) == 0;
+#ifdef HAVE_FSYNC
+	status = status && fsync(fileno(out)) == 0;
+#endif
+    }
+    if (in) fclose(in);
+    if (out && fclose(out)) status = NO;
+    if (!status && to) REMOVE(to);
+    HT_FREE(from);
+    HT_FREE(to);
+    return status;
+}
 
-PRIVATE char * cache_index_name (const char * cache_root)
+/*
+**	Write the header and the buckets and make sure that it all is on disk
+**	before the index is renamed into place. The new journal is renamed
+**	right after it. If we crash in between then the new journal is found
+**	when the index is read next time.
+*/
+PRIVATE int compact_end (BOOL status)
 {
-    if (cache_root) {
-	char * location = NULL;
-	if ((location = (char *)
-	     HT_MALLOC(strlen(cache_root) + strlen(HT_CACHE_INDEX) + 1)) == NULL)
-	    HT_OUTOFMEM("cache_index_name");
-	strcpy(location, cache_root);
-	strcat(location, HT_CACHE_INDEX);
-	return location;
+    Compaction * me = Compactor;
+    unsigned int generation = IndexGeneration + 1;
+    BOOL carried = NO;
+
+    /* If the journal broke then we don't have all the changes */
+    if (status && me->journal >= 0 && !JournalFp) status = NO;
+    if (status) {
+	IndexHead head;
+	memset(&head, 0, sizeof(head));
+	strncpy(head.magic, INDEX_MAGIC, sizeof(head.magic));
+	head.order = INDEX_ORDER;
+	head.longsize = sizeof(long);
+	head.entrysize = sizeof(IndexEntry);
+	head.generation = generation;
+	head.count = me->count;
+	head.buckets = me->nbuckets;
+	head.strings = me->strings;
+	head.content = me->content;
+	head.length = sizeof(IndexHead) + me->nbuckets * sizeof(unsigned int) +
+	    me->count * sizeof(IndexEntry) + me->strings;
+	status = (fseek(me->fp, 0, SEEK_SET) == 0 &&
+		  fwrite(&head, sizeof(head), 1, me->fp) == 1 &&
+		  fwrite(me->buckets, sizeof(unsigned int), me->nbuckets,
+			 me->fp) == me->nbuckets &&
+		  fflush(me->fp) == 0);
+#ifdef HAVE_FSYNC
+	status = status && fsync(fileno(me->fp)) == 0;
+#endif
     }
-    return NULL;
+    if (fclose(me->fp)) status = NO;
+    me->fp = NULL;
+    if (status && me->journal >= 0)
+	status = carried = journal_carry(me->root, me->journal, generation);
+    if (status && cache_rename(me->root, HT_CACHE_TMPINDEX, HT_CACHE_BINDEX)) {
+	long records = JournalRecords - me->records;
+	IndexGeneration = generation;
+	journal_close();
+	if (carried && cache_rename(me->root, HT_CACHE_TMPJOURNAL, HT_CACHE_JOURNAL) &&
+	    journal_append(me->root))
+	    JournalRecords = records;
+	else
+	    journal_reset(me->root, generation);
+	HTTRACE(CACHE_TRACE, "Cache Index. Wrote %u entries, %ld journal records carried over\n" _ 
+		me->count _ JournalRecords);
+	compact_free();
+	return HT_OK;
+    }
+    HTTRACE(CACHE_TRACE, "Cache Index. Error writing the index in `%s\'\n" _ me->root);
+    {
+	char * tmp = cache_file_name(me->root, HT_CACHE_TMPJOURNAL);
+	REMOVE(tmp);
+	HT_FREE(tmp);
+    }
+    compact_abort();
+    return HT_ERROR;
 }
 
 /*
-**  Remove the cache index file
+**	Go on with the compaction for at most `slice' milliseconds, or until
+**	done if it is 0. First the entries with the offsets of their strings
+**	and the hash buckets, then the strings.
+**	Returns	HT_WOULD_BLOCK	if there is more to do
+**		HT_OK		if the new index is in place
+**		HT_ERROR	if it failed and the old index is still used
 */
-PUBLIC BOOL HTCacheIndex_delete (const char * cache_root)
+PRIVATE int compact_step (ms_t slice)
 {
-    if (cache_root) {
-	char * index = cache_index_name(cache_root);
-	REMOVE(index);
-	HT_FREE(index);
-	return YES;
+    Compaction * me = Compactor;
+    ms_t end = slice ? HTGetTimeInMillis() + slice : 0;
+    const char *url, *name, *etag, *blob;
+    IndexEntry entry;
+    int cnt = 0;
+    if (!me) return HT_ERROR;
+    for (;;) {
+	if (!compact_next(me, &entry, &url, &name, &etag, &blob)) {
+	    if (me->phase == COMPACT_STRINGS) return compact_end(YES);
+	    if (putc('\0', me->fp) == EOF) return compact_end(NO);
+	    memset(&me->walk, 0, sizeof(IndexWalk));
+	    me->phase = COMPACT_STRINGS;
+	} else if (me->phase == COMPACT_ENTRIES) {
+	    unsigned int slot = entry.key & (me->nbuckets - 1);
+	    if (me->count >= me->nbuckets - 1) return compact_end(NO);
+	    while (me->buckets[slot]) slot = (slot + 1) & (me->nbuckets - 1);
+	    me->buckets[slot] = ++me->count;
+	    entry.url = me->strings;
+	    me->strings += strlen(url) + 1;
+	    entry.cachename = me->strings;
+	    me->strings += strlen(name) + 1;
+	    if (etag) {
+		entry.etag = me->strings;
+		me->strings += strlen(etag) + 1;
+	    } else
+		entry.etag = 0;
+	    if (blob) me->strings += strlen(blob) + 1;
+	    me->content += entry.size;
+	    if (fwrite(&entry, sizeof(entry), 1, me->fp) != 1)
+		return compact_end(NO);
+	} else {
+	    if (fwrite(url, 1, strlen(url) + 1, me->fp) != strlen(url) + 1 ||
+		fwrite(name, 1, strlen(name) + 1, me->fp) != strlen(name) + 1 ||
+		(etag && fwrite(etag, 1, strlen(etag) + 1, me->fp) != strlen(etag) + 1) ||
+		(blob && fwrite(blob, 1, strlen(blob) + 1, me->fp) != strlen(blob) + 1))
+		return compact_end(NO);
+	}
+	if (end && ++cnt % GC_CHECK == 0 && HTGetTimeInMillis() >= end)
+	    return HT_WOULD_BLOCK;
     }
-    return NO;
+}
+
+PRIVATE int compact_timeout (HTTimer * timer, void * param, HTEventType type)
+{
+    compact_step(GC_SLICE);
+    return HT_OK;
 }
 
 /*
-**	Walk through the list of cached objects and save them to disk.
-**	We override any existing version but that is normally OK as we have
-**	already read its contents.
+**	Start writing a new index in the background when the journal has
+**	grown too long
 */
-PUBLIC BOOL HTCacheIndex_write (const char * cache_root)
+PRIVATE void index_compact (void)
 {
-    if (cache_root && CacheTable) {
-	char * index = cache_index_name(cache_root);
-	FILE * fp = NULL;
-	HTTRACE(CACHE_TRACE, "Cache Index. Writing index `%s\'\n" _ index);
+    if (!Compactor && HTCacheRoot && compact_start(HTCacheRoot)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Compacting %ld entries and %ld journal records\n" _ 
+		cache_entries() _ JournalRecords);
+	Compactor->timer = HTTimer_new(NULL, compact_timeout, NULL,
+				       GC_INTERVAL, YES, YES);
+    }
+}
 
-	/*
-	**  Open the file for writing. Note - we don't take a backup!
-	**  This should probably be fixed!
-	*/
-	if (!index) return NO;
-	if ((fp = fopen(index, "wb")) == NULL) {
-	    HTTRACE(CACHE_TRACE, "Cache Index. Can't open `%s\' for writing\n" _ index);
-	    HT_FREE(index);
-	    return NO;
-	}
+/*
+**	Write the binary index in one go. A compaction which is under way is
+**	given up as this one has everything.
+*/
+PRIVATE BOOL index_save (const char * cache_root)
+{
+    compact_abort();
+    return compact_start(cache_root) && compact_step(0) == HT_OK;
+}
 
-	/*
-	**  Walk through the list and write it out. The format is really
-	**  simple as we keep it all in ASCII.
-	*/
-	{
-	    HTList * cur;
-	    int cnt;
-	    for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-		if ((cur = CacheTable[cnt])) { 
-		    HTCache * pres;
-		    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-			if (fprintf(fp, "%s %s %s %ld %ld %ld %c %d %d %ld %ld %ld %c\r\n",
-				    pres->url,
-				    pres->cachename,
-				    pres->etag ? pres->etag : HT_CACHE_EMPTY_ETAG,
-				    (long) (pres->lm),
-				    (long) (pres->expires),
-				    pres->size,
-				    pres->range+0x30,
-				    pres->hash,
-				    pres->hits,
-				    (long) (pres->freshness_lifetime),
-				    (long) (pres->response_time),
-				    (long) (pres->corrected_initial_age),
-				    pres->must_revalidate+0x30) < 0) {
-			    HTTRACE(CACHE_TRACE, "Cache Index. Error writing cache index\n");
-			    return NO;
-			}
-		    }
-		}
-	    }
+/*
+**	Save the state of all cached objects to disk. The ASCII index from
+**	earlier versions is only read, never written.
+*/
+PUBLIC BOOL HTCacheIndex_write (const char * cache_root)
+{
+    if (cache_root && (CacheTable || IndexHeader)) {
+	HTTRACE(CACHE_TRACE, "Cache Index. Writing index in `%s\'\n" _ cache_root);
+	if (index_save(cache_root)) {
+	    char * ascii = cache_file_name(cache_root, HT_CACHE_INDEX);
+	    REMOVE(ascii);
+	    HT_FREE(ascii);
+	    return YES;
 	}
-
-	/* Done writing */
-	fclose(fp);
-	HT_FREE(index);
     }
     return NO;
 }
@@ -406,18 +2456,11 @@ PRIVATE BOOL HTCacheIndex_parseLine (char * line)
 
 	/*
 	**  Create the cache table if not already existent and add the new
-	**  entry. Also check that the hash is still within bounds
+	**  entry. The hash is the cache subdirectory of the entry so check
+	**  that it is still within bounds
 	*/
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE,
-						    sizeof(HTList *))) == NULL)
-		HT_OUTOFMEM("HTCache_parseLine");
-	}
-	if (cache->hash >= 0 && cache->hash < HT_XL_HASH_SIZE) {
-	    int hash = cache->hash;
-	    if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	    HTList_addObject(CacheTable[hash], (void *) cache);
-	}
+	if (cache->hash >= 0 && cache->hash < HT_XL_HASH_SIZE)
+	    cache_add(cache);
 
 	/* Update the total cache size */
 	HTCacheContentSize += cache->size;
@@ -544,38 +2587,99 @@ PRIVATE HTStream * HTCacheIndexReader (HTRequest *	request)
     return me;
 }
 
+/*
+**	Read the ASCII index from earlier versions through a stream
+*/
+PRIVATE BOOL HTCacheIndex_readAscii (const char * cache_root)
+{
+    BOOL status = NO;
+    BOOL wasInteractive;
+    char * file = cache_file_name(cache_root, HT_CACHE_INDEX);
+    char * index = HTLocalToWWW(file, "cache:");
+    HTAnchor * anchor = HTAnchor_findAddress(index);	
+    HTRequest * request = HTRequest_new();
+    HTRequest_setPreemptive(request, YES);
+    HTRequest_setOutputFormat(request, WWW_SOURCE);
+
+    /* Make sure we don't use any filters */
+    HTRequest_addBefore(request, NULL, NULL, NULL, 0, YES);
+    HTRequest_addAfter(request, NULL, NULL, NULL, HT_ALL, 0, YES);
+
+    /* Set the output */    
+    HTRequest_setOutputStream(request, HTCacheIndexReader(request));
+    HTRequest_setAnchor(request, anchor);
+    HTAnchor_setFormat((HTParentAnchor *) anchor, HTAtom_for("www/cache-index"));
+    wasInteractive = HTAlert_interactive();
+    HTAlert_setInteractive(NO);
+    status = HTLoad(request, NO);
+    HTAlert_setInteractive(wasInteractive);
+    HTRequest_delete(request);
+    HT_FREE(file);
+    HT_FREE(index);
+    return status;
+}
+
 /*
 **	Read the saved set of cached entries from disk. we only allow the index
 **	ro be read when there is no entries in memory. That way we can ensure
-**	consistancy.
+**	consistancy. The binary index is mapped into memory and the journal is
+**	replayed on top of it. If there is no binary index then we read the
+**	ASCII index if there is one. Either way we then open the journal for
+**	the changes to come.
 */
 PUBLIC BOOL HTCacheIndex_read (const char * cache_root)
 {
     BOOL status = NO;
-    if (cache_root && CacheTable == NULL) {
-	BOOL wasInteractive;
-	char * file = cache_index_name(cache_root);
-	char * index = HTLocalToWWW(file, "cache:");
-	HTAnchor * anchor = HTAnchor_findAddress(index);	
-	HTRequest * request = HTRequest_new();
-	HTRequest_setPreemptive(request, YES);
-	HTRequest_setOutputFormat(request, WWW_SOURCE);
-
-	/* Make sure we don't use any filters */
-	HTRequest_addBefore(request, NULL, NULL, NULL, 0, YES);
-	HTRequest_addAfter(request, NULL, NULL, NULL, HT_ALL, 0, YES);
-
-	/* Set the output */    
-	HTRequest_setOutputStream(request, HTCacheIndexReader(request));
-	HTRequest_setAnchor(request, anchor);
-	HTAnchor_setFormat((HTParentAnchor *) anchor, HTAtom_for("www/cache-index"));
-	wasInteractive = HTAlert_interactive();
-	HTAlert_setInteractive(NO);
-	status = HTLoad(request, NO);
-	HTAlert_setInteractive(wasInteractive);
-	HTRequest_delete(request);
-	HT_FREE(file);
-	HT_FREE(index);
+    if (cache_root && CacheTable == NULL && IndexHeader == NULL) {
+	unsigned int generation = 0;
+	if ((status = index_open(cache_root)) == YES)
+	    generation = IndexHeader->generation;
+	else
+	    status = HTCacheIndex_readAscii(cache_root);
+	IndexGeneration = generation;
+
+	/*
+	**  If the journal is from this generation then replay it and keep
+	**  appending to it. If we crashed while writing to it then save a
+	**  new index with what we could replay. If there is no journal then
+	**  start a new one.
+	*/
+	switch (journal_replay(cache_root, HT_CACHE_JOURNAL, generation)) {
+	  case HT_OK:
+	    if (!journal_append(cache_root))
+		journal_reset(cache_root, generation);
+	    break;
+	  case HT_ERROR:
+	    index_save(cache_root);
+	    break;
+	  default:
+	    /*
+	    **  If we crashed after the new index was renamed into place but
+	    **  before its journal was, then the journal is still in the
+	    **  temporary file
+	    */
+	    switch (journal_replay(cache_root, HT_CACHE_TMPJOURNAL, generation)) {
+	      case HT_OK:
+		if (cache_rename(cache_root, HT_CACHE_TMPJOURNAL, HT_CACHE_JOURNAL) &&
+		    journal_append(cache_root))
+		    break;
+		index_save(cache_root);
+		break;
+	      case HT_ERROR:
+		index_save(cache_root);
+		break;
+	      default:
+		journal_reset(cache_root, generation);
+		break;
+	    }
+	    break;
+	}
+	{
+	    char * tmp = cache_file_name(cache_root, HT_CACHE_TMPJOURNAL);
+	    REMOVE(tmp);
+	    HT_FREE(tmp);
+	}
+	blob_count();
     }
     return status;
 }
@@ -760,9 +2864,11 @@ PUBLIC BOOL HTCacheInit (const char * cache_root, int size)
 	    return NO;
 
 	/*
-	**  Look for the cache index and read the contents
+	**  Look for the cache index and read the contents. If the cache is
+	**  already too big then start cleaning up as soon as we get going
 	*/
 	HTCacheIndex_read(HTCacheRoot);
+	if (startGC()) gc_start();
 
 	/*
 	**  Register the cache before and after filters
@@ -794,6 +2900,9 @@ PUBLIC BOOL HTCacheInit (const char * cache_root, int size)
 PUBLIC BOOL HTCacheTerminate (void)
 {
     if (HTCacheInitialized) {
+	HTTRACE(CACHE_TRACE, "Cache....... %ld lookups, hit ratio %.3f, byte hit ratio %.3f, %ld served from memory\n" _ 
+		CacheLookups _ HTCacheMode_hitRatio() _
+		HTCacheMode_byteHitRatio() _ MemoryHits);
 
 	/*
 	**  Write the index to file
@@ -952,12 +3061,173 @@ PUBLIC int HTCacheMode_DefaultExpiration (void)
     return DefaultExpiration;
 }
 
+/*
+**  Eviction policy. When we change policy the entries in memory are handed
+**  over to the new one as if they had just been added. Hit counts are kept
+**  so GDSF gets going quickly but SLRU has to learn which entries are used.
+*/
+PUBLIC BOOL HTCacheMode_setEviction (HTCacheEviction policy)
+{
+    const EvictionClass * eviction = policy == HT_EVICT_SLRU ? &SLRUClass :
+	policy == HT_EVICT_GDSF ? &GDSFClass : NULL;
+    if (!eviction) return NO;
+    if (eviction != Eviction) {
+	HTCache * pres;
+	int pos = 0;
+
+	/* Take the objects out of the old policy before it is cleared */
+	while (CacheTable &&
+	       (pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos)))
+	    Eviction->remove(pres);
+	Eviction->clear();
+	Eviction = eviction;
+	pos = 0;
+	while (CacheTable &&
+	       (pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos)))
+	    Eviction->add(pres);
+	HTTRACE(CACHE_TRACE, "Cache....... Using %s eviction\n" _ Eviction->name);
+    }
+    return YES;
+}
+
+PUBLIC HTCacheEviction HTCacheMode_eviction (void)
+{
+    return Eviction == &SLRUClass ? HT_EVICT_SLRU : HT_EVICT_GDSF;
+}
+
+/*
+**  Hit ratios since the cache was started or the counters were reset
+*/
+PUBLIC double HTCacheMode_hitRatio (void)
+{
+    return CacheLookups ? (double) CacheHits / CacheLookups : 0.0;
+}
+
+PUBLIC double HTCacheMode_byteHitRatio (void)
+{
+    long total = CacheHitBytes + CacheMissBytes;
+    return total ? (double) CacheHitBytes / total : 0.0;
+}
+
+PUBLIC void HTCacheMode_resetRatios (void)
+{
+    CacheLookups = CacheHits = 0;
+    CacheHitBytes = CacheMissBytes = 0;
+    MemoryHits = 0;
+    CompressionSaved = 0;
+}
+
+/*
+**  How much memory to use for keeping small, often used entries and how
+**  big they can be. Both are in Kbytes and 0 turns the memory tier off.
+*/
+PUBLIC BOOL HTCacheMode_setMemorySize (int size)
+{
+    if (size < 0) return NO;
+    MemorySize = size * 1024L;
+    if (!MemorySize)
+	memory_clear();
+    else
+	while (MemoryUsed > MemorySize && MemoryTail)
+	    memory_drop(MemoryTail->cache);
+    HTTRACE(CACHE_TRACE, "Cache....... Memory size is %ld\n" _ MemorySize);
+    return YES;
+}
+
+PUBLIC int HTCacheMode_memorySize (void)
+{
+    return MemorySize / 1024;
+}
+
+PUBLIC BOOL HTCacheMode_setMaxMemoryEntrySize (int size)
+{
+    if (size <= 0) return NO;
+    MemoryMaxEntrySize = size * 1024L;
+    HTTRACE(CACHE_TRACE, "Cache....... Max memory entry size is %ld\n" _ MemoryMaxEntrySize);
+    return YES;
+}
+
+PUBLIC int HTCacheMode_maxMemoryEntrySize (void)
+{
+    return MemoryMaxEntrySize / 1024;
+}
+
+PUBLIC long HTCacheMode_memoryHits (void)
+{
+    return MemoryHits;
+}
+
+/*
+**  Store entity bodies with the same content only once. Entries which are
+**  already shared stay so when this is turned off.
+*/
+PUBLIC void HTCacheMode_setDedup (BOOL mode)
+{
+    DedupEnabled = mode;
+}
+
+PUBLIC BOOL HTCacheMode_dedup (void)
+{
+    return DedupEnabled;
+}
+
+PUBLIC long HTCacheMode_dedupSaved (void)
+{
+    return BlobSaved;
+}
+
+/*
+**  Which bodies we deflate when they are stored, and how hard we try.
+**  Without zlib we can only store them as they are.
+*/
+PUBLIC BOOL HTCacheMode_setCompression (HTCacheCompression policy)
+{
+#ifdef HT_ZLIB
+    if (policy != HT_CACHE_COMPRESS_NONE && policy != HT_CACHE_COMPRESS_TEXT &&
+	policy != HT_CACHE_COMPRESS_ALL)
+	return NO;
+    Compression = policy;
+    return YES;
+#else
+    return policy == HT_CACHE_COMPRESS_NONE;
+#endif
+}
+
+PUBLIC HTCacheCompression HTCacheMode_compression (void)
+{
+    return Compression;
+}
+
+PUBLIC BOOL HTCacheMode_setCompressionLevel (int level)
+{
+    if (level < 1 || level > 9) return NO;
+    CompressionLevel = level;
+    return YES;
+}
+
+PUBLIC int HTCacheMode_compressionLevel (void)
+{
+    return CompressionLevel;
+}
+
+PUBLIC long HTCacheMode_compressionSaved (void)
+{
+    return CompressionSaved;
+}
+
 /* ------------------------------------------------------------------------- */
 /*  				 CACHE OBJECT				     */
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Free an entry which is only dropped from memory. Whatever is on disk,
+**	including a blob that nobody else in memory uses, is left alone. An
+**	entry that is removed from disk has already let go of its blob.
+*/
 PRIVATE BOOL free_object (HTCache * me)
 {
+    memory_drop(me);
+    if (me->blob) blob_unref(me, NO);
     HT_FREE(me->url);
     HT_FREE(me->cachename);
     HT_FREE(me->etag);
@@ -965,10 +3235,12 @@ PRIVATE BOOL free_object (HTCache * me)
     return YES;
 }
 
-PRIVATE BOOL delete_object (HTList * list, HTCache * me)
+PRIVATE BOOL delete_object (HTCache * me)
 {
-    HTTRACE(CACHE_TRACE, "Cache....... delete %p from list %p\n" _ me _ list);
-    HTList_removeObject(list, (void *) me);
+    HTTRACE(CACHE_TRACE, "Cache....... delete %p from table %p\n" _ me _ CacheTable);
+    journal_delete(me->url);
+    Eviction->remove(me);
+    HTHashtable_removeEntry(CacheTable, me->url, (void *) me);
     HTCacheContentSize -= me->size;
     free_object(me);
     return YES;
@@ -1050,6 +3322,12 @@ PRIVATE BOOL calculate_time (HTCache * me, HTRequest * request,
 	time_t date = HTAnchor_date(anchor);
 	me->response_time = time(NULL);
 	me->expires = HTAnchor_expires(anchor);
+
+	/*
+	**  A response without a date (or one we can't parse) gets the time
+	**  we received it. Otherwise it looks as old as the epoch.
+	*/
+	if (date <= 0) date = me->response_time;
 	{
 	    time_t apparent_age = HTMAX(0, me->response_time - date);
 	    time_t corrected_received_age = HTMAX(apparent_age, HTAnchor_age(anchor));
@@ -1094,48 +3372,33 @@ PRIVATE BOOL calculate_time (HTCache * me, HTRequest * request,
 PRIVATE HTCache * HTCache_new (HTRequest * request, HTResponse * response,
 			       HTParentAnchor * anchor)
 {
-    HTList * list = NULL;			    /* Current list in cache */
     HTCache * pres = NULL;
-    int hash = 0;
     char * url = NULL;
     if (!request || !response || !anchor) {
 	HTTRACE(CORE_TRACE, "Cache....... Bad argument\n");
 	return NULL;
     }
     
-    /* Find a hash for this anchor */
+    /* Search the cache for this anchor */
     if ((url = HTAnchor_address((HTAnchor *) anchor))) {
-	char * ptr;
-	for (ptr=url; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_XL_HASH_SIZE);
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList **) HT_CALLOC(HT_XL_HASH_SIZE,
-						   sizeof(HTList *))) == NULL)
-	        HT_OUTOFMEM("HTCache_new");
-	}
-	if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	list = CacheTable[hash];
+	if (!CacheTable)
+	    CacheTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE, HT_HASH_KEYREF);
+	pres = cache_lookup(url);
     } else
 	return NULL;
 
-    /* Search the cache */
-    {
-	HTList * cur = list;
-	while ((pres = (HTCache *) HTList_nextObject(cur))) {
-	    if (!strcmp(pres->url, url)) break;
-	}
-    }
-
-    /* If not found then create new cache object, else use existing one */
+    /*
+    **  If not found then create new cache object, else use existing one.
+    **  The hash of a new object is the subdirectory it is stored in.
+    */
     if (!pres) {
 	if ((pres = (HTCache *) HT_CALLOC(1, sizeof(HTCache))) == NULL)
 	    HT_OUTOFMEM("HTCache_new");
-	pres->hash = hash;
+	pres->hash = (int) (HTHash_string(url, NO) % HT_XL_HASH_SIZE);
 	pres->url = url;
 	pres->range = NO;
 	HTCache_createLocation(pres);
-	HTList_addObject(list, (void *) pres);
-	new_entries++;
+	cache_add(pres);
     } else
 	HT_FREE(url);
 
@@ -1181,8 +3444,13 @@ PUBLIC HTCache * HTCache_touch (HTRequest * request, HTResponse * response,
 
     /* We don't have any of the data in cache - only meta information */
     if (cache) {
+	memory_drop(cache);
+	if (cache->blob) blob_release(cache);
 	cache->size = 0;
 	cache->range = YES;
+	cache->deflated = NO;
+	Eviction->resize(cache);
+	journal_put(cache);
     }
 
     return cache;
@@ -1227,6 +3495,8 @@ PRIVATE int HTCacheFilter (HTRequest * request, void * param, int mode)
 	** backwards compatible with HTTP/1.0
 	*/
 	validate = YES;
+	CacheLookups++;
+	HTStats_count(HTStats_forAnchor(anchor), HT_STATS_CACHE_MISSES, 1);
 	HTRequest_addGnHd(request, HT_G_PRAGMA_NO_CACHE);
 	HTRequest_addCacheControl(request, "no-cache", "");
 
@@ -1244,6 +3514,7 @@ PRIVATE int HTCacheFilter (HTRequest * request, void * param, int mode)
 	** through one of our protocol modules (for example the file module)
 	*/
 	cache = HTCache_find(anchor, default_name);
+	CacheLookups++;
 	if (cache) {
 	    HTReload cache_mode = HTCache_isFresh(cache, request);
 	    if (cache_mode == HT_CACHE_ERROR) cache = NULL;
@@ -1298,8 +3569,13 @@ PRIVATE int HTCacheFilter (HTRequest * request, void * param, int mode)
 		    HTCache_addHit(cache);
 		    HT_FREE(name);
 		}
+		CacheHits++;
+		CacheHitBytes += cache->size;
+		HTStats_count(HTStats_forAnchor(anchor), HT_STATS_CACHE_HITS, 1);
 	    }
 	}
+	if (!cache)
+	    HTStats_count(HTStats_forAnchor(anchor), HT_STATS_CACHE_MISSES, 1);
     }
     
     /*
@@ -1350,6 +3626,9 @@ PRIVATE int  HTCacheUpdateFilter (HTRequest * request, HTResponse * response,
 	    HTCache_addHit(cache);
 	    HT_FREE(name);
 	    HTCache_updateMeta(cache, request, response);
+	    CacheHits++;
+	    CacheHitBytes += cache->size;
+	    HTStats_count(HTStats_forAnchor(anchor), HT_STATS_CACHE_VALIDATED, 1);
 	}
 
 	/*
@@ -1403,11 +3682,12 @@ PRIVATE int HTCacheCheckFilter (HTRequest * request, HTResponse * response,
 		    HTCache_updateMeta(cache, request, response);
 		    cache->size = 0;
 		    cache->range = YES;
+		    Eviction->resize(cache);
 		    /* @@ JK: update the cache meta data on disk */
 		    HTCache_writeMeta (cache, request, response);
 		    /* @@ JK: and we remove the file name as it's obsolete 
 		       now */
-		    REMOVE(cache->cachename);
+		    body_remove(cache);
 		} else
 		    HTCache_remove(cache);
 	    } 
@@ -1433,15 +3713,19 @@ PRIVATE BOOL HTCache_setSize (HTCache * cache, long written, BOOL append)
 	**  (in case the download was interrupted)
 	*/
 	if (cache->size > 0 && !append) HTCacheContentSize -= cache->size;
+	memory_drop(cache);
 	cache->size = written;
 	HTCacheContentSize += written;
+	Eviction->resize(cache);
 
 	/*
 	**  Now add the new size to the total cache size. If the new size is
-	**  bigger than the legal cache size then start the gc.
+	**  bigger than the legal cache size then start the gc. It runs in
+	**  time slices from a timer so this entry has been unlocked by the
+	**  time it can be considered.
 	*/
 	HTTRACE(CACHE_TRACE, "Cache....... Total size %ld\n" _ HTCacheContentSize);
-	if (startGC()) HTCacheGarbage();
+	if (startGC()) gc_start();
 	return YES;
     }
     return NO;
@@ -1457,39 +3741,21 @@ PRIVATE BOOL HTCache_setSize (HTCache * cache, long written, BOOL append)
 */
 PUBLIC HTCache * HTCache_find (HTParentAnchor * anchor, char * default_name)
 {
-    HTList * list = NULL;
     HTCache * pres = NULL;
 
-    /* Find a hash entry for this URL */
-    if (HTCacheMode_enabled() && anchor && CacheTable) {
+    /* Find an entry for this URL */
+    if (HTCacheMode_enabled() && anchor && (CacheTable || IndexHeader)) {
 	char * url = NULL;
-	int hash = 0;
-	char * ptr;
 
 	if (default_name)
 	    StrAllocCopy (url, default_name);
 	  else
 	    url = HTAnchor_address((HTAnchor *) anchor);
-	ptr = url;
-
-	for (; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_XL_HASH_SIZE);
-	if (!CacheTable[hash]) {
-	    HT_FREE(url);
-	    return NULL;
-	}
-	list = CacheTable[hash];
 
 	/* Search the cache */
-	{
-	    HTList * cur = list;
-	    while ((pres = (HTCache *) HTList_nextObject(cur))) {
-		if (!strcmp(pres->url, url)) {
-		    HTTRACE(CACHE_TRACE, "Cache....... Found %p hits %d\n" _ 
-					     pres _ pres->hits);
-		    break;
-		}
-	    }
+	if ((pres = cache_lookup(url))) {
+	    HTTRACE(CACHE_TRACE, "Cache....... Found %p hits %d\n" _ 
+			pres _ pres->hits);
 	}
 	HT_FREE(url);
     }
@@ -1502,10 +3768,8 @@ PUBLIC HTCache * HTCache_find (HTParentAnchor * anchor, char * default_name)
 */
 PRIVATE BOOL HTCache_delete (HTCache * cache)
 {
-    if (cache && CacheTable) {
-	HTList * cur = CacheTable[cache->hash];
-	return cur && delete_object(cur, cache);
-    }
+    if (cache && CacheTable)
+	return delete_object(cache);
     return NO;
 }
 
@@ -1516,20 +3780,23 @@ PRIVATE BOOL HTCache_delete (HTCache * cache)
 */
 PUBLIC BOOL HTCache_deleteAll (void)
 {
-    if (CacheTable) {
-	HTList * cur;
-	int cnt;
+    if (CacheTable || IndexHeader) {
+	HTCache * pres;
+	int pos = 0;
 
 	/* Delete the rest */
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = CacheTable[cnt])) { 
-		HTCache * pres;
-		while ((pres = (HTCache *) HTList_nextObject(cur)) != NULL)
-		    free_object(pres);
-	    }
-	    HTList_delete(CacheTable[cnt]);
+	if (CacheTable) {
+	    while ((pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos)) != NULL)
+		free_object(pres);
+	    HTHashtable_delete(CacheTable);
+	    CacheTable = NULL;
 	}
-	HT_FREE(CacheTable);
+	gc_stop();
+	Eviction->clear();
+	memory_clear();
+	blob_clear();
+	index_close();
+	journal_close();
 	HTCacheContentSize = 0L;
 	return YES;
     }
@@ -1664,6 +3931,7 @@ PUBLIC BOOL HTCache_writeMeta (HTCache * cache, HTRequest * request,
 	    HT_FREE(name);	    
 	    return NO;
 	}
+	memory_drop(cache);
 	status = meta_write(fp, request, response);
 	fclose(fp);
 	HT_FREE(name);
@@ -1699,14 +3967,44 @@ PRIVATE BOOL meta_read (FILE * fp, HTRequest * request, HTStream * target)
     return NO;
 }
 
+/*
+**  Feed the metainformation of an entry in memory to the MIME parser
+*/
+PRIVATE BOOL memory_meta (MemoryObject * me, HTStream * target)
+{
+    if (me->meta > 0) {
+	int status = (*target->isa->put_block)(target,
+					       HTIOBuffer_data(me->buffer) + me->body,
+					       (int) me->meta);
+	if (status == HT_LOADED)
+	    (*target->isa->flush)(target);
+	else if (status < 0) {
+	    HTTRACE(PROT_TRACE, "Cache....... Target ERROR %d\n" _ status);
+	    return NO;
+	}
+    }
+    HTTRACE(PROT_TRACE, "Cache....... Meta information loaded from memory\n");
+    return YES;
+}
+
 /*
 **  Read the metainformation for the data object. If no headers are
-**  available then the meta file is empty
+**  available then the meta file is empty. If the entry is in memory then
+**  we don't have to go to the file at all.
 */
 PRIVATE BOOL HTCache_readMeta (HTCache * cache, HTRequest * request)
 {
     HTParentAnchor * anchor = HTRequest_anchor(request);
-    if (cache && request && anchor) {
+    if (cache && cache->memory && request && anchor) {
+	BOOL status;
+	HTStream * target = HTStreamStack(WWW_MIME_HEAD, WWW_DEBUG,
+					  HTBlackHole(), request, NO);
+	HTResponse_setCachable(HTRequest_response(request), HT_CACHE_ALL);
+	status = memory_meta(cache->memory, target);
+	(*target->isa->_free)(target);
+	HTRequest_setResponse(request, NULL);
+	return status;
+    } else if (cache && request && anchor) {
 	BOOL status;
 	FILE * fp;
 	char * name = HTCache_metaLocation(cache);
@@ -1753,6 +4051,7 @@ PUBLIC BOOL HTCache_updateMeta (HTCache * cache, HTRequest * request,
     if (cache && request && response) {
 	HTParentAnchor * anchor = HTRequest_anchor(request);
 	cache->hits++;
+	Eviction->touch(cache);
 
 	/* Calculate the various times */
 	calculate_time(cache, request, response);
@@ -1767,6 +4066,7 @@ PUBLIC BOOL HTCache_updateMeta (HTCache * cache, HTRequest * request,
 	/* Must we revalidate this every time? */
 	cache->must_revalidate = HTResponse_mustRevalidate(response);
 
+	journal_put(cache);
 	return YES;
     }
     return NO;
@@ -1780,11 +4080,13 @@ PUBLIC BOOL HTCache_resetMeta (HTCache * cache, HTRequest * request,
   HTCache_updateMeta (cache, request, response);
   cache->size = 0;
   cache->range = YES;
+  cache->deflated = NO;
+  Eviction->resize(cache);
   /* @@ JK: update the cache meta data on disk */
   HTCache_writeMeta (cache, request, response);
   /* @@ JK: and we remove the file name as it's obsolete 
      now */
-  REMOVE(cache->cachename);
+  body_remove(cache);
 
   return YES;
 }
@@ -1799,7 +4101,7 @@ PRIVATE BOOL flush_object (HTCache * cache)
 	char * head = HTCache_metaLocation(cache);
 	REMOVE(head);
 	HT_FREE(head);
-	REMOVE(cache->cachename);
+	body_remove(cache);
 	return YES;
     }
     return NO;
@@ -1813,26 +4115,31 @@ PRIVATE BOOL flush_object (HTCache * cache)
 */
 PUBLIC BOOL HTCache_flushAll (void)
 {
-    if (CacheTable) {
-	HTList * cur;
-	int cnt;
-
-	/* Delete the rest */
-	for (cnt=0; cnt<HT_XL_HASH_SIZE; cnt++) {
-	    if ((cur = CacheTable[cnt])) { 
-		HTCache * pres;
-		while ((pres = (HTCache *) HTList_nextObject(cur)) != NULL) {
-		    flush_object(pres);
-		    free_object(pres);
-		}
-	    }
-	    HTList_delete(CacheTable[cnt]);
-	    CacheTable[cnt] = NULL;
+    if (CacheTable || IndexHeader) {
+	HTCache * pres;
+	int pos = 0;
+
+	/* Delete the rest but keep an empty table */
+	if (IndexHeader) {
+	    unsigned int i;
+	    for (i = 0; IndexLive && i < IndexHeader->count; i++)
+		if (index_entry(i)) index_evict(i);
 	}
+	index_close();
+	while ((pres = (HTCache *) HTHashtable_nextObject(CacheTable, &pos)) != NULL) {
+	    flush_object(pres);
+	    free_object(pres);
+	}
+	HTHashtable_delete(CacheTable);
+	CacheTable = HTHashtable_newWithFlags(HT_XL_HASH_SIZE, HT_HASH_KEYREF);
+	gc_stop();
+	Eviction->clear();
+	memory_clear();
+	blob_clear();
 
 	/* Write the new empty index to disk */
-	HTCacheIndex_write(HTCacheRoot);
 	HTCacheContentSize = 0L;
+	HTCacheIndex_write(HTCacheRoot);
 	return YES;
     }
     return NO;
@@ -1864,6 +4171,11 @@ PUBLIC HTReload HTCache_isFresh (HTCache * cache, HTRequest * request)
 	    HTAnchor_setHeaderParsed(anchor);
 	}
 
+#ifndef HT_ZLIB
+	/* We can't inflate a body which was stored by a build with zlib */
+	if (cache->deflated) return HT_CACHE_ERROR;
+#endif
+
 	/* the cache size is 0 when we want to force the 
     	   revalidation of the cache, for example, after a PUT */
 #if 0
@@ -1985,8 +4297,7 @@ PUBLIC BOOL HTCache_breakLock (HTCache * cache, HTRequest * request)
 PUBLIC char * HTCache_name (HTCache * cache)
 {
     if (cache) {
-	char * local = cache->cachename;
-	char * url = HTLocalToWWW(local, "cache:");
+	char * url = HTLocalToWWW(body_name(cache), "cache:");
 	return url;
     }
     return NULL;
@@ -2005,6 +4316,7 @@ PUBLIC BOOL HTCache_addHit (HTCache * cache)
 {
     if (cache) {
 	cache->hits++;
+	Eviction->touch(cache);
 	HTTRACE(CACHE_TRACE, "Cache....... Hits for %p is %d\n" _ 
 				 cache _ cache->hits);
 	return YES;
@@ -2020,6 +4332,22 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 {
     if (me) {
 	HTCache * cache = me->cache;
+	long written = me->bytes_written;
+	BOOL deflated = NO;
+
+#ifdef HT_ZLIB
+	/*
+	**  The size of a deflated body is what we have on disk. We can't
+	**  append to a part of one so that is thrown away.
+	*/
+	if (me->zstream) {
+	    if (!abort && zip_write(me, NULL, 0, Z_FINISH) != HT_OK)
+		abort = YES;
+	    written = zip_end(me);
+	    deflated = !abort;
+	    if (deflated) CompressionSaved += me->bytes_written - written;
+	}
+#endif
 
 	/*
 	**  We close the file object. This does not mean that we have the
@@ -2028,6 +4356,10 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 	**  the request.
 	*/
 	if (me->fp) fclose(me->fp);
+	if (cache && cache->deflated && !deflated) {
+	    REMOVE(cache->cachename);
+	    written = 0;
+	}
 
 	/*
 	**  We are done storing the object body and can update the cache entry.
@@ -2043,6 +4375,8 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 	    **  We assume that an abort will only give a part of the object.
 	    */
 	    cache->range = abort;
+	    cache->deflated = deflated;
+	    CacheMissBytes += me->bytes_written;
 
 	    /*
 	    **  Set the size and maybe do gc. If it is an abort then set the
@@ -2050,17 +4384,25 @@ PRIVATE BOOL free_stream (HTStream * me, BOOL abort)
 	    **  take the byte range as the number of bytes that we have already
 	    **  written to the cache entry.
 	    */
-	    HTCache_setSize(cache, me->bytes_written, me->append);
+	    HTCache_setSize(cache, written, me->append);
+
+	    /*
+	    **  A complete body can be shared with other entries. Bodies
+	    **  which were completed with a range request are not as we
+	    **  only have the hash of the last part.
+	    */
+	    if (me->dedup && !abort)
+		blob_store(cache, me->sum);
 	}
 
 	/*
-	**  In order not to loose information, we dump the current cache index
-	**  every time we have created DUMP_FREQUENCY new entries
+	**  In order not to loose information, we journal every change and
+	**  start writing a new index when the journal has grown too long.
+	**  If the garbage collector is running then we wait for it to
+	**  finish as the index will be a lot smaller by then.
 	*/
-	if (new_entries > DUMP_FREQUENCY) {
-	    HTCacheIndex_write(HTCacheRoot);
-	    new_entries = 0;
-	}
+	if (cache) journal_put(cache);
+	if (!GCTimer && journal_due()) index_compact();
 	HT_FREE(me);
 	return YES;
     }
@@ -2087,7 +4429,13 @@ PRIVATE int HTCache_flush (HTStream * me)
 
 PRIVATE int HTCache_putBlock (HTStream * me, const char * s, int  l)
 {
-    int status = (fwrite(s, 1, l, me->fp) != l) ? HT_ERROR : HT_OK;
+    int status;
+#ifdef HT_ZLIB
+    if (me->zstream)
+	status = zip_write(me, s, l, Z_NO_FLUSH);
+    else
+#endif
+	status = cache_write(me, s, l);
     if (l > 1 && status == HT_OK) {
 	HTCache_flush(me);
 	me->bytes_written += l;
@@ -2161,8 +4509,15 @@ PRIVATE HTStream * HTCacheStream (HTRequest * request, BOOL append)
 
     /*
     ** Test that we can actually write to the cache file. If the entry already
-    ** existed then it will be overridden with the new data.
+    ** existed then it will be overridden with the new data. We remove the
+    ** old file first so that requests which are still sending it from a
+    ** mapping or with sendfile() keep the old copy. A shared body is left
+    ** to the other entries using it.
     */
+    if (!append) {
+	if (cache->blob) blob_release(cache);
+	REMOVE(cache->cachename);
+    }
     if ((fp = fopen(cache->cachename, append ? "ab" : "wb")) == NULL) {
 	HTTRACE(CACHE_TRACE, "Cache....... Can't open `%s\' for writing\n" _ cache->cachename);
 	HTCache_delete(cache);
@@ -2183,6 +4538,13 @@ PRIVATE HTStream * HTCacheStream (HTRequest * request, BOOL append)
 	me->cache = cache;
 	me->fp = fp;
 	me->append = append;
+	me->dedup = DedupEnabled && !append;
+	me->sum = BLOB_HASH_SEED;
+	cache->deflated = NO;
+#ifdef HT_ZLIB
+	if (!append && zip_wanted(anchor) && zip_start(me))
+	    cache->deflated = YES;
+#endif
 	return me;
     }
     return NULL;
@@ -2264,6 +4626,8 @@ PRIVATE int CacheCleanup (HTRequest * req, int status)
     }
     
     if (cache) {
+	if (cache->target) (*cache->target->isa->abort)(cache->target, NULL);
+	HTIOBuffer_unref(cache->buffer);
         HT_FREE(cache->local);
         HT_FREE(cache);
     }
@@ -2370,6 +4734,19 @@ PRIVATE int CacheEvent (SOCKET soc, void * pVoid, HTEventType type)
 		cache->state = CL_ERROR;
 		break;
 	    }
+	    cache->deflated = body_deflated(anchor, cache->local);
+
+	    /*
+	    **  Small entries which are used often are served from memory.
+	    **  They don't need a channel so they don't have to wait in line
+	    **  behind the entries which are read from file.
+	    */
+	    if ((cache->buffer = memory_find(anchor, cache->local,
+					     &cache->length)) != NULL) {
+		HTTRACE(PROT_TRACE, "Load Cache.. Serving `%s\' from memory\n" _ cache->local);
+		cache->state = CL_NEED_MEMORY;
+		break;
+	    }
 
 	    /*
 	    **  Create a new host object and link it to the net object
@@ -2402,6 +4779,12 @@ PRIVATE int CacheEvent (SOCKET soc, void * pVoid, HTEventType type)
 		HTRequest_addError(request, ERR_FATAL, NO,HTERR_NO_CONTENT,
 				   NULL, 0, "HTLoadCache");
 		cache->state = CL_NO_DATA;
+	    } else if (cache->stat_info.st_size > MAP_MIN_SIZE &&
+		       (cache->buffer = map_file(cache->local,
+						 (long) cache->stat_info.st_size))) {
+		HTTRACE(PROT_TRACE, "Load Cache.. Mapped `%s\'\n" _ cache->local);
+		cache->length = (long) cache->stat_info.st_size;
+		cache->state = CL_NEED_MEMORY;
 	    } else
 		cache->state = CL_NEED_OPEN_FILE;
 	    break;
@@ -2415,10 +4798,7 @@ PRIVATE int CacheEvent (SOCKET soc, void * pVoid, HTEventType type)
 		** stream stack.
 		*/
 		{
-		    HTStream * rstream = HTStreamStack(HTAnchor_format(anchor),
-						       HTRequest_outputFormat(request),
-						       HTRequest_outputStream(request),
-						       request, YES);
+		    HTStream * rstream = cache_stream(cache, request);
 		    HTNet_setReadStream(net, rstream);
 		    HTRequest_setOutputConnected(request, YES);
 		}
@@ -2468,6 +4848,52 @@ PRIVATE int CacheEvent (SOCKET soc, void * pVoid, HTEventType type)
 	    }
 	    break;
 
+	case CL_NEED_MEMORY:
+	    if (!cache->target) {
+		cache->target = cache_stream(cache, request);
+		HTRequest_setOutputConnected(request, YES);
+		HTRequest_addError(request, ERR_INFO, NO, HTERR_OK,
+				   NULL, 0, "HTLoadCache");
+
+		/*
+		**  Return once to the event loop like we do when reading
+		**  from the file so that the load is never finished before
+		**  the caller gets control back
+		*/
+		if (HTEvent_isCallbacksRegistered() &&
+		    !HTRequest_preemptive(request)) {
+		    HTTRACE(PROT_TRACE, "HTLoadCache. Returning\n");
+		    if (!cache->timer)
+			cache->timer = HTTimer_new(NULL, ReturnEvent, cache, 1, YES, NO);
+		    return HT_OK;
+		}
+	    }
+	    if (cache->length)
+		status = memory_put(cache);
+	    else
+		status = HT_OK;
+
+	    /* The body is gone once it is taken, now free the target */
+	    if (status == HT_OK) {
+		cache->length = 0;
+		status = (*cache->target->isa->_free)(cache->target);
+		if (status != HT_WOULD_BLOCK) {
+		    cache->target = NULL;
+		    cache->state = status == HT_ERROR ? CL_ERROR : CL_GOT_DATA;
+		    break;
+		}
+	    }
+	    if (status == HT_WOULD_BLOCK || status == HT_PAUSE) {
+		HTTRACE(PROT_TRACE, "HTLoadCache. Target blocked, carrying on later\n");
+		if (!cache->timer)
+		    cache->timer = HTTimer_new(NULL, ReturnEvent, cache, 1, YES, NO);
+		return HT_OK;
+	    }
+	    HTRequest_addError(request, ERR_INFO, NO, HTERR_INTERNAL,
+			       NULL, 0, "HTLoadCache");
+	    cache->state = CL_ERROR;
+	    break;
+
 	case CL_GOT_DATA:
 	    CacheCleanup(request, HT_NOT_MODIFIED);
 	    return HT_OK;
@@ -22,6 +22,8 @@
 #include "HTError.h"
 #include "HTTrans.h"
 #include "HTHstMan.h"
+#include "HTResolv.h"
+#include "HTTCP.h"
 #include "HTDNS.h"					 /* Implemented here */
 
 #ifdef LIBWWW_USEIDN
@@ -38,9 +40,12 @@ struct _HTdns {
     int			homes;	       /* Number of IP addresses on the host */
     char **		addrlist;      /* List of addresses from name server */
     double *		weight;			   /* Weight on each address */
+    time_t		ttl;		 /* From the DNS records, 0 if unknown */
+    int			homes6;			  /* Number of IPv6 addresses */
+    char *		addr6;		     /* IPv6 addresses, 16 bytes each */
 };
 
-PRIVATE HTList	**CacheTable = NULL;
+PRIVATE HTHashtable * CacheTable = NULL;	   /* Entries keyed by hostname */
 PRIVATE time_t	DNSTimeout = DNS_TIMEOUT;	   /* Timeout on DNS entries */
 
 /* ------------------------------------------------------------------------- */
@@ -53,14 +58,15 @@ PRIVATE void free_object (HTdns * me)
 	    HT_FREE(*me->addrlist);
 	HT_FREE(me->addrlist);
 	HT_FREE(me->weight);
+	HT_FREE(me->addr6);
 	HT_FREE(me);
     }
 }
 
-PRIVATE BOOL delete_object (HTList * list, HTdns * me)
+PRIVATE BOOL delete_object (HTdns * me)
 {
-    HTTRACE(PROT_TRACE, "DNS Delete.. object %p from list %p\n" _ me _ list);
-    HTList_removeObject(list, (void *) me);
+    HTTRACE(PROT_TRACE, "DNS Delete.. object %p from table %p\n" _ me _ CacheTable);
+    HTHashtable_removeEntry(CacheTable, me->hostname, (void *) me);
     free_object(me);
     return YES;
 }
@@ -88,7 +94,8 @@ PUBLIC time_t HTDNS_timeout (time_t timeout)
 **	Add an element to the cache of visited hosts. Note that this function
 **	requires the system implemented structure hostent and not our own
 **	host_info. The homes variable indicates the number of IP addresses 
-**	found. A host name must NOT contain a port number.
+**	found. A host name must NOT contain a port number. The object is
+**	added to the list if one is given, else to the cache.
 **	Returns address of new HTdns object
 */
 PUBLIC HTdns * HTDNS_add (HTList * list, struct hostent * element,
@@ -117,12 +124,102 @@ PUBLIC HTdns * HTDNS_add (HTList * list, struct hostent * element,
     if ((me->weight = (double *) HT_CALLOC(me->homes, sizeof(double))) == NULL)
         HT_OUTOFMEM("HTDNS_add");
     me->addrlength = element->h_length;
+    if (list) {
+	HTTRACE(PROT_TRACE, "DNS Add..... `%s\' with %d home(s) to %p\n" _ 
+		    host _ *homes _ list);
+	HTList_addObject(list, (void *) me);
+	return me;
+    }
+    if (!CacheTable)
+	CacheTable = HTHashtable_newWithFlags(HT_M_HASH_SIZE, HT_HASH_KEYREF);
     HTTRACE(PROT_TRACE, "DNS Add..... `%s\' with %d home(s) to %p\n" _ 
-		host _ *homes _ list);
-    HTList_addObject(list, (void *) me);
+		host _ *homes _ CacheTable);
+    HTHashtable_addObject(CacheTable, me->hostname, (void *) me);
     return me;
 }
 
+/*	HTDNS_addAddresses
+**	------------------
+**	Add the addresses found by the resolver to the cache, replacing any
+**	old entry for the host. The addresses are packed one after the other,
+**	4 bytes for IPv4 and 16 bytes for IPv6. A ttl of 0 means that we use
+**	the global timeout.
+**	Returns address of new HTdns object
+*/
+PUBLIC HTdns * HTDNS_addAddresses (const char * host, int homes, const char * addr,
+				   int homes6, const char * addr6, time_t ttl)
+{
+    HTdns * me;
+    char * block = NULL;
+    int cnt;
+    if (homes6 < 0 || !addr6) homes6 = 0;
+    if (!host || homes < 0 || (homes > 0 && !addr) || homes + homes6 <= 0)
+	return NULL;
+    if (CacheTable && (me = (HTdns *) HTHashtable_object(CacheTable, host)))
+	delete_object(me);
+    if ((me = (HTdns *) HT_CALLOC(1, sizeof(HTdns))) == NULL ||
+	(me->addrlist = (char **) HT_CALLOC(homes + 1, sizeof(char *))) == NULL ||
+	(me->weight = (double *) HT_CALLOC(homes + homes6, sizeof(double))) == NULL)
+	HT_OUTOFMEM("HTDNS_addAddresses");
+    if (homes > 0) {
+	if ((block = (char *) HT_MALLOC(homes * 4)) == NULL)
+	    HT_OUTOFMEM("HTDNS_addAddresses");
+	memcpy(block, addr, homes * 4);
+	for (cnt = 0; cnt < homes; cnt++)
+	    *(me->addrlist+cnt) = block + cnt * 4;
+    }
+    if (homes6 > 0) {
+	if ((me->addr6 = (char *) HT_MALLOC(homes6 * 16)) == NULL)
+	    HT_OUTOFMEM("HTDNS_addAddresses");
+	memcpy(me->addr6, addr6, homes6 * 16);
+	me->homes6 = homes6;
+    }
+    StrAllocCopy(me->hostname, host);
+    me->ntime = time(NULL);
+    me->ttl = ttl;
+    me->homes = homes;
+    me->addrlength = 4;
+    if (!CacheTable)
+	CacheTable = HTHashtable_newWithFlags(HT_M_HASH_SIZE, HT_HASH_KEYREF);
+    HTTRACE(PROT_TRACE, "DNS Add..... `%s' with %d home(s) and %d IPv6 address(es), ttl %ld\n" _
+	    host _ homes _ homes6 _ (long) ttl);
+    HTHashtable_addObject(CacheTable, me->hostname, (void *) me);
+    return me;
+}
+
+/*
+**	The IPv6 addresses found for the host, if any
+*/
+PUBLIC int HTDNS_homes6 (HTdns * dns)
+{
+    return dns ? dns->homes6 : 0;
+}
+
+PUBLIC const char * HTDNS_address6 (HTdns * dns, int home)
+{
+    return (dns && home >= 0 && home < dns->homes6) ? dns->addr6 + home * 16 : NULL;
+}
+
+/*
+**	The IPv4 addresses and the weights. The weights of the IPv6 addresses
+**	follow those of the IPv4 addresses.
+*/
+PUBLIC int HTDNS_homes (HTdns * dns)
+{
+    return dns ? dns->homes : 0;
+}
+
+PUBLIC const char * HTDNS_address (HTdns * dns, int home)
+{
+    return (dns && home >= 0 && home < dns->homes) ? *(dns->addrlist+home) : NULL;
+}
+
+PUBLIC double HTDNS_weight (HTdns * dns, int home)
+{
+    return (dns && home >= 0 && home < dns->homes + dns->homes6) ?
+	*(dns->weight+home) : 0.0;
+}
+
 
 /*	HTDNS_updateWeights
 **	-------------------
@@ -136,7 +233,8 @@ PUBLIC HTdns * HTDNS_add (HTList * list, struct hostent * element,
 **
 **	A short window (low Neff) gives a high sensibility, but this is
 **	required as we can't expect a lot of data to test on.
-**	"current" is the index returned by HTGetHostByName()
+**	"current" is the index returned by HTGetHostByName(), or the
+**	number of IPv4 homes plus the index of an IPv6 address.
 */
 PUBLIC BOOL HTDNS_updateWeigths(HTdns *dns, int current, ms_t deltatime)
 {
@@ -149,7 +247,7 @@ PUBLIC BOOL HTDNS_updateWeigths(HTdns *dns, int current, ms_t deltatime)
 #else
 	const double alpha = 0.716531310574;	/* Doesn't need the math lib */
 #endif
-	for (cnt=0; cnt<dns->homes; cnt++) {
+	for (cnt=0; cnt<dns->homes+dns->homes6; cnt++) {
 	    if (cnt == current) {
 		*(dns->weight+current) = *(dns->weight+current)*alpha + (1.0-alpha)*deltatime;
 		if (*(dns->weight+current) < 0.0) *(dns->weight+current) = 0.0;
@@ -171,21 +269,10 @@ PUBLIC BOOL HTDNS_updateWeigths(HTdns *dns, int current, ms_t deltatime)
 */
 PUBLIC BOOL HTDNS_delete (const char * host)
 {
-    HTList *list;
-    int hash = 0;
-    const char *ptr;
+    HTdns *pres;
     if (!host || !CacheTable) return NO;
-    for(ptr=host; *ptr; ptr++)
-	hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_M_HASH_SIZE);
-    if ((list = CacheTable[hash])) {	 /* We have the list, find the entry */
-	HTdns *pres;
-	while ((pres = (HTdns *) HTList_nextObject(list))) {
-	    if (!strcmp(pres->hostname, host)) {
-		delete_object(CacheTable[hash], pres);
-		break;
-	    }
-	}
-    }
+    if ((pres = (HTdns *) HTHashtable_object(CacheTable, host)))
+	delete_object(pres);
     return YES;
 }
 
@@ -195,19 +282,13 @@ PUBLIC BOOL HTDNS_delete (const char * host)
 */
 PUBLIC BOOL HTDNS_deleteAll (void)
 {
-    int cnt;
-    HTList *cur;
+    HTdns *pres;
+    int pos = 0;
     if (!CacheTable) return NO;
-    for (cnt=0; cnt<HT_M_HASH_SIZE; cnt++) {
-	if ((cur = CacheTable[cnt])) { 
-	    HTdns *pres;
-	    while ((pres = (HTdns *) HTList_nextObject(cur)) != NULL)
-		free_object(pres);
-	}
-	HTList_delete(CacheTable[cnt]);
-	CacheTable[cnt] = NULL;
-    }
-    HT_FREE(CacheTable);
+    while ((pres = (HTdns *) HTHashtable_nextObject(CacheTable, &pos)) != NULL)
+	free_object(pres);
+    HTHashtable_delete(CacheTable);
+    CacheTable = NULL;
     return YES;
 }
 
@@ -279,20 +360,43 @@ PUBLIC int HTACEfromUTF8 (char *hostUTF8, char *punycode, size_t punyLength)
 }
 #endif
 
+/*
+**	Ask the asynchronous resolver. If it has put the name into the cache
+**	then we go round again. Returns 0 if we have to wait for the name
+**	server, -1 on error and -2 if we should use the blocking resolver.
+*/
+PRIVATE int lookup_async (HTHost * host, char * hostace, HTRequest * request)
+{
+    int status = HTResolver_lookup(hostace, HTRequest_net(request));
+    if (status == HT_WOULD_BLOCK) {
+	HTAlertCallback *cbf = HTAlert_find(HT_PROG_DNS);
+	if (cbf) (*cbf)(request, HT_PROG_DNS, HT_MSG_NULL,NULL,hostace,NULL);
+	return 0;
+    } else if (status == HT_OK) {
+	if (CacheTable && HTHashtable_object(CacheTable, hostace))
+	    return HTGetHostByName(host, hostace, request);
+    } else if (status == HT_ERROR)
+	return -1;
+    return -2;
+}
+
 /*	HTGetHostByName
 **	---------------
 **	Resolve the host name using internal DNS cache. As we want to refer   
 **	a specific host when timing the connection the weight function must
 **	use the 'current' value as returned.
+**	If the asynchronous resolver is enabled and the name isn't in the
+**	cache then we return 0 and the Net object is called again when the
+**	answer is in.
 **      Returns:
 **	       	>0	Number of homes
+**		 0	Waiting for the name server
 **		-1	Error
 */
 PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 {
     SockA *sin = HTHost_getSockAddr(host);
     int homes = -1;
-    HTList *list;				    /* Current list in cache */
     HTdns *pres = NULL;
     char hostace[256]; /* check lengths!!! */
 
@@ -306,33 +410,15 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 	    return -1;
     }
     HTHost_setHome(host, 0); 
-
-    /* Find a hash for this host */
-    {
-	int hash = 0;
-	char *ptr;
-	for(ptr=hostace; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HT_M_HASH_SIZE);
-	if (!CacheTable) {
-	    if ((CacheTable = (HTList* *) HT_CALLOC(HT_M_HASH_SIZE, sizeof(HTList *))) == NULL)
-	        HT_OUTOFMEM("HTDNS_init");
-	}
-	if (!CacheTable[hash]) CacheTable[hash] = HTList_new();
-	list = CacheTable[hash];
-    }
+    host->ipv6 = NO;
 
     /* Search the cache */
-    {
-	HTList *cur = list;
-	while ((pres = (HTdns *) HTList_nextObject(cur))) {
-	    if (!strcmp(pres->hostname, hostace)) {
-		if (time(NULL) > pres->ntime + DNSTimeout) {
-		    HTTRACE(PROT_TRACE, "HostByName.. Refreshing cache\n");
-		    delete_object(list, pres);
-		    pres = NULL;
-		}
-		break;
-	    }
+    if (CacheTable &&
+	(pres = (HTdns *) HTHashtable_object(CacheTable, hostace))) {
+	if (time(NULL) > pres->ntime + (pres->ttl ? pres->ttl : DNSTimeout)) {
+	    HTTRACE(PROT_TRACE, "HostByName.. Refreshing cache\n");
+	    delete_object(pres);
+	    pres = NULL;
 	}
     }
     if (pres) {
@@ -341,6 +427,21 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 	** fall back for persistent connections
 	*/
 	homes = pres->homes;
+
+	/*
+	** A host with IPv6 addresses only can be reached if we race
+	** connects over IPv6, otherwise we can't use it
+	*/
+	if (homes == 0) {
+	    if (HTDoConnect_IPv6() && !HTRequest_preemptive(request)) {
+		host->dns = pres;
+		return pres->homes6;
+	    }
+	    HTTRACE(PROT_TRACE, "HostByName.. `%s\' has no IPv4 address\n" _ hostace);
+	    HTRequest_addError(request, ERR_FATAL, NO, HTERR_NO_REMOTE_HOST,
+			       "No IPv4 address", 15, "HTGetHostByName");
+	    return -1;
+	}
 	if (pres->homes > 1) {
 	    int cnt = 0;
 	    double best_weight = 1e30;			      /* Pretty bad */
@@ -355,6 +456,9 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
 	host->dns = pres;
 	memcpy((void *) &sin->sin_addr, *(pres->addrlist+HTHost_home(host)),
 	       pres->addrlength);
+    } else if (HTResolver_async() && !HTRequest_preemptive(request) &&
+	       (homes = lookup_async(host, hostace, request)) != -2) {
+	return homes;
     } else {
 	struct hostent *hostelement;			      /* see netdb.h */
 	HTAlertCallback *cbf = HTAlert_find(HT_PROG_DNS);
@@ -391,7 +495,7 @@ PUBLIC int HTGetHostByName (HTHost * host, char *hostname, HTRequest* request)
    			             "gethostbyname");
 	    return -1;
 	}	
-	host->dns = HTDNS_add(list, hostelement, hostace, &homes);
+	host->dns = HTDNS_add(NULL, hostelement, hostace, &homes);
 	memcpy((void *) &sin->sin_addr, *hostelement->h_addr_list,
 	       hostelement->h_length);
     }
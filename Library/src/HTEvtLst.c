@@ -37,7 +37,7 @@
 
 /* Type definitions and global variables etc. local to this module */
 #define MILLI_PER_SECOND	1000
-#define HASH(s)			((s) % HT_M_HASH_SIZE) 
+#define SOCK_TABLE_SIZE		64	/* Initial size of the socket registry */
 
 #define EVENTS_TO_EXECUTE	10 /* how many to execute in one select loop */
 
@@ -47,6 +47,7 @@ typedef struct {
     SOCKET 	s ;	 		/* our socket */
     HTEvent * 	events[HTEvent_TYPES];	/* event parameters for read, write, oob */
     HTTimer *	timeouts[HTEvent_TYPES];
+    BOOL	always;		/* Backend can't watch it - always ready */
 } SockEvents;
 
 typedef struct {
@@ -61,7 +62,15 @@ typedef enum {
     SockEvents_find
 } SockEvents_action;
 
-PRIVATE HTList * HashTable [HT_M_HASH_SIZE]; 
+/*
+**  The registry is indexed by the socket itself so that finding the entry
+**  for a socket costs the same with 50000 sockets as with 5. It grows to
+**  twice the size when a socket doesn't fit. Winsock sockets are small
+**  handle values as well so this works there too.
+*/
+PRIVATE SockEvents ** SockTable = NULL;
+PRIVATE SOCKET SockTableSize = 0;
+
 PRIVATE HTList * EventOrderList = NULL;
 PRIVATE int HTEndLoop = 0;		       /* If !0 then exit event loop */
 PRIVATE BOOL HTInLoop = NO;
@@ -73,6 +82,25 @@ PRIVATE ATOM HTclass;
 PRIVATE HINSTANCE HTinstance;
 PRIVATE unsigned long HTwinMsg;
 #else /* WWW_WIN_ASYNC */
+/*
+**  An event backend is the part of the event loop that knows how to ask
+**  the OS which sockets are ready. The registry above it is the same for
+**  all backends. A backend is told every time the set of events a socket
+**  is registered for changes and it is asked to wait for activity which
+**  it then queues up using EventOrder_addSockEvents.
+*/
+typedef struct _EventBackend {
+    HTEventBackend	type;
+    const char *	name;
+    BOOL (*init)	(void);
+    BOOL (*terminate)	(void);
+    int  (*update)	(SockEvents * sockp, int oldset, int newset);
+    int  (*wait)	(int millis, int * active);
+} EventBackend;
+
+PRIVATE EventBackend * Backend = NULL;		   /* Current event backend */
+PRIVATE HTEventBackend PreferredBackend = HT_EVENT_DEFAULT;
+
 PRIVATE fd_set FdArray[HTEvent_TYPES];
 PRIVATE SOCKET MaxSock = 0;			  /* max socket value in use */
 #endif /* !WWW_WIN_ASYNC */
@@ -119,8 +147,7 @@ PRIVATE void Timer_traceHead (void)
 */
 PRIVATE void EventList_dump (void)
 {
-    int v = 0;
-    HTList* cur;
+    SOCKET v;
     SockEvents * pres;
     HTTRACE(ALL_TRACE, "Event....... Dumping socket events\n");
     HTTRACE(ALL_TRACE, "soc ");
@@ -128,9 +155,8 @@ PRIVATE void EventList_dump (void)
     HTTRACE(ALL_TRACE, " ");
     Timer_traceHead();
     HTTRACE(ALL_TRACE, "\n");
-    for (v = 0; v < HT_M_HASH_SIZE; v++) {
-	cur = HashTable[v];
-	while ((pres = (SockEvents *) HTList_nextObject(cur))) {
+    for (v = 0; v < SockTableSize; v++) {
+	if ((pres = SockTable[v]) != NULL) {
 	    int i;
 	    HTTRACE(ALL_TRACE, "%3d \n" _ pres->s);
 	    for (i = 0; i < HTEvent_TYPES; i++)
@@ -249,38 +275,47 @@ PUBLIC void CheckSockEvent (HTTimer * timer, HTTimerCallback * cbf, void * param
 
 PRIVATE SockEvents * SockEvents_get (SOCKET s, SockEvents_action action)
 {
-    long v = HASH(s);
-    HTList* cur;
     SockEvents * pres;
 
     /* if the socket doesn't exists, don't do anything */
     if (s == INVSOC)
       return NULL;
 
-    if (HashTable[v] == NULL) HashTable[v] = HTList_new();
-    cur = HashTable[v];
-    while ((pres = (SockEvents *) HTList_nextObject(cur)))
-	if (pres->s == s) return pres;
+    if (s < SockTableSize && SockTable[s]) return SockTable[s];
 
     if (action == SockEvents_mayCreate) {
+	if (s >= SockTableSize) {
+	    SOCKET size = SockTableSize ? SockTableSize : SOCK_TABLE_SIZE;
+	    while (size <= s) size *= 2;
+	    if ((SockTable = (SockEvents **) HT_REALLOC(SockTable, size * sizeof(SockEvents *))) == NULL)
+		HT_OUTOFMEM("SockEvents_get");
+	    memset(SockTable + SockTableSize, 0, (size - SockTableSize) * sizeof(SockEvents *));
+	    SockTableSize = size;
+	}
         if ((pres = (SockEvents *) HT_CALLOC(1, sizeof(SockEvents))) == NULL)
 	    HT_OUTOFMEM("HTEventList_register");
 	pres->s = s;
-	HTList_addObject(HashTable[v], (void *)pres);
+	SockTable[s] = pres;
 	return pres;
     }
     return NULL;
 }
 
-PRIVATE int EventOrder_add (SOCKET s, HTEventType type, ms_t now)
+/*
+**  Queue an event for a socket that we already have the registry entry
+**  for. Backends that can carry our context through the OS call this
+**  directly so that they don't have to look up the socket again.
+*/
+PRIVATE int EventOrder_addSockEvents (SockEvents * sockp, HTEventType type,
+				      ms_t now)
 {
     EventOrder * pres;
     HTList * cur = EventOrderList;
     HTList * insertAfter = cur;
-    SockEvents * sockp = SockEvents_get(s, SockEvents_find);
+    SOCKET s = sockp->s;
     HTEvent * event;
 
-    if (sockp == NULL || (event = sockp->events[HTEvent_INDEX(type)]) == NULL) {
+    if ((event = sockp->events[HTEvent_INDEX(type)]) == NULL) {
 	HTTRACE(THD_TRACE, "EventOrder.. no event found for socket %d, type %s.\n" _
 		s _ HTEvent_type2str(type));
 	return HT_ERROR;
@@ -310,6 +345,17 @@ PRIVATE int EventOrder_add (SOCKET s, HTEventType type, ms_t now)
     return HT_OK;
 }
 
+PRIVATE int EventOrder_add (SOCKET s, HTEventType type, ms_t now)
+{
+    SockEvents * sockp = SockEvents_get(s, SockEvents_find);
+    if (sockp == NULL) {
+	HTTRACE(THD_TRACE, "EventOrder.. no event found for socket %d, type %s.\n" _
+		s _ HTEvent_type2str(type));
+	return HT_ERROR;
+    }
+    return EventOrder_addSockEvents(sockp, type, now);
+}
+
 PUBLIC int EventOrder_executeAndDelete (void) 
 {
     HTList * cur = EventOrderList;
@@ -356,13 +402,13 @@ PUBLIC BOOL EventOrder_deleteAll (void)
 }
 
 /* ------------------------------------------------------------------------- */
-/*				EVENT REGISTRATION			     */
+/*				SELECT BACKEND				     */
 /* ------------------------------------------------------------------------- */
 
+#ifndef WWW_WIN_ASYNC
 /*
 ** ResetMaxSock - reset the value of the maximum socket in use 
 */
-#ifndef WWW_WIN_ASYNC
 PRIVATE void __ResetMaxSock (void)
 {
     SOCKET cnt;
@@ -378,8 +424,462 @@ PRIVATE void __ResetMaxSock (void)
     HTTRACE(THD_TRACE, "Event....... Reset MaxSock from %u to %u\n" _ old_max _ MaxSock);
     return;
 }  
+
+PRIVATE BOOL Select_init (void)
+{
+    FD_ZERO(FdArray+HTEvent_INDEX(HTEvent_READ));
+    FD_ZERO(FdArray+HTEvent_INDEX(HTEvent_WRITE));
+    FD_ZERO(FdArray+HTEvent_INDEX(HTEvent_OOB));
+    MaxSock = 0;
+    return YES;
+}
+
+PRIVATE BOOL Select_terminate (void)
+{
+    return Select_init();
+}
+
+/*
+**  Put the socket into the fd sets it is now registered for and take it
+**  out of the ones it isn't.
+*/
+PRIVATE int Select_update (SockEvents * sockp, int oldset, int newset)
+{
+    SOCKET s = sockp->s;
+    int i;
+    for (i = 0; i < HTEvent_TYPES; i++) {
+	if (newset & (1<<i)) {
+	    FD_SET(s, FdArray+i);
+	    HTTRACEDATA((char *) FdArray+i, 8, "Select_update: set (s:%d)" _ s);
+	} else if (oldset & (1<<i)) {
+	    FD_CLR(s, FdArray+i);
+	    HTTRACEDATA((char *) FdArray+i, 8, "Select_update: clear (s:%d)" _ s);
+	}
+    }
+    if (newset && s > MaxSock) {
+	MaxSock = s ;
+	HTTRACE(THD_TRACE, "Event....... New value for MaxSock is %d\n" _ MaxSock);
+    } else if (!newset && s >= MaxSock)
+	__ResetMaxSock();
+    return HT_OK;
+}
+
+PRIVATE int Select_wait (int millis, int * active)
+{
+    fd_set treadset, twriteset, texceptset;
+    struct timeval waittime, * wt = NULL;
+    int active_sockets;
+    int maxfds;
+    ms_t now;
+    SOCKET s;
+    int status;
+
+    /*
+    **  Timeval struct copy needed for linux, as it set the value to the
+    **  remaining timeout while exiting the select. (and perhaps for
+    **  other OS). Code borrowed from X server.
+    */
+    *active = 0;
+    if (millis >= 0) {
+	waittime.tv_sec = millis / MILLI_PER_SECOND;
+	waittime.tv_usec = (millis % MILLI_PER_SECOND) *
+	    (1000000 / MILLI_PER_SECOND);
+	wt = &waittime;
+    }
+
+    /*
+    **  Now we copy the current active file descriptors to pass them to select.
+    */
+    treadset = FdArray[HTEvent_INDEX(HTEvent_READ)];
+    twriteset = FdArray[HTEvent_INDEX(HTEvent_WRITE)];
+    texceptset = FdArray[HTEvent_INDEX(HTEvent_OOB)];
+
+    /* And also get the max socket value */
+    maxfds = MaxSock; 
+
+    HTTRACE(THD_TRACE, "Event Loop.. calling select: maxfds is %d\n" _ maxfds);
+#ifdef HTDEBUG
+    fd_dump(maxfds, &treadset, &twriteset, &texceptset, wt);
+#endif
+
+#ifdef __hpux 
+    active_sockets = select(maxfds+1, (int *)&treadset, (int *)&twriteset,
+			    (int *)&texceptset, wt);
+#elif defined(_WINSOCKAPI_)
+    /*
+     * yovavm@contact.com
+     *
+     * On some WINSOCK versions select() with 3 empty sets and NULL timeout
+     * returns 0 and in some it returns -1.
+     * If 0 is returned in such situation, we will go into an infinite loop
+     * (cause the sets will stay empty forever ...),
+     * so make sure to set the active_sockets = -1 which will take us out 
+     * of the loop.
+     */
+    if ((treadset.fd_count || twriteset.fd_count || texceptset.fd_count) 
+	&& wt)
+	 active_sockets = select(maxfds+1, &treadset, &twriteset,
+				 &texceptset, wt);
+    else
+	 active_sockets = -1;	
+#else
+    active_sockets = select(maxfds+1, &treadset, &twriteset, &texceptset, wt);
+#endif
+
+    now = HTGetTimeInMillis();
+
+    HTTRACE(THD_TRACE, "Event Loop.. select returns %d\n" _ active_sockets);
+#ifdef HTDEBUG
+    fd_dump(maxfds, &treadset, &twriteset, &texceptset, wt);
+#endif
+
+    if (active_sockets == -1) {
+#ifdef EINTR
+	if (socerrno == EINTR) {
+	    /*
+	    ** EINTR     The select() function was interrupted  before  any
+	    **           of  the  selected  events  occurred and before the
+	    **           timeout interval expired.
+	    **
+	    **           If SA_RESTART has been set  for  the  interrupting
+	    **           signal,  it  is  implementation-dependent  whether
+	    **	     select() restarts or returns with EINTR.
+	    */
+	    HTTRACE(THD_TRACE, "Event Loop.. select was interruted - try again\n");
+	    return HT_OK;
+	}
+#endif /* EINTR */
+#ifdef EBADF
+	if (socerrno == EBADF) {
+	    /*
+	    ** EBADF     One or more of the file descriptor sets  specified
+	    **           a  file  descriptor  that is not a valid open file
+	    **           descriptor.
+	    */
+	    HTTRACE(THD_TRACE, "Event Loop.. One or more sockets were not through their connect phase - try again\n");
+	    return HT_OK;
+	}
+#endif
+	HTTRACE(THD_TRACE, "Event Loop.. select returned error %d\n" _ socerrno);
+
+#ifdef HTDEBUG
+	EventList_dump();
+#endif /* HTDEBUG */
+
+	return HT_ERROR;
+    }
+
+    /*
+    **  We had a timeout so now we check and see if we have a timeout
+    **  handler to call. Let HTTimer_next get it.
+    */ 
+    if (active_sockets == 0)
+	return HT_OK;
+
+    /* There were active sockets. Determine which fd sets they were in */
+    *active = active_sockets;
+    for (s = 0 ; s <= maxfds ; s++) { 
+	if (FD_ISSET(s, &texceptset))
+	    if ((status = EventOrder_add(s, HTEvent_OOB, now)) != HT_OK)
+		return status;
+	if (FD_ISSET(s, &twriteset))
+	    if ((status = EventOrder_add(s, HTEvent_WRITE, now)) != HT_OK)
+		return status;
+	if (FD_ISSET(s, &treadset))
+	    if ((status = EventOrder_add(s, HTEvent_READ, now)) != HT_OK)
+		return status;
+    }
+    return HT_OK;
+}
+
+PRIVATE EventBackend SelectBackend = {
+    HT_EVENT_SELECT, "select",
+    Select_init, Select_terminate, Select_update, Select_wait
+};
+
+/* ------------------------------------------------------------------------- */
+/*				EPOLL BACKEND				     */
+/* ------------------------------------------------------------------------- */
+
+#ifdef HAVE_SYS_EPOLL_H
+
+#define EPOLL_MAX_EVENTS	256	    /* Events fetched per epoll_wait() */
+
+PRIVATE int EpollFd = -1;
+PRIVATE struct epoll_event * EpollEvents = NULL;
+
+/*
+**  Descriptors that epoll refuses to watch (regular files, for example
+**  stdin redirected from a file) are always ready as far as select() is
+**  concerned. We keep them on the side and report them on every round.
+*/
+PRIVATE HTList * EpollAlways = NULL;
+
+PRIVATE BOOL Epoll_init (void)
+{
+    if (EpollFd >= 0) return YES;
+    if ((EpollFd = epoll_create(EPOLL_MAX_EVENTS)) < 0) {
+	HTTRACE(THD_TRACE, "Epoll....... Can't create epoll descriptor: %s\n" _
+		HTErrnoString(socerrno));
+	return NO;
+    }
+#ifdef HAVE_FCNTL
+    fcntl(EpollFd, F_SETFD, FD_CLOEXEC);
+#endif
+    if ((EpollEvents = (struct epoll_event *)
+	 HT_CALLOC(EPOLL_MAX_EVENTS, sizeof(struct epoll_event))) == NULL)
+	HT_OUTOFMEM("Epoll_init");
+    EpollAlways = HTList_new();
+    HTTRACE(THD_TRACE, "Epoll....... Created epoll descriptor %d\n" _ EpollFd);
+    return YES;
+}
+
+PRIVATE BOOL Epoll_terminate (void)
+{
+    if (EpollFd >= 0) {
+	close(EpollFd);
+	EpollFd = -1;
+    }
+    HT_FREE(EpollEvents);
+    HTList_delete(EpollAlways);
+    EpollAlways = NULL;
+    return YES;
+}
+
+/*
+**  We use level triggered notification so that the semantics are the
+**  same as for select(): a handler that doesn't drain the socket will be
+**  called again the next time around.
+*/
+PRIVATE int Epoll_update (SockEvents * sockp, int oldset, int newset)
+{
+    struct epoll_event ev;
+    int op = oldset ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (sockp->always) {
+	if (!newset) {
+	    HTList_removeObject(EpollAlways, sockp);
+	    sockp->always = NO;
+	}
+	return HT_OK;
+    }
+
+    if (!newset) {
+	/*
+	**  If the socket already has been closed then the kernel has removed
+	**  it from the interest list for us so we don't care about errors
+	*/
+	if (epoll_ctl(EpollFd, EPOLL_CTL_DEL, sockp->s, &ev) < 0)
+	    HTTRACE(THD_TRACE, "Epoll....... Can't remove socket %d: %s\n" _
+		    sockp->s _ HTErrnoString(socerrno));
+	return HT_OK;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = sockp;
+    if (newset & (1<<HTEvent_INDEX(HTEvent_READ))) ev.events |= EPOLLIN;
+    if (newset & (1<<HTEvent_INDEX(HTEvent_WRITE))) ev.events |= EPOLLOUT;
+    if (newset & (1<<HTEvent_INDEX(HTEvent_OOB))) ev.events |= EPOLLPRI;
+
+    /*
+    **  A socket may have been closed and the descriptor reused without us
+    **  knowing so we may have to swap ADD and MOD
+    */
+    if (epoll_ctl(EpollFd, op, sockp->s, &ev) < 0) {
+	if (errno == ENOENT && op == EPOLL_CTL_MOD)
+	    op = EPOLL_CTL_ADD;
+	else if (errno == EEXIST && op == EPOLL_CTL_ADD)
+	    op = EPOLL_CTL_MOD;
+	else if (errno == EPERM) {
+	    HTTRACE(THD_TRACE, "Epoll....... Socket %d can't be polled - always ready\n" _
+		    sockp->s);
+	    sockp->always = YES;
+	    HTList_addObject(EpollAlways, sockp);
+	    return HT_OK;
+	} else
+	    op = -1;
+	if (op < 0 || epoll_ctl(EpollFd, op, sockp->s, &ev) < 0) {
+	    HTTRACE(THD_TRACE, "Epoll....... Can't register socket %d: %s\n" _
+		    sockp->s _ HTErrnoString(socerrno));
+	    return HT_ERROR;
+	}
+    }
+    return HT_OK;
+}
+
+/*
+**  Queue the events that the socket is registered for and which epoll
+**  found to be ready. Errors and hangups are passed on to both readers and
+**  writers as select() does.
+*/
+PRIVATE int Epoll_queue (SockEvents * sockp, unsigned int ready, ms_t now)
+{
+    int status = HT_OK;
+    if ((ready & EPOLLPRI) && sockp->events[HTEvent_INDEX(HTEvent_OOB)])
+	if ((status = EventOrder_addSockEvents(sockp, HTEvent_OOB, now)) != HT_OK)
+	    return status;
+    if ((ready & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+	sockp->events[HTEvent_INDEX(HTEvent_WRITE)])
+	if ((status = EventOrder_addSockEvents(sockp, HTEvent_WRITE, now)) != HT_OK)
+	    return status;
+    if ((ready & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+	sockp->events[HTEvent_INDEX(HTEvent_READ)])
+	if ((status = EventOrder_addSockEvents(sockp, HTEvent_READ, now)) != HT_OK)
+	    return status;
+    return status;
+}
+
+PRIVATE int Epoll_wait (int millis, int * active)
+{
+    int active_sockets;
+    int status;
+    int cnt;
+    ms_t now;
+
+    *active = 0;
+    if (!HTList_isEmpty(EpollAlways)) millis = 0;
+
+    HTTRACE(THD_TRACE, "Event Loop.. calling epoll_wait: timeout is %d ms\n" _ millis);
+    active_sockets = epoll_wait(EpollFd, EpollEvents, EPOLL_MAX_EVENTS, millis);
+    now = HTGetTimeInMillis();
+    HTTRACE(THD_TRACE, "Event Loop.. epoll_wait returns %d\n" _ active_sockets);
+
+    if (active_sockets < 0) {
+	if (socerrno == EINTR) {
+	    HTTRACE(THD_TRACE, "Event Loop.. epoll_wait was interrupted - try again\n");
+	    return HT_OK;
+	}
+	HTTRACE(THD_TRACE, "Event Loop.. epoll_wait returned error %d\n" _ socerrno);
+#ifdef HTDEBUG
+	EventList_dump();
+#endif /* HTDEBUG */
+	return HT_ERROR;
+    }
+
+    for (cnt = 0; cnt < active_sockets; cnt++) {
+	SockEvents * sockp = (SockEvents *) EpollEvents[cnt].data.ptr;
+	if ((status = Epoll_queue(sockp, EpollEvents[cnt].events, now)) != HT_OK)
+	    return status;
+    }
+
+    if (!HTList_isEmpty(EpollAlways)) {
+	HTList * cur = EpollAlways;
+	SockEvents * sockp;
+	while ((sockp = (SockEvents *) HTList_nextObject(cur))) {
+	    if ((status = Epoll_queue(sockp, EPOLLIN | EPOLLOUT, now)) != HT_OK)
+		return status;
+	    active_sockets++;
+	}
+    }
+
+    *active = active_sockets;
+    return HT_OK;
+}
+
+PRIVATE EventBackend EpollBackend = {
+    HT_EVENT_EPOLL, "epoll",
+    Epoll_init, Epoll_terminate, Epoll_update, Epoll_wait
+};
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* ------------------------------------------------------------------------- */
+/*			      BACKEND SELECTION				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE int EventList_remaining (SockEvents * pres);
+
+PRIVATE EventBackend * EventBackend_find (HTEventBackend type)
+{
+    switch (type) {
+    case HT_EVENT_SELECT:
+	return &SelectBackend;
+#ifdef HAVE_SYS_EPOLL_H
+    case HT_EVENT_EPOLL:
+    case HT_EVENT_DEFAULT:
+	return &EpollBackend;
+#else
+    case HT_EVENT_DEFAULT:
+	return &SelectBackend;
+#endif /* HAVE_SYS_EPOLL_H */
+    default:
+	return NULL;
+    }
+}
+
+/*
+**  Get the current backend, starting it if this is the first time. If the
+**  backend can't be started then we fall back on select() which always
+**  works. Sockets that were registered before (or with another backend)
+**  are handed over to the new backend.
+*/
+PRIVATE EventBackend * EventBackend_current (void)
+{
+    if (!Backend) {
+	EventBackend * backend = EventBackend_find(PreferredBackend);
+	SOCKET v;
+	if (!backend || !(*backend->init)()) {
+	    backend = &SelectBackend;
+	    (*backend->init)();
+	}
+	HTTRACE(THD_TRACE, "Event....... Using %s backend\n" _ backend->name);
+	Backend = backend;
+	for (v = 0; v < SockTableSize; v++) {
+	    SockEvents * pres = SockTable[v];
+	    if (pres) {
+		pres->always = NO;
+		(*Backend->update)(pres, 0, EventList_remaining(pres));
+	    }
+	}
+    }
+    return Backend;
+}
+
+PRIVATE void EventBackend_stop (void)
+{
+    if (Backend) {
+	(*Backend->terminate)();
+	Backend = NULL;
+    }
+}
 #endif /* !WWW_WIN_ASYNC */
 
+PUBLIC BOOL HTEventList_setBackend (HTEventBackend type)
+{
+#ifdef WWW_WIN_ASYNC
+    return NO;
+#else
+    EventBackend * backend = EventBackend_find(type);
+    if (!backend) {
+	HTTRACE(THD_TRACE, "Event....... Backend %d is not available\n" _ type);
+	return NO;
+    }
+    if (HTInLoop) {
+	HTTRACE(THD_TRACE, "Event....... Can't change backend while in the loop\n");
+	return NO;
+    }
+    PreferredBackend = type;
+    if (Backend && Backend != backend) {
+	EventBackend_stop();
+	if (EventBackend_current() != backend) return NO;
+    }
+    return YES;
+#endif /* !WWW_WIN_ASYNC */
+}
+
+PUBLIC HTEventBackend HTEventList_backend (void)
+{
+#ifdef WWW_WIN_ASYNC
+    return HT_EVENT_DEFAULT;
+#else
+    return EventBackend_current()->type;
+#endif /* !WWW_WIN_ASYNC */
+}
+
+/* ------------------------------------------------------------------------- */
+/*				EVENT REGISTRATION			     */
+/* ------------------------------------------------------------------------- */
+
 PRIVATE int EventList_remaining (SockEvents * pres)
 {
     int ret = 0;
@@ -398,6 +898,7 @@ PRIVATE int EventList_remaining (SockEvents * pres)
 */
 PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
 {
+    int oldset = 0;
     int newset = 0;
     SockEvents * sockp;
     HTTRACE(THD_TRACE, "Event....... Register socket %d, request %p handler %p type %s at priority %d\n" _ 
@@ -414,6 +915,7 @@ PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
     HTTRACE(THD_TRACE, "Event....... Registering socket for %s\n" _ HTEvent_type2str(type));
     sockp = SockEvents_get(s, SockEvents_mayCreate);
     sockp->s = s;
+    oldset = EventList_remaining(sockp);
     sockp->events[HTEvent_INDEX(type)] = event;
     newset = EventList_remaining(sockp);
 #ifdef WWW_WIN_ASYNC
@@ -422,14 +924,8 @@ PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
 	return HT_ERROR;
     }
 #else /* WWW_WIN_ASYNC */
-    FD_SET(s, FdArray+HTEvent_INDEX(type));
-
-    HTTRACEDATA((char *) FdArray+HTEvent_INDEX(type), 8, "HTEventList_register: (s:%d)" _ s);
-
-    if (s > MaxSock) {
-	MaxSock = s ;
-	HTTRACE(THD_TRACE, "Event....... New value for MaxSock is %d\n" _ MaxSock);
-    }
+    if ((*EventBackend_current()->update)(sockp, oldset, newset) != HT_OK)
+	return HT_ERROR;
 #endif /* !WWW_WIN_ASYNC */
 
     /*
@@ -446,6 +942,11 @@ PUBLIC int HTEventList_register (SOCKET s, HTEventType type, HTEvent * event)
 }
 
 /* PATCH INFOVISTA */
+/*
+**  Orders are queued with the type the backend reported, so we match on
+**  the index. Otherwise a CONNECT unregister leaves a WRITE order behind
+**  which calls back into an event that may be gone by then.
+*/
 PRIVATE void EventOrder_clean (SOCKET s, HTEventType type) 
 {
     HTList * cur = EventOrderList;
@@ -454,7 +955,7 @@ PRIVATE void EventOrder_clean (SOCKET s, HTEventType type)
     HTTRACE(THD_TRACE, "EventOrder.. Clearing ordered events of type %s for socket %d\n" _ HTEvent_type2str(type) _ s);
     /* Look to see if it's already here from before */
     while ((pres = (EventOrder *) HTList_nextObject(cur))) {
-	if (pres->s == s && pres->type == type) {
+	if (pres->s == s && HTEvent_INDEX(pres->type) == HTEvent_INDEX(type)) {
 	  HTList_quickRemoveElement(cur, last);
 	  HT_FREE (pres);
 	  cur = last;
@@ -473,9 +974,6 @@ PRIVATE void EventOrder_clean (SOCKET s, HTEventType type)
 */
 PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type) 
 {
-    long 		v;
-    HTList * 		cur;
-    HTList * 		last;
     SockEvents *	pres;
     int			ret = HT_ERROR;
 
@@ -483,67 +981,49 @@ PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type)
     if (s == INVSOC || HTEvent_INDEX (type) >= HTEvent_TYPES)
        return HT_ERROR;
 
-    last = cur = HashTable[v = HASH(s)];
-
     EventOrder_clean (s, type);
     /* PATCH INFOVISTA */
 
-    while (cur && (pres = (SockEvents *) HTList_nextObject(cur))) {
-        if (pres->s == s) {
-	    int	remaining = 0;
+    if ((pres = SockEvents_get(s, SockEvents_find)) != NULL) {
+	int	oldset = EventList_remaining(pres);
+	int	remaining = 0;
 
-	    /*
-	    **  Unregister the event from this action
-	    */
-	    pres->events[HTEvent_INDEX(type)] = NULL;
-            remaining = EventList_remaining(pres);
+	/*
+	**  Unregister the event from this action
+	*/
+	pres->events[HTEvent_INDEX(type)] = NULL;
+	remaining = EventList_remaining(pres);
 
-	    /*
-	    **  Check to see of there was a timeout connected with the event.
-	    **  If so then delete the timeout as well.
-	    */
-	    {
-		HTTimer * timer = pres->timeouts[HTEvent_INDEX(type)];
-                if (timer) HTTimer_delete(timer);
-                pres->timeouts[HTEvent_INDEX(type)] = NULL;
-	    }
+	/*
+	**  Check to see of there was a timeout connected with the event.
+	**  If so then delete the timeout as well.
+	*/
+	{
+	    HTTimer * timer = pres->timeouts[HTEvent_INDEX(type)];
+	    if (timer) HTTimer_delete(timer);
+	    pres->timeouts[HTEvent_INDEX(type)] = NULL;
+	}
 	    
 #ifdef WWW_WIN_ASYNC
-	    if (WSAAsyncSelect(s, HTSocketWin, HTwinMsg, remaining) < 0)
-		ret = HT_ERROR;
+	if (WSAAsyncSelect(s, HTSocketWin, HTwinMsg, remaining) < 0)
+	    ret = HT_ERROR;
 #else /* WWW_WIN_ASYNC */
-	    FD_CLR(s, FdArray+HTEvent_INDEX(type));
-
-	    HTTRACEDATA((char*)FdArray+HTEvent_INDEX(type), 8, "HTEventList_unregister: (s:%d)" _ s);
-
+	(*EventBackend_current()->update)(pres, oldset, remaining);
 #endif /* !WWW_WIN_ASYNC */
 
-	    /*
-	    **  Check to see if we can delete the action completely. We do this
-	    **  if there are no more events registered.
-	    */
-	    if (remaining == 0) {
-		HTList * doomed = cur;
-		HTTRACE(THD_TRACE, "Event....... No more events registered for socket %d\n" _ s);
-
-#ifndef WWW_WIN_ASYNC
-		/* Check to see if we have to update MaxSock */
-		if (pres->s >= MaxSock) __ResetMaxSock();
-#endif /* !WWW_WIN_ASYNC */
-
-		HT_FREE(pres);
-		pres = (SockEvents *) HTList_nextObject(cur);
-		HTList_quickRemoveElement(doomed, last);
-	    }
-	    ret = HT_OK;
-
-      	    HTTRACE(THD_TRACE, "Event....... Socket %d unregistered for %s\n" _ s _ 
-				   HTEvent_type2str(type));
-
-	    /* We found the socket and can break */
-	    break;
+	/*
+	**  Check to see if we can delete the action completely. We do this
+	**  if there are no more events registered.
+	*/
+	if (remaining == 0) {
+	    HTTRACE(THD_TRACE, "Event....... No more events registered for socket %d\n" _ s);
+	    HT_FREE(pres);
+	    SockTable[s] = NULL;
 	}
-	last = cur;
+	ret = HT_OK;
+
+	HTTRACE(THD_TRACE, "Event....... Socket %d unregistered for %s\n" _ s _ 
+			       HTEvent_type2str(type));
     }
     if (THD_TRACE) {
 	if (ret == HT_ERROR)
@@ -560,20 +1040,21 @@ PUBLIC int HTEventList_unregister (SOCKET s, HTEventType type)
 */
 PUBLIC int HTEventList_unregisterAll (void) 
 {
-    int i;
+    SOCKET i;
     HTTRACE(THD_TRACE, "Unregister.. all sockets\n");
-    for (i = 0 ; i < HT_M_HASH_SIZE; i++) {
-	HTList * cur = HashTable[i];
-	SockEvents * pres;
-	while ((pres = (SockEvents *) HTList_nextObject(cur))) {
+    for (i = 0 ; i < SockTableSize; i++) {
+	SockEvents * pres = SockTable[i];
+	if (pres) {
 #ifdef WWW_WIN_ASYNC
 	    WSAAsyncSelect(pres->s, HTSocketWin, HTwinMsg, 0);
+#else /* WWW_WIN_ASYNC */
+	    if (Backend) (*Backend->update)(pres, EventList_remaining(pres), 0);
 #endif /* WWW_WIN_ASYNC */
 	    HT_FREE(pres);
 	}
-	HTList_delete(HashTable[i]);
-	HashTable[i] = NULL;
     }
+    HT_FREE(SockTable);
+    SockTableSize = 0;
 
 #ifndef WWW_WIN_ASYNC
     MaxSock = 0 ;
@@ -646,7 +1127,8 @@ PUBLIC void HTEventList_stopLoop (void)
 /*
 **  There are now two versions of the event loop. The first is if you want
 **  to use async I/O on windows, and the other is if you want to use normal
-**  Unix setup with sockets
+**  Unix setup with sockets. The latter waits for activity using the current
+**  event backend.
 */
 PUBLIC int HTEventList_loop (HTRequest * theRequest)
 {
@@ -668,13 +1150,9 @@ PUBLIC int HTEventList_loop (HTRequest * theRequest)
 
 #else /* WWW_WIN_ASYNC */
 
-    fd_set treadset, twriteset, texceptset;
-    struct timeval waittime, * wt;
+    EventBackend * backend = EventBackend_current();
     int active_sockets;
-    int maxfds;
     ms_t timeout;
-    ms_t now;
-    SOCKET s;
     int status = HT_OK;
 
     /* Check that we don't have multiple loops started at once */
@@ -693,20 +1171,9 @@ PUBLIC int HTEventList_loop (HTRequest * theRequest)
     /* Don't leave this loop until we leave the application */
     while (!HTEndLoop) {
 
-        /*
-	**  Timeval struct copy needed for linux, as it set the value to the
-	**  remaining timeout while exiting the select. (and perhaps for
-	**  other OS). Code borrowed from X server.
-	*/
-	wt = NULL;
+	/* A timeout of 0 from the timer module means that we can wait forever */
 	if ((status = HTTimer_next(&timeout)))
 	    break;
-	if (timeout != 0) {
-	    waittime.tv_sec = timeout / MILLI_PER_SECOND;
-	    waittime.tv_usec = (timeout % MILLI_PER_SECOND) *
-		(1000000 / MILLI_PER_SECOND);
-	    wt = &waittime;
-	}
 
 	/*
 	** Check whether we still have to continue the event loop. It could
@@ -714,88 +1181,10 @@ PUBLIC int HTEventList_loop (HTRequest * theRequest)
 	*/
 	if (HTEndLoop) break;
 
-	/*
-	**  Now we copy the current active file descriptors to pass them to select.
-	*/
-        treadset = FdArray[HTEvent_INDEX(HTEvent_READ)];
-        twriteset = FdArray[HTEvent_INDEX(HTEvent_WRITE)];
-        texceptset = FdArray[HTEvent_INDEX(HTEvent_OOB)];
-
-	/* And also get the max socket value */
-        maxfds = MaxSock; 
-
-	HTTRACE(THD_TRACE, "Event Loop.. calling select: maxfds is %d\n" _ maxfds);
-#ifdef HTDEBUG
-	fd_dump(maxfds, &treadset, &twriteset, &texceptset, wt);
-#endif
-
-#ifdef __hpux 
-        active_sockets = select(maxfds+1, (int *)&treadset, (int *)&twriteset,
-				(int *)&texceptset, wt);
-#elif defined(_WINSOCKAPI_)
-	/*
-	 * yovavm@contact.com
-	 *
-	 * On some WINSOCK versions select() with 3 empty sets and NULL timeout
-	 * returns 0 and in some it returns -1.
-	 * If 0 is returned in such situation, we will go into an infinite loop
-	 * (cause the sets will stay empty forever ...),
-	 * so make sure to set the active_sockets = -1 which will take us out 
-	 * of the loop.
-	 */
-	if ((treadset.fd_count || twriteset.fd_count || texceptset.fd_count) 
-	    && wt)
-	     active_sockets = select(maxfds+1, &treadset, &twriteset,
-				     &texceptset, wt);
-	else
-	     active_sockets = -1;	
-#else
-        active_sockets = select(maxfds+1, &treadset, &twriteset, &texceptset, wt);
-#endif
-
-	now = HTGetTimeInMillis();
-
-	HTTRACE(THD_TRACE, "Event Loop.. select returns %d\n" _ active_sockets);
-#ifdef HTDEBUG
-	fd_dump(maxfds, &treadset, &twriteset, &texceptset, wt);
-#endif
-
-        if (active_sockets == -1) {
-#ifdef EINTR
-	    if (socerrno == EINTR) {
-		/*
-		** EINTR     The select() function was interrupted  before  any
-		**           of  the  selected  events  occurred and before the
-		**           timeout interval expired.
-		**
-		**           If SA_RESTART has been set  for  the  interrupting
-		**           signal,  it  is  implementation-dependent  whether
-		**	     select() restarts or returns with EINTR.
-		*/
-		HTTRACE(THD_TRACE, "Event Loop.. select was interruted - try again\n");
-		continue;
-	    }
-#endif /* EINTR */
-#ifdef EBADF
-	    if (socerrno == EBADF) {
-	        /*
-		** EBADF     One or more of the file descriptor sets  specified
-		**           a  file  descriptor  that is not a valid open file
-		**           descriptor.
-		*/
-		HTTRACE(THD_TRACE, "Event Loop.. One or more sockets were not through their connect phase - try again\n");
-		continue;
-	    }
-#endif
-	    HTTRACE(THD_TRACE, "Event Loop.. select returned error %d\n" _ socerrno);
-
-#ifdef HTDEBUG
-	    EventList_dump();
-#endif /* HTDEBUG */
-
-	    status = HT_ERROR;
+	/* Wait for activity and queue up the sockets that became ready */
+	if ((status = (*backend->wait)(timeout ? (int) timeout : -1,
+				       &active_sockets)) != HT_OK)
 	    break;
-        }
 
 	/*
 	**  We had a timeout so now we check and see if we have a timeout
@@ -804,23 +1193,10 @@ PUBLIC int HTEventList_loop (HTRequest * theRequest)
 	if (active_sockets == 0)
 	    continue;
 
-	/* There were active sockets. Determine which fd sets they were in */
-	for (s = 0 ; s <= maxfds ; s++) { 
-	    if (FD_ISSET(s, &texceptset))
-		if ((status = EventOrder_add(s, HTEvent_OOB, now)) != HT_OK)
-		    goto stop_loop;
-	    if (FD_ISSET(s, &twriteset))
-		if ((status = EventOrder_add(s, HTEvent_WRITE, now)) != HT_OK)
-		    goto stop_loop;
-	    if (FD_ISSET(s, &treadset))
-		if ((status = EventOrder_add(s, HTEvent_READ, now)) != HT_OK)
-		    goto stop_loop;
-	}
 	if ((status = EventOrder_executeAndDelete()) != HT_OK) break;
     };
 
     /* Reset HTEndLoop in case we want to start again */
- stop_loop:
     HTEndLoop = 0;
     HTInLoop = NO;
     return status;
@@ -974,6 +1350,10 @@ PUBLIC BOOL HTEventInit (void)
 
 PUBLIC BOOL HTEventTerminate (void)
 {
+#ifndef WWW_WIN_ASYNC
+    EventBackend_stop();
+#endif /* !WWW_WIN_ASYNC */
+
 #ifdef _WINSOCKAPI_
     WSACleanup();
 #endif /* _WINSOCKAPI_ */
@@ -641,31 +641,20 @@ PUBLIC double HTStackValue (HTList *	theseConversions,
     return NO_VALUE_FOUND;		/* Really bad */
 }
 
-/*	Create a new coder and insert it into stream chain
-**	--------------------------------------------------
-**	Creating the content decoding stack is not based on quality factors as
-**	we don't have the freedom as with content types. Specify whether you
-**	you want encoding or decoding using the BOOL "encode" flag.
+/*
+**	Find the best content coder for this encoding in the local and the
+**	global lists
 */
-PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
-					HTStream *	target,
-					HTRequest *	request,
-					void *		param,
-					BOOL		encode)
+PRIVATE HTCoding * HTContentCoding_find (HTEncoding	encoding,
+					 HTRequest *	request)
 {
     HTList * coders[2];
-    HTStream * top = target;
     HTCoding * pres = NULL;
     HTCoding * best_match = NULL;
     double best_quality = -1e30;		/* Pretty bad! */
     int cnt;
-    if (!encoding || !request) {
-	HTTRACE(CORE_TRACE, "Codings... Nothing applied...\n");
-	return target ? target : HTErrorStream();
-    }
     coders[0] = HTRequest_encoding(request);
     coders[1] = HTContentCoders;
-    HTTRACE(CORE_TRACE, "C-E......... Looking for `%s\'\n" _ HTAtom_name(encoding));
     for (cnt=0; cnt < 2; cnt++) {
 	HTList * cur = coders[cnt];
 	while ((pres = (HTCoding *) HTList_nextObject(cur))) {
@@ -676,6 +665,38 @@ PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
 	    }
 	}
     }
+    return best_match;
+}
+
+PUBLIC BOOL HTContentCoding_canEncode (HTEncoding	encoding,
+				       HTRequest *	request)
+{
+    HTCoding * coding;
+    if (!encoding || !request) return NO;
+    coding = HTContentCoding_find(encoding, request);
+    return (coding && coding->encoder);
+}
+
+/*	Create a new coder and insert it into stream chain
+**	--------------------------------------------------
+**	Creating the content decoding stack is not based on quality factors as
+**	we don't have the freedom as with content types. Specify whether you
+**	you want encoding or decoding using the BOOL "encode" flag.
+*/
+PUBLIC HTStream * HTContentCodingStack (HTEncoding	encoding,
+					HTStream *	target,
+					HTRequest *	request,
+					void *		param,
+					BOOL		encode)
+{
+    HTStream * top = target;
+    HTCoding * best_match = NULL;
+    if (!encoding || !request) {
+	HTTRACE(CORE_TRACE, "Codings... Nothing applied...\n");
+	return target ? target : HTErrorStream();
+    }
+    HTTRACE(CORE_TRACE, "C-E......... Looking for `%s\'\n" _ HTAtom_name(encoding));
+    best_match = HTContentCoding_find(encoding, request);
 
     if (best_match) {
 	HTTRACE(CORE_TRACE, "C-E......... Found `%s\'\n" _ HTAtom_name(best_match->encoding));
@@ -0,0 +1,555 @@
+/*								      HTHPack.c
+**	HPACK HEADER COMPRESSION FOR HTTP/2
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	Encoder and decoder for the HPACK header compression format. The
+**	dynamic table is kept as a ring of entries with the newest entry
+**	first as this is the order in which HPACK indexes them. The Huffman
+**	code is canonical so we only keep the code lengths and compute the
+**	codes from them the first time they are needed.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "HTHPack.h"					 /* Implemented here */
+
+#define ENTRY_OVERHEAD		32	     /* Added to the size of an entry */
+#define STATIC_ENTRIES		61
+#define HUFFMAN_EOS		256
+#define HUFFMAN_MAX_BITS	30
+#define MAX_INTEGER		0x0FFFFFFFL
+
+typedef struct _HTHPackEntry {
+    char *		name;		       /* Name and value in one block */
+    int			name_len;
+    char *		value;
+    int			value_len;
+} HTHPackEntry;
+
+struct _HTHPack {
+    HTHPackEntry *	entries;			    /* Ring of entries */
+    int			allocated;
+    int			first;			 /* Position of newest entry */
+    int			count;
+    int			size;		     /* Size of table as HPACK sees it */
+    int			max_size;
+    int			limit;		     /* Largest size we will accept */
+    BOOL		resized;	   /* Must tell decoder about max_size */
+    HTChunk *		name;		/* Decoded Huffman strings go here */
+    HTChunk *		value;
+};
+
+typedef struct _HTHPackStatic {
+    const char *	name;
+    const char *	value;
+} HTHPackStatic;
+
+PRIVATE const HTHPackStatic StaticTable[STATIC_ENTRIES] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""}
+};
+
+/*
+**  Length in bits of the Huffman code of each symbol. The last one is EOS
+*/
+PRIVATE const unsigned char HuffmanLength[HUFFMAN_EOS+1] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30
+};
+
+PRIVATE BOOL HuffmanReady = NO;
+PRIVATE unsigned long HuffmanCode[HUFFMAN_EOS+1];
+PRIVATE unsigned short HuffmanSymbol[HUFFMAN_EOS+1];   /* By length, value */
+PRIVATE unsigned long HuffmanFirst[HUFFMAN_MAX_BITS+1];  /* First code of len */
+PRIVATE int HuffmanCount[HUFFMAN_MAX_BITS+1];		 /* Codes of length */
+PRIVATE int HuffmanOffset[HUFFMAN_MAX_BITS+1];	    /* Into HuffmanSymbol */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+**  Assign the canonical codes: shorter codes first and codes of the same
+**  length in the order of the symbols.
+*/
+PRIVATE void HTHPack_huffmanInit (void)
+{
+    unsigned long code = 0;
+    int len, sym, pos = 0;
+    for (len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+	HuffmanFirst[len] = code;
+	HuffmanOffset[len] = pos;
+	HuffmanCount[len] = 0;
+	for (sym = 0; sym <= HUFFMAN_EOS; sym++) {
+	    if (HuffmanLength[sym] == len) {
+		HuffmanCode[sym] = code++;
+		HuffmanSymbol[pos++] = (unsigned short) sym;
+		HuffmanCount[len]++;
+	    }
+	}
+	code <<= 1;
+    }
+    HuffmanReady = YES;
+}
+
+PRIVATE BOOL HTHPack_huffmanDecode (HTChunk * out, const unsigned char * p,
+				    int length)
+{
+    const unsigned char * end = p + length;
+    unsigned long code = 0;
+    int len = 0;
+    if (!HuffmanReady) HTHPack_huffmanInit();
+    HTChunk_truncate(out, 0);
+    while (p < end) {
+	int bit;
+	for (bit = 7; bit >= 0; bit--) {
+	    code = (code << 1) | ((*p >> bit) & 1);
+	    if (++len > HUFFMAN_MAX_BITS) return NO;
+	    if (code - HuffmanFirst[len] < (unsigned long) HuffmanCount[len]) {
+		int sym = HuffmanSymbol[HuffmanOffset[len] + code - HuffmanFirst[len]];
+		if (sym == HUFFMAN_EOS) return NO;
+		HTChunk_putc(out, (char) sym);
+		code = 0;
+		len = 0;
+	    }
+	}
+	p++;
+    }
+
+    /* What is left must be padding made from the start of EOS */
+    return (len <= 7 && code == (1UL << len) - 1);
+}
+
+PRIVATE int HTHPack_huffmanSize (const char * s, int length)
+{
+    long bits = 0;
+    while (length-- > 0) bits += HuffmanLength[(unsigned char) *s++];
+    return (int) ((bits + 7) / 8);
+}
+
+PRIVATE void HTHPack_huffmanEncode (HTChunk * out, const char * s, int length)
+{
+    unsigned long bits = 0;
+    int pending = 0;
+    while (length-- > 0) {
+	unsigned char c = (unsigned char) *s++;
+	unsigned long code = HuffmanCode[c];
+	int left = HuffmanLength[c];
+
+	/* Never hold more than 31 bits at a time */
+	while (left > 0) {
+	    int take = left > 24 ? 24 : left;
+	    left -= take;
+	    bits = (bits << take) | ((code >> left) & ((1UL << take) - 1));
+	    pending += take;
+	    while (pending >= 8) {
+		pending -= 8;
+		HTChunk_putc(out, (char) (bits >> pending));
+	    }
+	    bits &= (1UL << pending) - 1;
+	}
+    }
+    if (pending > 0)
+	HTChunk_putc(out, (char) ((bits << (8 - pending)) |
+				  ((1UL << (8 - pending)) - 1)));
+}
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE HTHPackEntry * HTHPack_entry (HTHPack * me, int pos)
+{
+    return me->entries + (me->first + pos) % me->allocated;
+}
+
+PRIVATE void HTHPack_evict (HTHPack * me, int max_size)
+{
+    while (me->count > 0 && me->size > max_size) {
+	HTHPackEntry * oldest = HTHPack_entry(me, me->count - 1);
+	me->size -= oldest->name_len + oldest->value_len + ENTRY_OVERHEAD;
+	HT_FREE(oldest->name);
+	me->count--;
+    }
+}
+
+/*
+**  Insert a new entry at the front. The strings are copied before we evict
+**  anything as they may point into an entry which is about to go away.
+*/
+PRIVATE void HTHPack_insert (HTHPack * me, const char * name, int name_len,
+			     const char * value, int value_len)
+{
+    int size = name_len + value_len + ENTRY_OVERHEAD;
+    char * block;
+    HTHPackEntry * entry;
+    if (size > me->max_size) {
+	HTHPack_evict(me, 0);
+	return;
+    }
+    if ((block = (char *) HT_MALLOC(name_len + value_len + 2)) == NULL)
+	HT_OUTOFMEM("HTHPack_insert");
+    memcpy(block, name, name_len);
+    block[name_len] = '\0';
+    memcpy(block + name_len + 1, value, value_len);
+    block[name_len + 1 + value_len] = '\0';
+    HTHPack_evict(me, me->max_size - size);
+
+    /* Grow the ring keeping the entries in order */
+    if (me->count == me->allocated) {
+	int allocated = me->allocated ? me->allocated * 2 : 16;
+	HTHPackEntry * entries;
+	int pos;
+	if ((entries = (HTHPackEntry *) HT_CALLOC(allocated, sizeof(HTHPackEntry))) == NULL)
+	    HT_OUTOFMEM("HTHPack_insert");
+	for (pos = 0; pos < me->count; pos++)
+	    entries[pos] = *HTHPack_entry(me, pos);
+	HT_FREE(me->entries);
+	me->entries = entries;
+	me->allocated = allocated;
+	me->first = 0;
+    }
+    me->first = (me->first + me->allocated - 1) % me->allocated;
+    entry = me->entries + me->first;
+    entry->name = block;
+    entry->name_len = name_len;
+    entry->value = block + name_len + 1;
+    entry->value_len = value_len;
+    me->count++;
+    me->size += size;
+}
+
+PUBLIC HTHPack * HTHPack_new (int max_size)
+{
+    HTHPack * me;
+    if ((me = (HTHPack *) HT_CALLOC(1, sizeof(HTHPack))) == NULL)
+	HT_OUTOFMEM("HTHPack_new");
+    me->max_size = me->limit = max_size >= 0 ? max_size : HT_HPACK_TABLE_SIZE;
+    me->name = HTChunk_new(64);
+    me->value = HTChunk_new(128);
+    return me;
+}
+
+PUBLIC void HTHPack_delete (HTHPack * me)
+{
+    if (me) {
+	HTHPack_evict(me, -1);
+	HT_FREE(me->entries);
+	HTChunk_delete(me->name);
+	HTChunk_delete(me->value);
+	HT_FREE(me);
+    }
+}
+
+PUBLIC BOOL HTHPack_setMaxSize (HTHPack * me, int max_size)
+{
+    if (me && max_size >= 0) {
+	if (max_size > me->limit) max_size = me->limit;
+	if (max_size != me->max_size) {
+	    me->max_size = max_size;
+	    me->resized = YES;
+	    HTHPack_evict(me, max_size);
+	}
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC int HTHPack_maxSize (HTHPack * me)
+{
+    return me ? me->max_size : -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				    DECODER				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE BOOL HTHPack_getInteger (const unsigned char ** p,
+				 const unsigned char * end,
+				 int prefix, long * value)
+{
+    int mask = (1 << prefix) - 1;
+    int shift = 0;
+    if (*p >= end) return NO;
+    *value = **p & mask;
+    (*p)++;
+    if (*value < mask) return YES;
+    while (*p < end) {
+	int c = *(*p)++;
+	*value += (long) (c & 0x7F) << shift;
+	if (*value > MAX_INTEGER) return NO;
+	if (!(c & 0x80)) return YES;
+	if ((shift += 7) > 28) return NO;
+    }
+    return NO;
+}
+
+PRIVATE BOOL HTHPack_getString (const unsigned char ** p,
+				const unsigned char * end, HTChunk * scratch,
+				const char ** str, int * len)
+{
+    BOOL huffman;
+    long length;
+    if (*p >= end) return NO;
+    huffman = (**p & 0x80) != 0;
+    if (!HTHPack_getInteger(p, end, 7, &length) || length > end - *p)
+	return NO;
+    if (huffman) {
+	if (!HTHPack_huffmanDecode(scratch, *p, (int) length)) return NO;
+	*str = HTChunk_data(scratch) ? HTChunk_data(scratch) : "";
+	*len = HTChunk_size(scratch);
+    } else {
+	*str = (const char *) *p;
+	*len = (int) length;
+    }
+    *p += length;
+    return YES;
+}
+
+PRIVATE BOOL HTHPack_lookup (HTHPack * me, long index,
+			     const char ** name, int * name_len,
+			     const char ** value, int * value_len)
+{
+    if (index <= 0) return NO;
+    if (index <= STATIC_ENTRIES) {
+	const HTHPackStatic * entry = StaticTable + index - 1;
+	*name = entry->name;
+	*name_len = (int) strlen(entry->name);
+	*value = entry->value;
+	*value_len = (int) strlen(entry->value);
+	return YES;
+    } else if (index - STATIC_ENTRIES <= me->count) {
+	HTHPackEntry * entry = HTHPack_entry(me, (int) index - STATIC_ENTRIES - 1);
+	*name = entry->name;
+	*name_len = entry->name_len;
+	*value = entry->value;
+	*value_len = entry->value_len;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC int HTHPack_decode (HTHPack * me, const char * block, int length,
+			   HTHPackCallback * cbf, void * context)
+{
+    const unsigned char * p = (const unsigned char *) block;
+    const unsigned char * end = p + length;
+    BOOL fields = NO;
+    if (!me || !block) return HT_ERROR;
+    while (p < end) {
+	const char * name = NULL;
+	const char * value = NULL;
+	int name_len = 0, value_len = 0;
+	BOOL indexing = NO;
+	long index;
+	int status;
+
+	if (*p & 0x80) {				  /* Indexed field */
+	    if (!HTHPack_getInteger(&p, end, 7, &index) ||
+		!HTHPack_lookup(me, index, &name, &name_len, &value, &value_len))
+		goto error;
+	} else if ((*p & 0xE0) == 0x20) {	     /* Dynamic table size update */
+	    if (fields || !HTHPack_getInteger(&p, end, 5, &index) ||
+		index > me->limit)
+		goto error;
+	    me->max_size = (int) index;
+	    HTHPack_evict(me, me->max_size);
+	    continue;
+	} else {				      /* Literal field */
+	    int prefix = 4;
+	    if (*p & 0x40) {
+		indexing = YES;
+		prefix = 6;
+	    }
+	    if (!HTHPack_getInteger(&p, end, prefix, &index)) goto error;
+	    if (index) {
+		if (!HTHPack_lookup(me, index, &name, &name_len, &value, &value_len))
+		    goto error;
+	    } else if (!HTHPack_getString(&p, end, me->name, &name, &name_len))
+		goto error;
+	    if (!HTHPack_getString(&p, end, me->value, &value, &value_len))
+		goto error;
+	}
+	fields = YES;
+	if (cbf &&
+	    (status = (*cbf)(context, name, name_len, value, value_len)) != HT_OK)
+	    return status;
+	if (indexing) HTHPack_insert(me, name, name_len, value, value_len);
+    }
+    return HT_OK;
+
+  error:
+    HTTRACE(PROT_TRACE, "HPACK....... Bad header block at byte %d of %d\n" _
+	    (int) ((const char *) p - block) _ length);
+    return HT_ERROR;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				    ENCODER				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTHPack_putInteger (HTChunk * out, int first, int prefix,
+				 unsigned long value)
+{
+    unsigned long mask = (1UL << prefix) - 1;
+    if (value < mask) {
+	HTChunk_putc(out, (char) (first | value));
+	return;
+    }
+    HTChunk_putc(out, (char) (first | mask));
+    value -= mask;
+    while (value >= 0x80) {
+	HTChunk_putc(out, (char) ((value & 0x7F) | 0x80));
+	value >>= 7;
+    }
+    HTChunk_putc(out, (char) value);
+}
+
+PRIVATE void HTHPack_putString (HTChunk * out, const char * s)
+{
+    int length = (int) strlen(s);
+    int huffman;
+    if (!HuffmanReady) HTHPack_huffmanInit();
+    if ((huffman = HTHPack_huffmanSize(s, length)) < length) {
+	HTHPack_putInteger(out, 0x80, 7, huffman);
+	HTHPack_huffmanEncode(out, s, length);
+    } else {
+	HTHPack_putInteger(out, 0x00, 7, length);
+	HTChunk_putb(out, s, length);
+    }
+}
+
+/*
+**  Find the field in the tables. Returns the index of an exact match and
+**  sets name_index to the first entry with the same name.
+*/
+PRIVATE int HTHPack_find (HTHPack * me, const char * name, const char * value,
+			  int * name_index)
+{
+    int index;
+    *name_index = 0;
+    for (index = 1; index <= STATIC_ENTRIES; index++) {
+	const HTHPackStatic * entry = StaticTable + index - 1;
+	if (*entry->name == *name && !strcmp(entry->name, name)) {
+	    if (!*name_index) *name_index = index;
+	    if (!strcmp(entry->value, value)) return index;
+	}
+    }
+    for (index = 0; index < me->count; index++) {
+	HTHPackEntry * entry = HTHPack_entry(me, index);
+	if (*entry->name == *name && !strcmp(entry->name, name)) {
+	    if (!*name_index) *name_index = index + STATIC_ENTRIES + 1;
+	    if (!strcmp(entry->value, value))
+		return index + STATIC_ENTRIES + 1;
+	}
+    }
+    return 0;
+}
+
+PUBLIC BOOL HTHPack_encode (HTHPack * me, HTChunk * out,
+			    const char * name, const char * value,
+			    BOOL sensitive)
+{
+    int index, name_index;
+    if (!me || !out || !name || !value) return NO;
+    if (me->resized) {
+	HTHPack_putInteger(out, 0x20, 5, me->max_size);
+	me->resized = NO;
+    }
+    index = HTHPack_find(me, name, value, &name_index);
+    if (index && !sensitive) {
+	HTHPack_putInteger(out, 0x80, 7, index);
+    } else {
+	int size = (int) (strlen(name) + strlen(value)) + ENTRY_OVERHEAD;
+
+	/*
+	**  The path changes with every request and big fields would only
+	**  push the fields we can reuse out of the table
+	*/
+	BOOL indexing = !sensitive && strcmp(name, ":path") &&
+	    size <= me->max_size / 4;
+	if (indexing)
+	    HTHPack_putInteger(out, 0x40, 6, name_index);
+	else
+	    HTHPack_putInteger(out, sensitive ? 0x10 : 0x00, 4, name_index);
+	if (!name_index) HTHPack_putString(out, name);
+	HTHPack_putString(out, value);
+	if (indexing)
+	    HTHPack_insert(me, name, (int) strlen(name), value, (int) strlen(value));
+    }
+    return YES;
+}
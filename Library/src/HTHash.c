@@ -4,6 +4,21 @@
 **	This HashTable class implements a simple hash table to keep
 **	objects associated with key words.
 **
+**	The table uses open addressing with linear probing over a power of
+**	two number of slots. Each slot caches the full hash value so that
+**	probing rarely touches the key itself. Deleted slots are marked with
+**	a tombstone so that entries don't move while somebody is walking the
+**	table and removing entries. When the table gets too full, a new table
+**	is allocated and the entries are migrated a few slots at a time on
+**	each insertion so that no single operation has to pay for rehashing
+**	the whole table.
+**
+**	If a key is added more than once then the newest entry is the one
+**	that is found first. Entries with the same key are kept newest first
+**	along their probe sequence, the current table is searched before the
+**	old one, and the old table is migrated in the order of its probe
+**	sequences.
+**
 ** Author:
 **	JP	John Punin
 **
@@ -14,6 +29,201 @@
 #include "HTString.h"
 #include "HTHash.h"
 
+#define HASH_MIN_SIZE		16	       /* Smallest number of slots */
+#define HASH_MIGRATE_STEP	16     /* Old slots migrated per insertion */
+
+/* Max fill (live entries + tombstones) before we rehash: 3/4 */
+#define HASH_FULL(t)		((t)->used >= (t)->size - ((t)->size >> 2))
+
+typedef struct _HTHashSlot {
+    unsigned int	hash;
+    char *		key;		   /* NULL if empty, or HashTombstone */
+    void *		object;
+} HTHashSlot;
+
+typedef struct _HTHashTab {
+    HTHashSlot *	slots;
+    int			size;			       /* Always power of two */
+    int			used;			   /* Live entries + tombstones */
+} HTHashTab;
+
+/*
+**	The public part is the structure of the old chained table so that
+**	code using its fields still compiles. The count is kept up to date.
+*/
+typedef struct _HTHashImpl {
+    HTHashtable		pub;				  /* Must be first */
+    HTHashTab		cur;				 /* Where we add entries */
+    HTHashTab		old;		   /* Being migrated into cur, if any */
+    int			start;		 /* First old slot to be migrated */
+    int			migrated;		   /* Old slots migrated so far */
+    int			flags;
+} HTHashImpl;
+
+PRIVATE char HashTombstone[] = "";
+
+#define SLOT_LIVE(s)	((s)->key && (s)->key != HashTombstone)
+
+/* ------------------------------------------------------------------------- */
+
+/*
+**	A Murmur3 style 32 bit string hash mixing in four characters at a
+**	time. The blocks are assembled in little endian order so that the
+**	value is the same on all platforms. If caseless then the characters
+**	are folded to lower case first using a table that we build the first
+**	time around.
+*/
+#define HASH_C1		0xcc9e2d51U
+#define HASH_C2		0x1b873593U
+#define ROTL32(x,r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
+PRIVATE unsigned char HashLower[256];
+PRIVATE BOOL HashLowerInit = NO;
+
+PUBLIC unsigned int HTHash_string (const char * key, BOOL caseless)
+{
+    const unsigned char * p = (const unsigned char *) key;
+    unsigned int len = key ? strlen(key) : 0;
+    unsigned int h = 0x9747b28cU;
+    unsigned int k;
+    unsigned int n;
+    if (caseless && !HashLowerInit) {
+	int c;
+	for (c = 0; c < 256; c++) HashLower[c] = (unsigned char) TOLOWER(c);
+	HashLowerInit = YES;
+    }
+    for (n = len >> 2; n > 0; n--, p += 4) {
+	if (caseless)
+	    k = HashLower[p[0]] | (HashLower[p[1]] << 8) |
+		(HashLower[p[2]] << 16) | ((unsigned int) HashLower[p[3]] << 24);
+	else
+	    k = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+	k *= HASH_C1;
+	k = ROTL32(k, 15);
+	k *= HASH_C2;
+	h ^= k;
+	h = ROTL32(h, 13);
+	h = h * 5 + 0xe6546b64U;
+    }
+    k = 0;
+    switch (len & 3) {
+      case 3: k ^= (caseless ? HashLower[p[2]] : p[2]) << 16;
+	/* Fall through */
+      case 2: k ^= (caseless ? HashLower[p[1]] : p[1]) << 8;
+	/* Fall through */
+      case 1: k ^= (caseless ? HashLower[p[0]] : p[0]);
+	k *= HASH_C1;
+	k = ROTL32(k, 15);
+	k *= HASH_C2;
+	h ^= k;
+    }
+    h ^= len;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+
+PRIVATE BOOL key_equal (HTHashImpl * me, const char * a, const char * b)
+{
+    return (me->flags & HT_HASH_CASELESS) ? !strcasecomp(a, b) : !strcmp(a, b);
+}
+
+PRIVATE BOOL HashTab_init (HTHashTab * tab, int size)
+{
+    if ((tab->slots = (HTHashSlot *) HT_CALLOC(size, sizeof(HTHashSlot))) == NULL)
+	HT_OUTOFMEM("HashTab_init");
+    tab->size = size;
+    tab->used = 0;
+    return YES;
+}
+
+/*
+**	Put an entry along its probe sequence. A new entry goes in front of
+**	any entries with the same key: it takes the place of the first one,
+**	which in turn takes the place of the next and so on. An entry that
+**	is migrated from the old table is older than those already here with
+**	the same key so it goes after the last of them.
+*/
+PRIVATE void HashTab_put (HTHashImpl * me, HTHashTab * tab, unsigned int hash,
+			  char * key, void * object, BOOL last)
+{
+    unsigned int mask = tab->size - 1;
+    unsigned int i = hash & mask;
+    HTHashSlot * free = NULL;
+    for (;; i = (i + 1) & mask) {
+	HTHashSlot * slot = tab->slots + i;
+	if (!SLOT_LIVE(slot)) {
+	    if (!free) free = slot;
+	    if (!last || !slot->key) break;
+	} else if (slot->hash == hash && key_equal(me, slot->key, key)) {
+	    if (last)
+		free = NULL;
+	    else {
+		char * skey = slot->key;
+		void * sobject = slot->object;
+		slot->key = key;
+		slot->object = object;
+		key = skey;
+		object = sobject;
+	    }
+	}
+    }
+    if (!free->key) tab->used++;
+    free->hash = hash;
+    free->key = key;
+    free->object = object;
+}
+
+/*
+**	Move up to "steps" slots from the old table into the current one.
+**	We start right after an empty slot and go round the table so that
+**	each probe sequence is moved from its start to its end, keeping the
+**	entries with the same key in order. The moved slots are left as
+**	tombstones so that probe sequences for entries still in the old
+**	table aren't broken.
+*/
+PRIVATE void HashTab_migrate (HTHashImpl * me, int steps)
+{
+    HTHashTab * old = &me->old;
+    while (old->slots && steps-- > 0) {
+	HTHashSlot * slot =
+	    old->slots + ((me->start + me->migrated) & (old->size - 1));
+	if (SLOT_LIVE(slot)) {
+	    HashTab_put(me, &me->cur, slot->hash, slot->key, slot->object, YES);
+	    slot->key = HashTombstone;
+	    slot->object = NULL;
+	}
+	if (++me->migrated >= old->size) {
+	    HT_FREE(old->slots);
+	    old->size = old->used = 0;
+	    me->migrated = 0;
+	}
+    }
+}
+
+/*
+**	Start a migration into a fresh table. If most of the used slots are
+**	tombstones then we keep the same size and just clean them out.
+*/
+PRIVATE void HashTab_grow (HTHashImpl * me)
+{
+    int size = me->cur.size;
+    if (me->old.slots) HashTab_migrate(me, me->old.size);
+    if (me->pub.count >= (size >> 1)) size <<= 1;
+    HTTRACE(CORE_TRACE, "Hash table.. %p resizing from %d to %d slots (%d entries)\n" _
+	    me _ me->cur.size _ size _ me->pub.count);
+    me->old = me->cur;
+    me->migrated = 0;
+    for (me->start = 0; me->old.slots[me->start].key; me->start++);
+    me->start++;
+    HashTab_init(&me->cur, size);
+    me->pub.size = size;
+}
+
 /*
 (
   Creation and Deletion Methods
@@ -22,54 +232,49 @@
 These methods create and deletes a Hash Table
 */
 
-PUBLIC HTHashtable * HTHashtable_new (int size)
+PUBLIC HTHashtable * HTHashtable_newWithFlags (int size, int flags)
 {
-    HTHashtable *newHashtable;
-    int c = size > 0 ? size : HT_L_HASH_SIZE;
-    if ((newHashtable = (HTHashtable  *) HT_CALLOC(1, sizeof (HTHashtable))) == NULL)
+    HTHashImpl * me;
+    int c = HASH_MIN_SIZE;
+    if (size <= 0) size = HT_L_HASH_SIZE;
+    while (c < size) c <<= 1;
+    if ((me = (HTHashImpl *) HT_CALLOC(1, sizeof(HTHashImpl))) == NULL)
         HT_OUTOFMEM("HTHashtable_new");
+    HashTab_init(&me->cur, c);
+    me->pub.size = c;
+    me->flags = flags;
+    return &me->pub;
+}
 
-    if((newHashtable->table = (void **) HT_CALLOC(c, sizeof (void *))) == NULL)
-	HT_OUTOFMEM("HTHashtable_new");
-
-    newHashtable->count = 0;
-    newHashtable->size = c;
-    return newHashtable;
+PUBLIC HTHashtable * HTHashtable_new (int size)
+{
+    return HTHashtable_newWithFlags(size, 0);
 }
 
-PUBLIC BOOL HTHashtable_delete (HTHashtable *me)
+PRIVATE void HashTab_free (HTHashImpl * me, HTHashTab * tab)
 {
-    if (me) {
-	int i;
-	for(i = 0; i< me->size; i++) {
-	    HTList * l = (HTList *)me->table[i];
-	    if (l) {
-		HTList *cur = l;
-		keynode *kn;
-		while ((kn = (keynode *) HTList_nextObject(cur))) {
-		    HT_FREE(kn->key);
-		    HT_FREE(kn);
-		}
-		HTList_delete(l);
+    if (tab->slots) {
+	if (!(me->flags & HT_HASH_KEYREF)) {
+	    int i;
+	    for (i = 0; i < tab->size; i++) {
+		HTHashSlot * slot = tab->slots + i;
+		if (SLOT_LIVE(slot)) HT_FREE(slot->key);
 	    }
 	}
-        HT_FREE(me->table);
-	HT_FREE(me);
-	return YES;
+	HT_FREE(tab->slots);
     }
-    return NO;
 }
 
-PRIVATE int hash_number (const char *key, int size)
+PUBLIC BOOL HTHashtable_delete (HTHashtable * table)
 {
-    int hash = 0;
-
-    if (key) {
-	const char * ptr = key;
-	for(; *ptr; ptr++)
-	    hash = (int) ((hash*3 + (*(unsigned char*)ptr)) % size);
+    if (table) {
+	HTHashImpl * me = (HTHashImpl *) table;
+	HashTab_free(me, &me->old);
+	HashTab_free(me, &me->cur);
+	HT_FREE(me);
+	return YES;
     }
-    return hash;
+    return NO;
 }
 
 /*
@@ -78,22 +283,22 @@ PRIVATE int hash_number (const char *key, int size)
 )
 */
 
-PUBLIC BOOL HTHashtable_addObject (HTHashtable *me, const char *key,
-				   void *newObject)
+PUBLIC BOOL HTHashtable_addObject (HTHashtable * table, const char * key,
+				   void * newObject)
 {
-    if(me) {
-	int size = me->size;
-	int i = hash_number(key,size);
-	HTList *l = (HTList *)me->table[i];
-	keynode *kn;
-	if(!l)
-	    l = me->table[i] = HTList_new();
-	if ((kn = (keynode  *) HT_CALLOC(1, sizeof (keynode))) == NULL)
-	    HT_OUTOFMEM("HTHashtable_addObject");
-	StrAllocCopy(kn->key,key);
-	kn->object = newObject;
-	HTList_addObject(l,kn);
-	me->count++;
+    if (table && key) {
+	HTHashImpl * me = (HTHashImpl *) table;
+	char * nkey = NULL;
+	if (me->old.slots) HashTab_migrate(me, HASH_MIGRATE_STEP);
+	if (HASH_FULL(&me->cur)) HashTab_grow(me);
+	if (me->flags & HT_HASH_KEYREF)
+	    nkey = (char *) key;
+	else
+	    StrAllocCopy(nkey, key);
+	HashTab_put(me, &me->cur,
+		    HTHash_string(key, me->flags & HT_HASH_CASELESS),
+		    nkey, newObject, NO);
+	me->pub.count++;
 	return YES;
     }
     return NO;
@@ -101,53 +306,115 @@ PUBLIC BOOL HTHashtable_addObject (HTHashtable *me, const char *key,
 
 /*
 (
-  Remove an Element from the HashTable
+  Search for Elements in a Hash Table
 )
+
+The position encodes both which table we are in and how far along the
+probe sequence we have got: values below the size of the current table
+are probe steps in the current table and the rest are probe steps in the
+old one.
 */
 
-PUBLIC BOOL HTHashtable_removeObject (HTHashtable *me, const char *key)
+PRIVATE HTHashSlot * HashTab_nextMatch (HTHashImpl * me, const char * key,
+					unsigned int hash, int * pos)
 {
-    if(me) {
-	int size = me->size;
-	int i = hash_number(key,size);
-	HTList *l = (HTList *)me->table[i];
-	if(l) {
-	    HTList *cur = l;
-	    keynode *kn;
-	    while ((kn = (keynode *) HTList_nextObject(cur))) {
-		if(!strcmp(key,kn->key)) {
-		    HTList_removeObject(l,kn);
-		    me->count--;
-		    return YES;
-		}
+    int step = *pos;
+    if (step < 0) return NULL;
+    if (step < me->cur.size) {
+	HTHashTab * tab = &me->cur;
+	unsigned int mask = tab->size - 1;
+	for (; step < tab->size; step++) {
+	    HTHashSlot * slot = tab->slots + ((hash + step) & mask);
+	    if (!slot->key) break;
+	    if (slot->key != HashTombstone && slot->hash == hash &&
+		key_equal(me, slot->key, key)) {
+		*pos = step + 1;
+		return slot;
 	    }
 	}
+	step = me->cur.size;
     }
-    return NO;
+    if (me->old.slots) {
+	HTHashTab * tab = &me->old;
+	int base = me->cur.size;
+	unsigned int mask = tab->size - 1;
+	for (step -= base; step < tab->size; step++) {
+	    HTHashSlot * slot = tab->slots + ((hash + step) & mask);
+	    if (!slot->key) break;
+	    if (slot->key != HashTombstone && slot->hash == hash &&
+		key_equal(me, slot->key, key)) {
+		*pos = base + step + 1;
+		return slot;
+	    }
+	}
+    }
+    *pos = -1;
+    return NULL;
+}
+
+PUBLIC void * HTHashtable_nextMatch (HTHashtable * table, const char * key,
+				     int * pos)
+{
+    if (table && key && pos) {
+	HTHashImpl * me = (HTHashImpl *) table;
+	HTHashSlot * slot = HashTab_nextMatch(me, key,
+			HTHash_string(key, me->flags & HT_HASH_CASELESS), pos);
+	return slot ? slot->object : NULL;
+    }
+    return NULL;
+}
+
+PUBLIC void *HTHashtable_object (HTHashtable * me, const char *key)
+{
+    int pos = 0;
+    return HTHashtable_nextMatch(me, key, &pos);
 }
 
 /*
 (
-  Search for an Element in a Hash Table
+  Remove an Element from the HashTable
 )
 */
 
-PUBLIC void *HTHashtable_object (HTHashtable * me, const char *key)
+PRIVATE void HashTab_kill (HTHashImpl * me, HTHashSlot * slot)
 {
-    if(me) {
-	int size = me->size;
-	int i = hash_number(key,size);
-	HTList * l = (HTList *)me->table[i];
-	if (l) {
-	    HTList *cur = l;
-	    keynode *kn;
-	    while ((kn = (keynode *) HTList_nextObject(cur))) {
-		if(!strcmp(key,kn->key))
-		    return kn->object;
+    if (!(me->flags & HT_HASH_KEYREF)) HT_FREE(slot->key);
+    slot->key = HashTombstone;
+    slot->object = NULL;
+    me->pub.count--;
+}
+
+PUBLIC BOOL HTHashtable_removeObject (HTHashtable * table, const char * key)
+{
+    if (table && key) {
+	HTHashImpl * me = (HTHashImpl *) table;
+	int pos = 0;
+	HTHashSlot * slot = HashTab_nextMatch(me, key,
+			HTHash_string(key, me->flags & HT_HASH_CASELESS), &pos);
+	if (slot) {
+	    HashTab_kill(me, slot);
+	    return YES;
+	}
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTHashtable_removeEntry (HTHashtable * table, const char * key,
+				     void * object)
+{
+    if (table && key) {
+	HTHashImpl * me = (HTHashImpl *) table;
+	unsigned int hash = HTHash_string(key, me->flags & HT_HASH_CASELESS);
+	int pos = 0;
+	HTHashSlot * slot;
+	while ((slot = HashTab_nextMatch(me, key, hash, &pos))) {
+	    if (slot->object == object) {
+		HashTab_kill(me, slot);
+		return YES;
 	    }
 	}
     }
-    return NULL;
+    return NO;
 }
 
 /*
@@ -163,6 +430,44 @@ PUBLIC int HTHashtable_count (HTHashtable *me)
     return -1;
 }
 
+/*
+(
+   Iterate over all Elements in the HashTable
+)
+*/
+
+PRIVATE HTHashSlot * HashTab_nextSlot (HTHashImpl * me, int * pos)
+{
+    int i = *pos;
+    int oldsize = me->old.slots ? me->old.size : 0;
+    if (i < 0) return NULL;
+    for (; i < oldsize; i++) {
+	HTHashSlot * slot = me->old.slots + i;
+	if (SLOT_LIVE(slot)) {
+	    *pos = i + 1;
+	    return slot;
+	}
+    }
+    for (i -= oldsize; i < me->cur.size; i++) {
+	HTHashSlot * slot = me->cur.slots + i;
+	if (SLOT_LIVE(slot)) {
+	    *pos = oldsize + i + 1;
+	    return slot;
+	}
+    }
+    *pos = -1;
+    return NULL;
+}
+
+PUBLIC void * HTHashtable_nextObject (HTHashtable * me, int * pos)
+{
+    if (me && pos) {
+	HTHashSlot * slot = HashTab_nextSlot((HTHashImpl *) me, pos);
+	return slot ? slot->object : NULL;
+    }
+    return NULL;
+}
+
 /*
 (
    Walk all Elements in the HashTable
@@ -173,23 +478,14 @@ PUBLIC BOOL HTHashtable_walk (HTHashtable *me,
 			      int (*walkFunc)(HTHashtable *,char *, void *))
 {
     if(me) {
-	int i, j;
-	for(i = 0; i< me->size; i++) {
-	    HTList *l = (HTList *)me->table[i];
-	    if(l) {
-		HTList *cur = l;
-		keynode *kn, *nextkn;
-		for(kn = (keynode *)HTList_nextObject(cur); kn; kn = nextkn) {
-		    j = walkFunc(me, kn->key, kn->object);
-		    if(j == 0)
-			return YES;
-		    nextkn = (keynode *)HTList_nextObject(cur);
-		    if (j < 0) {
-			HTList_removeObject(l, kn);
-			me->count--;
-		    }
-		}
-	    }
+	int pos = 0;
+	HTHashSlot * slot;
+	while ((slot = HashTab_nextSlot((HTHashImpl *) me, &pos))) {
+	    int j = walkFunc(me, slot->key, slot->object);
+	    if (j == 0)
+		return YES;
+	    if (j < 0 && SLOT_LIVE(slot))
+		HashTab_kill((HTHashImpl *) me, slot);
 	}
 	return YES;
     }
@@ -205,20 +501,13 @@ PUBLIC BOOL HTHashtable_walk (HTHashtable *me,
 PUBLIC HTArray * HTHashtable_keys (HTHashtable *me)
 {
     if(me) {
-	HTArray *keys = HTArray_new(me->count);
-	int i;
-    
-	for(i = 0; i< me->size; i++) {
-	    HTList * l = (HTList *)me->table[i];
-	    if (l) {
-		HTList *cur = l;
-		keynode *kn;
-		while ((kn = (keynode *) HTList_nextObject(cur))) {
-		    char * nkey = NULL;
-		    StrAllocCopy(nkey,kn->key);
-		    HTArray_addObject(keys,nkey);
-		}
-	    }
+	HTArray *keys = HTArray_new(me->count > 0 ? me->count : 1);
+	int pos = 0;
+	HTHashSlot * slot;
+	while ((slot = HashTab_nextSlot((HTHashImpl *) me, &pos))) {
+	    char * nkey = NULL;
+	    StrAllocCopy(nkey, slot->key);
+	    HTArray_addObject(keys, nkey);
 	}
 	return keys;
     }
@@ -244,4 +533,3 @@ PUBLIC void HTHashtable_print (HTHashtable *me)
     }
     HTArray_delete(keys);
 }
-
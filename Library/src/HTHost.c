@@ -22,6 +22,8 @@
 #include "HTTrans.h"
 #include "HTTPUtil.h"
 #include "HTTCP.h"
+#include "HTInet.h"
+#include "HTStats.h"
 #include "HTHost.h"					 /* Implemented here */
 #include "HTHstMan.h"
 
@@ -31,21 +33,28 @@
 #define TCP_IDLE_ACTIVE     60000L /* Active TTL in ms on an idle connection */
 
 #define MAX_PIPES		50   /* maximum number of pipelined requests */
+#define PIPE_DEPTH_START	4    /* Initial pipeline depth for new hosts */
+#define PIPE_STALL_FACTOR	4      /* Stalled if this much slower than avg */
+#define PIPE_STALL_TIME		1000L	 /* Min time in ms before it's a stall */
 #define MAX_HOST_RECOVER	1	      /* Max number of auto recovery */
 #define DEFAULT_DELAY		30	  /* Default write flush delay in ms */
+#define POOL_MIN		1	   /* Connections kept open to a host */
+#define POOL_MAX		1		/* Max connections to a host */
+#define POOL_IDLE_TIME		10000L	 /* Idle time in ms before reaping */
 
 struct _HTInputStream {
     const HTInputStreamClass *	isa;
 };
 
 PRIVATE int HostEvent(SOCKET soc, void * pVoid, HTEventType type);
+PRIVATE BOOL _roomInPipe (HTHost * host);
 
 /* Type definitions and global variables etc. local to this module */
 PRIVATE time_t	HostTimeout = HOST_OBJECT_TTL;	 /* Timeout for host objects */
 PRIVATE time_t	HTPassiveTimeout = TCP_IDLE_PASSIVE; /* Passive timeout in s */
 PRIVATE ms_t	HTActiveTimeout = TCP_IDLE_ACTIVE;   /* Active timeout in ms */
 
-PRIVATE HTList	** HostTable = NULL;
+PRIVATE HTHashtable * HostTable = NULL;     /* Hosts keyed by hostname */
 PRIVATE HTList * PendHost = NULL;	    /* List of pending host elements */
 
 /* JK: New functions for interruption the automatic pending request 
@@ -60,6 +69,11 @@ PRIVATE int EventTimeout = -1;		        /* Global Host event timeout */
 PRIVATE ms_t WriteDelay = DEFAULT_DELAY;		      /* Delay in ms */
 
 PRIVATE int MaxPipelinedRequests = MAX_PIPES;
+PRIVATE ms_t PipeStallTime = PIPE_STALL_TIME;
+
+PRIVATE int PoolMin = POOL_MIN;
+PRIVATE int PoolMax = POOL_MAX;
+PRIVATE ms_t PoolIdleTime = POOL_IDLE_TIME;
 
 /* ------------------------------------------------------------------------- */
 
@@ -83,8 +97,23 @@ PRIVATE void free_object (HTHost * me)
 	for (i = 0; i < HTEvent_TYPES; i++)
 	    HTEvent_delete(me->events[i]);
 
-	/* Delete the timer (if any) */
+	/* Delete the timers (if any) */
 	if (me->timer) HTTimer_delete(me->timer);
+	if (me->stall_timer) HTTimer_delete(me->stall_timer);
+	if (me->pool_timer) HTTimer_delete(me->pool_timer);
+
+	/* Close any parallel connects */
+	HTDoConnect_cancel(me, NULL);
+
+	/* Delete the connection pool */
+	if (me->pool) {
+	    HTList * cur = me->pool;
+	    HTHost * pres;
+	    while ((pres = (HTHost *) HTList_nextObject(cur)))
+		free_object(pres);
+	    HTList_delete(me->pool);
+	}
+	HTList_removeObject(PendHost, me);
 
 	/* Delete the queues */
 	HTList_delete(me->pipeline);
@@ -93,10 +122,29 @@ PRIVATE void free_object (HTHost * me)
     }
 }
 
-PRIVATE BOOL delete_object (HTList * list, HTHost * me)
+PRIVATE HTHost * new_object (const char * host, u_short u_port)
+{
+    HTHost * me;
+    int i;
+    if ((me = (HTHost *) HT_CALLOC(1, sizeof(HTHost))) == NULL)
+	HT_OUTOFMEM("HTHost_add");
+    me->hash = (int) (HTHash_string(host, NO) % HOST_HASH_SIZE);
+    StrAllocCopy(me->hostname, host);
+    me->u_port = u_port;
+    me->ntime = time(NULL);
+    me->mode = HT_TP_SINGLE;
+    me->delay = WriteDelay;
+    me->inFlush = NO;
+    me->pipe_depth = PIPE_DEPTH_START;
+    for (i = 0; i < HTEvent_TYPES; i++)
+	me->events[i]= HTEvent_new(HostEvent, me, HT_PRIORITY_MAX, EventTimeout);
+    return me;
+}
+
+PRIVATE BOOL delete_object (HTHost * me)
 {
-    HTTRACE(CORE_TRACE, "Host info... object %p from list %p\n" _ me _ list);
-    HTList_removeObject(list, (void *) me);
+    HTTRACE(CORE_TRACE, "Host info... object %p from table %p\n" _ me _ HostTable);
+    HTHashtable_removeEntry(HostTable, me->hostname, (void *) me);
     free_object(me);
     return YES;
 }
@@ -166,6 +214,318 @@ PRIVATE int IdleTimeoutEvent (HTTimer * timer, void * param, HTEventType type)
     return HostEvent (sockfd, host, HTEvent_CLOSE);
 }
 
+/*
+**	Adaptive pipelining. A host starts out with a shallow pipe which gets
+**	one deeper for every response coming back while the pipe was full.
+**	If the server drops the connection with more than one request in the
+**	pipe then we remember that depth as unsafe and halve the pipe. We also
+**	keep a smoothed response time so that we can tell when the request at
+**	the front of the pipe is holding up the ones queued behind it. If so
+**	then the queue is moved to another connection to the same host.
+**	What we learn is kept in the host object owning the connection pool.
+*/
+PRIVATE int PipeStallEvent (HTTimer * timer, void * param, HTEventType type);
+
+PRIVATE HTHost * pipeOwner (HTHost * host)
+{
+    return host->owner ? host->owner : host;
+}
+
+PRIVATE int pipeDepth (HTHost * host)
+{
+    return HTMIN(pipeOwner(host)->pipe_depth, MaxPipelinedRequests);
+}
+
+PRIVATE ms_t stallTime (HTHost * host)
+{
+    return HTMAX(PipeStallTime,
+		 PIPE_STALL_FACTOR * pipeOwner(host)->response_time);
+}
+
+PRIVATE BOOL pipeStalled (HTHost * host, ms_t now)
+{
+    return (host->tcpstate == TCP_IN_USE && !HTList_isEmpty(host->pipeline) &&
+	    now - host->head_start >= stallTime(host));
+}
+
+PRIVATE void pipeShrink (HTHost * host, int broken)
+{
+    host = pipeOwner(host);
+    if (broken > 1) host->pipe_limit = broken - 1;
+    host->pipe_depth = HTMAX(host->pipe_depth / 2, 1);
+    if (host->pipe_limit)
+	host->pipe_depth = HTMIN(host->pipe_depth, host->pipe_limit);
+    HTTRACE(CORE_TRACE, "Host pipe... Depth on host %p down to %d (limit %d)\n" _
+		host _ host->pipe_depth _ host->pipe_limit);
+}
+
+/*
+**	Called when the Net object at the front of the pipe is done
+*/
+PRIVATE void pipeResponse (HTHost * host)
+{
+    HTHost * owner = pipeOwner(host);
+    ms_t sample;
+    if (host->mode == HT_TP_INTERLEAVE || !host->head_start) return;
+    sample = HTGetTimeInMillis() - host->head_start;
+    owner->response_time = owner->response_time ?
+	(7 * owner->response_time + sample) / 8 : sample;
+    if (host->mode == HT_TP_PIPELINE &&
+	(HTList_count(host->pipeline) >= pipeDepth(host) ||
+	 !HTList_isEmpty(host->pending)) &&
+	owner->pipe_depth < MaxPipelinedRequests &&
+	(!owner->pipe_limit || owner->pipe_depth < owner->pipe_limit)) {
+	owner->pipe_depth++;
+	HTTRACE(CORE_TRACE, "Host pipe... Depth on host %p up to %d\n" _
+		    owner _ owner->pipe_depth);
+    }
+}
+
+/*
+**	Watch for stalls as long as there is something queued up behind the
+**	pipe. If restart is set then the front of the pipe has changed.
+*/
+PRIVATE void pipeWatch (HTHost * host, BOOL restart)
+{
+    if (PipeStallTime && host->mode != HT_TP_INTERLEAVE &&
+	!HTList_isEmpty(host->pipeline) && !HTList_isEmpty(host->pending)) {
+	if (restart || !host->stall_timer) {
+	    ms_t now = HTGetTimeInMillis();
+	    ms_t stall = host->head_start + stallTime(host);
+	    host->stall_timer = HTTimer_new(host->stall_timer, PipeStallEvent,
+					    host, stall > now ?
+					    stall - now : stallTime(host),
+					    YES, NO);
+	}
+    } else if (host->stall_timer) {
+	HTTimer_delete(host->stall_timer);
+	host->stall_timer = NULL;
+    }
+}
+
+/*
+**	Connection pools. A host object has a single channel so in order to
+**	talk to a host over more than one connection, the host object in the
+**	host table owns a pool of extra host objects for the same host and
+**	port. These are not found by HTHost_new(). New requests go to the
+**	least loaded connection which has room for them and a new connection
+**	is opened if they are all busy and the pool isn't full. Connections
+**	beyond the minimum are closed when they have been idle for a while.
+*/
+PRIVATE int PoolReapEvent (HTTimer * timer, void * param, HTEventType type);
+
+PRIVATE int poolMax (HTHost * owner)
+{
+    return owner->pool_max > 0 ? owner->pool_max : PoolMax;
+}
+
+PRIVATE int poolMin (HTHost * owner)
+{
+    return owner->pool_min > 0 ? owner->pool_min : PoolMin;
+}
+
+PRIVATE int poolLoad (HTHost * host)
+{
+    return HTList_count(host->pipeline) + HTList_count(host->pending);
+}
+
+PRIVATE BOOL poolIdle (HTHost * owner)
+{
+    HTList * cur = owner->pool;
+    HTHost * pres;
+    while ((pres = (HTHost *) HTList_nextObject(cur)))
+	if (!HTHost_isIdle(pres)) return NO;
+    return YES;
+}
+
+PRIVATE HTHost * poolNew (HTHost * owner)
+{
+    HTHost * me = new_object(owner->hostname, owner->u_port);
+    StrAllocCopy(me->type, owner->type);
+    me->version = owner->version;
+    me->reqsPerConnection = owner->reqsPerConnection;
+    memcpy((void *) &me->sock_addr, (void *) &owner->sock_addr, sizeof(SockA));
+#ifdef AF_INET6
+    memcpy((void *) &me->sock_addr6, (void *) &owner->sock_addr6,
+	   sizeof(me->sock_addr6));
+#endif
+    me->ipv6 = owner->ipv6;
+    me->owner = owner;
+    if (!owner->pool) owner->pool = HTList_new();
+    HTList_addObject(owner->pool, me);
+    if (!owner->pool_timer)
+	owner->pool_timer = HTTimer_new(NULL, PoolReapEvent, owner,
+					PoolIdleTime, YES, YES);
+    HTTRACE(CORE_TRACE, "Host pool... Added host %p to pool of host %p, %d connections\n" _ 
+		me _ owner _ HTList_count(owner->pool) + 1);
+    return me;
+}
+
+/*
+**	Find the connection that a new request should go to
+*/
+PRIVATE HTHost * poolDispatch (HTHost * owner)
+{
+    HTList * cur = owner->pool;
+    HTHost * pres = owner;
+    HTHost * best = NULL;
+    HTHost * least = owner;
+    ms_t now = HTGetTimeInMillis();
+    do {
+	if (_roomInPipe(pres) && HTList_isEmpty(pres->pending) &&
+	    !pipeStalled(pres, now) &&
+	    (!best || HTList_count(pres->pipeline) < HTList_count(best->pipeline)))
+	    best = pres;
+	if (poolLoad(pres) < poolLoad(least)) least = pres;
+    } while ((pres = (HTHost *) HTList_nextObject(cur)));
+    if (!best && HTList_count(owner->pool) + 1 < poolMax(owner))
+	best = poolNew(owner);
+    return best ? best : least;
+}
+
+/*
+**	A connection with room and nothing pending takes over the most
+**	recently queued request from the connection with most pending
+*/
+PRIVATE BOOL poolSteal (HTHost * host)
+{
+    HTHost * owner = pipeOwner(host);
+    HTList * cur = owner->pool;
+    HTHost * pres = owner;
+    HTHost * busiest = NULL;
+    HTNet * net;
+    if (!owner->pool) return NO;
+    do {
+	if (pres != host && HTList_count(pres->pending) >
+	    (busiest ? HTList_count(busiest->pending) : 0))
+	    busiest = pres;
+    } while ((pres = (HTHost *) HTList_nextObject(cur)));
+    if (!busiest) return NO;
+    net = (HTNet *) HTList_removeLastObject(busiest->pending);
+    if (busiest->lock == net) busiest->lock = HTList_firstObject(busiest->pending);
+    HTNet_setHost(net, host);
+    if (!host->pending) host->pending = HTList_new();
+    HTList_addObject(host->pending, net);
+    HTTRACE(CORE_TRACE, "Host pool... Host %p took Net %p from host %p\n" _ 
+		host _ net _ busiest);
+    return YES;
+}
+
+/*
+**	Move the pending queue of a stalled connection to the least loaded
+**	connection in the pool which isn't stalled, or to a new one if that
+**	one is busy as well and the pool isn't full.
+*/
+PRIVATE BOOL poolMove (HTHost * host, ms_t now)
+{
+    HTHost * owner = pipeOwner(host);
+    HTList * cur = owner->pool;
+    HTHost * pres = owner;
+    HTHost * other = NULL;
+    HTNet * net;
+    int moved = 0;
+    if (!host->type || strcasecomp(host->type, "http")) return NO;
+    do {
+	if (pres != host && !pipeStalled(pres, now) &&
+	    (!other || poolLoad(pres) < poolLoad(other)))
+	    other = pres;
+    } while ((pres = (HTHost *) HTList_nextObject(cur)));
+    if ((!other || poolLoad(other)) &&
+	HTList_count(owner->pool) + 1 < poolMax(owner))
+	other = poolNew(owner);
+    if (!other) {
+	HTTRACE(CORE_TRACE, "Host pool... No other connection for host %p\n" _ host);
+	return NO;
+    }
+
+    if (!other->pending) other->pending = HTList_new();
+    if (!other->channel && !other->lock) {
+	other->forceWriteFlush = YES;
+	other->lock = HTList_firstObject(host->pending);
+    }
+    while ((net = (HTNet *) HTList_removeFirstObject(host->pending))) {
+	HTNet_setHost(net, other);
+	HTList_addObject(other->pending, net);
+	moved++;
+    }
+    host->lock = NULL;
+    HTTRACE(CORE_TRACE, "Host pool... Moved %d Net objects from host %p to %p\n" _
+		moved _ host _ other);
+    HTHost_launchPending(other);
+    return YES;
+}
+
+PRIVATE int PipeStallEvent (HTTimer * timer, void * param, HTEventType type)
+{
+    HTHost * host = (HTHost *) param;
+    ms_t now = HTGetTimeInMillis();
+
+    HTTimer_delete(timer);
+    host->stall_timer = NULL;
+
+    if (pipeStalled(host, now) && !HTList_isEmpty(host->pending)) {
+	HTTRACE(CORE_TRACE, "Host pipe... Host %p stalled for %lu ms with %d pending\n" _
+		    host _ now - host->head_start _ HTList_count(host->pending));
+	if (poolMove(host, now)) {
+	    HTHost * owner = pipeOwner(host);
+	    owner->pipe_depth = HTMAX(owner->pipe_depth / 2, 1);
+	    return HT_OK;
+	}
+    }
+    pipeWatch(host, YES);
+    return HT_OK;
+}
+
+PRIVATE BOOL poolReapable (HTHost * host, ms_t now)
+{
+    return (HTHost_isIdle(host) && HTList_isEmpty(host->pending) &&
+	    !host->lock && !host->doit && now - host->idle_since >= PoolIdleTime);
+}
+
+/*
+**	Close idle connections beyond the minimum and throw away the host
+**	objects of the ones which are closed
+*/
+PRIVATE int PoolReapEvent (HTTimer * timer, void * param, HTEventType type)
+{
+    HTHost * owner = (HTHost *) param;
+    ms_t now = HTGetTimeInMillis();
+    int open = owner->channel ? 1 : 0;
+    HTList * cur = owner->pool;
+    HTHost * pres;
+
+    while ((pres = (HTHost *) HTList_nextObject(cur)))
+	if (pres->channel) open++;
+
+    cur = owner->pool;
+    while ((pres = (HTHost *) HTList_nextObject(cur))) {
+	if (pres->channel && open > poolMin(owner) && poolReapable(pres, now)) {
+	    HTTRACE(CORE_TRACE, "Host pool... Closing idle connection on host %p\n" _ pres);
+	    HTChannel_setSemaphore(pres->channel, 0);
+	    HTHost_clearChannel(pres, HT_OK);
+	    open--;
+	}
+    }
+
+    do {
+	cur = owner->pool;
+	while ((pres = (HTHost *) HTList_nextObject(cur)))
+	    if (!pres->channel && poolReapable(pres, now)) break;
+	if (pres) {
+	    HTTRACE(CORE_TRACE, "Host pool... Removing host %p from pool of host %p\n" _ 
+			pres _ owner);
+	    HTList_removeObject(owner->pool, pres);
+	    free_object(pres);
+	}
+    } while (pres);
+
+    if (HTList_isEmpty(owner->pool)) {
+	HTTimer_delete(timer);
+	owner->pool_timer = NULL;
+    }
+    return HT_OK;
+}
+
 /*
 **	HostEvent - host event manager - recieves events from the event 
 **	manager and dispatches them to the client net objects by calling the 
@@ -280,36 +640,27 @@ PRIVATE int HostEvent (SOCKET soc, void * pVoid, HTEventType type)
 */
 PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 {
-    HTList * list = NULL;			    /* Current list in cache */
     HTHost * pres = NULL;
-    int hash = 0;
     if (!host) {
 	HTTRACE(CORE_TRACE, "Host info... Bad argument\n");
 	return NULL;
     }
-    
-    /* Find a hash for this host */
-    {
-	char *ptr;
-	for (ptr=host; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HOST_HASH_SIZE);
-	if (!HostTable) {
-	    if ((HostTable = (HTList **) HT_CALLOC(HOST_HASH_SIZE,
-						   sizeof(HTList *))) == NULL)
-	        HT_OUTOFMEM("HTHost_find");
-	}
-	if (!HostTable[hash]) HostTable[hash] = HTList_new();
-	list = HostTable[hash];
-    }
+    if (!HostTable)
+	HostTable = HTHashtable_newWithFlags(HOST_HASH_SIZE, HT_HASH_KEYREF);
 
-    /* Search the cache */
+    /*
+    **  Search the cache. The same host name can be registered more than
+    **  once with different ports
+    */
     {
-	HTList * cur = list;
-	while ((pres = (HTHost *) HTList_nextObject(cur))) {
-	    if (!strcmp(pres->hostname, host) && u_port == pres->u_port) {
-		if (HTHost_isIdle(pres) && time(NULL)>pres->ntime+HostTimeout){
+	int pos = 0;
+	while ((pres = (HTHost *) HTHashtable_nextMatch(HostTable, host, &pos))) {
+	    if (u_port == pres->u_port) {
+		if (HTHost_isIdle(pres) &&
+		    poolIdle(pres) &&
+		    time(NULL)>pres->ntime+HostTimeout) {
 		    HTTRACE(CORE_TRACE, "Host info... Collecting host info %p\n" _ pres);
-		    delete_object(list, pres);
+		    delete_object(pres);
 		    pres = NULL;
 		}
 		break;
@@ -340,23 +691,10 @@ PUBLIC HTHost * HTHost_new (char * host, u_short u_port)
 	    HTTRACE(CORE_TRACE, "Host info... Found Host %p with no active channel\n" _ pres);
 	}
     } else {
-	if ((pres = (HTHost *) HT_CALLOC(1, sizeof(HTHost))) == NULL)
-	    HT_OUTOFMEM("HTHost_add");
-	pres->hash = hash;
-	StrAllocCopy(pres->hostname, host);
-	pres->u_port = u_port;
-	pres->ntime = time(NULL);
-	pres->mode = HT_TP_SINGLE;
-	pres->delay = WriteDelay;
-	pres->inFlush = NO;
-	{
-	    int i;
-	    for (i = 0; i < HTEvent_TYPES; i++)
-		pres->events[i]= HTEvent_new(HostEvent, pres, HT_PRIORITY_MAX, EventTimeout);
-	}
-	HTTRACE(CORE_TRACE, "Host info... added `%s\' with host %p to list %p\n" _ 
-		    host _ pres _ list);
-	HTList_addObject(list, (void *) pres);
+	pres = new_object(host, u_port);
+	HTTRACE(CORE_TRACE, "Host info... added `%s\' with host %p to table %p\n" _ 
+		    host _ pres _ HostTable);
+	HTHashtable_addObject(HostTable, pres->hostname, (void *) pres);
     }
     return pres;
 }
@@ -424,34 +762,20 @@ PUBLIC HTHost * HTHost_newWParse (HTRequest * request, char * url, u_short u_por
 */
 PUBLIC HTHost * HTHost_find (char * host)
 {
-    HTList * list = NULL;			    /* Current list in cache */
     HTHost * pres = NULL;
     HTTRACE(CORE_TRACE, "Host info... Looking for `%s\'\n" _ host ? host : "<null>");
 
-    /* Find a hash for this host */
+    /* Search the cache */
     if (host && HostTable) {
-	int hash = 0;
-	char *ptr;
-	for (ptr=host; *ptr; ptr++)
-	    hash = (int) ((hash * 3 + (*(unsigned char *) ptr)) % HOST_HASH_SIZE);
-	if (!HostTable[hash]) return NULL;
-	list = HostTable[hash];
-
-	/* Search the cache */
-	{
-	    HTList * cur = list;
-	    while ((pres = (HTHost *) HTList_nextObject(cur))) {
-		if (!strcmp(pres->hostname, host)) {
-		    if (time(NULL) > pres->ntime + HostTimeout) {
-			HTTRACE(CORE_TRACE, "Host info... Collecting host %p\n" _ pres);
-			delete_object(list, pres);
-			pres = NULL;
-  		    } else {
-			HTTRACE(CORE_TRACE, "Host info... Found `%s\'\n" _ host);
-		    }
-		    return pres;
-		}
+	if ((pres = (HTHost *) HTHashtable_object(HostTable, host))) {
+	    if (time(NULL) > pres->ntime + HostTimeout) {
+		HTTRACE(CORE_TRACE, "Host info... Collecting host %p\n" _ pres);
+		delete_object(pres);
+		pres = NULL;
+	    } else {
+		HTTRACE(CORE_TRACE, "Host info... Found `%s\'\n" _ host);
 	    }
+	    return pres;
 	}
     }
     return NULL;
@@ -462,24 +786,16 @@ PUBLIC HTHost * HTHost_find (char * host)
 */
 PUBLIC void HTHost_deleteAll (void)
 {
-    HTList * list;
     HTHost * host;
-    int i;
+    int pos = 0;
 
     if (!HostTable)
 	return;
 
-    for (i=0; i < HOST_HASH_SIZE; i++) {
-	list = HostTable[i];
-	if (!list) continue;
-
-	while ((host = (HTHost *) HTList_removeFirstObject(list)) != NULL)
-	    free_object(host);
+    while ((host = (HTHost *) HTHashtable_nextObject(HostTable, &pos)) != NULL)
+	delete_object(host);
 
-	HTList_delete(list);
-    }
-
-    HT_FREE(HostTable);
+    HTHashtable_delete(HostTable);
     HostTable = NULL;
 }
 
@@ -801,6 +1117,11 @@ PUBLIC BOOL HTHost_clearChannel (HTHost * host, int status)
 
 	host->recovered = 0;
 
+	if (host->stall_timer) {
+	    HTTimer_delete(host->stall_timer);
+	    host->stall_timer = NULL;
+	}
+
 	HTTRACE(CORE_TRACE, "Host info... removed host %p as persistent\n" _ host);
 
 	if (!HTList_isEmpty(host->pending)) {
@@ -841,6 +1162,13 @@ PUBLIC BOOL HTHost_recoverPipe (HTHost * host)
 	if (piped > 0) {
 	    int cnt;
 	    host->recovered++;
+
+	    /*
+	    **  Unless the server told us that it was going to close, it
+	    **  couldn't take that many requests in the pipe
+	    */
+	    if (!host->do_recover && piped > 1) pipeShrink(host, piped);
+	    HTStats_count(HTStats_forHost(host), HT_STATS_RETRIES, piped);
 	    HTTRACE(CORE_TRACE, "Host recover %p recovered %d times. Moving %d Net objects from pipe line to pending queue\n" _ host _ host->recovered _ piped);
 	    
 	    /*
@@ -964,7 +1292,7 @@ PRIVATE BOOL _roomInPipe (HTHost * host)
 	return count <= 0;
     case HT_TP_PIPELINE:
 	return (host->recovered < MAX_HOST_RECOVER) ?
-	    (count < MaxPipelinedRequests) : (count <= 0);
+	    (count < pipeDepth(host)) : (count <= 0);
     case HT_TP_INTERLEAVE:
 	return YES;
     }
@@ -1048,8 +1376,12 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 	if (_roomInPipe(host) && (HTList_isEmpty(host->pending) || doit)) {
 	    if (doit) host->doit = NULL;
 	    if (!host->pipeline) host->pipeline = HTList_new();
+	    if (HTList_isEmpty(host->pipeline))
+		host->head_start = HTGetTimeInMillis();
 	    HTList_addObject(host->pipeline, net);
 	    host->reqsMade++;
+	    HTStats_record(HTStats_forHost(host), HT_STATS_PIPELINE_DEPTH,
+			   HTList_count(host->pipeline));
             HTTRACE(CORE_TRACE, "Host info... Added Net %p (request %p) to pipe on Host %p, %d requests made, %d requests in pipe, %d pending\n" _ 
 			net _ net->request _ host _ host->reqsMade _ 
 			HTList_count(host->pipeline) _ HTList_count(host->pending));
@@ -1075,6 +1407,7 @@ PUBLIC int HTHost_addNet (HTHost * host, HTNet * net)
 			net _ net->request _ 
 			host _ host->reqsMade _ 
 			HTList_count(host->pipeline) _ HTList_count(host->pending));
+	    pipeWatch(host, NO);
 	    status = HT_PENDING;
 	}
 	return status;
@@ -1155,10 +1488,22 @@ PUBLIC BOOL HTHost_deleteNet (HTHost * host, HTNet * net, int status)
     if (host && net) {
         HTTRACE(CORE_TRACE, "Host info... Remove %p from pipe\n" _ net);
 
+	/* Stop connecting if we were doing it on behalf of this Net object */
+	HTDoConnect_cancel(host, net);
+
 	/* If the Net object is in the pipeline then also update the channel */
 	if (host->pipeline && HTList_indexOf(host->pipeline, net) >= 0) {
+	    BOOL head = (HTList_firstObject(host->pipeline) == net);
+	    if (head && status >= 0) pipeResponse(host);
 	    HTHost_free(host, status);
 	    HTList_removeObjectAll(host->pipeline, net);
+	    if (head) {
+		host->head_start = HTList_isEmpty(host->pipeline) ?
+		    0 : HTGetTimeInMillis();
+		pipeWatch(host, YES);
+	    }
+	    if (HTList_isEmpty(host->pipeline))
+		host->idle_since = HTGetTimeInMillis();
 	}
 
 	HTList_removeObjectAll(host->pending, net); /* just to make sure */
@@ -1244,8 +1589,13 @@ PUBLIC BOOL HTHost_launchPending (HTHost * host)
     }
 
     /*
-    **  Check the current Host object for pending Net objects
+    **  Check the current Host object for pending Net objects. If it
+    **  hasn't got any then see if it can help out another connection in
+    **  the pool.
     */
+    if (_roomInPipe(host) && DoPendingReqLaunch &&
+	HTList_isEmpty(host->pending))
+	poolSteal(host);
     if (_roomInPipe(host) && DoPendingReqLaunch &&
 	   (net = HTHost_nextPendingNet(host))) {
 	HTHost_ActivateRequest(net);
@@ -1302,6 +1652,12 @@ PUBLIC int HTHost_connect (HTHost * host, HTNet * net, char * url)
 	if ((host = HTHost_newWParse(request, url, HTProtocol_id(protocol))) == NULL)
 	    return HT_ERROR;
 
+	/*
+	** HTTP requests are spread over the connection pool of the host
+	*/
+	if (!strcasecomp(HTProtocol_name(protocol), "http"))
+	    host = poolDispatch(host);
+
 	/*
 	** If not already locked and without a channel
 	** then lock the darn thing with the first Net object
@@ -1771,6 +2127,142 @@ PUBLIC int HTHost_maxPipelinedRequests (void)
     return MaxPipelinedRequests;
 }
 
+PUBLIC int HTHost_pipelineDepth (HTHost * host)
+{
+    return host ? pipeDepth(host) : -1;
+}
+
+PUBLIC void HTHost_setPipelineStallTime (ms_t stall)
+{
+    PipeStallTime = stall;
+    HTTRACE(CORE_TRACE, "Host........ Setting pipeline stall time to %lu ms\n" _ stall);
+}
+
+PUBLIC ms_t HTHost_pipelineStallTime (void)
+{
+    return PipeStallTime;
+}
+
+/*
+**	Connection pool sizes
+*/
+PUBLIC BOOL HTHost_setDefaultPoolSize (int min, int max)
+{
+    if (min >= 1 && max >= min) {
+	PoolMin = min;
+	PoolMax = max;
+	HTTRACE(CORE_TRACE, "Host pool... Default pool is %d to %d connections\n" _ min _ max);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC int HTHost_defaultPoolMin (void)
+{
+    return PoolMin;
+}
+
+PUBLIC int HTHost_defaultPoolMax (void)
+{
+    return PoolMax;
+}
+
+PUBLIC BOOL HTHost_setPoolSize (HTHost * host, int min, int max)
+{
+    if (host && min >= 1 && max >= min) {
+	host = pipeOwner(host);
+	host->pool_min = min;
+	host->pool_max = max;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC int HTHost_poolConnections (HTHost * host)
+{
+    int open = 0;
+    if (host) {
+	HTList * cur;
+	HTHost * pres = host = pipeOwner(host);
+	cur = host->pool;
+	do {
+	    if (pres->channel) open++;
+	} while ((pres = (HTHost *) HTList_nextObject(cur)));
+    }
+    return open;
+}
+
+PUBLIC BOOL HTHost_setPoolIdleTime (ms_t idle)
+{
+    if (idle > 0) {
+	PoolIdleTime = idle;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC ms_t HTHost_poolIdleTime (void)
+{
+    return PoolIdleTime;
+}
+
+/*
+**	Save and load what we have learned about pipelining to each host
+**	so that we don't have to start from scratch the next time.
+*/
+PUBLIC BOOL HTHost_savePipelineDepths (const char * filename)
+{
+    FILE * fp;
+    HTHost * host;
+    int pos = 0;
+    if (!filename || (fp = fopen(filename, "w")) == NULL) {
+	HTTRACE(CORE_TRACE, "Host pipe... Can't write `%s\'\n" _ 
+		    filename ? filename : "<null>");
+	return NO;
+    }
+    fprintf(fp, "# host port depth limit response-time-ms\n");
+    while (HostTable &&
+	   (host = (HTHost *) HTHashtable_nextObject(HostTable, &pos)) != NULL) {
+	if (host->pipe_depth != PIPE_DEPTH_START || host->pipe_limit ||
+	    host->response_time)
+	    fprintf(fp, "%s %u %d %d %lu\n", host->hostname, host->u_port,
+		    host->pipe_depth, host->pipe_limit, host->response_time);
+    }
+    fclose(fp);
+    return YES;
+}
+
+PUBLIC BOOL HTHost_loadPipelineDepths (const char * filename)
+{
+    FILE * fp;
+    char line[256];
+    char name[256];
+    if (!filename || (fp = fopen(filename, "r")) == NULL) {
+	HTTRACE(CORE_TRACE, "Host pipe... Can't read `%s\'\n" _ 
+		    filename ? filename : "<null>");
+	return NO;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+	unsigned int port;
+	int depth, limit;
+	unsigned long response;
+	HTHost * host;
+	if (*line == '#' ||
+	    sscanf(line, "%255s %u %d %d %lu", name, &port, &depth, &limit,
+		   &response) != 5 || depth < 1)
+	    continue;
+	if ((host = HTHost_new(name, (u_short) port)) != NULL) {
+	    host->pipe_depth = depth;
+	    host->pipe_limit = limit > 0 ? limit : 0;
+	    host->response_time = response;
+	    HTTRACE(CORE_TRACE, "Host pipe... Host %p `%s\' starts at depth %d\n" _ 
+			host _ name _ depth);
+	}
+    }
+    fclose(fp);
+    return YES;
+}
+
 PUBLIC void HTHost_setActivateRequestCallback (HTHost_ActivateRequestCallback * cbf)
 {
     HTTRACE(CORE_TRACE, "HTHost...... Registering %p\n" _ cbf);
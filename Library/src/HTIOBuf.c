@@ -0,0 +1,234 @@
+/*								     HTIOBuf.c
+**	SHARED I/O BUFFERS
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	Reference counted buffers recycled through a pool with one free list
+**	for each power of two between HT_IOBUF_MIN and HT_IOBUF_MAX. The
+**	data follows the buffer header in the same block of memory, except
+**	for buffers which are a mapped region of a file.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "HTUtils.h"
+#include "HTMemory.h"
+#include "HTIOBuf.h"					 /* Implemented here */
+
+#define IOBUF_CLASSES		6	   /* HT_IOBUF_MIN to HT_IOBUF_MAX */
+#define IOBUF_MAX_IDLE		8
+
+struct _HTIOBuffer {
+    int			refs;
+    int			sizeclass;		      /* -1 if not pooled */
+    size_t		size;
+    HTIOBuffer *	next;			  /* Next in the free list */
+
+    /* Mapped files */
+    char *		data;		       /* NULL if data follows */
+    char *		map;			  /* Start of the mapping */
+    size_t		maplen;
+    int			fd;
+    long		offset;		    /* Of the data in the file */
+};
+
+PRIVATE HTIOBuffer * FreeList[IOBUF_CLASSES];
+PRIVATE int Idle[IOBUF_CLASSES];
+PRIVATE int MaxIdle = IOBUF_MAX_IDLE;
+PRIVATE long Live = 0;
+PRIVATE long IdleBytes = 0;
+PRIVATE BOOL Registered = NO;
+
+PRIVATE HTIOBuffer * Current = NULL;	   /* Being pushed down a stream */
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTIOBuffer * HTIOBuffer_new (size_t size)
+{
+    HTIOBuffer * me;
+    size_t bytes = HT_IOBUF_MIN;
+    int sizeclass = 0;
+    while (bytes < size && sizeclass < IOBUF_CLASSES-1) {
+	bytes <<= 1;
+	sizeclass++;
+    }
+    if (bytes < size) {
+	bytes = size;
+	sizeclass = -1;
+    }
+    if (sizeclass >= 0 && (me = FreeList[sizeclass]) != NULL) {
+	FreeList[sizeclass] = me->next;
+	Idle[sizeclass]--;
+	IdleBytes -= bytes;
+    } else {
+	if (!Registered) {
+	    HTMemoryCall_add(HTIOBuffer_purge);
+	    Registered = YES;
+	}
+	if ((me = (HTIOBuffer *) HT_MALLOC(sizeof(HTIOBuffer) + bytes)) == NULL)
+	    HT_OUTOFMEM("HTIOBuffer_new");
+	me->sizeclass = sizeclass;
+	me->size = bytes;
+	HTTRACE(MEM_TRACE, "I/O Buffer.. Created %p of %d bytes\n" _ me _ (int) bytes);
+    }
+    me->refs = 1;
+    me->next = NULL;
+    me->data = NULL;
+    me->fd = -1;
+    Live++;
+    return me;
+}
+
+/*
+**	Map a region of a file. The buffer takes over the file descriptor and
+**	closes it when the last reference goes. Returns NULL if the file can't
+**	be mapped in which case the descriptor is left alone.
+*/
+PUBLIC HTIOBuffer * HTIOBuffer_newFile (int fd, long offset, size_t size)
+{
+#ifdef HAVE_MMAP
+    HTIOBuffer * me;
+    long page = sysconf(_SC_PAGESIZE);
+    long start = page > 0 ? offset - offset % page : offset;
+    char * map;
+    if (fd < 0 || offset < 0 || !size) return NULL;
+    map = (char *) mmap(NULL, size + (offset - start), PROT_READ, MAP_SHARED,
+			fd, (off_t) start);
+    if (map == (char *) MAP_FAILED) {
+	HTTRACE(MEM_TRACE, "I/O Buffer.. Can't map file %d\n" _ fd);
+	return NULL;
+    }
+    if ((me = (HTIOBuffer *) HT_CALLOC(1, sizeof(HTIOBuffer))) == NULL)
+	HT_OUTOFMEM("HTIOBuffer_newFile");
+    me->refs = 1;
+    me->sizeclass = -1;
+    me->size = size;
+    me->map = map;
+    me->maplen = size + (offset - start);
+    me->data = map + (offset - start);
+    me->fd = fd;
+    me->offset = offset;
+    Live++;
+    HTTRACE(MEM_TRACE, "I/O Buffer.. Mapped %d bytes of file %d in %p\n" _ 
+	    (int) size _ fd _ me);
+    return me;
+#else
+    return NULL;
+#endif /* HAVE_MMAP */
+}
+
+PUBLIC HTIOBuffer * HTIOBuffer_ref (HTIOBuffer * me)
+{
+    if (me) me->refs++;
+    return me;
+}
+
+PUBLIC BOOL HTIOBuffer_unref (HTIOBuffer * me)
+{
+    if (me) {
+	if (--me->refs > 0) return YES;
+	Live--;
+	if (Current == me) Current = NULL;
+#ifdef HAVE_MMAP
+	if (me->map) {
+	    munmap((void *) me->map, me->maplen);
+	    close(me->fd);
+	    HT_FREE(me);
+	    return YES;
+	}
+#endif
+	if (me->sizeclass >= 0 && Idle[me->sizeclass] < MaxIdle) {
+	    me->next = FreeList[me->sizeclass];
+	    FreeList[me->sizeclass] = me;
+	    Idle[me->sizeclass]++;
+	    IdleBytes += me->size;
+	} else
+	    HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC char * HTIOBuffer_data (HTIOBuffer * me)
+{
+    return me ? (me->data ? me->data : (char *) (me + 1)) : NULL;
+}
+
+PUBLIC size_t HTIOBuffer_size (HTIOBuffer * me)
+{
+    return me ? me->size : 0;
+}
+
+PUBLIC int HTIOBuffer_refs (HTIOBuffer * me)
+{
+    return me ? me->refs : 0;
+}
+
+PUBLIC int HTIOBuffer_file (HTIOBuffer * me, long * offset)
+{
+    if (me && me->fd >= 0) {
+	if (offset) *offset = me->offset;
+	return me->fd;
+    }
+    return -1;
+}
+
+/*
+**	Current buffer
+*/
+PUBLIC HTIOBuffer * HTIOBuffer_setCurrent (HTIOBuffer * me)
+{
+    HTIOBuffer * previous = Current;
+    Current = me;
+    return previous;
+}
+
+PUBLIC HTIOBuffer * HTIOBuffer_hold (const char * data, size_t len)
+{
+    if (Current && data) {
+	const char * start = HTIOBuffer_data(Current);
+	if (data >= start && data + len <= start + Current->size)
+	    return HTIOBuffer_ref(Current);
+    }
+    return NULL;
+}
+
+/*
+**	Pool management
+*/
+PUBLIC void HTIOBuffer_setMaxIdle (int buffers)
+{
+    MaxIdle = buffers >= 0 ? buffers : IOBUF_MAX_IDLE;
+}
+
+PUBLIC int HTIOBuffer_maxIdle (void)
+{
+    return MaxIdle;
+}
+
+PUBLIC void HTIOBuffer_purge (size_t size)
+{
+    int cnt;
+    for (cnt = 0; cnt < IOBUF_CLASSES; cnt++) {
+	HTIOBuffer * me;
+	while ((me = FreeList[cnt]) != NULL) {
+	    FreeList[cnt] = me->next;
+	    HT_FREE(me);
+	}
+	Idle[cnt] = 0;
+    }
+    HTTRACE(MEM_TRACE, "I/O Buffer.. Purged %ld idle bytes\n" _ IdleBytes);
+    IdleBytes = 0;
+}
+
+PUBLIC long HTIOBuffer_live (void)
+{
+    return Live;
+}
+
+PUBLIC long HTIOBuffer_idleBytes (void)
+{
+    return IdleBytes;
+}
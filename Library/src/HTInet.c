@@ -203,7 +203,7 @@ PUBLIC const char * HTInetString (SockA * sin)
 **	Any port number gets chopped off
 **      Returns:
 **	       	>0	Number of homes
-**		 0	Wait for persistent socket
+**		 0	Wait for persistent socket or the name server
 **		-1	Error
 */
 PUBLIC int HTParseInet (HTHost * host, char * hostname, HTRequest * request)
@@ -180,8 +180,15 @@ PUBLIC void HTTransferEncoderInit (HTList * c)
 PUBLIC void HTContentEncoderInit (HTList * c)
 {
 #ifdef HT_ZLIB
-    HTCoding_add(c, "deflate", NULL, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "gzip", HTZLib_deflate, HTZLib_inflate, 1.0);
+    HTCoding_add(c, "deflate", HTZLib_deflate, HTZLib_inflate, 1.0);
 #endif /* HT_ZLIB */
+#ifdef HT_ZSTD
+    HTCoding_add(c, "zstd", NULL, HTZstd_decode, 1.0);
+#endif /* HT_ZSTD */
+#ifdef HT_BROTLI
+    HTCoding_add(c, "br", NULL, HTBrotli_decode, 1.0);
+#endif /* HT_BROTLI */
 }
 
 /*	REGISTER BEFORE FILTERS
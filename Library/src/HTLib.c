@@ -18,6 +18,8 @@
 #include "HTAnchor.h"
 #include "HTProt.h"
 #include "HTDNS.h"
+#include "HTResolv.h"
+#include "HTStats.h"
 #include "HTUTree.h"
 #include "HTLib.h"					 /* Implemented here */
 
@@ -185,12 +187,15 @@ PUBLIC BOOL HTLibTerminate (void)
     HTNet_killAll();
     HTHost_deleteAll();		/* Delete remaining hosts */
     HTChannel_deleteAll();			/* Delete remaining channels */
+    HTIOBuffer_purge(0);			 /* Free idle I/O buffers */
 
     HT_FREE(HTAppName);	        /* Freed thanks to Wade Ogden <wade@ebt.com> */
     HT_FREE(HTAppVersion);
 
     HTAtom_deleteAll();					 /* Remove the atoms */
     HTDNS_deleteAll();				/* Remove the DNS host cache */
+    HTResolver_deleteAll();		     /* Drop outstanding DNS queries */
+    HTStats_deleteAll();			  /* Drop request statistics */
     HTAnchor_deleteAll(NULL);		/* Delete anchors and drop hyperdocs */
 
     HTProtocol_deleteAll();  /* Remove bindings between access and protocols */
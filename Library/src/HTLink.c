@@ -91,6 +91,7 @@ PUBLIC BOOL HTLink_remove (HTAnchor * source, HTAnchor * destination)
 	source->mainLink.type = NULL;
 	source->mainLink.method = METHOD_INVALID;
 	source->mainLink.result = HT_LINK_INVALID;
+	HTList_removeObject(destination->parent->sources, source);
 	return YES;
     }
 
@@ -102,6 +103,7 @@ PUBLIC BOOL HTLink_remove (HTAnchor * source, HTAnchor * destination)
 	    if (pres->dest == destination) {
 		HTList_removeObject(source->links, pres);
 		HT_FREE(pres);
+		HTList_removeObject(destination->parent->sources, source);
 		return YES;
 	    }
 	}
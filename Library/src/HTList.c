@@ -15,10 +15,20 @@
 #include "HTUtils.h"
 #include "HTList.h"
 
+PRIVATE HTMemPool * ListPool = NULL;		     /* All nodes come from here */
+
+PRIVATE HTList * HTList_newNode (void)
+{
+    if (!ListPool) ListPool = HTMemPool_new("HTList", sizeof(HTList));
+    return (HTList *) HTMemPool_alloc(ListPool);
+}
+
+#define HTList_freeNode(node)	HTMemPool_free(ListPool, (node))
+
 PUBLIC HTList * HTList_new (void)
 {
     HTList *newList;
-    if ((newList = (HTList  *) HT_CALLOC(1, sizeof (HTList))) == NULL)
+    if ((newList = HTList_newNode()) == NULL)
         HT_OUTOFMEM("HTList_new");
     newList->object = NULL;
     newList->next = NULL;
@@ -31,7 +41,7 @@ PUBLIC BOOL HTList_delete (HTList * me)
 	HTList *current;
 	while ((current = me)) {
 	    me = me->next;
-	    HT_FREE(current);
+	    HTList_freeNode(current);
 	}
 	return YES;
     }
@@ -42,7 +52,7 @@ PUBLIC BOOL HTList_addObject (HTList * me, void * newObject)
 {
     if (me) {
 	HTList *newNode;
-	if ((newNode = (HTList  *) HT_CALLOC(1, sizeof(HTList))) == NULL)
+	if ((newNode = HTList_newNode()) == NULL)
 	    HT_OUTOFMEM("HTList_addObject");
 	newNode->object = newObject;
 	newNode->next = me->next;
@@ -73,7 +83,7 @@ PUBLIC BOOL HTList_removeObject (HTList * me, void * oldObject)
 	    me = me->next;
 	    if (me->object == oldObject) {
 		previous->next = me->next;
-		HT_FREE(me);
+		HTList_freeNode(me);
 		return YES;	/* Success */
 	    }
 	}
@@ -85,7 +95,7 @@ PUBLIC HTList * HTList_addList (HTList * me, void * newObject)
 {
     if (me) {
 	HTList *newNode;
-	if ((newNode = (HTList  *) HT_CALLOC(1, sizeof(HTList))) == NULL)
+	if ((newNode = HTList_newNode()) == NULL)
 	    HT_OUTOFMEM("HTList_addObject");
 	newNode->object = newObject;
 	newNode->next = me->next;
@@ -112,7 +122,7 @@ PUBLIC BOOL HTList_quickRemoveElement (HTList * me, HTList * last)
 {
     if (me && last) {
 	last->next = me->next;
-	HT_FREE(me);
+	HTList_freeNode(me);
 	return YES;	/* Success */
     }
     return NO;			/* object not found or NULL list */
@@ -131,7 +141,7 @@ PUBLIC BOOL HTList_removeObjectAll (HTList * me, void * oldObject)
        if (i->object == oldObject)
 	 {
 	  me->next = i->next;
-	  HT_FREE(i);
+	  HTList_freeNode(i);
 	  found = YES;	/* At least one object found */
 	 }
         else
@@ -150,7 +160,7 @@ PUBLIC void * HTList_removeLastObject  (HTList * me)
 	HTList *lastNode = me->next;
 	void * lastObject = lastNode->object;
 	me->next = lastNode->next;
-	HT_FREE(lastNode);
+	HTList_freeNode(lastNode);
 	return lastObject;
     } else			/* Empty list */
 	return NULL;
@@ -167,7 +177,7 @@ PUBLIC void * HTList_removeFirstObject  (HTList * me)
 	}
 	firstObject = me->object;
 	prevNode->next = NULL;
-	HT_FREE(me);
+	HTList_freeNode(me);
 	return firstObject;
     } else			/* Empty list */
 	return NULL;
@@ -290,6 +290,40 @@ PRIVATE int _stream2dispatchParsers (HTStream * me)
     return (_dispatchParsers (me->request, token, value));
 }
 
+/*
+**	Look at the header line starting at the beginning of the buffer. If it
+**	is a complete "token: value" line followed by the start of another
+**	line then put the token and the value into the chunks and return where
+**	the next line starts. Folded lines, the end of the header, lines split
+**	between two blocks, and anything odd are left to the state machine.
+**	memchr() looks at a word or a vector at a time in most C libraries so
+**	this is a lot faster than going through the state machine.
+*/
+PRIVATE const char * HTMIME_line (HTStream * me, const char * b, int l)
+{
+    const char * lf = (const char *) memchr(b, LF, l);
+    const char * eol;
+    const char * colon;
+    const char * value;
+    const char * ptr;
+    if (!lf || lf+1 >= b+l || isspace((int) *(unsigned char *) (lf+1)))
+	return NULL;
+    eol = (lf > b && *(lf-1) == CR) ? lf-1 : lf;
+    if (memchr(b, CR, eol-b) ||
+	(colon = (const char *) memchr(b, ':', eol-b)) == NULL || colon == b)
+	return NULL;
+    for (ptr = b; ptr < colon; ptr++)
+	if (isspace((int) *(unsigned char *) ptr)) return NULL;
+    for (value = colon+1; value < eol; value++)
+	if (*value != ':' && !isspace((int) *(unsigned char *) value)) break;
+    if (value == eol) return NULL;
+    HTChunk_putb(me->token, b, colon-b);
+    HTChunk_putc(me->token, '\0');
+    HTChunk_putb(me->value, value, eol-value);
+    HTChunk_putc(me->value, '\0');
+    return lf+1;
+}
+
 /*
 **	Header is terminated by CRCR, LFLF, CRLFLF, CRLFCRLF
 **	Folding is either of CF LWS, LF LWS, CRLF LWS
@@ -303,6 +337,24 @@ PRIVATE int HTMIME_put_block (HTStream * me, const char * b, int l)
     int status;
 
     while (!me->transparent) {
+	/*
+	**  At the start of a line we first try to take the whole line in
+	**  one go
+	*/
+	if (me->EOLstate == EOL_BEGIN && !me->haveToken &&
+	    !HTChunk_size(me->token) && !HTChunk_size(me->value)) {
+	    const char * next = HTMIME_line(me, b, l);
+	    if (next) {
+		int ret = _stream2dispatchParsers(me);
+		HTNet_addBytesRead(me->net, next-b);
+		l -= next-b;
+		b = start = end = next;
+		HTChunk_truncate(me->token,0);
+		HTChunk_truncate(me->value,0);
+		if (ret != HT_OK && ret != HT_LOADED) return ret;
+		continue;
+	    }
+	}
 	if (me->EOLstate == EOL_FCR) {
 	    if (*b == CR)				    /* End of header */
 	        me->EOLstate = EOL_END;
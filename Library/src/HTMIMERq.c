@@ -33,9 +33,17 @@ struct _HTStream {
     HTRequest *			request;
     BOOL			endHeader;
     BOOL			transparent;
+    BOOL			reply;		  /* Body goes back to the peer */
+    HTEncoding			coding;	       /* Coding that we apply or NULL */
+    long			consumed;	/* Body bytes before coding */
+    BOOL			ended;	     /* End of coded body passed on */
 };
 
 #define HT_MAX_WAIT		8      /* Max number of secs to wait for PUT */
+#define CODING_THRESHOLD	1024	   /* Min size of a body worth coding */
+
+PRIVATE HTEncoding ContentCoding = NULL;
+PRIVATE long CodingThreshold = CODING_THRESHOLD;
 
 PRIVATE int MIMERequest_put_block (HTStream * me, const char * b, int l);
 
@@ -43,6 +51,67 @@ PRIVATE int MIMERequest_put_block (HTStream * me, const char * b, int l);
 /* 			    MIME Output Request Stream			     */
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Text compresses well, most other types are compressed already
+*/
+PRIVATE BOOL MIMECompressible (HTFormat format)
+{
+    const char * type = format ? HTAtom_name(format) : NULL;
+    int length = type ? strlen(type) : 0;
+    if (!type) return NO;
+    return (!strncasecomp(type, "text/", 5) ||
+	    (length > 4 && !strcasecomp(type + length - 4, "+xml")) ||
+	    !strcasecomp(type, "application/xml") ||
+	    !strcasecomp(type, "application/json") ||
+	    !strcasecomp(type, "application/javascript") ||
+	    !strcasecomp(type, "application/x-www-form-urlencoded"));
+}
+
+/*
+**	Does the peer take this coding? A reply only uses a coding that the
+**	client listed in its Accept-Encoding header. When we send an entity
+**	of our own, it is up to the application to only set a coding for
+**	servers which take it.
+*/
+PRIVATE BOOL MIMEAccepted (HTRequest * request, HTEncoding coding, BOOL reply)
+{
+    HTAssocList * accept = HTRequest_acceptEncoding(request);
+    if (accept) {
+	char * quality = HTAssocList_findObjectExact(accept, HTAtom_name(coding));
+	if (!quality) quality = HTAssocList_findObjectExact(accept, "*");
+	return (quality && atof(quality) > 0.0);
+    }
+    return reply ? NO : HTMethod_hasEntity(HTRequest_method(request));
+}
+
+/*
+**	Find out whether we should compress the body on the fly. We only do
+**	so if it hasn't got a coding already and isn't too small to be worth
+**	it.
+*/
+PRIVATE HTEncoding MIMECoding (HTRequest * request, HTParentAnchor * entity,
+			       HTEnHd mask, BOOL reply)
+{
+    HTEncoding coding = ContentCoding;
+    HTList * cur = entity->content_encoding;
+    HTEncoding pres;
+    if (!coding || HTRequest_transfer(request) ||
+	HTRequest_method(request) == METHOD_HEAD ||
+	!(mask & HT_E_CONTENT_ENCODING) || !(mask & HT_E_CONTENT_LENGTH))
+	return NULL;
+    while ((pres = (HTEncoding) HTList_nextObject(cur)))
+	if (!HTFormat_isUnityContent(pres)) return NULL;
+    if (entity->content_length >= 0 && entity->content_length < CodingThreshold)
+	return NULL;
+    if (!MIMECompressible(entity->content_type) ||
+	!MIMEAccepted(request, coding, reply) ||
+	!HTContentCoding_canEncode(coding, request))
+	return NULL;
+    HTTRACE(STREAM_TRACE, "MIME........ Sending body with coding `%s\'\n" _ 
+		HTAtom_name(coding));
+    return coding;
+}
+
 /*	MIMEMakeRequest
 **	---------------
 **	Generates the BODY parts of a MIME message.
@@ -56,6 +125,8 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
     BOOL transfer_coding = NO;		/* We should get this from the Host object */
     *crlf = CR; *(crlf+1) = LF; *(crlf+2) = '\0';
 
+    me->coding = MIMECoding(request, entity, EntityMask, me->reply);
+
     if (EntityMask & HT_E_ALLOW) {
 	BOOL first = YES;
 	int cnt;
@@ -72,7 +143,15 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
 	}
 	if (!first) PUTBLOCK(crlf, 2);
     }
-    if (EntityMask & HT_E_CONTENT_ENCODING && entity->content_encoding) {
+    if (me->coding) {
+	sprintf(linebuf, "Content-Encoding: %s%c%c", HTAtom_name(me->coding),
+		CR, LF);
+	PUTBLOCK(linebuf, (int) strlen(linebuf));
+	if (HTRequest_acceptEncoding(request)) {
+	    sprintf(linebuf, "Vary: Accept-Encoding%c%c", CR, LF);
+	    PUTBLOCK(linebuf, (int) strlen(linebuf));
+	}
+    } else if (EntityMask & HT_E_CONTENT_ENCODING && entity->content_encoding) {
 	BOOL first = YES;
 	HTList * cur = entity->content_encoding;
 	HTEncoding pres;
@@ -113,7 +192,7 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
     /* Only send out Content-Length if we don't have a transfer coding */
     if (!HTRequest_transfer(request)) {
 	if (EntityMask & HT_E_CONTENT_LENGTH) {
-	    if (entity->content_length >= 0) {
+	    if (entity->content_length >= 0 && !me->coding) {
 		sprintf(linebuf, "Content-Length: %ld%c%c",
 			entity->content_length, CR, LF);
 		PUTBLOCK(linebuf, (int) strlen(linebuf));	
@@ -246,6 +325,16 @@ PRIVATE int MIMEMakeRequest (HTStream * me, HTRequest * request)
 	    me->target = target;
     }
 
+    /*
+    **  Any content coding that we apply ourselves goes on top of the
+    **  transfer coding
+    */
+    if (me->coding) {
+	HTTRACE(STREAM_TRACE, "Building.... Content-Encoding stack\n");
+	me->target = HTContentCodingStack(me->coding, me->target, request,
+					  NULL, YES);
+    }
+
 #if 0
     /*
     **  We expect the anchor object already to have the right encoding and
@@ -306,10 +395,27 @@ PRIVATE int MIMERequest_put_block (HTStream * me, const char * b, int l)
 	}
     }
     
-    /* Check if we have written it all */
+    /*
+    **  Check if we have written it all. If we code the body then what goes
+    **  on the wire doesn't tell us how much we have had. A block that would
+    **  block comes back again so it only counts once it has gone through,
+    **  and the same goes for the end of the body.
+    */
     if (b) {
 	HTParentAnchor * entity = HTRequest_entityAnchor(me->request);
 	long cl = HTAnchor_length(entity);
+	if (me->coding) {
+	    int status;
+	    if (me->ended) return HT_LOADED;
+	    if (cl < 0 || me->consumed < cl) {
+		if ((status = PUTBLOCK(b, l)) != HT_OK) return status;
+		me->consumed += l;
+		if (cl < 0 || me->consumed < cl) return HT_OK;
+	    }
+	    if ((status = PUTBLOCK(b, 0)) == HT_OK)		/* End of body */
+		me->ended = YES;
+	    return status;
+	}
 	return (cl>=0 && HTNet_bytesWritten(net)-HTNet_headerBytesWritten(net) >= cl) ?
 	    HT_LOADED : PUTBLOCK(b, l);
     }
@@ -375,3 +481,36 @@ PUBLIC HTStream * HTMIMERequest_new (HTRequest * request, HTStream * target,
     me->transparent = NO;
     return me;
 }
+
+PUBLIC HTStream * HTMIMEReply_new (HTRequest * request, HTStream * target,
+				   BOOL endHeader)
+{
+    HTStream * me = HTMIMERequest_new(request, target, endHeader);
+    me->reply = YES;
+    return me;
+}
+
+/*
+**	Content coding of entity bodies
+*/
+PUBLIC BOOL HTMIMERequest_setContentCoding (HTEncoding coding, long threshold)
+{
+    if (threshold >= 0) {
+	ContentCoding = HTFormat_isUnityContent(coding) ? NULL : coding;
+	CodingThreshold = threshold;
+	HTTRACE(STREAM_TRACE, "MIME........ Coding bodies of %ld bytes or more with `%s\'\n" _ 
+		    threshold _ ContentCoding ? HTAtom_name(ContentCoding) : "none");
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC HTEncoding HTMIMERequest_contentCoding (void)
+{
+    return ContentCoding;
+}
+
+PUBLIC long HTMIMERequest_codingThreshold (void)
+{
+    return CodingThreshold;
+}
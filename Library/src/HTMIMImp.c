@@ -38,10 +38,30 @@ PUBLIC int HTMIME_acceptCharset (HTRequest * request, HTResponse * response,
     return HT_OK;
 }
 
+/*
+**	Only a server gets this one. We keep the codings and their quality
+**	factors so that we know how we may encode the response.
+*/
 PUBLIC int HTMIME_acceptEncoding (HTRequest * request, HTResponse * response,
 				  char * token, char * value)
 {
-
+    char * element;
+    while ((element = HTNextElement(&value)) != NULL) {
+	char * coding = HTNextField(&element);
+	char * quality = NULL;
+	char * param;
+	while ((param = HTNextField(&element)) != NULL) {
+	    if (!strcasecomp(param, "q")) {
+		quality = HTNextField(&element);
+		break;
+	    }
+	}
+	if (coding) {
+	    HTTRACE(STREAM_TRACE, "MIMEParser.. Accepts coding `%s\' with quality %s\n" _ 
+			coding _ quality ? quality : "1");
+	    HTRequest_addAcceptEncoding(request, coding, quality);
+	}
+    }
     return HT_OK;
 }
 
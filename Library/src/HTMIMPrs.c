@@ -25,6 +25,47 @@ struct _HTMIMEParseEl{
     HTParserCallback * 	pFunk;
 };
 
+/*
+**	Well known header names. The names that the Library and most servers
+**	use are looked up through a perfect hash so that we don't have to
+**	walk the hash buckets or the regex list for them. The hash is FNV-1a
+**	over the lower case name starting from KNOWN_SEED, and the seed has
+**	been picked so that the top KNOWN_BITS bits are different for all the
+**	names below. If a name is added and collides with another then it
+**	simply isn't known and is handled by the hash buckets as before, but
+**	a new seed should be found.
+*/
+#define KNOWN_SEED	377
+#define KNOWN_BITS	8
+#define KNOWN_SLOTS	(1 << KNOWN_BITS)
+
+PRIVATE const char * KnownNames[] = {
+    "accept", "accept-charset", "accept-encoding", "accept-language",
+    "accept-ranges", "age", "allow", "authentication-info", "authorization",
+    "cache-control", "connection", "content-base", "content-disposition",
+    "content-encoding", "content-language", "content-length",
+    "content-location", "content-md5", "content-range",
+    "content-transfer-encoding", "content-type", "cookie", "date",
+    "derived-from", "digest-messagedigest", "etag", "expect", "expires",
+    "from", "host", "if-match", "if-modified-since", "if-none-match",
+    "if-range", "if-unmodified-since", "keep-alive", "last-modified", "link",
+    "location", "max-forwards", "mime-version", "pragma", "protocol",
+    "protocol-info", "protocol-request", "proxy-authenticate",
+    "proxy-authentication-info", "proxy-authorization", "proxy-connection",
+    "public", "range", "referer", "retry-after", "server", "set-cookie",
+    "set-cookie2", "te", "title", "trailer", "transfer-encoding", "upgrade",
+    "uri", "user-agent", "vary", "via", "warning", "www-authenticate"
+};
+#define KNOWN_NAMES	((int) (sizeof(KnownNames) / sizeof(char *)))
+
+PRIVATE unsigned char KnownSlot[KNOWN_SLOTS];	  /* Name index + 1 or 0 */
+PRIVATE BOOL KnownInit = NO;
+
+/*
+**	Regex parser cache entry for a known name which no regex matches
+*/
+PRIVATE HTMIMEParseEl NoRegex;
+
 PRIVATE HTMIMEParseEl * HTMIMEParseEl_new(HTMIMEParseEl ** pBefore, 
 					  const char * token, 
 					  BOOL caseSensitive, 
@@ -66,6 +107,90 @@ PRIVATE int HTMIMEParseSet_hash(HTMIMEParseSet * me, const char * token)
     return ret;
 }
 
+/*
+**	Header names are ASCII so we don't need the locale to lower case them
+*/
+#define KNOWN_LOWER(c)	((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+PRIVATE unsigned long known_hash (const char * token)
+{
+    unsigned long h = KNOWN_SEED;
+    const unsigned char * p;
+    for (p = (const unsigned char *) token; *p; p++)
+	h = ((h ^ KNOWN_LOWER(*p)) * 16777619UL) & 0xFFFFFFFFUL;
+    return h >> (32 - KNOWN_BITS);
+}
+
+PRIVATE void known_init (void)
+{
+    int i;
+    for (i = 0; i < KNOWN_NAMES; i++) {
+	unsigned long slot = known_hash(KnownNames[i]);
+	if (KnownSlot[slot]) {
+	    HTTRACE(CORE_TRACE, "MIME Parser. `%s\' collides with `%s\'\n" _ 
+		    KnownNames[i] _ KnownNames[KnownSlot[slot]-1]);
+	} else
+	    KnownSlot[slot] = i + 1;
+    }
+    KnownInit = YES;
+}
+
+/*
+**	Returns the index of a well known header name or -1
+*/
+PRIVATE int known_index (const char * token)
+{
+    int index;
+    const unsigned char * p = (const unsigned char *) token;
+    const char * q;
+    if (!KnownInit) known_init();
+    if ((index = KnownSlot[known_hash(token)] - 1) < 0) return -1;
+    for (q = KnownNames[index]; *q && *q == KNOWN_LOWER(*p); p++, q++);
+    return (!*q && !*p) ? index : -1;
+}
+
+/*
+**	The regex parser that matches a known name is looked up once and
+**	remembered. This only works if all the regex parsers up to the one
+**	that matches are case insensitive as otherwise the result depends on
+**	how the name was spelled. In that case we return NULL and the caller
+**	must search the list.
+*/
+PRIVATE HTMIMEParseEl * known_regex (HTMIMEParseSet * me, int index)
+{
+    HTMIMEParseEl * pEl = me->knownRegex[index];
+    if (!pEl) {
+	for (pEl = me->regexParsers; pEl; pEl = pEl->next) {
+	    if (pEl->caseSensitive) return NULL;
+	    if (HTStrCaseMatch(pEl->token, KnownNames[index])) break;
+	}
+	me->knownRegex[index] = pEl = pEl ? pEl : &NoRegex;
+    }
+    return pEl;
+}
+
+PRIVATE void known_flush (HTMIMEParseSet * me)
+{
+    if (me->knownRegex)
+	memset(me->knownRegex, 0, KNOWN_NAMES * sizeof(HTMIMEParseEl *));
+}
+
+/*		Insure hash list
+*/
+PRIVATE void HTMIMEParseSet_init (HTMIMEParseSet * me)
+{
+    if (!me->parsers) {
+        if (!me->size)
+	    me->size = HT_S_HASH_SIZE;
+	if ((me->parsers = (HTMIMEParseEl **) HT_CALLOC(me->size, sizeof(HTMIMEParseEl *))) == NULL)
+	    HT_OUTOFMEM("HTMIME parsers");
+	if ((me->known = (HTMIMEParseEl **) HT_CALLOC(KNOWN_NAMES, sizeof(HTMIMEParseEl *))) == NULL)
+	    HT_OUTOFMEM("HTMIME parsers");
+	if ((me->knownRegex = (HTMIMEParseEl **) HT_CALLOC(KNOWN_NAMES, sizeof(HTMIMEParseEl *))) == NULL)
+	    HT_OUTOFMEM("HTMIME parsers");
+    }
+}
+
 PUBLIC HTMIMEParseSet * HTMIMEParseSet_new(int hashSize)
 {
     HTMIMEParseSet * me;
@@ -89,7 +214,21 @@ PUBLIC int HTMIMEParseSet_deleteAll (HTMIMEParseSet * me)
 		HT_FREE(pEl);
 	    }
 	}
+	for (i=0; i<KNOWN_NAMES; i++) {
+	    for (pEl = me->known[i]; pEl; pEl = next) {
+		next = pEl->next;
+		HT_FREE(pEl->token);
+		HT_FREE(pEl);
+	    }
+	}
+	for (pEl = me->regexParsers; pEl; pEl = next) {
+	    next = pEl->next;
+	    HT_FREE(pEl->token);
+	    HT_FREE(pEl);
+	}
 	HT_FREE(me->parsers);
+	HT_FREE(me->known);
+	HT_FREE(me->knownRegex);
 	HT_FREE(me);
     }
     return HT_OK;
@@ -101,19 +240,16 @@ PUBLIC HTMIMEParseEl * HTMIMEParseSet_add (HTMIMEParseSet * me,
 					   HTParserCallback * callback)
 {
     int hash;
+    int index;
 
-    /*		Insure hash list
-    */
-    if (!me->parsers) {
-        if (!me->size)
-	    me->size = HT_S_HASH_SIZE;
-	if ((me->parsers = (HTMIMEParseEl **) HT_CALLOC(me->size, sizeof(HTMIMEParseEl *))) == NULL)
-	    HT_OUTOFMEM("HTMIME parsers");
-    }
-    hash = HTMIMEParseSet_hash(me, token);
+    HTMIMEParseSet_init(me);
 
-    /*		Add a new entry
+    /*		Add a new entry. Well known names have their own list
     */
+    if ((index = known_index(token)) >= 0)
+	return HTMIMEParseEl_new(&me->known[index], token,
+				 caseSensitive, callback);
+    hash = HTMIMEParseSet_hash(me, token);
     return HTMIMEParseEl_new(&me->parsers[hash], token, 
 			     caseSensitive, callback);
 }
@@ -124,23 +260,30 @@ PUBLIC HTMIMEParseEl * HTMIMEParseSet_addRegex (HTMIMEParseSet * me,
 						BOOL caseSensitive, 
 						HTParserCallback * callback)
 {
+    HTMIMEParseSet_init(me);
+    known_flush(me);
     return HTMIMEParseEl_new(&me->regexParsers, token, 
 			     caseSensitive, callback);
 }
 
 PUBLIC int HTMIMEParseSet_delete (HTMIMEParseSet * me, const char * token)
 {
-    int hash, i;
+    int hash, i, index;
     HTMIMEParseEl * pEl, ** last;
     
-    hash = HTMIMEParseSet_hash(me, token);
-
-    pEl = me->parsers[hash];
-    last = &me->parsers[hash];
+    if (!me || !me->parsers) return HT_ERROR;
+    if ((index = known_index(token)) >= 0)
+	last = &me->known[index];
+    else {
+	hash = HTMIMEParseSet_hash(me, token);
+	last = &me->parsers[hash];
+    }
+    pEl = *last;
     for (i = 0; i < 2; i++) { /* do both  */
         for (; pEl; last = &pEl->next, pEl = pEl->next) {
 	    if ((pEl->caseSensitive && !strcmp(pEl->token, token)) || 
 		(!pEl->caseSensitive && !strcasecomp(pEl->token, token))) {
+		if (i) known_flush(me);
 	        return HTMIMEParseEl_delete(pEl, last);
 	    }
 	}
@@ -158,23 +301,33 @@ PUBLIC int HTMIMEParseSet_dispatch (HTMIMEParseSet * me, HTRequest * request,
 				    char * token, char * value, BOOL * pFound)
 {
     int hash;
+    int index;
     HTResponse * response = HTRequest_response(request);
     HTMIMEParseEl * pEl;
     
     if (pFound) *pFound = NO;
+    if (!me->parsers) return HT_OK;
 
     /*
-    **  Get a hash value for this token. This has is a function of the hash
+    **  Well known names are found through the perfect hash. Otherwise get
+    **  a hash value for this token. This has is a function of the hash
     **  size given when the MIME header parse set was created.
     */
-    hash = HTMIMEParseSet_hash(me, token);
+    if ((index = known_index(token)) >= 0)
+	pEl = me->known[index];
+    else {
+	hash = HTMIMEParseSet_hash(me, token);
+	pEl = me->parsers[hash];
+    }
 
     /*
-    **  Search for an exact match
+    **  Search for an exact match. All the tokens in the list for a well
+    **  known name are the same as the name apart from the case.
     */
-    for (pEl = me->parsers[hash]; pEl; pEl = pEl->next) {
+    for (; pEl; pEl = pEl->next) {
         if ((pEl->caseSensitive && !strcmp(pEl->token, token)) || 
-	    (!pEl->caseSensitive && !strcasecomp(pEl->token, token))) {
+	    (!pEl->caseSensitive &&
+	     (index >= 0 || !strcasecomp(pEl->token, token)))) {
 	    if (pFound) *pFound = YES;
 	    if (!pEl->pFunk) return HT_OK; /* registered with no callback*/
 	    return (*pEl->pFunk)(request, response, token, value);
@@ -182,8 +335,15 @@ PUBLIC int HTMIMEParseSet_dispatch (HTMIMEParseSet * me, HTRequest * request,
     }
 
     /*
-    **  Search for best match using regular expressions. 
+    **  Search for best match using regular expressions. For well known
+    **  names we normally know the answer already.
     */
+    if (index >= 0 && (pEl = known_regex(me, index)) != NULL) {
+	if (pEl == &NoRegex) return HT_OK;
+	if (pFound) *pFound = YES;
+	if (!pEl->pFunk) return HT_OK; /* registered with no callback*/
+	return (*pEl->pFunk)(request, response, token, value);
+    }
     for (pEl = me->regexParsers; pEl; pEl = pEl->next) {
         if ((pEl->caseSensitive && HTStrMatch(pEl->token, token)) || 
 	    (!pEl->caseSensitive && HTStrCaseMatch(pEl->token, token))) {
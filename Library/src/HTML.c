@@ -184,6 +184,12 @@ PUBLIC BOOL HTMLUseCharacterSet (HTMLCharacterSet i)
     }
 }
 
+PUBLIC const char * HTMLEntityValue (int entity_number)
+{
+    return (entity_number>=0 && entity_number<HTML_ENTITIES) ?
+	*(CurrentEntityValues+entity_number) : NULL;
+}
+
 PRIVATE int HTML_write (HTStructured * me, const char * b, int l)
 {
     if (!me->started) {
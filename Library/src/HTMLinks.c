@@ -0,0 +1,696 @@
+/*								     HTMLinks.c
+**	HTML LINK EXTRACTOR
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	This stream finds the links in an HTML document without building a
+**	structured stream, a parse stack or a text object. It splits the
+**	document into tags the same way as the SGML parser but only keeps
+**	the attributes of the elements that can have links in them and the
+**	text of the title. The links are handed to the application in
+**	batches.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "WWWCore.h"
+#include "HTMLPDTD.h"
+#include "HTML.h"
+#include "HTMLinks.h"					 /* Implemented here */
+
+#define LINKS_BATCH	32		   /* Links handed over in one call */
+#define NAME_MAX_LEN	32		     /* Longer names are never known */
+#define MAX_TITLES	8		       /* Nested TITLE elements we follow */
+
+typedef enum _LinksState {
+    L_text, L_after_open, L_nl, L_nl_tago, L_ero, L_entity, L_cro,
+    L_tag, L_tag_gap, L_attr, L_attr_gap, L_equals, L_value,
+    L_squoted, L_dquoted, L_end, L_junk_tag,
+    L_md, L_md_dqs, L_md_sqs, L_com_1, L_com, L_com_2, L_com_2a
+} LinksState;
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    HTRequest *			request;
+    HTParentAnchor *		node_anchor;
+    HTStream *			target;
+    SGML_dtd *			dtd;
+
+    LinksState			state;
+    char			name[NAME_MAX_LEN+1];
+    int				name_len;		/* May be > NAME_MAX_LEN */
+
+    HTTag *			tag;	     /* Element whose attributes we keep */
+    int				element;		 /* Element number or -1 */
+    int				attribute;
+    int				token;		    /* Start of current value */
+    BOOL			present[MAX_ATTRIBUTES];
+    int				value[MAX_ATTRIBUTES];
+    HTChunk *			values;
+
+    HTChunk *			title;
+    int				title_depth;	 /* -1 when not in a title */
+    int				title_at[MAX_TITLES];   /* Depths of TITLEs */
+    int				titles;
+    BOOL			empty;	       /* Last element started was empty */
+
+    HTFoundLink			links[LINKS_BATCH];
+    int				count;
+};
+
+PRIVATE HTFoundLinks * FoundLinks = NULL;
+
+/*
+**	The elements that either have links or change the anchor
+*/
+PRIVATE int LinkElements[] = {
+    HTML_A, HTML_AREA, HTML_BASE, HTML_BODY, HTML_FORM, HTML_FRAME,
+    HTML_IMG, HTML_INPUT, HTML_ISINDEX, HTML_LINK, HTML_META, HTML_OBJECT,
+    HTML_TITLE
+};
+#define LINK_ELEMENTS	((int) (sizeof(LinkElements) / sizeof(int)))
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC void HTMLinks_setCallback (HTFoundLinks * cbf)
+{
+    FoundLinks = cbf;
+}
+
+PUBLIC HTFoundLinks * HTMLinks_callback (void)
+{
+    return FoundLinks;
+}
+
+PRIVATE void HTMLinks_flushLinks (HTStream * me)
+{
+    if (me->count > 0) {
+	HTTRACE(SGML_TRACE, "HTML Links.. Reporting %d link(s)\n" _ me->count);
+	if (FoundLinks) (*FoundLinks)(me->request, me->links, me->count);
+	me->count = 0;
+    }
+}
+
+PRIVATE void HTMLinks_add (HTStream * me, int element, int attribute,
+			   HTChildAnchor * anchor)
+{
+    if (anchor) {
+	HTFoundLink * link = &me->links[me->count++];
+	link->element_number = element;
+	link->attribute_number = attribute;
+	link->anchor = anchor;
+	if (me->count >= LINKS_BATCH) HTMLinks_flushLinks(me);
+    }
+}
+
+PRIVATE void HTMLinks_addHref (HTStream * me, int element, int attribute,
+			       const BOOL * present, const char ** value)
+{
+    if (present[attribute] && value[attribute])
+	HTMLinks_add(me, element, attribute,
+		     HTAnchor_findChildAndLink(me->node_anchor, NULL,
+					       value[attribute], NULL));
+}
+
+PRIVATE void HTMLinks_relations (HTParentAnchor * from, HTParentAnchor * to,
+				 const char * relations)
+{
+    char * strval = NULL;
+    char * ptr = NULL;
+    char * relation = NULL;
+    StrAllocCopy(strval, relations);
+    ptr = strval;
+    while ((relation = HTNextLWSToken(&ptr)) != NULL)
+	HTLink_add((HTAnchor *) from, (HTAnchor *) to,
+		   (HTLinkType) HTAtom_caseFor(relation), METHOD_INVALID);
+    HT_FREE(strval);
+}
+
+/*
+**	Does to the anchor what the HTML parser does for the same element
+*/
+PRIVATE void HTMLinks_element (HTStream * me, int element,
+			       const BOOL * present, const char ** value)
+{
+    switch (element) {
+    case HTML_A:
+	if (present[HTML_A_HREF] && value[HTML_A_HREF]) {
+	    HTChildAnchor * address = HTAnchor_findChildAndLink(
+		me->node_anchor,
+		present[HTML_A_NAME] ? value[HTML_A_NAME] : NULL,
+		value[HTML_A_HREF],
+		present[HTML_A_REL] && value[HTML_A_REL] ?
+		(HTLinkType) HTAtom_caseFor(value[HTML_A_REL]) : NULL);
+	    if (present[HTML_A_TITLE] && value[HTML_A_TITLE]) {
+		HTLink * link = HTAnchor_mainLink((HTAnchor *) address);
+		HTParentAnchor * dest = HTAnchor_parent(HTLink_destination(link));
+		if (!HTAnchor_title(dest))
+		    HTAnchor_setTitle(dest, value[HTML_A_TITLE]);
+	    }
+	    HTMLinks_add(me, element, HTML_A_HREF, address);
+	}
+	break;
+
+    case HTML_AREA:
+	HTMLinks_addHref(me, element, HTML_AREA_HREF, present, value);
+	break;
+
+    case HTML_BASE:
+	if (present[HTML_BASE_HREF] && value[HTML_BASE_HREF])
+	    HTAnchor_setBase(me->node_anchor, (char *) value[HTML_BASE_HREF]);
+	break;
+
+    case HTML_BODY:
+	HTMLinks_addHref(me, element, HTML_BODY_BACKGROUND, present, value);
+	break;
+
+    case HTML_FORM:
+	HTMLinks_addHref(me, element, HTML_FORM_ACTION, present, value);
+	break;
+
+    case HTML_FRAME:
+	HTMLinks_addHref(me, element, HTML_FRAME_SRC, present, value);
+	break;
+
+    case HTML_INPUT:
+	HTMLinks_addHref(me, element, HTML_INPUT_SRC, present, value);
+	break;
+
+    case HTML_IMG:
+	HTMLinks_addHref(me, element, HTML_IMG_SRC, present, value);
+	break;
+
+    case HTML_ISINDEX:
+	HTAnchor_setIndex(me->node_anchor);
+	break;
+
+    case HTML_LINK:
+	if (present[HTML_LINK_HREF] && value[HTML_LINK_HREF]) {
+	    HTChildAnchor * address = HTAnchor_findChildAndLink(
+		me->node_anchor, NULL, value[HTML_LINK_HREF], NULL);
+	    HTParentAnchor * dest =
+		HTAnchor_parent(HTAnchor_followMainLink((HTAnchor *) address));
+	    if (present[HTML_LINK_REL] && value[HTML_LINK_REL])
+		HTMLinks_relations(me->node_anchor, dest, value[HTML_LINK_REL]);
+	    if (present[HTML_LINK_REV] && value[HTML_LINK_REV])
+		HTMLinks_relations(dest, me->node_anchor, value[HTML_LINK_REV]);
+	    if (present[HTML_LINK_TYPE] && value[HTML_LINK_TYPE] &&
+		HTAnchor_format(dest) == WWW_UNKNOWN)
+		HTAnchor_setFormat(dest,
+				   (HTFormat) HTAtom_caseFor(value[HTML_LINK_TYPE]));
+	    HTMLinks_add(me, element, HTML_LINK_HREF, address);
+	}
+	break;
+
+    case HTML_META:
+	if (present[HTML_META_NAME] && value[HTML_META_NAME])
+	    HTAnchor_addMeta(me->node_anchor, value[HTML_META_NAME],
+			     (present[HTML_META_CONTENT] && value[HTML_META_CONTENT]) ?
+			     value[HTML_META_CONTENT] : "");
+	break;
+
+    case HTML_OBJECT:
+	HTMLinks_addHref(me, element, HTML_OBJECT_CLASSID, present, value);
+	HTMLinks_addHref(me, element, HTML_OBJECT_CODEBASE, present, value);
+	HTMLinks_addHref(me, element, HTML_OBJECT_DATA, present, value);
+	HTMLinks_addHref(me, element, HTML_OBJECT_ARCHIVE, present, value);
+	HTMLinks_addHref(me, element, HTML_OBJECT_USEMAP, present, value);
+	break;
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*				TITLE					     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	The title is the text that the HTML parser would see with the TITLE
+**	element on top of its stack, including the entities that it expands.
+*/
+#define IN_TITLE(me)	((me)->titles > 0 && \
+			 (me)->title_depth == (me)->title_at[(me)->titles-1])
+
+PRIVATE void HTMLinks_titleEntity (HTStream * me, BOOL numeric)
+{
+    const char * s = me->name;
+    if (me->name_len > NAME_MAX_LEN) return;
+    me->name[me->name_len] = '\0';
+    if (numeric) {
+	int value;
+	if (sscanf(s, "%d", &value) == 1)
+	    HTChunk_putc(me->title, (char) value);
+	else {
+	    HTChunk_puts(me->title, "&#");
+	    HTChunk_puts(me->title, s);
+	}
+    } else {
+	const char ** entities = me->dtd->entity_names;
+	int high, low, i, diff;
+	for (low = 0, high = me->dtd->number_of_entities; high > low;
+	     diff < 0 ? (low = i+1) : (high = i)) {
+	    i = low + (high-low)/2;
+	    if ((diff = strcmp(entities[i], s)) == 0) {
+		const char * value = HTMLEntityValue(i);
+		if (value) HTChunk_puts(me->title, value);
+		return;
+	    }
+	}
+    }
+}
+
+/*
+**	While a title is open we follow the elements nested inside it as the
+**	HTML parser's stack does: non-empty elements are pushed and any known
+**	end tag pops one. Like the HTML parser, we set the title at every end
+**	tag for TITLE, even if the title was closed before.
+*/
+PRIVATE void HTMLinks_titleStart (HTStream * me)
+{
+    if (me->element == HTML_TITLE) {
+	if (!me->title) me->title = HTChunk_new(128);
+	HTChunk_truncate(me->title, 0);
+	if (++me->title_depth == 0) me->titles = 0;
+	if (me->titles < MAX_TITLES) me->title_at[me->titles++] = me->title_depth;
+	me->empty = NO;
+    } else if (me->element >= 0) {
+	me->empty = SGML_findTagContents(me->dtd, me->element) == SGML_EMPTY;
+	if (!me->empty) me->title_depth++;
+    }
+}
+
+PRIVATE void HTMLinks_titleEnd (HTStream * me)
+{
+    int element;
+    if (me->name_len > NAME_MAX_LEN) return;
+    me->name[me->name_len] = '\0';
+    if (me->title_depth < 0)
+	element = strcasecomp(me->name, "title") ? -1 : HTML_TITLE;
+    else if ((element = SGML_findElementNumber(me->dtd, me->name)) >= 0) {
+	if (me->titles > 0 && me->title_at[me->titles-1] == me->title_depth)
+	    me->titles--;
+	me->title_depth--;
+    }
+    if (element == HTML_TITLE)
+	HTAnchor_setTitle(me->node_anchor, HTChunk_data(me->title));
+}
+
+/* ------------------------------------------------------------------------- */
+/*				TAGS					     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTMLinks_startTag (HTStream * me)
+{
+    int i;
+    me->tag = NULL;
+    me->element = -1;
+    me->attribute = -1;
+    if (me->name_len > NAME_MAX_LEN) return;
+    me->name[me->name_len] = '\0';
+    for (i = 0; i < LINK_ELEMENTS; i++) {
+	HTTag * tag = me->dtd->tags + LinkElements[i];
+	if (TOLOWER(*tag->name) == TOLOWER(*me->name) &&
+	    !strcasecomp(tag->name, me->name)) {
+	    int j;
+	    me->tag = tag;
+	    me->element = LinkElements[i];
+	    for (j = 0; j < tag->number_of_attributes; j++) {
+		me->present[j] = NO;
+		me->value[j] = -1;
+	    }
+	    HTChunk_clear(me->values);
+	    return;
+	}
+    }
+    if (me->title_depth >= 0)
+	me->element = SGML_findElementNumber(me->dtd, me->name);
+}
+
+PRIVATE void HTMLinks_attributeName (HTStream * me)
+{
+    HTAttr * attributes;
+    int low, high, i, diff;
+    me->attribute = -1;
+    if (!me->tag || me->name_len > NAME_MAX_LEN) return;
+    me->name[me->name_len] = '\0';
+    attributes = me->tag->attributes;
+    for (low = 0, high = me->tag->number_of_attributes; high > low;
+	 diff < 0 ? (low = i+1) : (high = i)) {
+	i = low + (high-low)/2;
+	if ((diff = strcasecomp(attributes[i].name, me->name)) == 0) {
+	    me->attribute = i;
+	    me->present[i] = YES;
+	    return;
+	}
+    }
+}
+
+PRIVATE void HTMLinks_attributeValue (HTStream * me)
+{
+    if (me->tag) {
+	HTChunk_terminate(me->values);
+	if (me->attribute >= 0) me->value[me->attribute] = me->token;
+	me->token = HTChunk_size(me->values);
+    }
+    me->attribute = -1;
+}
+
+PRIVATE void HTMLinks_openTag (HTStream * me)
+{
+    if (me->tag && me->element != HTML_TITLE) {
+	const char * value[MAX_ATTRIBUTES];
+	char * data = HTChunk_data(me->values);
+	int i;
+	for (i = 0; i < me->tag->number_of_attributes; i++)
+	    value[i] = me->value[i] < 0 ? NULL : data + me->value[i];
+	HTMLinks_element(me, me->element, me->present, value);
+    }
+    if (me->title_depth >= 0 || me->element == HTML_TITLE)
+	HTMLinks_titleStart(me);
+    me->tag = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				STREAM					     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	The states and transitions are those of SGML_write. Text outside the
+**	title, comments and junk after end tags are skipped without looking
+**	at the characters one by one.
+*/
+PRIVATE int HTMLinks_put_block (HTStream * me, const char * b, int l)
+{
+    const char * end = b + l;
+    while (b < end) {
+	const char * p = b;
+	char c;
+	switch (me->state) {
+	case L_text:
+	    if (!IN_TITLE(me)) {
+		if ((p = (const char *) memchr(b, '<', end - b)) == NULL)
+		    return HT_OK;
+	    } else {
+		while (p < end && *p != '<' && *p != '&' && *p != '\n') p++;
+		if (p > b) HTChunk_putb(me->title, b, p - b);
+	    }
+	    break;
+
+	case L_com:
+	    if ((p = (const char *) memchr(b, '-', end - b)) == NULL)
+		return HT_OK;
+	    break;
+
+	case L_junk_tag:
+	    if ((p = (const char *) memchr(b, '>', end - b)) == NULL)
+		return HT_OK;
+	    break;
+
+	case L_tag:
+	case L_end:
+	    while (p < end && isalnum((int) *p)) {
+		if (me->name_len < NAME_MAX_LEN) me->name[me->name_len] = *p;
+		me->name_len++;
+		p++;
+	    }
+	    break;
+
+	case L_value:
+	    while (p < end && *p != '>' && !isspace((int) *p)) p++;
+	    if (me->tag && p > b) HTChunk_putb(me->values, b, p - b);
+	    break;
+
+	default:
+	    break;
+	}
+	if ((b = p) >= end) break;
+
+	c = *b++;
+	switch (me->state) {
+	case L_after_open:
+	    /* One newline is left out after a non-empty start tag */
+	    if (c == '\n' && !me->empty) {
+		me->state = L_text;
+		break;
+	    }
+	    goto text;
+
+	text:
+	    me->state = L_text;
+	    /* Fall through */
+	case L_text:
+	    if (c == '<') {
+		me->name_len = 0;
+		me->state = L_tag;
+	    } else if (IN_TITLE(me)) {
+		if (c == '&') {
+		    me->name_len = 0;
+		    me->state = L_ero;
+		} else if (c == '\n')
+		    me->state = L_nl;
+		else
+		    HTChunk_putc(me->title, c);
+	    }
+	    break;
+
+	case L_nl:
+	    if (c == '<') {
+		me->name_len = 0;
+		me->state = L_nl_tago;
+	    } else {
+		HTChunk_putc(me->title, '\n');
+		goto text;
+	    }
+	    break;
+
+	case L_nl_tago:
+	    /* The newline is only left out before an end tag */
+	    if (c != '/') HTChunk_putc(me->title, '\n');
+	    me->state = L_tag;
+	    goto tag;
+
+	case L_ero:
+	    if (c == '#') {
+		me->state = L_cro;
+		break;
+	    }
+	    me->state = L_entity;
+	    /* Fall through */
+
+	case L_entity:
+	case L_cro:
+	    if (isalnum((int) c)) {
+		if (me->name_len < NAME_MAX_LEN) me->name[me->name_len] = c;
+		me->name_len++;
+	    } else {
+		HTMLinks_titleEntity(me, me->state == L_cro);
+		if (c != ';') goto text;
+		me->state = L_text;
+	    }
+	    break;
+
+	tag:
+	case L_tag:
+	    if (isalnum((int) c)) {
+		if (me->name_len < NAME_MAX_LEN) me->name[me->name_len] = c;
+		me->name_len++;
+	    } else if (c == '/')
+		me->state = L_end;
+	    else if (c == '!')
+		me->state = L_md;
+	    else {
+		HTMLinks_startTag(me);
+		me->token = 0;
+		goto tag_gap;
+	    }
+	    break;
+
+	tag_gap:
+	    me->state = L_tag_gap;
+	    /* Fall through */
+	case L_tag_gap:
+	    if (isspace((int) c)) break;
+	    if (c == '>') goto open;
+	    goto attr;
+
+	attr:
+	    me->state = L_attr;
+	    me->name_len = 0;
+	    /* Fall through */
+	case L_attr:
+	    if (isspace((int) c) || c == '>' || c == '=') {
+		HTMLinks_attributeName(me);
+		me->state = L_attr_gap;
+		goto attr_gap;
+	    }
+	    if (me->name_len < NAME_MAX_LEN) me->name[me->name_len] = c;
+	    me->name_len++;
+	    break;
+
+	attr_gap:
+	case L_attr_gap:
+	    if (isspace((int) c)) break;
+	    if (c == '>') goto open;
+	    if (c != '=') goto attr;
+	    me->state = L_equals;
+	    break;
+
+	case L_equals:
+	    if (isspace((int) c)) break;
+	    if (c == '>') goto open;
+	    if (me->tag) HTChunk_truncate(me->values, me->token);
+	    if (c == '\'')
+		me->state = L_squoted;
+	    else if (c == '"')
+		me->state = L_dquoted;
+	    else {
+		if (me->tag) HTChunk_putc(me->values, c);
+		me->state = L_value;
+	    }
+	    break;
+
+	case L_value:
+	    HTMLinks_attributeValue(me);
+	    goto tag_gap;
+
+	case L_squoted:
+	case L_dquoted:
+	    if (c == (me->state == L_squoted ? '\'' : '"')) {
+		HTMLinks_attributeValue(me);
+		me->state = L_tag_gap;
+	    } else if (c && c != '\n' && c != '\r' && me->tag)
+		HTChunk_putc(me->values, c);
+	    break;
+
+	open:
+	    HTMLinks_openTag(me);
+	    me->state = L_after_open;
+	    break;
+
+	case L_end:
+	    if (me->title) HTMLinks_titleEnd(me);
+	    me->state = (c == '>') ? L_text : L_junk_tag;
+	    break;
+
+	case L_junk_tag:
+	    me->state = L_text;
+	    break;
+
+	case L_md:
+	    if (c == '-')
+		me->state = L_com_1;
+	    else if (c == '"')
+		me->state = L_md_dqs;
+	    else if (c == '\'')
+		me->state = L_md_sqs;
+	    else if (c == '>')
+		me->state = L_text;
+	    break;
+
+	case L_md_dqs:
+	case L_md_sqs:
+	    if (c == (me->state == L_md_dqs ? '"' : '\''))
+		me->state = L_md;
+	    else if (c == '>')
+		me->state = L_text;
+	    break;
+
+	case L_com_1:
+	    if (c == '>')
+		me->state = L_text;
+	    else
+		me->state = (c == '-') ? L_com : L_md;
+	    break;
+
+	case L_com:
+	    me->state = L_com_2;
+	    break;
+
+	case L_com_2:
+	    me->state = (c == '-') ? L_com_2a : L_com;
+	    break;
+
+	case L_com_2a:
+	    if (c == '>')
+		me->state = L_text;
+	    else if (c != '-')
+		me->state = L_com;
+	    break;
+	}
+    }
+    return HT_OK;
+}
+
+PRIVATE int HTMLinks_put_character (HTStream * me, char c)
+{
+    return HTMLinks_put_block(me, &c, 1);
+}
+
+PRIVATE int HTMLinks_put_string (HTStream * me, const char * s)
+{
+    return HTMLinks_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE int HTMLinks_flush (HTStream * me)
+{
+    HTMLinks_flushLinks(me);
+    return me->target ? (*me->target->isa->flush)(me->target) : HT_OK;
+}
+
+PRIVATE int HTMLinks_free (HTStream * me)
+{
+    HTMLinks_flushLinks(me);
+    if (me->target) (*me->target->isa->_free)(me->target);
+    HTChunk_delete(me->values);
+    HTChunk_delete(me->title);
+    HT_FREE(me);
+    return HT_OK;
+}
+
+PRIVATE int HTMLinks_abort (HTStream * me, HTList * e)
+{
+    HTMLinks_flushLinks(me);
+    if (me->target) (*me->target->isa->abort)(me->target, e);
+    HTChunk_delete(me->values);
+    HTChunk_delete(me->title);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+PRIVATE const HTStreamClass HTMLinksClass =
+{
+    "HTMLToLinks",
+    HTMLinks_flush,
+    HTMLinks_free,
+    HTMLinks_abort,
+    HTMLinks_put_character,
+    HTMLinks_put_string,
+    HTMLinks_put_block
+};
+
+/*	HTConverter for HTML to links
+**	-----------------------------
+*/
+PUBLIC HTStream * HTMLToLinks (HTRequest *	request,
+			       void *		param,
+			       HTFormat		input_format,
+			       HTFormat		output_format,
+			       HTStream *	output_stream)
+{
+    HTStream * me;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+	HT_OUTOFMEM("HTMLToLinks");
+    me->isa = &HTMLinksClass;
+    me->request = request;
+    me->node_anchor = HTRequest_anchor(request);
+    me->target = output_stream;
+    me->dtd = HTML_dtd();
+    me->state = L_text;
+    me->element = -1;
+    me->attribute = -1;
+    me->values = HTChunk_new(128);
+    me->title_depth = -1;
+    return me;
+}
@@ -133,6 +133,289 @@ PUBLIC void HTMemory_free (void * ptr)
     }
 }
 
+/* ------------------------------------------------------------------------- */
+/*			     FIXED SIZE OBJECT POOLS			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	A pool hands out objects of one size carved from larger slabs and
+**	keeps freed objects on a free list for reuse. Slabs are never given
+**	back to the system, so a pool stays at its high water mark. If
+**	HT_NO_MEMPOOL is defined then each object is allocated on its own,
+**	which is handy for finding memory errors with external tools.
+*/
+typedef union _HTMemAlign {	       /* Strictest alignment we care about */
+    void *	ptr;
+    double	dbl;
+    long	lng;
+} HTMemAlign;
+
+#define MEM_ALIGN(n)	((((n) + sizeof(HTMemAlign) - 1) / sizeof(HTMemAlign)) * sizeof(HTMemAlign))
+#define POOL_SLAB_SIZE	16384			     /* Bytes per slab */
+#define POOL_MIN_OBJS	16		      /* Min number of objects per slab */
+
+struct _HTMemPool {
+    const char *	name;
+    size_t		size;				/* Rounded object size */
+    size_t		objsize;		      /* Requested object size */
+    int			per_slab;
+    void *		free;				/* List of free objects */
+    void *		slabs;					/* List of slabs */
+    long		nslabs;
+    long		live;				/* Objects handed out */
+    long		peak;
+    unsigned long	allocs;
+    HTMemPool *		next;
+};
+
+PRIVATE HTMemPool * MemPools = NULL;		     /* All pools we have */
+
+PUBLIC HTMemPool * HTMemPool_new (const char * name, size_t size)
+{
+    HTMemPool * me;
+    if ((me = (HTMemPool *) HTMemory_calloc(1, sizeof(HTMemPool))) == NULL)
+	HT_OUTOFMEM("HTMemPool_new");
+    me->name = name ? name : "anonymous";
+    me->objsize = size;
+    me->size = MEM_ALIGN(size > 0 ? size : 1);
+    me->per_slab = (POOL_SLAB_SIZE - sizeof(HTMemAlign)) / me->size;
+    if (me->per_slab < POOL_MIN_OBJS) me->per_slab = POOL_MIN_OBJS;
+    me->next = MemPools;
+    MemPools = me;
+    HTTRACE(MEM_TRACE, "Mem Pool.... `%s' with objects of %d bytes, %d per slab\n" _
+	    me->name _ (int) me->size _ me->per_slab);
+    return me;
+}
+
+#ifndef HT_NO_MEMPOOL
+/*
+**	Add a new slab and put its objects on the free list in address order.
+**	The first word of the slab links the slabs together.
+*/
+PRIVATE BOOL HTMemPool_grow (HTMemPool * me)
+{
+    char * slab;
+    char * obj;
+    int cnt;
+    if ((slab = (char *) HTMemory_malloc(sizeof(HTMemAlign) + me->per_slab * me->size)) == NULL)
+	return NO;
+    *(void **) slab = me->slabs;
+    me->slabs = slab;
+    me->nslabs++;
+    obj = slab + sizeof(HTMemAlign) + (me->per_slab - 1) * me->size;
+    for (cnt = 0; cnt < me->per_slab; cnt++, obj -= me->size) {
+	*(void **) obj = me->free;
+	me->free = obj;
+    }
+    return YES;
+}
+#endif
+
+/*
+**	Returns a zero-filled object or NULL if we are out of memory.
+*/
+PUBLIC void * HTMemPool_alloc (HTMemPool * me)
+{
+    void * ptr = NULL;
+    if (me) {
+#ifdef HT_NO_MEMPOOL
+	if ((ptr = HTMemory_calloc(1, me->objsize)) == NULL) return NULL;
+#else
+	if (!me->free && !HTMemPool_grow(me)) return NULL;
+	ptr = me->free;
+	me->free = *(void **) ptr;
+	memset(ptr, '\0', me->size);
+#endif
+	me->allocs++;
+	if (++me->live > me->peak) me->peak = me->live;
+    }
+    return ptr;
+}
+
+PUBLIC void HTMemPool_free (HTMemPool * me, void * ptr)
+{
+    if (me && ptr) {
+#ifdef HT_NO_MEMPOOL
+	HTMemory_free(ptr);
+#else
+	*(void **) ptr = me->free;
+	me->free = ptr;
+#endif
+	me->live--;
+    }
+}
+
+PUBLIC HTMemPool * HTMemPool_next (HTMemPool * me)
+{
+    return me ? me->next : MemPools;
+}
+
+PUBLIC const char * HTMemPool_name (HTMemPool * me)
+{
+    return me ? me->name : NULL;
+}
+
+PUBLIC long HTMemPool_live (HTMemPool * me)
+{
+    return me ? me->live : -1;
+}
+
+PUBLIC long HTMemPool_liveBytes (HTMemPool * me)
+{
+    return me ? me->live * (long) me->objsize : -1;
+}
+
+PUBLIC long HTMemPool_peak (HTMemPool * me)
+{
+    return me ? me->peak : -1;
+}
+
+PUBLIC long HTMemPool_reservedBytes (HTMemPool * me)
+{
+#ifdef HT_NO_MEMPOOL
+    return me ? me->live * (long) me->objsize : -1;
+#else
+    return me ? me->nslabs * (long) (sizeof(HTMemAlign) + me->per_slab * me->size) : -1;
+#endif
+}
+
+PUBLIC unsigned long HTMemPool_allocs (HTMemPool * me)
+{
+    return me ? me->allocs : 0;
+}
+
+PUBLIC void HTMemPool_print (void)
+{
+    HTMemPool * pres = MemPools;
+    HTPrint("%-16s %8s %10s %12s %10s %12s\n",
+	    "Pool", "Size", "Live", "Live bytes", "Peak", "Reserved");
+    for (; pres; pres = pres->next)
+	HTPrint("%-16s %8ld %10ld %12ld %10ld %12ld\n",
+		pres->name, (long) pres->objsize, pres->live,
+		HTMemPool_liveBytes(pres), pres->peak,
+		HTMemPool_reservedBytes(pres));
+}
+
+/* ------------------------------------------------------------------------- */
+/*				    ARENAS				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	An arena hands out memory by bumping a pointer through a list of
+**	blocks and frees it all in one go when the arena is deleted. Large
+**	allocations get a block of their own so that we don't waste the rest
+**	of the current block.
+*/
+#define ARENA_BLOCK_SIZE	4096
+
+typedef struct _HTArenaBlock HTArenaBlock;
+struct _HTArenaBlock {
+    HTArenaBlock *	next;
+    HTMemAlign		data[1];
+};
+
+#define ARENA_HEADER	(sizeof(HTArenaBlock) - sizeof(HTMemAlign))
+
+struct _HTArena {
+    HTArenaBlock *	blocks;
+    char *		ptr;			   /* Free space in first block */
+    size_t		left;
+    size_t		blocksize;
+    size_t		used;				/* Bytes handed out */
+    size_t		reserved;			   /* Bytes allocated */
+};
+
+PUBLIC HTArena * HTArena_new (size_t blocksize)
+{
+    HTArena * me;
+    if ((me = (HTArena *) HT_CALLOC(1, sizeof(HTArena))) == NULL)
+	HT_OUTOFMEM("HTArena_new");
+    me->blocksize = blocksize > 0 ? MEM_ALIGN(blocksize) : ARENA_BLOCK_SIZE;
+    HTTRACE(MEM_TRACE, "Mem Arena... %p created with blocks of %d bytes\n" _
+	    me _ (int) me->blocksize);
+    return me;
+}
+
+PUBLIC BOOL HTArena_delete (HTArena * me)
+{
+    if (me) {
+	HTArenaBlock * block = me->blocks;
+	HTTRACE(MEM_TRACE, "Mem Arena... %p deleted, %d bytes used of %d\n" _
+		me _ (int) me->used _ (int) me->reserved);
+	while (block) {
+	    HTArenaBlock * next = block->next;
+	    HTMemory_free(block);
+	    block = next;
+	}
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC void * HTArena_malloc (HTArena * me, size_t size)
+{
+    void * ptr;
+    if (!me) return NULL;
+    size = MEM_ALIGN(size > 0 ? size : 1);
+    if (size > me->left) {
+	HTArenaBlock * block;
+	if (size > me->blocksize / 4) {
+
+	    /* Big one - put it behind the current block */
+	    if ((block = (HTArenaBlock *) HTMemory_malloc(ARENA_HEADER + size)) == NULL)
+		return NULL;
+	    me->reserved += ARENA_HEADER + size;
+	    if (me->blocks) {
+		block->next = me->blocks->next;
+		me->blocks->next = block;
+	    } else {
+		block->next = NULL;
+		me->blocks = block;
+	    }
+	    me->used += size;
+	    return block->data;
+	}
+	if ((block = (HTArenaBlock *) HTMemory_malloc(ARENA_HEADER + me->blocksize)) == NULL)
+	    return NULL;
+	me->reserved += ARENA_HEADER + me->blocksize;
+	block->next = me->blocks;
+	me->blocks = block;
+	me->ptr = (char *) block->data;
+	me->left = me->blocksize;
+    }
+    ptr = me->ptr;
+    me->ptr += size;
+    me->left -= size;
+    me->used += size;
+    return ptr;
+}
+
+PUBLIC void * HTArena_calloc (HTArena * me, size_t count, size_t size)
+{
+    void * ptr;
+    if (size && count > ((size_t) -1) / size) return NULL;
+    if ((ptr = HTArena_malloc(me, count * size)) != NULL)
+	memset(ptr, '\0', count * size);
+    return ptr;
+}
+
+PUBLIC char * HTArena_strdup (HTArena * me, const char * str)
+{
+    char * ptr = NULL;
+    if (str) {
+	size_t len = strlen(str) + 1;
+	if ((ptr = (char *) HTArena_malloc(me, len)) != NULL)
+	    memcpy(ptr, str, len);
+    }
+    return ptr;
+}
+
+PUBLIC size_t HTArena_bytes (HTArena * me)
+{
+    return me ? me->used : 0;
+}
+
 /*	HTMemory_setExit
 **	----------------
 **	Register the memory exit function. This function notifies the user that
@@ -30,6 +30,9 @@
 #include "HTStream.h"
 #include "HTHstMan.h"
 #include "HTIOStream.h"
+#include "HTResolv.h"
+#include "HTInet.h"
+#include "HTStats.h"
 #include "HTNetMan.h"					 /* Implemented here */
 
 #ifndef HT_MAX_SOCKETS
@@ -76,6 +79,7 @@ PRIVATE int Persistent = 0;		        /* Counts persistent sockets */
 
 PRIVATE HTList ** NetTable = NULL;		      /* List of net objects */
 PRIVATE int HTNetCount = 0;		       /* Counting elements in table */
+PRIVATE HTMemPool * NetPool = NULL;		       /* Net objects come from here */
 
 /* ------------------------------------------------------------------------- */
 /*		   GENERIC BEFORE and AFTER filter Management		     */
@@ -539,9 +543,11 @@ PRIVATE HTNet * create_object (void)
     HTNet * me = NULL;
 
     /* Create new object */
-    if ((me = (HTNet *) HT_CALLOC(1, sizeof(HTNet))) == NULL)
+    if (!NetPool) NetPool = HTMemPool_new("HTNet", sizeof(HTNet));
+    if ((me = (HTNet *) HTMemPool_alloc(NetPool)) == NULL)
         HT_OUTOFMEM("HTNet_new");
     me->hash = net_hash++ % HT_XL_HASH_SIZE;
+    if (HTStats_enabled()) me->start = HTGetTimeInMillis();
 
     /* Insert into hash table */
     if (!NetTable) {
@@ -838,7 +844,8 @@ PRIVATE BOOL free_net (HTNet * net)
     HTTRACE(CORE_TRACE, "Net Object.. Freeing object %p\n" _ net);
     if (net) {
         if (net == HTRequest_net(net->request)) HTRequest_setNet(net->request, NULL);
-        HT_FREE(net);
+	HTResolver_cancel(net);
+        HTMemPool_free(NetPool, net);
 	return YES;
     }
     return NO;
@@ -910,6 +917,12 @@ PUBLIC BOOL HTNet_delete (HTNet * net, int status)
 			    request _ HTRequest_retrys(request) _ net);
 		return YES;
 	    }
+	    if (net->start) {
+		HTStats * stats = HTStats_forHost(net->host);
+		HTStats_count(stats, HT_STATS_REQUESTS, 1);
+		HTStats_record(stats, HT_STATS_RESPONSE_TIME,
+			       HTGetTimeInMillis() - net->start);
+	    }
             HTHost_deleteNet(net->host, net, status);
 	    if (HTHost_doRecover(net->host)) HTHost_recoverPipe(net->host);
         }
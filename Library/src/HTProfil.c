@@ -43,6 +43,9 @@ PUBLIC void HTProfile_delete (void)
 	/* Remove bindings between suffixes, media types */
 	HTBind_deleteAll();
 
+	/* Remove the tag and attribute hashes of the SGML parser */
+	SGML_deleteAll();
+
 	/* Terminate libwww */
 	HTLibTerminate();
     }
@@ -7,6 +7,10 @@
 **
 ** HISTORY:
 **	6 June 95  HFN	Written
+**
+**	The data is read into a shared I/O buffer which is only kept as long
+**	as there is unconsumed data in it. The read size grows when reads fill
+**	the buffer and shrinks again after a series of short reads.
 */
 
 /* Library Include files */
@@ -16,6 +20,8 @@
 #include "HTNetMan.h"
 #include "HTReader.h"					 /* Implemented here */
 
+#define SHORT_READS		4     /* Short reads before shrinking size */
+
 struct _HTStream {
     const HTStreamClass *	isa;
     /* ... */
@@ -28,7 +34,9 @@ struct _HTInputStream {
     char *			write;			/* Last byte written */
     char *			read;			   /* Last byte read */
     int				b_read;
-    char			data [INPUT_BUFFER_SIZE];	   /* buffer */
+    HTIOBuffer *		buffer;		 /* NULL if all is consumed */
+    int				size;		   /* Current read size */
+    int				short_reads;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -97,6 +105,41 @@ PRIVATE char * strnstr(char * haystack, int *pLen, char * needle)
 }
 #endif /* FIND_SIGNATURES */
 
+/*
+**	Give the buffer back to the pool when all data in it has been consumed
+*/
+PRIVATE void HTReader_release (HTInputStream * me)
+{
+    if (me->buffer) {
+	HTIOBuffer_unref(me->buffer);
+	me->buffer = NULL;
+	me->write = me->read = NULL;
+	me->b_read = 0;
+    }
+}
+
+/*
+**	Double the read size when a read fills the buffer and halve it after
+**	a series of reads that fill less than a quarter of it.
+*/
+PRIVATE void HTReader_adapt (HTInputStream * me)
+{
+    if (me->b_read >= me->size) {
+	me->short_reads = 0;
+	if (me->size < INPUT_BUFFER_SIZE) {
+	    me->size <<= 1;
+	    HTTRACE(STREAM_TRACE, "Read Socket. Read size is now %d\n" _ me->size);
+	}
+    } else if (me->b_read < me->size / 4) {
+	if (++me->short_reads >= SHORT_READS && me->size > INPUT_BUFFER_MIN) {
+	    me->size >>= 1;
+	    me->short_reads = 0;
+	    HTTRACE(STREAM_TRACE, "Read Socket. Read size is now %d\n" _ me->size);
+	}
+    } else
+	me->short_reads = 0;
+}
+
 PRIVATE int HTReader_read (HTInputStream * me)
 {
     HTHost * host = me->host;
@@ -113,7 +156,14 @@ PRIVATE int HTReader_read (HTInputStream * me)
     do {
 	/* don't read if we have to push unwritten data from last call */
 	if (me->write >= me->read) {
-	    if ((me->b_read = NETREAD(soc, me->data, INPUT_BUFFER_SIZE)) < 0) {
+	    char * data;
+
+	    /* The read size may have grown past the buffer we are holding */
+	    if (me->buffer && HTIOBuffer_size(me->buffer) < (size_t) me->size)
+		HTReader_release(me);
+	    if (!me->buffer) me->buffer = HTIOBuffer_new(me->size);
+	    data = HTIOBuffer_data(me->buffer);
+	    if ((me->b_read = NETREAD(soc, data, me->size)) < 0) {
 #ifdef EAGAIN
 		if (socerrno==EAGAIN || socerrno==EWOULDBLOCK)      /* POSIX */
 #else
@@ -121,6 +171,7 @@ PRIVATE int HTReader_read (HTInputStream * me)
 #endif	
 		{
 		    HTTRACE(STREAM_TRACE, "Read Socket. WOULD BLOCK fd %d\n" _ soc);
+		    HTReader_release(me);
 		    HTHost_register(host, net, HTEvent_READ);
 		    return HT_WOULD_BLOCK;
 #ifdef __svr4__
@@ -174,21 +225,23 @@ PRIVATE int HTReader_read (HTInputStream * me)
 
 	    socketClosed:
 		HTTRACE(STREAM_TRACE, "Read Socket. FIN received on socket %d\n" _ soc);
+		HTReader_release(me);
 		HTHost_unregister(host, net, HTEvent_READ);
 		HTHost_register(host, net, HTEvent_CLOSE);
 		return HT_CLOSED;
 	    }
 
 	    /* Remember how much we have read from the input socket */
-	    HTTRACEDATA(me->data, me->b_read, "Reading from socket %d" _ soc);
-	    me->write = me->data;
-	    me->read = me->data + me->b_read;
+	    HTTRACEDATA(data, me->b_read, "Reading from socket %d" _ soc);
+	    me->write = data;
+	    me->read = data + me->b_read;
+	    HTReader_adapt(me);
 #ifdef FIND_SIGNATURES
 	    {
-		char * ptr = me->data;
+		char * ptr = data;
 		int len = me->b_read;
 		while ((ptr = strnstr(ptr, &len, "HTTP/1.1 200 OK")) != NULL) {
-		    HTTRACE(STREAM_TRACE, "Read Socket. Signature found at 0x%x of 0x%x.\n" _ ptr - me->data _ me->b_read);
+		    HTTRACE(STREAM_TRACE, "Read Socket. Signature found at 0x%x of 0x%x.\n" _ ptr - data _ me->b_read);
 		    ptr++;
 		    len--;
 		}
@@ -196,7 +249,7 @@ PRIVATE int HTReader_read (HTInputStream * me)
 #endif /* FIND_SIGNATURES */
 #ifdef NOT_ASCII
 	    {
-		char *p = me->data;
+		char *p = data;
 		while (p < me->read) {
 		    *p = FROMASCII(*p);
 		    p++;
@@ -206,6 +259,7 @@ PRIVATE int HTReader_read (HTInputStream * me)
 
 	    HTTRACE(STREAM_TRACE, "Read Socket. %d bytes read from socket %d\n" _ 
 			me->b_read _ soc);
+	    HTStats_count(HTStats_forHost(me->host), HT_STATS_BYTES_IN, me->b_read);
 	    if (request) {
 		HTAlertCallback * cbf = HTAlert_find(HT_PROG_READ);
 		if (HTNet_rawBytesCount(net))
@@ -218,8 +272,15 @@ PRIVATE int HTReader_read (HTInputStream * me)
 	}
 
 	/* Now push the data down the stream */
-	if ((status = (*net->readStream->isa->put_block)
-	     (net->readStream, me->write, me->b_read)) != HT_OK) {
+	{
+	    HTIOBuffer * buffer = HTIOBuffer_ref(me->buffer);
+	    HTIOBuffer * previous = HTIOBuffer_setCurrent(buffer);
+	    status = (*net->readStream->isa->put_block)
+		(net->readStream, me->write, me->b_read);
+	    HTIOBuffer_setCurrent(previous);
+	    HTIOBuffer_unref(buffer);
+	}
+	if (status != HT_OK) {
 	    if (status == HT_WOULD_BLOCK) {
 		HTTRACE(STREAM_TRACE, "Read Socket. Target WOULD BLOCK\n");
 		HTHost_unregister(host, net, HTEvent_READ);
@@ -250,6 +311,7 @@ PRIVATE int HTReader_read (HTInputStream * me)
 		HTHost_setConsumed(host, remaining);
 	    }
 	}
+	if (me->write >= me->read) HTReader_release(me);
     } while (net->preemptive);
     HTHost_register(host, net, HTEvent_READ);
     return HT_WOULD_BLOCK;
@@ -271,6 +333,7 @@ PRIVATE int HTReader_close (HTInputStream * me)
 	net->readStream = NULL;
     }
     HTTRACE(STREAM_TRACE, "Socket read. FREEING....\n");
+    HTReader_release(me);
     HT_FREE(me);
     return status;
 }
@@ -311,6 +374,7 @@ PUBLIC HTInputStream * HTReader_new (HTHost * host, HTChannel * ch,
 	    me->isa = &HTReader;
 	    me->ch = ch;
 	    me->host = host;
+	    me->size = INPUT_BUFFER_MIN;
 	    HTTRACE(STREAM_TRACE, "Reader...... Created reader stream %p\n" _ me);
 	}
 	return me;
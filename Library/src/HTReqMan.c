@@ -60,10 +60,13 @@ struct _HTStream {
 /*			Create and delete the HTRequest Object		     */
 /* --------------------------------------------------------------------------*/
 
+PRIVATE HTMemPool * RequestPool = NULL;	 /* Request objects come from here */
+
 PUBLIC HTRequest * HTRequest_new (void)
 {
     HTRequest * me;
-    if ((me = (HTRequest *) HT_CALLOC(1, sizeof(HTRequest))) == NULL)
+    if (!RequestPool) RequestPool = HTMemPool_new("HTRequest", sizeof(HTRequest));
+    if ((me = (HTRequest *) HTMemPool_alloc(RequestPool)) == NULL)
         HT_OUTOFMEM("HTRequest_new()");
     
    /* Force Reload */
@@ -149,9 +152,10 @@ PUBLIC HTRequest * HTRequest_dup (HTRequest * src)
 {
     HTRequest * me;
     if (!src) return NULL;
-    if ((me = (HTRequest  *) HT_MALLOC(sizeof(HTRequest))) == NULL)
+    if ((me = (HTRequest  *) HTMemPool_alloc(RequestPool)) == NULL)
         HT_OUTOFMEM("HTRequest_dup");
     memcpy(me, src, sizeof(HTRequest));
+    me->arena = NULL;
     HTTRACE(CORE_TRACE, "Request..... Duplicated %p to %p\n" _ src _ me);
     return me;
 }
@@ -168,9 +172,10 @@ PUBLIC HTRequest * HTRequest_dupInternal (HTRequest * src)
 {
     HTRequest * me;
     if (!src) return 0;
-    if ((me = (HTRequest  *) HT_MALLOC(sizeof(HTRequest))) == NULL)
+    if ((me = (HTRequest  *) HTMemPool_alloc(RequestPool)) == NULL)
         HT_OUTOFMEM("HTRequest_dup");
     memcpy(me, src, sizeof(HTRequest));
+    me->arena = NULL;
     HTRequest_clear(me);
     return me;
 }
@@ -236,6 +241,9 @@ PUBLIC void HTRequest_delete (HTRequest * me)
 	/* Connection headers */
 	if (me->expect) HTAssocList_delete(me->expect);
 
+	/* Codings accepted by the peer */
+	if (me->accept_encoding) HTAssocList_delete(me->accept_encoding);
+
 	/* Proxy information */
 	HT_FREE(me->proxy);
 
@@ -254,8 +262,11 @@ PUBLIC void HTRequest_delete (HTRequest * me)
         me->messageBodyFormat = NULL;
         me->messageBodyLength = -1;     
 #endif
+
+	/* Anything allocated for the lifetime of the request */
+	if (me->arena) HTArena_delete(me->arena);
         
-	HT_FREE(me);
+	HTMemPool_free(RequestPool, me);
     }
 }
 
@@ -960,6 +971,35 @@ PUBLIC HTAssocList * HTRequest_expect (HTRequest * me)
     return (me ? me->expect : NULL);
 }
 
+/*
+**	Content codings accepted by the peer
+*/
+PUBLIC BOOL HTRequest_addAcceptEncoding (HTRequest * me,
+					 char * coding, char * quality)
+{
+    if (me && coding) {
+	if (!me->accept_encoding) me->accept_encoding = HTAssocList_new();
+	return HTAssocList_replaceObject(me->accept_encoding, coding,
+					 quality ? quality : "1");
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTRequest_deleteAcceptEncoding (HTRequest * me)
+{
+    if (me && me->accept_encoding) {
+	HTAssocList_delete(me->accept_encoding);
+	me->accept_encoding = NULL;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC HTAssocList * HTRequest_acceptEncoding (HTRequest * me)
+{
+    return (me ? me->accept_encoding : NULL);
+}
+
 /*
 **  Access Authentication Credentials
 */
@@ -1328,6 +1368,15 @@ PUBLIC void *HTRequest_context (HTRequest * me)
     return me ? me->context : NULL;
 }
 
+/*
+**	Memory that is freed together with the request object
+*/
+PUBLIC HTArena * HTRequest_arena (HTRequest * me)
+{
+    if (me && !me->arena) me->arena = HTArena_new(0);
+    return me ? me->arena : NULL;
+}
+
 /*
 **	Has output stream been connected to the channel? If not then we
 **	must free it explicitly when deleting the request object
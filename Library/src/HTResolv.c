@@ -0,0 +1,718 @@
+/*								     HTResolv.c
+**	ASYNCHRONOUS DNS RESOLVER
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	A small stub resolver that sends A and AAAA queries over UDP to the
+**	name servers listed in resolv.conf and picks up the answers from the
+**	event loop. Each query has a repetitive timer which sends it again to
+**	the next name server until we run out of attempts. The answers are
+**	put into the DNS cache using the TTL of the records. Net objects
+**	waiting for a name are called with a HTEvent_CONNECT event when the
+**	query is done so that they can go on connecting.
+**
+**	Nothing but the query id and the source port keeps others from
+**	answering in place of the name server, so each query gets its own
+**	socket bound to a random port, the ids come from the system random
+**	device and answers are only taken from the servers we have asked.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "HTEvent.h"
+#include "HTTimer.h"
+#include "HTInet.h"
+#include "HTWWWStr.h"
+#include "HTNet.h"
+#include "HTDNS.h"
+#include "HTResolv.h"					 /* Implemented here */
+
+#define RESOLV_TIMEOUT		5000L	      /* Default timeout per attempt */
+#define RESOLV_RETRIES		2	       /* Attempts on each name server */
+#define RESOLV_MAX_SERVERS	3
+#define RESOLV_MAX_HOMES	16	  /* Max addresses of each type we keep */
+#define RESOLV_PACKET		512		      /* Max UDP message size */
+#define RESOLV_MIN_TTL		1L		   /* Keep answers at least 1s */
+#define RESOLV_MAX_TTL		604800L		       /* and at most a week */
+#define RESOLV_PORT_BASE	1024		/* Lowest random source port */
+#define RESOLV_BIND_TRIES	8
+
+#define DNS_PORT		53
+#define DNS_HEADER		12
+#define DNS_TYPE_A		1
+#define DNS_TYPE_AAAA		28
+#define DNS_CLASS_IN		1
+#define DNS_FLAG_QR		0x8000
+#define DNS_FLAG_TC		0x0200
+#define DNS_FLAG_RD		0x0100
+#define DNS_RCODE(flags)	((flags) & 0x000F)
+#define DNS_RCODE_NXDOMAIN	3
+
+#ifndef INADDR_NONE
+#define INADDR_NONE		0xFFFFFFFF
+#endif
+
+#define QUERY_A			0
+#define QUERY_AAAA		1
+
+typedef struct _HTQuery {
+    char *		name;
+    unsigned short	id[2];			    /* A and AAAA query ids */
+    BOOL		pending[2];		       /* Waiting for answer */
+    BOOL		done;
+    int			status;
+    int			tries;
+    int			server;			 /* Name server to ask next */
+    int			asked;		     /* Bit mask of servers asked */
+    SOCKET		soc;
+    HTEvent *		event;
+    HTTimer *		timer;
+    HTList *		waiters;		    /* Net objects to call back */
+    int			homes;
+    char		addr[RESOLV_MAX_HOMES * 4];
+    int			homes6;
+    char		addr6[RESOLV_MAX_HOMES * 16];
+    unsigned long	ttl;			   /* Lowest TTL in the answers */
+} HTQuery;
+
+PRIVATE BOOL		Async = NO;
+PRIVATE BOOL		Configured = NO;
+PRIVATE ms_t		Timeout = RESOLV_TIMEOUT;
+PRIVATE int		Retries = RESOLV_RETRIES;
+PRIVATE BOOL		UserOptions = NO;     /* Timeout or retries set by app */
+PRIVATE char *		HostsFile = NULL;
+
+PRIVATE struct sockaddr_in Servers[RESOLV_MAX_SERVERS];
+PRIVATE int		NServers = 0;
+
+PRIVATE HTHashtable *	Queries = NULL;		     /* Queries keyed by name */
+PRIVATE int		Waiting = 0;		  /* Net objects in all queries */
+PRIVATE FILE *		RandomFile = NULL;
+PRIVATE BOOL		RandomTried = NO;
+PRIVATE unsigned long	RandomState = 0;
+
+/* ------------------------------------------------------------------------- */
+/*				 CONFIGURATION				     */
+/* ------------------------------------------------------------------------- */
+
+PUBLIC void HTResolver_setAsync (BOOL mode)
+{
+    Async = mode;
+}
+
+PUBLIC BOOL HTResolver_async (void)
+{
+    return Async;
+}
+
+PUBLIC void HTResolver_setTimeout (ms_t timeout)
+{
+    if (timeout > 0) {
+	Timeout = timeout;
+	UserOptions = YES;
+    }
+}
+
+PUBLIC ms_t HTResolver_timeout (void)
+{
+    return Timeout;
+}
+
+PUBLIC void HTResolver_setRetries (int attempts)
+{
+    if (attempts > 0) {
+	Retries = attempts;
+	UserOptions = YES;
+    }
+}
+
+PUBLIC int HTResolver_retries (void)
+{
+    return Retries;
+}
+
+PUBLIC BOOL HTResolver_setHostsFile (const char * file)
+{
+    if (file) {
+	StrAllocCopy(HostsFile, file);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTResolver_addServer (const char * address, int port)
+{
+    if (address && NServers < RESOLV_MAX_SERVERS) {
+	struct sockaddr_in * sin = &Servers[NServers];
+	memset((void *) sin, '\0', sizeof(struct sockaddr_in));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons((unsigned short) (port > 0 ? port : DNS_PORT));
+	if ((sin->sin_addr.s_addr = inet_addr(address)) == INADDR_NONE) {
+	    HTTRACE(PROT_TRACE, "Resolver.... Ignoring name server `%s\'\n" _ address);
+	    return NO;
+	}
+	HTTRACE(PROT_TRACE, "Resolver.... Added name server %s\n" _ HTInetString(sin));
+	NServers++;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTResolver_deleteServers (void)
+{
+    NServers = 0;
+    return YES;
+}
+
+/*
+**	Read the name servers and options from resolv.conf unless the
+**	application has set them already
+*/
+PRIVATE void HTResolver_configure (void)
+{
+    FILE * fp;
+    BOOL servers = (NServers == 0);
+    Configured = YES;
+    if ((fp = fopen(HT_RESOLV_CONF, "r")) != NULL) {
+	char buffer[256];
+	while (fgets(buffer, sizeof(buffer), fp)) {
+	    char * line = buffer;
+	    char * word = HTNextField(&line);
+	    if (!word) continue;
+	    if (!strcasecomp(word, "nameserver")) {
+		if (servers && (word = HTNextField(&line)) != NULL)
+		    HTResolver_addServer(word, 0);
+	    } else if (!strcasecomp(word, "options") && !UserOptions) {
+		while ((word = HTNextField(&line)) != NULL) {
+		    if (!strncasecomp(word, "timeout:", 8)) {
+			int timeout = atoi(word+8);
+			if (timeout > 0) Timeout = timeout * 1000L;
+		    } else if (!strncasecomp(word, "attempts:", 9)) {
+			int attempts = atoi(word+9);
+			if (attempts > 0) Retries = attempts;
+		    }
+		}
+	    }
+	}
+	fclose(fp);
+    }
+    HTTRACE(PROT_TRACE, "Resolver.... %d name server(s), timeout %lu ms, %d attempts\n" _
+	    NServers _ Timeout _ Retries);
+}
+
+/*
+**	Look for the name in the hosts file and put any IPv4 addresses we
+**	find into the DNS cache. Returns YES if found
+*/
+PRIVATE BOOL HTResolver_hosts (const char * name)
+{
+    FILE * fp;
+    char addr[RESOLV_MAX_HOMES * 4];
+    int homes = 0;
+    if ((fp = fopen(HostsFile ? HostsFile : HT_HOSTS_FILE, "r")) != NULL) {
+	char buffer[512];
+	while (homes < RESOLV_MAX_HOMES && fgets(buffer, sizeof(buffer), fp)) {
+	    char * line = buffer;
+	    char * comment = strchr(buffer, '#');
+	    char * field;
+	    unsigned long inaddr;
+	    if (comment) *comment = '\0';
+	    if ((field = HTNextField(&line)) == NULL ||
+		(inaddr = inet_addr(field)) == INADDR_NONE)
+		continue;
+	    while ((field = HTNextField(&line)) != NULL) {
+		if (!strcasecomp(field, name)) {
+		    struct in_addr in;
+		    in.s_addr = inaddr;
+		    memcpy(addr + homes++ * 4, (void *) &in, 4);
+		    break;
+		}
+	    }
+	}
+	fclose(fp);
+    }
+    if (homes > 0) {
+	HTTRACE(PROT_TRACE, "Resolver.... Found `%s\' in hosts file\n" _ name);
+	HTDNS_addAddresses(name, homes, addr, 0, NULL, 0);
+	return YES;
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				DNS MESSAGES				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	Query ids and source ports come from the random device. Only if
+**	there is none we fall back on a simple generator which is better
+**	than nothing but easy to guess.
+*/
+PRIVATE unsigned short HTResolver_random (void)
+{
+    unsigned char buf[2];
+    if (!RandomTried) {
+	RandomTried = YES;
+	if ((RandomFile = fopen(HT_RANDOM_DEVICE, "rb")) == NULL) {
+	    HTTRACE(PROT_TRACE, "Resolver.... No random device `%s', ids can be guessed\n" _
+		    HT_RANDOM_DEVICE);
+	}
+    }
+    if (RandomFile && fread(buf, 1, 2, RandomFile) == 2)
+	return (unsigned short) ((buf[0] << 8) | buf[1]);
+    if (!RandomState)
+	RandomState = (unsigned long) HTGetTimeInMillis() ^
+	    ((unsigned long) getpid() << 16) ^ (unsigned long) &RandomState;
+    RandomState = RandomState * 1103515245UL + 12345UL;
+    return (unsigned short) (RandomState >> 16);
+}
+
+/*
+**	Build a query for the name. Returns the length of the message or -1
+**	if the name can't be encoded
+*/
+PRIVATE int dns_query (unsigned char * buf, unsigned short id,
+		       const char * name, int type)
+{
+    unsigned char * ptr = buf + DNS_HEADER;
+    const char * label = name;
+    memset(buf, '\0', DNS_HEADER);
+    buf[0] = (unsigned char) (id >> 8);
+    buf[1] = (unsigned char) (id & 0xFF);
+    buf[2] = (unsigned char) (DNS_FLAG_RD >> 8);
+    buf[5] = 1;						/* One question */
+    while (*label) {
+	const char * end = strchr(label, '.');
+	int len = end ? end - label : (int) strlen(label);
+	if (len < 1 || len > 63 || (ptr - buf) + len + 6 > RESOLV_PACKET)
+	    return -1;
+	*ptr++ = (unsigned char) len;
+	memcpy(ptr, label, len);
+	ptr += len;
+	label += len;
+	if (*label == '.') label++;
+    }
+    *ptr++ = 0;
+    *ptr++ = 0;
+    *ptr++ = (unsigned char) type;
+    *ptr++ = 0;
+    *ptr++ = DNS_CLASS_IN;
+    return ptr - buf;
+}
+
+/*
+**	Skip a possibly compressed name. Returns the position after the name
+**	or -1 if the message is broken
+*/
+PRIVATE int dns_skipName (const unsigned char * buf, int len, int pos)
+{
+    while (pos < len) {
+	int cnt = buf[pos];
+	if (!cnt) return pos + 1;
+	if ((cnt & 0xC0) == 0xC0) return pos + 2 <= len ? pos + 2 : -1;
+	if (cnt & 0xC0) return -1;
+	pos += cnt + 1;
+    }
+    return -1;
+}
+
+/*
+**	Read the name in the question section which is never compressed
+*/
+PRIVATE int dns_readName (const unsigned char * buf, int len, int pos,
+			  char * name, int size)
+{
+    char * ptr = name;
+    while (pos < len) {
+	int cnt = buf[pos++];
+	if (!cnt) {
+	    if (ptr > name) ptr--;			   /* Trailing dot */
+	    *ptr = '\0';
+	    return pos;
+	}
+	if ((cnt & 0xC0) || pos + cnt > len || (ptr - name) + cnt + 1 >= size)
+	    return -1;
+	memcpy(ptr, buf + pos, cnt);
+	ptr += cnt;
+	*ptr++ = '.';
+	pos += cnt;
+    }
+    return -1;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				   QUERIES				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTQuery_send (HTQuery * me)
+{
+    struct sockaddr_in * sin = &Servers[me->server % NServers];
+    unsigned char buf[RESOLV_PACKET];
+    int type;
+    me->asked |= 1 << (me->server % NServers);
+    for (type = QUERY_A; type <= QUERY_AAAA; type++) {
+	int len;
+	if (!me->pending[type]) continue;
+	len = dns_query(buf, me->id[type], me->name,
+			type == QUERY_A ? DNS_TYPE_A : DNS_TYPE_AAAA);
+	if (sendto(me->soc, (char *) buf, len, 0, (struct sockaddr *) sin,
+		   sizeof(struct sockaddr_in)) < 0) {
+	    HTTRACE(PROT_TRACE, "Resolver.... Can't send query for `%s\' to %s\n" _
+		    me->name _ HTInetString(sin));
+	}
+    }
+    me->tries++;
+}
+
+PRIVATE void HTQuery_delete (HTQuery * me)
+{
+    if (me) {
+	if (me->timer) HTTimer_delete(me->timer);
+	if (me->soc != INVSOC) {
+	    HTEvent_unregister(me->soc, HTEvent_READ);
+	    NETCLOSE(me->soc);
+	}
+	if (me->event) HTEvent_delete(me->event);
+	Waiting -= HTList_count(me->waiters);
+	HTList_delete(me->waiters);
+	HT_FREE(me->name);
+	HT_FREE(me);
+    }
+}
+
+/*
+**	Put the answer into the DNS cache and call everybody waiting for it.
+**	A Net object that we call may well delete other Net objects waiting
+**	for the same name, so we take them off the list one by one.
+*/
+PRIVATE void HTQuery_done (HTQuery * me)
+{
+    HTNet * net;
+    if (me->timer) {
+	HTTimer_delete(me->timer);
+	me->timer = NULL;
+    }
+    me->done = YES;
+    if (me->status != HT_NO_DATA) {
+	if (me->homes > 0 || me->homes6 > 0) {
+	    time_t ttl = me->ttl < RESOLV_MIN_TTL ? RESOLV_MIN_TTL :
+		me->ttl > RESOLV_MAX_TTL ? RESOLV_MAX_TTL : (time_t) me->ttl;
+	    HTDNS_addAddresses(me->name, me->homes, me->addr,
+			       me->homes6, me->addr6, ttl);
+	    me->status = HT_OK;
+	} else {
+	    HTTRACE(PROT_TRACE, "Resolver.... No address for `%s\'\n" _ me->name);
+	    me->status = HT_ERROR;
+	}
+    }
+    HTTRACE(PROT_TRACE, "Resolver.... `%s\' done with status %d, calling %d waiting\n" _
+	    me->name _ me->status _ HTList_count(me->waiters));
+    while ((net = (HTNet *) HTList_removeLastObject(me->waiters)) != NULL) {
+	Waiting--;
+	HTNet_execute(net, HTEvent_CONNECT);
+    }
+    HTHashtable_removeEntry(Queries, me->name, (void *) me);
+    HTQuery_delete(me);
+}
+
+/*
+**	Called every timeout. If we have an answer of one type then we don't
+**	wait any longer for the other one. Otherwise we ask the next name
+**	server until we run out of attempts.
+*/
+PRIVATE int HTQuery_timeout (HTTimer * timer, void * param, HTEventType type)
+{
+    HTQuery * me = (HTQuery *) param;
+    if (me->pending[QUERY_A] != me->pending[QUERY_AAAA] ||
+	me->tries >= Retries * NServers) {
+	HTTRACE(PROT_TRACE, "Resolver.... Timeout for `%s\' after %d tries\n" _
+		me->name _ me->tries);
+	HTQuery_done(me);
+    } else {
+	me->server++;
+	HTQuery_send(me);
+    }
+    return HT_OK;
+}
+
+/*
+**	Did the message come from one of the name servers we have asked?
+*/
+PRIVATE BOOL HTQuery_fromServer (HTQuery * me, struct sockaddr_in * from)
+{
+    int cnt;
+    for (cnt = 0; cnt < NServers; cnt++) {
+	if ((me->asked & (1 << cnt)) &&
+	    from->sin_family == AF_INET &&
+	    from->sin_addr.s_addr == Servers[cnt].sin_addr.s_addr &&
+	    from->sin_port == Servers[cnt].sin_port)
+	    return YES;
+    }
+    return NO;
+}
+
+/*
+**	Handle an answer. We only accept it if the id and the question match
+**	what we are waiting for. Returns YES if the query is done in which
+**	case it has been deleted.
+*/
+PRIVATE BOOL HTResolver_answer (HTQuery * me, const unsigned char * buf, int len)
+{
+    char name[256];
+    unsigned int id, flags, answers, qtype;
+    int pos, type, cnt;
+    if (len < DNS_HEADER) return NO;
+    id = (buf[0] << 8) | buf[1];
+    flags = (buf[2] << 8) | buf[3];
+    answers = (buf[6] << 8) | buf[7];
+    if (!(flags & DNS_FLAG_QR) || buf[4] || buf[5] != 1) return NO;
+    if ((pos = dns_readName(buf, len, DNS_HEADER, name, sizeof(name))) < 0 ||
+	pos + 4 > len)
+	return NO;
+    qtype = (buf[pos] << 8) | buf[pos+1];
+    pos += 4;
+    type = qtype == DNS_TYPE_A ? QUERY_A : qtype == DNS_TYPE_AAAA ? QUERY_AAAA : -1;
+    if (type < 0 || me->done || !me->pending[type] || me->id[type] != id ||
+	strcasecomp(name, me->name)) {
+	HTTRACE(PROT_TRACE, "Resolver.... Unexpected answer %u for `%s\'\n" _ id _ name);
+	return NO;
+    }
+
+    /* A truncated answer means that we have to use TCP - leave it */
+    if (flags & DNS_FLAG_TC) {
+	HTTRACE(PROT_TRACE, "Resolver.... Truncated answer for `%s\'\n" _ name);
+	me->status = HT_NO_DATA;
+	HTQuery_done(me);
+	return YES;
+    }
+
+    /* Server failures are retried with the next name server */
+    if (DNS_RCODE(flags) && DNS_RCODE(flags) != DNS_RCODE_NXDOMAIN) {
+	HTTRACE(PROT_TRACE, "Resolver.... Error %d for `%s\'\n" _ DNS_RCODE(flags) _ name);
+	return NO;
+    }
+
+    /* Pick out the addresses, skipping anything else like CNAMEs */
+    for (cnt = 0; cnt < (int) answers; cnt++) {
+	unsigned int rtype, rclass, rdlength;
+	unsigned long ttl;
+	if ((pos = dns_skipName(buf, len, pos)) < 0 || pos + 10 > len) break;
+	rtype = (buf[pos] << 8) | buf[pos+1];
+	rclass = (buf[pos+2] << 8) | buf[pos+3];
+	ttl = ((unsigned long) buf[pos+4] << 24) | ((unsigned long) buf[pos+5] << 16) |
+	    ((unsigned long) buf[pos+6] << 8) | buf[pos+7];
+	rdlength = (buf[pos+8] << 8) | buf[pos+9];
+	pos += 10;
+	if (pos + (int) rdlength > len) break;
+	if (rclass == DNS_CLASS_IN) {
+	    BOOL found = NO;
+	    if (rtype == DNS_TYPE_A && rdlength == 4 && me->homes < RESOLV_MAX_HOMES) {
+		memcpy(me->addr + me->homes++ * 4, buf + pos, 4);
+		found = YES;
+	    } else if (rtype == DNS_TYPE_AAAA && rdlength == 16 &&
+		       me->homes6 < RESOLV_MAX_HOMES) {
+		memcpy(me->addr6 + me->homes6++ * 16, buf + pos, 16);
+		found = YES;
+	    }
+	    if (found && (!me->ttl || ttl < me->ttl)) me->ttl = ttl;
+	}
+	pos += rdlength;
+    }
+    HTTRACE(PROT_TRACE, "Resolver.... %s answer for `%s\' has %d IPv4 and %d IPv6 addresses\n" _
+	    type == QUERY_A ? "A" : "AAAA" _ name _ me->homes _ me->homes6);
+    me->pending[type] = NO;
+    if (!me->pending[QUERY_A] && !me->pending[QUERY_AAAA]) {
+	HTQuery_done(me);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	Anything that doesn't come from a name server we have asked is
+**	dropped before we even look at it
+*/
+PRIVATE int HTResolver_read (SOCKET soc, void * param, HTEventType type)
+{
+    HTQuery * me = (HTQuery *) param;
+    unsigned char buf[RESOLV_PACKET];
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    int len;
+    while ((len = recvfrom(soc, (char *) buf, RESOLV_PACKET, 0,
+			   (struct sockaddr *) &from, &fromlen)) > 0) {
+	if (fromlen < (socklen_t) sizeof(from) || !HTQuery_fromServer(me, &from)) {
+	    HTTRACE(PROT_TRACE, "Resolver.... Ignoring message from %s\n" _
+		    HTInetString(&from));
+	} else if (HTResolver_answer(me, buf, len))
+	    break;
+	fromlen = sizeof(from);
+    }
+    return HT_OK;
+}
+
+/*
+**	Bind to a random port so that the answers can't be sent blindly. If
+**	we don't find a free one then we let the system pick one.
+*/
+PRIVATE void HTQuery_bind (HTQuery * me)
+{
+    struct sockaddr_in sin;
+    int cnt;
+    memset((void *) &sin, '\0', sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    for (cnt = 0; cnt < RESOLV_BIND_TRIES; cnt++) {
+	sin.sin_port = htons((unsigned short) (RESOLV_PORT_BASE +
+			     HTResolver_random() % (65536 - RESOLV_PORT_BASE)));
+	if (bind(me->soc, (struct sockaddr *) &sin, sizeof(sin)) == 0) return;
+    }
+    sin.sin_port = 0;
+    if (bind(me->soc, (struct sockaddr *) &sin, sizeof(sin)) < 0) {
+	HTTRACE(PROT_TRACE, "Resolver.... Can't bind socket %d\n" _ me->soc);
+    }
+}
+
+/*
+**	Create the UDP socket for the query and register it for reading
+*/
+PRIVATE BOOL HTQuery_open (HTQuery * me)
+{
+    int status;
+    if ((me->soc = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVSOC) {
+	HTTRACE(PROT_TRACE, "Resolver.... Can't create socket\n");
+	return NO;
+    }
+#ifdef _WINSOCKAPI_
+    {
+	u_long one = 1;
+	status = ioctlsocket(me->soc, FIONBIO, &one) == SOCKET_ERROR ? -1 : 0;
+    }
+#else
+#if defined(VMS)
+    {
+	int enable = 1;
+	status = IOCTL(me->soc, FIONBIO, &enable);
+    }
+#else
+    if ((status = fcntl(me->soc, F_GETFL, 0)) != -1) {
+#ifdef O_NONBLOCK
+	status |= O_NONBLOCK;				    /* POSIX */
+#else
+#ifdef F_NDELAY
+	status |= F_NDELAY;				      /* BSD */
+#endif
+#endif
+	status = fcntl(me->soc, F_SETFL, status);
+    }
+#endif /* !VMS */
+#endif /* !_WINSOCKAPI_ */
+    if (status == -1) {
+	HTTRACE(PROT_TRACE, "Resolver.... Can't make socket %d non-blocking\n" _ me->soc);
+	NETCLOSE(me->soc);
+	me->soc = INVSOC;
+	return NO;
+    }
+    HTQuery_bind(me);
+    HTTRACE(PROT_TRACE, "Resolver.... Using socket %d\n" _ me->soc);
+    me->event = HTEvent_new(HTResolver_read, me, HT_PRIORITY_MAX, -1);
+    HTEvent_register(me->soc, HTEvent_READ, me->event);
+    return YES;
+}
+
+PRIVATE HTQuery * HTQuery_new (const char * name)
+{
+    HTQuery * me;
+    unsigned char buf[RESOLV_PACKET];
+    if (dns_query(buf, 0, name, DNS_TYPE_A) < 0) {
+	HTTRACE(PROT_TRACE, "Resolver.... Can't encode `%s\'\n" _ name);
+	return NULL;
+    }
+    if ((me = (HTQuery *) HT_CALLOC(1, sizeof(HTQuery))) == NULL)
+	HT_OUTOFMEM("HTQuery_new");
+    me->soc = INVSOC;
+    me->waiters = HTList_new();
+    if (!HTQuery_open(me)) {
+	HTQuery_delete(me);
+	return NULL;
+    }
+    StrAllocCopy(me->name, name);
+    me->id[QUERY_A] = HTResolver_random();
+    me->id[QUERY_AAAA] = HTResolver_random();
+    me->pending[QUERY_A] = me->pending[QUERY_AAAA] = YES;
+    me->status = HT_WOULD_BLOCK;
+    if (!Queries) Queries = HTHashtable_newWithFlags(0, HT_HASH_CASELESS | HT_HASH_KEYREF);
+    HTHashtable_addObject(Queries, me->name, (void *) me);
+    HTTRACE(PROT_TRACE, "Resolver.... Looking up `%s\' with ids %u and %u\n" _
+	    name _ me->id[QUERY_A] _ me->id[QUERY_AAAA]);
+    HTQuery_send(me);
+    me->timer = HTTimer_new(NULL, HTQuery_timeout, me, Timeout, YES, YES);
+    return me;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PUBLIC int HTResolver_lookup (const char * name, HTNet * net)
+{
+    HTQuery * me = NULL;
+    char host[256];
+    int len;
+    if (!name || !*name || (len = strlen(name)) >= (int) sizeof(host))
+	return HT_ERROR;
+    strcpy(host, name);
+    if (host[len-1] == '.') host[len-1] = '\0';		   /* Trailing dot */
+    if (!Configured) HTResolver_configure();
+
+    /* See if we already are looking for it */
+    if (Queries && (me = (HTQuery *) HTHashtable_object(Queries, host)) != NULL) {
+	if (me->done) return me->status;
+    } else {
+	if (HTResolver_hosts(host)) return HT_OK;
+	if (!NServers || !strchr(host, '.')) return HT_NO_DATA;
+	if ((me = HTQuery_new(host)) == NULL) return HT_NO_DATA;
+    }
+    if (net && HTList_indexOf(me->waiters, net) < 0) {
+	HTList_addObject(me->waiters, net);
+	Waiting++;
+    }
+    return HT_WOULD_BLOCK;
+}
+
+PUBLIC BOOL HTResolver_cancel (HTNet * net)
+{
+    if (net && Waiting > 0 && Queries) {
+	HTQuery * pres;
+	int pos = 0;
+	while ((pres = (HTQuery *) HTHashtable_nextObject(Queries, &pos)) != NULL) {
+	    if (HTList_removeObject(pres->waiters, net)) {
+		HTTRACE(PROT_TRACE, "Resolver.... Net %p no longer waiting for `%s\'\n" _
+			net _ pres->name);
+		Waiting--;
+		return YES;
+	    }
+	}
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTResolver_deleteAll (void)
+{
+    if (Queries) {
+	HTQuery * pres;
+	int pos = 0;
+	while ((pres = (HTQuery *) HTHashtable_nextObject(Queries, &pos)) != NULL)
+	    HTQuery_delete(pres);
+	HTHashtable_delete(Queries);
+	Queries = NULL;
+    }
+    if (RandomFile) {
+	fclose(RandomFile);
+	RandomFile = NULL;
+    }
+    RandomTried = NO;
+    Waiting = 0;
+    return YES;
+}
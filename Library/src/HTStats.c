@@ -0,0 +1,539 @@
+/*								     HTStats.c
+**	REQUEST STATISTICS
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	Counters and latency histograms for each origin server. The records
+**	are kept in a hash table keyed by "host:port" and every update is
+**	also added to the global record.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "HTParse.h"
+#include "HTProt.h"
+#include "HTHstMan.h"
+#include "HTStats.h"					 /* Implemented here */
+
+#define HIST_SUB_BITS		4
+#define HIST_SUB		(1<<HIST_SUB_BITS)    /* Buckets in an octave */
+#define HIST_BUCKETS		((8*(int)sizeof(unsigned long)-HIST_SUB_BITS+1)*HIST_SUB)
+
+#define STATS_HASH_SIZE		67
+#define STATS_GLOBAL		"*"
+
+struct _HTHistogram {
+    unsigned long *	buckets;
+    int			size;			       /* Allocated buckets */
+    long		count;
+    unsigned long	min;
+    unsigned long	max;
+    double		sum;
+};
+
+typedef struct _HTStatusCount {
+    int			status;
+    long		count;
+} HTStatusCount;
+
+struct _HTStats {
+    char *		origin;
+    long		counters[HT_STATS_COUNTERS];
+    HTHistogram *	histograms[HT_STATS_HISTOGRAMS];
+    HTStatusCount *	status;
+    int			nstatus;
+};
+
+PRIVATE BOOL Enabled = NO;
+PRIVATE HTHashtable * StatsTable = NULL;
+PRIVATE HTStats * Global = NULL;
+
+PRIVATE const char * CounterNames[HT_STATS_COUNTERS] = {
+    "requests",
+    "connects",
+    "connect_failures",
+    "dns_failures",
+    "bytes_in",
+    "bytes_out",
+    "retries",
+    "cache_hits",
+    "cache_validated",
+    "cache_misses"
+};
+
+PRIVATE const char * HistogramNames[HT_STATS_HISTOGRAMS] = {
+    "dns_ms",
+    "connect_ms",
+    "first_byte_ms",
+    "response_ms",
+    "pipeline_depth"
+};
+
+/* ------------------------------------------------------------------------- */
+/*				  HISTOGRAMS				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**	Values below 2*HIST_SUB have a bucket each. Above that the value is
+**	shifted down until it has HIST_SUB_BITS+1 bits which gives HIST_SUB
+**	buckets for each power of two. The largest values end up in the
+**	last bucket.
+*/
+PRIVATE int HTHistogram_bucket (unsigned long value)
+{
+    int shift = 0;
+    int bucket;
+    while ((value >> shift) >= 2*HIST_SUB) shift++;
+    bucket = shift*HIST_SUB + (int) (value >> shift);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS-1;
+}
+
+PRIVATE unsigned long HTHistogram_highest (int bucket)
+{
+    int shift = bucket < 2*HIST_SUB ? 0 : (bucket >> HIST_SUB_BITS) - 1;
+    unsigned long low = (unsigned long) (bucket - shift*HIST_SUB) << shift;
+    return low + ((1UL << shift) - 1);
+}
+
+PUBLIC HTHistogram * HTHistogram_new (void)
+{
+    HTHistogram * me;
+    if ((me = (HTHistogram *) HT_CALLOC(1, sizeof(HTHistogram))) == NULL)
+	HT_OUTOFMEM("HTHistogram_new");
+    return me;
+}
+
+PUBLIC BOOL HTHistogram_delete (HTHistogram * me)
+{
+    if (me) {
+	HT_FREE(me->buckets);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC HTHistogram * HTHistogram_copy (HTHistogram * me)
+{
+    HTHistogram * copy = NULL;
+    if (me) {
+	copy = HTHistogram_new();
+	HTHistogram_merge(copy, me);
+    }
+    return copy;
+}
+
+PRIVATE BOOL HTHistogram_grow (HTHistogram * me, int bucket)
+{
+    if (bucket >= me->size) {
+	int size = me->size ? me->size : 2*HIST_SUB;
+	while (size <= bucket) size += HIST_SUB;
+	if (size > HIST_BUCKETS) size = HIST_BUCKETS;
+	if ((me->buckets = (unsigned long *)
+	     HT_REALLOC(me->buckets, size * sizeof(unsigned long))) == NULL)
+	    HT_OUTOFMEM("HTHistogram_grow");
+	memset(me->buckets + me->size, 0,
+	       (size - me->size) * sizeof(unsigned long));
+	me->size = size;
+    }
+    return YES;
+}
+
+PUBLIC BOOL HTHistogram_add (HTHistogram * me, unsigned long value)
+{
+    if (me) {
+	int bucket = HTHistogram_bucket(value);
+	HTHistogram_grow(me, bucket);
+	me->buckets[bucket]++;
+	if (!me->count || value < me->min) me->min = value;
+	if (value > me->max) me->max = value;
+	me->sum += value;
+	me->count++;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTHistogram_merge (HTHistogram * me, HTHistogram * other)
+{
+    if (me && other && other->count) {
+	int cnt;
+	HTHistogram_grow(me, other->size - 1);
+	for (cnt = 0; cnt < other->size; cnt++)
+	    me->buckets[cnt] += other->buckets[cnt];
+	if (!me->count || other->min < me->min) me->min = other->min;
+	if (other->max > me->max) me->max = other->max;
+	me->sum += other->sum;
+	me->count += other->count;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTHistogram_clear (HTHistogram * me)
+{
+    if (me) {
+	if (me->buckets) memset(me->buckets, 0, me->size * sizeof(unsigned long));
+	me->count = 0;
+	me->min = me->max = 0;
+	me->sum = 0;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC long HTHistogram_count (HTHistogram * me)
+{
+    return me ? me->count : 0;
+}
+
+PUBLIC unsigned long HTHistogram_min (HTHistogram * me)
+{
+    return me ? me->min : 0;
+}
+
+PUBLIC unsigned long HTHistogram_max (HTHistogram * me)
+{
+    return me ? me->max : 0;
+}
+
+PUBLIC double HTHistogram_mean (HTHistogram * me)
+{
+    return (me && me->count) ? me->sum / me->count : 0;
+}
+
+PUBLIC unsigned long HTHistogram_percentile (HTHistogram * me, double percentile)
+{
+    if (me && me->count) {
+	long target = (long) (percentile * me->count / 100 + 0.5);
+	long seen = 0;
+	int cnt;
+	if (target < 1) target = 1;
+	for (cnt = 0; cnt < me->size; cnt++) {
+	    if ((seen += me->buckets[cnt]) >= target) {
+		unsigned long value = HTHistogram_highest(cnt);
+		return value < me->max ? value : me->max;
+	    }
+	}
+	return me->max;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				   RECORDS				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE HTStats * HTStats_new (const char * origin)
+{
+    HTStats * me;
+    if ((me = (HTStats *) HT_CALLOC(1, sizeof(HTStats))) == NULL)
+	HT_OUTOFMEM("HTStats_new");
+    StrAllocCopy(me->origin, origin);
+    return me;
+}
+
+PRIVATE BOOL HTStats_free (HTStats * me)
+{
+    if (me) {
+	int cnt;
+	for (cnt = 0; cnt < HT_STATS_HISTOGRAMS; cnt++)
+	    HTHistogram_delete(me->histograms[cnt]);
+	HT_FREE(me->status);
+	HT_FREE(me->origin);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+PRIVATE HTStats * HTStats_copy (HTStats * me)
+{
+    HTStats * copy = HTStats_new(me->origin);
+    int cnt;
+    memcpy(copy->counters, me->counters, sizeof(me->counters));
+    for (cnt = 0; cnt < HT_STATS_HISTOGRAMS; cnt++)
+	copy->histograms[cnt] = HTHistogram_copy(me->histograms[cnt]);
+    if (me->nstatus) {
+	if ((copy->status = (HTStatusCount *)
+	     HT_MALLOC(me->nstatus * sizeof(HTStatusCount))) == NULL)
+	    HT_OUTOFMEM("HTStats_copy");
+	memcpy(copy->status, me->status, me->nstatus * sizeof(HTStatusCount));
+	copy->nstatus = me->nstatus;
+    }
+    return copy;
+}
+
+PUBLIC void HTStats_setEnabled (BOOL mode)
+{
+    Enabled = mode;
+}
+
+PUBLIC BOOL HTStats_enabled (void)
+{
+    return Enabled;
+}
+
+PUBLIC HTStats * HTStats_find (const char * host, u_short port)
+{
+    if (Enabled && host && *host) {
+	char origin[256];
+	HTStats * me;
+	if (!StatsTable) {
+	    StatsTable = HTHashtable_newWithFlags(STATS_HASH_SIZE,
+						  HT_HASH_CASELESS | HT_HASH_KEYREF);
+	    Global = HTStats_new(STATS_GLOBAL);
+	}
+	if (strlen(host) + 8 > sizeof(origin)) return NULL;
+	sprintf(origin, "%s:%u", host, (unsigned) port);
+	if ((me = (HTStats *) HTHashtable_object(StatsTable, origin)) == NULL) {
+	    me = HTStats_new(origin);
+	    HTHashtable_addObject(StatsTable, me->origin, me);
+	    HTTRACE(CORE_TRACE, "Statistics.. New record for `%s\'\n" _ origin);
+	}
+	return me;
+    }
+    return NULL;
+}
+
+PUBLIC HTStats * HTStats_forHost (HTHost * host)
+{
+    return (Enabled && host) ? HTStats_find(host->hostname, host->u_port) : NULL;
+}
+
+/*
+**	Find the origin from the address of the anchor. If there is no port
+**	in the address then we use the default port of the protocol.
+*/
+PUBLIC HTStats * HTStats_forAnchor (HTParentAnchor * anchor)
+{
+    HTStats * me = NULL;
+    if (Enabled && anchor) {
+	char * addr = HTAnchor_address((HTAnchor *) anchor);
+	char * access = HTParse(addr, "", PARSE_ACCESS);
+	char * fullhost = HTParse(addr, "", PARSE_HOST);
+	char * host = strchr(fullhost, '@');
+	char * port;
+	u_short u_port = 0;
+	host = host ? host+1 : fullhost;
+	if ((port = strchr(host, ':')) != NULL) {
+	    *port++ = '\0';
+	    if (isdigit((int) *port)) u_port = (u_short) atol(port);
+	}
+	if (!u_port) {
+	    HTProtocol * protocol = HTProtocol_find(NULL, access);
+	    if (protocol) u_port = HTProtocol_id(protocol);
+	}
+	me = HTStats_find(host, u_port);
+	HT_FREE(fullhost);
+	HT_FREE(access);
+	HT_FREE(addr);
+    }
+    return me;
+}
+
+PUBLIC void HTStats_count (HTStats * me, HTStatsCounter counter, long value)
+{
+    if (me && counter >= 0 && counter < HT_STATS_COUNTERS) {
+	me->counters[counter] += value;
+	Global->counters[counter] += value;
+    }
+}
+
+PUBLIC void HTStats_record (HTStats * me, HTStatsHistogram which,
+			    unsigned long value)
+{
+    if (me && which >= 0 && which < HT_STATS_HISTOGRAMS) {
+	if (!me->histograms[which]) me->histograms[which] = HTHistogram_new();
+	if (!Global->histograms[which]) Global->histograms[which] = HTHistogram_new();
+	HTHistogram_add(me->histograms[which], value);
+	HTHistogram_add(Global->histograms[which], value);
+    }
+}
+
+PRIVATE void HTStats_addOneStatus (HTStats * me, int status)
+{
+    int cnt;
+    for (cnt = 0; cnt < me->nstatus; cnt++) {
+	if (me->status[cnt].status == status) {
+	    me->status[cnt].count++;
+	    return;
+	}
+    }
+    if ((me->status = (HTStatusCount *) HT_REALLOC(me->status,
+	 (me->nstatus + 1) * sizeof(HTStatusCount))) == NULL)
+	HT_OUTOFMEM("HTStats_addStatus");
+
+    /* Keep them sorted by status code */
+    for (cnt = me->nstatus; cnt > 0 && me->status[cnt-1].status > status; cnt--)
+	me->status[cnt] = me->status[cnt-1];
+    me->status[cnt].status = status;
+    me->status[cnt].count = 1;
+    me->nstatus++;
+}
+
+PUBLIC void HTStats_addStatus (HTStats * me, int status)
+{
+    if (me) {
+	HTStats_addOneStatus(me, status);
+	HTStats_addOneStatus(Global, status);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/*				  SNAPSHOTS				     */
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTList * HTStats_snapshot (void)
+{
+    HTList * list = HTList_new();
+    HTList * last = list;
+    if (StatsTable) {
+	HTStats * pres;
+	int pos = 0;
+	last = HTList_addList(last, HTStats_copy(Global));
+	while ((pres = (HTStats *) HTHashtable_nextObject(StatsTable, &pos)) != NULL)
+	    last = HTList_addList(last, HTStats_copy(pres));
+    }
+    return list;
+}
+
+PUBLIC BOOL HTStats_deleteSnapshot (HTList * snapshot)
+{
+    if (snapshot) {
+	HTList * cur = snapshot;
+	HTStats * pres;
+	while ((pres = (HTStats *) HTList_nextObject(cur)) != NULL)
+	    HTStats_free(pres);
+	HTList_delete(snapshot);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC const char * HTStats_origin (HTStats * me)
+{
+    return me ? me->origin : NULL;
+}
+
+PUBLIC long HTStats_counter (HTStats * me, HTStatsCounter counter)
+{
+    return (me && counter >= 0 && counter < HT_STATS_COUNTERS) ?
+	me->counters[counter] : 0;
+}
+
+PUBLIC HTHistogram * HTStats_histogram (HTStats * me, HTStatsHistogram which)
+{
+    return (me && which >= 0 && which < HT_STATS_HISTOGRAMS) ?
+	me->histograms[which] : NULL;
+}
+
+PUBLIC long HTStats_statusCount (HTStats * me, int status)
+{
+    if (me) {
+	int cnt;
+	for (cnt = 0; cnt < me->nstatus; cnt++)
+	    if (me->status[cnt].status == status) return me->status[cnt].count;
+    }
+    return 0;
+}
+
+PUBLIC BOOL HTStats_status (HTStats * me, int index, int * status, long * count)
+{
+    if (me && index >= 0 && index < me->nstatus) {
+	if (status) *status = me->status[index].status;
+	if (count) *count = me->status[index].count;
+	return YES;
+    }
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				 TEXT EXPORT				     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTStats_print (HTChunk * out, HTStats * me)
+{
+    char line[256];
+    int cnt;
+    sprintf(line, "origin %s\n", me->origin);
+    HTChunk_puts(out, line);
+    for (cnt = 0; cnt < HT_STATS_COUNTERS; cnt++) {
+	sprintf(line, "  %s %ld\n", CounterNames[cnt], me->counters[cnt]);
+	HTChunk_puts(out, line);
+    }
+    for (cnt = 0; cnt < HT_STATS_HISTOGRAMS; cnt++) {
+	HTHistogram * h = me->histograms[cnt];
+	if (!h || !h->count) continue;
+	sprintf(line, "  %s count=%ld min=%lu p50=%lu p90=%lu p99=%lu max=%lu mean=%.1f\n",
+		HistogramNames[cnt], h->count, h->min,
+		HTHistogram_percentile(h, 50), HTHistogram_percentile(h, 90),
+		HTHistogram_percentile(h, 99), h->max, HTHistogram_mean(h));
+	HTChunk_puts(out, line);
+    }
+    if (me->nstatus) {
+	HTChunk_puts(out, "  status");
+	for (cnt = 0; cnt < me->nstatus; cnt++) {
+	    sprintf(line, " %d=%ld", me->status[cnt].status, me->status[cnt].count);
+	    HTChunk_puts(out, line);
+	}
+	HTChunk_putc(out, '\n');
+    }
+}
+
+PUBLIC HTChunk * HTStats_text (void)
+{
+    HTChunk * out = HTChunk_new(1024);
+    if (StatsTable) {
+	HTStats * pres;
+	int pos = 0;
+	HTStats_print(out, Global);
+	while ((pres = (HTStats *) HTHashtable_nextObject(StatsTable, &pos)) != NULL)
+	    HTStats_print(out, pres);
+    }
+    return out;
+}
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTStats_clear (HTStats * me)
+{
+    int cnt;
+    memset(me->counters, 0, sizeof(me->counters));
+    for (cnt = 0; cnt < HT_STATS_HISTOGRAMS; cnt++)
+	HTHistogram_clear(me->histograms[cnt]);
+    HT_FREE(me->status);
+    me->nstatus = 0;
+}
+
+PUBLIC BOOL HTStats_reset (void)
+{
+    if (StatsTable) {
+	HTStats * pres;
+	int pos = 0;
+	HTStats_clear(Global);
+	while ((pres = (HTStats *) HTHashtable_nextObject(StatsTable, &pos)) != NULL)
+	    HTStats_clear(pres);
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTStats_deleteAll (void)
+{
+    if (StatsTable) {
+	HTStats * pres;
+	int pos = 0;
+	while ((pres = (HTStats *) HTHashtable_nextObject(StatsTable, &pos)) != NULL)
+	    HTStats_free(pres);
+	HTHashtable_delete(StatsTable);
+	StatsTable = NULL;
+	HTStats_free(Global);
+	Global = NULL;
+	return YES;
+    }
+    return NO;
+}
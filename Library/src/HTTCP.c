@@ -90,27 +90,22 @@
 /*	       	      CONNECTION ESTABLISHMENT MANAGEMENT 		     */
 /* ------------------------------------------------------------------------- */
 
-/* _makeSocket - create a socket, if !preemptive, set FIONBIO
+/* _newSocket - create a socket of the given family, if !preemptive, set
+** FIONBIO. The socket is not counted by the Net manager.
 ** returns sockfd or INVSOC if error
 */
-PRIVATE int _makeSocket (HTHost * host, HTRequest * request, int preemptive)
+PRIVATE SOCKET _newSocket (int family, int preemptive)
 {
     int status = 1;
     SOCKET sockfd = INVSOC;
 #ifdef DECNET
     if ((sockfd=socket(AF_DECnet, SOCK_STREAM, 0))==INVSOC)
 #else
-    if ((sockfd=socket(AF_INET, SOCK_STREAM,IPPROTO_TCP))==INVSOC)
+    if ((sockfd=socket(family, SOCK_STREAM,IPPROTO_TCP))==INVSOC)
 #endif
-    {
-	HTRequest_addSystemError(request, ERR_FATAL, socerrno, NO, "socket");
 	return INVSOC;
-    }
     HTTRACE(PROT_TRACE, "Socket...... Created %d\n" _ sockfd);
 
-    /* Increase the number of sockets by one */
-    HTNet_increaseSocket();
-
     /*
     **  If we have compiled without Nagle's algorithm then try and turn
     **  it off now
@@ -173,6 +168,26 @@ PRIVATE int _makeSocket (HTHost * host, HTRequest * request, int preemptive)
     return sockfd;
 }
 
+/* _makeSocket - create a socket, if !preemptive, set FIONBIO
+** returns sockfd or INVSOC if error
+*/
+PRIVATE int _makeSocket (HTHost * host, HTRequest * request, int preemptive)
+{
+#ifdef AF_INET6
+    SOCKET sockfd = _newSocket(host->ipv6 ? AF_INET6 : AF_INET, preemptive);
+#else
+    SOCKET sockfd = _newSocket(AF_INET, preemptive);
+#endif
+    if (sockfd == INVSOC) {
+	HTRequest_addSystemError(request, ERR_FATAL, socerrno, NO, "socket");
+	return INVSOC;
+    }
+
+    /* Increase the number of sockets by one */
+    HTNet_increaseSocket();
+    return sockfd;
+}
+
 /*
 **  Associate the channel with the host and create an input and and output stream
 **  for this host/channel
@@ -188,6 +203,375 @@ PRIVATE BOOL createChannelAndTransportStreams (HTHost * host, SOCKET sockfd, HTT
     return NO;
 }
 
+/* ------------------------------------------------------------------------- */
+/*		    PARALLEL CONNECTS TO MULTIHOMED HOSTS		     */
+/* ------------------------------------------------------------------------- */
+
+#define RACE_DELAY		250    /* Default ms before the next attempt */
+
+typedef struct _HTRaceAttempt {
+    int			home;	 /* Weight index, IPv6 after the IPv4 homes */
+    int			family;
+    char		addr[16];		     /* Network byte order */
+    SOCKET		sockfd;
+    ms_t		start;
+} HTRaceAttempt;
+
+typedef struct _HTRace {
+    HTHost *		host;
+    HTNet *		net;		    /* The Net object that is waiting */
+    HTEvent *		event;
+    HTTimer *		timer;		       /* Starts the next attempt */
+    HTRaceAttempt	attempts[HT_CONNECT_ATTEMPTS];
+    int			count;
+    int			next;			   /* Next attempt to start */
+    int			running;		  /* Connects in progress */
+    SOCKET		winner;
+    int			error;		  /* Socket error of last failure */
+    BOOL		done;
+} HTRace;
+
+PRIVATE BOOL RaceMode = NO;
+PRIVATE BOOL RaceIPv6 = NO;
+PRIVATE ms_t RaceDelay = RACE_DELAY;
+
+PUBLIC void HTDoConnect_setParallel (BOOL mode)
+{
+    RaceMode = mode;
+}
+
+PUBLIC BOOL HTDoConnect_parallel (void)
+{
+    return RaceMode;
+}
+
+PUBLIC void HTDoConnect_setParallelDelay (ms_t delay)
+{
+    RaceDelay = delay > 0 ? delay : RACE_DELAY;
+}
+
+PUBLIC ms_t HTDoConnect_parallelDelay (void)
+{
+    return RaceDelay;
+}
+
+PUBLIC void HTDoConnect_setIPv6 (BOOL mode)
+{
+    RaceIPv6 = mode;
+}
+
+PUBLIC BOOL HTDoConnect_IPv6 (void)
+{
+#ifdef AF_INET6
+    return RaceIPv6;
+#else
+    return NO;
+#endif
+}
+
+/*
+**	Keep the best homes in the range [first; first+homes[ sorted by
+**	weight. Returns the number of homes put into the list.
+*/
+PRIVATE int HTRace_best (HTdns * dns, int first, int homes, int * list)
+{
+    int count = 0;
+    int cnt;
+    for (cnt = first; cnt < first + homes; cnt++) {
+	double weight = HTDNS_weight(dns, cnt);
+	int pos = count < HT_CONNECT_ATTEMPTS ? count++ : HT_CONNECT_ATTEMPTS;
+	while (pos > 0 && HTDNS_weight(dns, list[pos-1]) > weight) {
+	    if (pos < HT_CONNECT_ATTEMPTS) list[pos] = list[pos-1];
+	    pos--;
+	}
+	if (pos < HT_CONNECT_ATTEMPTS) list[pos] = cnt;
+    }
+    return count;
+}
+
+/*
+**	Create a race for a host with more than one address. The IPv4 and
+**	IPv6 addresses are tried alternately, starting with the best IPv4
+**	address. Returns NULL if there is only one address to try, unless
+**	it is an IPv6 address which is the only way to reach the host.
+*/
+PRIVATE HTRace * HTRace_new (HTHost * host, HTNet * net)
+{
+    HTdns * dns = host->dns;
+    int homes = HTDNS_homes(dns);
+    int v4[HT_CONNECT_ATTEMPTS];
+    int v6[HT_CONNECT_ATTEMPTS];
+    int n4 = HTRace_best(dns, 0, homes, v4);
+    int n6 = 0;
+    int i4 = 0, i6 = 0;
+    HTRace * me;
+#ifdef AF_INET6
+    if (RaceIPv6) n6 = HTRace_best(dns, homes, HTDNS_homes6(dns), v6);
+#endif
+    if (n4 + n6 < (n4 ? 2 : 1)) return NULL;
+    if ((me = (HTRace *) HT_CALLOC(1, sizeof(HTRace))) == NULL)
+	HT_OUTOFMEM("HTRace_new");
+    while (me->count < HT_CONNECT_ATTEMPTS && (i4 < n4 || i6 < n6)) {
+	HTRaceAttempt * attempt = me->attempts + me->count;
+	BOOL ipv6 = i6 < n6 && (i4 >= n4 || i6 < i4);
+	if (ipv6) {
+#ifdef AF_INET6
+	    attempt->home = v6[i6++];
+	    attempt->family = AF_INET6;
+	    memcpy(attempt->addr, HTDNS_address6(dns, attempt->home - homes), 16);
+#endif
+	} else {
+	    attempt->home = v4[i4++];
+	    attempt->family = AF_INET;
+	    memcpy(attempt->addr, HTDNS_address(dns, attempt->home), 4);
+	}
+	attempt->sockfd = INVSOC;
+	me->count++;
+    }
+    me->host = host;
+    me->net = net;
+    me->winner = INVSOC;
+    HTTRACE(PROT_TRACE, "HTDoConnect. Racing %d addresses of `%s\'\n" _
+	    me->count _ HTHost_name(host));
+    return me;
+}
+
+PRIVATE BOOL HTRace_delete (HTRace * me)
+{
+    if (me) {
+	int cnt;
+	for (cnt = 0; cnt < me->next; cnt++) {
+	    HTRaceAttempt * attempt = me->attempts + cnt;
+	    if (attempt->sockfd != INVSOC) {
+		HTEvent_unregister(attempt->sockfd, HTEvent_CONNECT);
+		NETCLOSE(attempt->sockfd);
+	    }
+	}
+	if (me->winner != INVSOC) NETCLOSE(me->winner);
+	if (me->timer) HTTimer_delete(me->timer);
+	HTEvent_delete(me->event);
+	if (me->host->race == me) me->host->race = NULL;
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
+}
+
+/*
+**	An attempt failed. The weight of the address gets the same penalty
+**	as when a normal connect to a multihomed host fails.
+*/
+PRIVATE void HTRace_failed (HTRace * me, HTRaceAttempt * attempt, int error)
+{
+    ms_t connecttime = HTGetTimeInMillis() - attempt->start;
+    HTTRACE(PROT_TRACE, "HTDoConnect. Attempt on home %d failed with error %d\n" _
+	    attempt->home _ error);
+    connecttime += HT_HOSTUNREACHABLE(error) ? TCP_DELAY : TCP_PENALTY;
+    HTDNS_updateWeigths(me->host->dns, attempt->home, connecttime);
+    if (attempt->sockfd != INVSOC) {
+	NETCLOSE(attempt->sockfd);
+	attempt->sockfd = INVSOC;
+    }
+    me->error = error;
+}
+
+/*
+**	An attempt succeeded. The other attempts are closed and all the
+**	connect times that we have seen are fed into the weights.
+*/
+PRIVATE void HTRace_won (HTRace * me, HTRaceAttempt * attempt)
+{
+    HTHost * host = me->host;
+    ms_t now = HTGetTimeInMillis();
+    int cnt;
+    HTTRACE(PROT_TRACE, "HTDoConnect. Home %d of `%s\' connected on socket %d in %lu ms\n" _
+	    attempt->home _ HTHost_name(host) _ attempt->sockfd _ now - attempt->start);
+    for (cnt = 0; cnt < me->next; cnt++) {
+	HTRaceAttempt * other = me->attempts + cnt;
+	if (other != attempt && other->sockfd != INVSOC) {
+	    HTEvent_unregister(other->sockfd, HTEvent_CONNECT);
+	    NETCLOSE(other->sockfd);
+	    other->sockfd = INVSOC;
+	    HTDNS_updateWeigths(host->dns, other->home, now - other->start);
+	}
+    }
+    HTDNS_updateWeigths(host->dns, attempt->home, now - attempt->start);
+
+    /*
+    **  Remember the address that won so that new sockets for the host, for
+    **  example when a persistent connection is lost, go to the same place
+    */
+    HTHost_setHome(host, attempt->home);
+#ifdef AF_INET6
+    if (attempt->family == AF_INET6) {
+	memset((void *) &host->sock_addr6, '\0', sizeof(host->sock_addr6));
+	host->sock_addr6.sin6_family = AF_INET6;
+	host->sock_addr6.sin6_port = host->sock_addr.sin_port;
+	memcpy((void *) &host->sock_addr6.sin6_addr, attempt->addr, 16);
+	host->ipv6 = YES;
+    } else
+#endif
+    {
+	memcpy((void *) &host->sock_addr.sin_addr, attempt->addr, 4);
+	host->ipv6 = NO;
+    }
+    me->winner = attempt->sockfd;
+    attempt->sockfd = INVSOC;
+    me->running = 0;
+    me->done = YES;
+    if (me->timer) {
+	HTTimer_delete(me->timer);
+	me->timer = NULL;
+    }
+}
+
+/*
+**	Start a non-blocking connect to an address.
+**	Returns	HT_WOULD_BLOCK	if the connect is in progress
+**		HT_OK		if we are already connected
+**		HT_ERROR	if the connect failed
+*/
+PRIVATE int HTRace_connect (HTRace * me, HTRaceAttempt * attempt)
+{
+    HTHost * host = me->host;
+    int status;
+    attempt->start = HTGetTimeInMillis();
+    if ((attempt->sockfd = _newSocket(attempt->family, NO)) == INVSOC) {
+	me->error = socerrno;
+	return HT_ERROR;
+    }
+    HTEvent_register(attempt->sockfd, HTEvent_CONNECT, me->event);
+#ifdef AF_INET6
+    if (attempt->family == AF_INET6) {
+	struct sockaddr_in6 sin6;
+	memset((void *) &sin6, '\0', sizeof(sin6));
+	sin6.sin6_family = AF_INET6;
+	sin6.sin6_port = host->sock_addr.sin_port;
+	memcpy((void *) &sin6.sin6_addr, attempt->addr, 16);
+	status = connect(attempt->sockfd, (struct sockaddr *) &sin6, sizeof(sin6));
+    } else
+#endif
+    {
+	SockA sin;
+	memcpy((void *) &sin, (void *) &host->sock_addr, sizeof(sin));
+	memcpy((void *) &sin.sin_addr, attempt->addr, 4);
+	status = connect(attempt->sockfd, (struct sockaddr *) &sin, sizeof(sin));
+    }
+    if (NETCALL_ERROR(status)) {
+	if (NETCALL_WOULDBLOCK(socerrno)) {
+	    HTTRACE(PROT_TRACE, "HTDoConnect. Connecting to home %d on socket %d\n" _
+		    attempt->home _ attempt->sockfd);
+	    return HT_WOULD_BLOCK;
+	}
+	me->error = socerrno;
+	HTEvent_unregister(attempt->sockfd, HTEvent_CONNECT);
+	return me->error == EISCONN ? HT_OK : HT_ERROR;
+    }
+    HTEvent_unregister(attempt->sockfd, HTEvent_CONNECT);
+    return HT_OK;
+}
+
+/*
+**	Start the next attempt. If it fails right away then we go on with the
+**	one after that. When there is nothing left to try and nothing in
+**	progress then the race is lost.
+*/
+PRIVATE void HTRace_next (HTRace * me)
+{
+    while (!me->done && me->next < me->count) {
+	HTRaceAttempt * attempt = me->attempts + me->next++;
+	int status = HTRace_connect(me, attempt);
+	if (status == HT_WOULD_BLOCK) {
+	    me->running++;
+	    break;
+	} else if (status == HT_OK) {
+	    HTRace_won(me, attempt);
+	} else
+	    HTRace_failed(me, attempt, me->error);
+    }
+    if (me->next >= me->count && me->timer) {
+	HTTimer_delete(me->timer);
+	me->timer = NULL;
+    }
+    if (!me->done && !me->running && me->next >= me->count) {
+	HTTRACE(PROT_TRACE, "HTDoConnect. No more addresses to try for `%s\'\n" _
+		HTHost_name(me->host));
+	me->done = YES;
+    }
+}
+
+PRIVATE int HTRace_event (SOCKET sockfd, void * param, HTEventType type)
+{
+    HTRace * me = (HTRace *) param;
+    HTRaceAttempt * attempt = NULL;
+    int error = 0;
+    int cnt;
+    for (cnt = 0; cnt < me->next; cnt++) {
+	if (me->attempts[cnt].sockfd == sockfd) {
+	    attempt = me->attempts + cnt;
+	    break;
+	}
+    }
+    if (!attempt || me->done) return HT_OK;
+    HTEvent_unregister(sockfd, HTEvent_CONNECT);
+    me->running--;
+    if (type == HTEvent_TIMEOUT)
+	error = ETIMEDOUT;
+#if defined(HAVE_GETSOCKOPT) && defined(SO_ERROR)
+    else {
+	socklen_t size = sizeof(int);
+	if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (void *) &error, &size) == -1)
+	    error = socerrno;
+    }
+#endif
+    if (error) {
+	HTRace_failed(me, attempt, error);
+	HTRace_next(me);
+    } else
+	HTRace_won(me, attempt);
+
+    /* Let the Net object pick up the result */
+    if (me->done) HTNet_execute(me->net, HTEvent_CONNECT);
+    return HT_OK;
+}
+
+PRIVATE int HTRace_timeout (HTTimer * timer, void * param, HTEventType type)
+{
+    HTRace * me = (HTRace *) param;
+    HTRace_next(me);
+    if (me->done) HTNet_execute(me->net, HTEvent_CONNECT);
+    return HT_OK;
+}
+
+/*
+**	Start the race and the first attempt. The timer starts the rest.
+*/
+PRIVATE HTRace * HTRace_start (HTHost * host, HTNet * net)
+{
+    HTRace * me = HTRace_new(host, net);
+    if (me) {
+	host->race = me;
+	me->event = HTEvent_new(HTRace_event, me, HT_PRIORITY_MAX,
+				HTHost_eventTimeout());
+	me->timer = HTTimer_new(NULL, HTRace_timeout, me, RaceDelay, YES, YES);
+	HTRace_next(me);
+    }
+    return me;
+}
+
+PUBLIC BOOL HTDoConnect_cancel (HTHost * host, HTNet * net)
+{
+    if (host && host->race && (!net || host->race->net == net)) {
+	HTTRACE(PROT_TRACE, "HTDoConnect. Cancelling parallel connects to `%s\'\n" _
+		HTHost_name(host));
+	HTRace_delete(host->race);
+	HTHost_setRetry(host, 0);
+	host->tcpstate = TCP_BEGIN;
+	return YES;
+    }
+    return NO;
+}
+
 /*								HTDoConnect()
 **
 **	Note: Any port indication in URL, e.g., as `host:port' overwrites
@@ -236,6 +620,7 @@ PUBLIC int HTDoConnect (HTNet * net)
 	    **  Resolved
 	    */
 	    if (HTHost_channel(host) == NULL) {
+		if (HTStats_enabled()) host->dnsStart = HTGetTimeInMillis();
 		host->tcpstate = TCP_DNS;
 		HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_DNS.\n" _ host);
 	    } else {
@@ -261,16 +646,76 @@ PUBLIC int HTDoConnect (HTNet * net)
 				   HTERR_NO_REMOTE_HOST,
 				   (void *) hostname, strlen(hostname),
 				   "HTDoConnect");
+		HTStats_count(HTStats_forHost(host), HT_STATS_DNS_FAILURES, 1);
+		host->dnsStart = 0;
 		host->tcpstate = TCP_DNS_ERROR;
 		HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_ERROR.\n" _ host);
 		break;
 	    }
+	    if (status == 0) {
+		HTTRACE(PROT_TRACE, "HTDoConnect. Waiting for name server to resolve `%s'\n" _ hostname);
+		return HT_WOULD_BLOCK;
+	    }
+	    if (host->dnsStart) {
+		ms_t now = HTGetTimeInMillis();
+		HTStats_record(HTStats_forHost(host), HT_STATS_DNS_TIME,
+			       now - host->dnsStart);
+		host->dnsStart = 0;
+		host->connectStart = now;
+	    }
 	    if (!HTHost_retry(host) && status > 1)		/* If multiple homes */
 		HTHost_setRetry(host, status);
+	    if (!preemptive && host->dns && (HTDNS_homes(host->dns) == 0 ||
+		(RaceMode && (status > 1 || (RaceIPv6 && HTDNS_homes6(host->dns) > 0))))) {
+		host->tcpstate = TCP_RACE;
+		HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_RACE.\n" _ host);
+		break;
+	    }
 	    host->tcpstate = TCP_NEED_SOCKET;
 	    HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_NEED_SOCKET.\n" _ host);
 	    break;
 
+	case TCP_RACE:
+	{
+	    HTRace * race = host->race;
+	    if (!race) {
+		if ((race = HTRace_start(host, net)) == NULL) {
+		    host->tcpstate = TCP_NEED_SOCKET;
+		    HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_NEED_SOCKET.\n" _ host);
+		    break;
+		}
+
+		/* Progress notification */
+		{
+		    HTAlertCallback *cbf = HTAlert_find(HT_PROG_CONNECT);
+		    if (cbf) (*cbf)(request, HT_PROG_CONNECT, HT_MSG_NULL,
+				    NULL, hostname, NULL);
+		}
+	    }
+	    if (!race->done) return HT_WOULD_BLOCK;
+
+	    /* The winner becomes the channel of the host */
+	    if (race->winner != INVSOC) {
+		HTNet_increaseSocket();
+		createChannelAndTransportStreams(host, race->winner, net->transport);
+		race->winner = INVSOC;
+		HTRace_delete(race);
+		HTHost_setRetry(host, 0);
+		host->tcpstate = TCP_CONNECTED;
+		HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_CONNECTED.\n" _ host);
+		break;
+	    }
+	    HTRequest_addSystemError(request, ERR_FATAL, race->error, NO, "connect");
+	    HTStats_count(HTStats_forHost(host), HT_STATS_CONNECT_FAILURES, 1);
+	    host->connectStart = 0;
+	    HTRace_delete(race);
+	    HTDNS_delete(hostname);
+	    HTHost_setRetry(host, 0);
+	    host->tcpstate = TCP_BEGIN;
+	    HTTRACE(PROT_TRACE, "HTHost %p going to state TCP_BEGIN.\n" _ host);
+	    return HT_ERROR;
+	}
+
 	case TCP_NEED_SOCKET:
 	{
 	    SOCKET sockfd;
@@ -317,6 +762,13 @@ PUBLIC int HTDoConnect (HTNet * net)
             */
 	    HTHost_register(host, net, HTEvent_CONNECT);
 #endif /* _WINSOCKAPI_ */
+#ifdef AF_INET6
+	    if (host->ipv6)
+		status = connect(HTChannel_socket(host->channel),
+				 (struct sockaddr *) &host->sock_addr6,
+				 sizeof(host->sock_addr6));
+	    else
+#endif
 	    status = connect(HTChannel_socket(host->channel), (struct sockaddr *) &host->sock_addr,
 			     sizeof(host->sock_addr));
 	    /*
@@ -403,6 +855,13 @@ PUBLIC int HTDoConnect (HTNet * net)
 		host->connecttime = HTGetTimeInMillis() - host->connecttime;
 		HTDNS_updateWeigths(host->dns, HTHost_home(host), host->connecttime);
 	    }
+	    if (host->connectStart) {
+		HTStats * stats = HTStats_forHost(host);
+		HTStats_count(stats, HT_STATS_CONNECTS, 1);
+		HTStats_record(stats, HT_STATS_CONNECT_TIME,
+			       HTGetTimeInMillis() - host->connectStart);
+		host->connectStart = 0;
+	    }
 	    HTHost_setRetry(host, 0);
 	    host->tcpstate = TCP_IN_USE;
 	    HTTRACE(PROT_TRACE, "HTHost %p connected.\n" _ host);
@@ -448,6 +907,8 @@ PUBLIC int HTDoConnect (HTNet * net)
 		break;
 	    }
 	    HTRequest_addSystemError(request, ERR_FATAL, socerrno, NO, "connect");
+	    HTStats_count(HTStats_forHost(host), HT_STATS_CONNECT_FAILURES, 1);
+	    host->connectStart = 0;
 	    HTDNS_delete(hostname);
 	    HTHost_setRetry(host, 0);
 	    host->tcpstate = TCP_BEGIN;
@@ -626,6 +1087,7 @@ PUBLIC int HTDoListen (HTNet * listening, HTNet * accepting, int backlog)
 	    return HT_OK;
 
 	case TCP_NEED_CONNECT:
+	case TCP_RACE:
 	case TCP_DNS:
 	case TCP_DNS_ERROR:
 	case TCP_ERROR:
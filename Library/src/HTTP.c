@@ -31,6 +31,7 @@
 #include "HTNetMan.h"
 #include "HTTPUtil.h"
 #include "HTTPReq.h"
+#include "HTTP2.h"
 #include "HTTP.h"					       /* Implements */
 
 /* Macros and other defines */
@@ -74,6 +75,8 @@ typedef struct _http_info {
     HTTimer *		timer;
     BOOL		usedTimer;
     BOOL		repetitive_writing;
+    BOOL		http2;			 /* Request is an HTTP/2 stream */
+    HTStream *		stream;
 } http_info;
 
 #define MAX_STATUS_LEN		100   /* Max nb of chars to check StatusLine */
@@ -158,6 +161,7 @@ PRIVATE int HTTPCleanup (HTRequest *req, int status)
 		(*input->isa->_free)(input);
 	}
 	HTRequest_setInputStream(req, NULL);
+	if (http) http->stream = NULL;
     }
 
     /*
@@ -173,6 +177,21 @@ PRIVATE int HTTPCleanup (HTRequest *req, int status)
     ** Remove the request object and our own context structure for http.
     */
     if (status != HT_RECOVER_PIPE) {
+
+	/*
+	**  With HTTP/2 the read stream doesn't belong to the channel reader
+	**  so we must free it ourselves
+	*/
+	if (http && http->http2) {
+	    HTStream * target = HTNet_readStream(net);
+	    if (target) {
+		if (status==HT_INTERRUPTED || status==HT_TIMEOUT)
+		    (*target->isa->abort)(target, NULL);
+		else
+		    (*target->isa->_free)(target);
+		HTNet_setReadStream(net, NULL);
+	    }
+	}
         HTNet_delete(net, status);
 	HT_FREE(http);
     }
@@ -715,7 +734,9 @@ PRIVATE int stream_pipe (HTStream * me, int length)
 	}
 
 	/* Here we want to find out when to use persistent connection */
-	if (major > 1 && major < 100) {
+	if (major == 2 && me->http->http2) {
+	    me->status = atoi(HTNextField(&ptr));
+	} else if (major > 1 && major < 100) {
 	    HTTRACE(PROT_TRACE, "HTTP Status. Major version number is %d\n" _ major);
 	    me->target = HTErrorStream();
 	    me->status = 9999;
@@ -747,6 +768,13 @@ PRIVATE int stream_pipe (HTStream * me, int length)
 	    me->status = atoi(HTNextField(&ptr));
 	}
 
+	if (net->start && me->status/100 != 1) {
+	    HTStats * stats = HTStats_forHost(host);
+	    HTStats_addStatus(stats, me->status);
+	    HTStats_record(stats, HT_STATS_FIRST_BYTE,
+			   HTGetTimeInMillis() - net->start);
+	}
+
 	me->reason = ptr;
 	if ((ptr = strchr(me->reason, '\r')) != NULL)	  /* Strip \r and \n */
 	    *ptr = '\0';
@@ -1011,6 +1039,20 @@ PUBLIC HTStream * HTTPStatus_new (HTRequest *	request,
 */
 PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type);
 
+/*
+**	Is this the http protocol on one of the plain TCP transports?
+*/
+PRIVATE BOOL HTTP_plainTCP (HTNet * net)
+{
+    HTProtocol * protocol = HTNet_protocol(net);
+    const char * name = protocol ? HTProtocol_name(protocol) : NULL;
+    const char * transport = protocol ? HTProtocol_transport(protocol) : NULL;
+    return (name && !strcasecomp(name, "http") && transport &&
+	    (!strcasecomp(transport, "tcp") ||
+	     !strcasecomp(transport, "buffered_tcp") ||
+	     !strcasecomp(transport, "mux")));
+}
+
 PUBLIC int HTLoadHTTP (SOCKET soc, HTRequest * request)
 {
     http_info *http;			    /* Specific protocol information */
@@ -1157,6 +1199,18 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		    HTTRACE(PROT_TRACE, "HTTP........ Mode is FORCE HTTP/1.0\n");
 		    HTHost_setVersion(host, HTTP_10);
 		}
+		/*
+		**  Prior knowledge only works in the clear as TLS would
+		**  need ALPN. Other transports like https are left alone.
+		*/
+		if ((ConnectionMode & HTTP_20_PRIOR_KNOWLEDGE) &&
+		    !HTRequest_proxy(request) && !HTNet_preemptive(net) &&
+		    HTTP_plainTCP(net)) {
+		    HTTRACE(PROT_TRACE, "HTTP........ Mode is HTTP/2 with prior knowledge\n");
+		    HTHost_setVersion(host, HTTP_20);
+		    HTNet_setPersistent(net, YES, HT_TP_INTERLEAVE);
+		    http->http2 = YES;
+		}
 
 		if (HTNet_preemptive(net)) {
 		    HTTRACE(PROT_TRACE, "HTTP........ Force flush on preemptive load\n");
@@ -1216,6 +1270,10 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		HTOutputStream * output = HTChannel_getChannelOStream(channel);
 		int version = HTHost_version(host);
 		HTStream * app = NULL;
+		if (http->http2) {
+		    http->stream = HTTP2Request_new(request, host);
+		    output = (HTOutputStream *) http->stream;
+		}
 		
 #ifdef HTDEBUG
 		if (PROT_TRACE) {
@@ -1255,7 +1313,7 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 	      if (type == HTEvent_WRITE) {
 		  HTStream * input = HTRequest_inputStream(request);
 		  HTPostCallback * pcbf = HTRequest_postCallback(request);
-		  status = HTRequest_flush(request) ?
+		  status = HTRequest_flush(request) && !http->http2 ?
 		      HTHost_forceFlush(host) : (*input->isa->flush)(input);
 
 		  /*
@@ -1273,6 +1331,7 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		          if (http->lock == NO) {
 			      int retrys = HTRequest_retrys(request);
 			      ms_t delay = retrys > 3 ? HTSecondWriteDelay : HTFirstWriteDelay;
+			      if (http->http2) delay = 0;   /* No 100 Continue */
 			      if (!http->timer && !http->usedTimer) {
 				  http->timer = HTTimer_new(NULL, FlushPutEvent,
 							http, delay, YES, NO);
@@ -1299,7 +1358,7 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		      return HT_OK;
 		  else if (status == HT_PAUSE || status == HT_LOADED) {
 		      type = HTEvent_READ;
-		  } else if (status==HT_ERROR)
+		  } else if (status==HT_ERROR || status==HT_CLOSED)
 		      http->state = HTTP_RECOVER_PIPE;
 	      } else if (type == HTEvent_FLUSH) {
 		  HTStream * input = HTRequest_inputStream(request);
@@ -1307,7 +1366,8 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		      return HT_ERROR;
 		  return (*input->isa->flush)(input);
 	      } else if (type == HTEvent_READ) {
-		  status = HTHost_read(host, net);
+		  status = http->http2 ?
+		      HTTP2_read(http->stream) : HTHost_read(host, net);
 		  if (status == HT_WOULD_BLOCK)
 		      return HT_OK;
 		  else if (status == HT_CONTINUE) {
@@ -1318,7 +1378,10 @@ PRIVATE int HTTPEvent (SOCKET soc, void * pVoid, HTEventType type)
 		      http->state = http->next;	/* Jump to next state (OK or ERROR) */
 		  else if (status==HT_CLOSED)
 		      http->state = HTTP_RECOVER_PIPE;
-		  else if (status == HT_ERROR)
+		  else if (status == HT_ERROR && http->http2) {
+		      http->result = HT_ERROR;	       /* Only this stream failed */
+		      http->state = HTTP_ERROR;
+		  } else if (status == HT_ERROR)
 		      http->state = HTTP_KILL_PIPE;
 		  else
 		      http->state = HTTP_ERROR;
@@ -0,0 +1,1464 @@
+/*								       HTTP2.c
+**	HTTP/2 CLIENT TRANSPORT
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	The session is the input stream of the channel so it gets to read
+**	all frames on the connection. Each request has a stream which takes
+**	the HTTP/1 request generated by the HTTP request stream and sends it
+**	as a HEADERS frame followed by DATA frames. Response header blocks
+**	are decoded and written as an HTTP/1 header to the read stream of
+**	the net object so that the usual status and MIME parsers can be
+**	used. The body goes straight to the read stream.
+**
+**	All requests are in the pipeline of the host at the same time but
+**	the host only hands read events to the first one. Whoever reads
+**	first therefore reads for everybody and then calls the other net
+**	objects whose responses are done so that they can clean up. The
+**	stream objects of requests which are deleted while the session is
+**	reading are not freed until the session is done reading.
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "WWWCore.h"
+#include "HTNetMan.h"
+#include "HTReader.h"
+#include "HTHPack.h"
+#include "HTTP2.h"					 /* Implemented here */
+
+#define PREFACE			"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define FRAME_HEADER		9
+#define FRAME_SIZE		16384	      /* Default and what we accept */
+#define MAX_FRAME_SIZE		16777215L
+#define MAX_WINDOW		0x7FFFFFFFL
+#define MAX_STREAM_ID		0x7FFFFFFFL
+#define MAX_HEADER_BLOCK	(256*1024)
+#define MAX_HEADER_LIST		(64*1024)     /* Decoded size we take */
+#define DEFAULT_WINDOW		65535L
+#define DEFAULT_STREAMS		100
+#define STREAM_WINDOW		(1024L*1024L)	   /* What we tell the server */
+#define CONNECTION_WINDOW	(16L*1024L*1024L)
+
+/* Frame types */
+#define H2_DATA			0x0
+#define H2_HEADERS		0x1
+#define H2_PRIORITY		0x2
+#define H2_RST_STREAM		0x3
+#define H2_SETTINGS		0x4
+#define H2_PUSH_PROMISE		0x5
+#define H2_PING			0x6
+#define H2_GOAWAY		0x7
+#define H2_WINDOW_UPDATE	0x8
+#define H2_CONTINUATION		0x9
+
+/* Frame flags */
+#define H2_END_STREAM		0x1
+#define H2_ACK			0x1
+#define H2_END_HEADERS		0x4
+#define H2_PADDED		0x8
+#define H2_PRIORITY_FLAG	0x20
+
+/* Settings */
+#define H2_HEADER_TABLE_SIZE	0x1
+#define H2_ENABLE_PUSH		0x2
+#define H2_MAX_STREAMS		0x3
+#define H2_INITIAL_WINDOW	0x4
+#define H2_MAX_FRAME		0x5
+#define H2_MAX_HEADER_LIST	0x6
+
+/* Error codes */
+#define H2_NO_ERROR		0x0
+#define H2_PROTOCOL_ERROR	0x1
+#define H2_FLOW_CONTROL_ERROR	0x3
+#define H2_FRAME_SIZE_ERROR	0x6
+#define H2_CANCEL		0x8
+#define H2_COMPRESSION_ERROR	0x9
+#define H2_ENHANCE_YOUR_CALM	0xB
+
+typedef enum _HTTP2State {
+    H2_HEADER = 0,			     /* Collecting the request header */
+    H2_WAITING,				/* Waiting for a free stream slot */
+    H2_OPEN,					     /* HEADERS has been sent */
+    H2_CLOSED					   /* Response done or reset */
+} HTTP2State;
+
+typedef enum _HTTP2Chunk {
+    CHUNK_SIZE = 0,
+    CHUNK_EXTENSION,
+    CHUNK_DATA,
+    CHUNK_CRLF,
+    CHUNK_TRAILER
+} HTTP2Chunk;
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    HTInputStream *		session;	  /* NULL when session is gone */
+    HTRequest *			request;
+    HTNet *			net;
+    HTTP2State			state;
+    unsigned long		id;
+    HTChunk *			header;		   /* HTTP/1 request header */
+    char *			method;
+    char *			uri;
+    char *			authority;
+    char **			fields;		 /* Name and value pairs */
+    int				nfields;
+    HTChunk *			body;		       /* Body not yet sent */
+    int				offset;	       /* Bytes of body already sent */
+    long			length;	      /* Body still to come, -1 if unknown */
+    BOOL			chunked;	  /* Body is chunked encoded */
+    HTTP2Chunk			chunk_state;
+    long			chunk_left;
+    BOOL			end;		/* We have the whole body */
+    BOOL			ended;			/* We sent END_STREAM */
+    long			send_window;
+    long			recv_window;
+    long			consumed;     /* Read since last WINDOW_UPDATE */
+    HTChunk *			pending;	/* Read stream didn't take it */
+    long			unflowed;   /* Header bytes first in pending */
+    BOOL			eos;			/* Got END_STREAM */
+    BOOL			response;	/* Got the final response header */
+    BOOL			loaded;	      /* Read stream said HT_LOADED */
+    BOOL			done;
+    int				result;
+    BOOL			notified;
+    BOOL			detached;
+};
+
+struct _HTInputStream {
+    const HTInputStreamClass *	isa;
+    HTHost *			host;
+    SOCKET			sockfd;
+    HTStream *			output;	      /* NULL when channel is gone */
+    HTHPack *			encoder;
+    HTHPack *			decoder;
+    HTList *			streams;
+    HTList *			graveyard;	   /* Streams freed while reading */
+    char *			buffer;
+    HTChunk *			input;		 /* Part of a frame read so far */
+    HTChunk *			block;		/* Header block being collected */
+    unsigned long		block_id;
+    BOOL			block_end;
+    BOOL			continuation;
+    HTChunk *			text;		 /* Response header as HTTP/1 */
+    long			list_size;	 /* Decoded size of the block */
+    int				status;
+    BOOL			malformed;
+    HTChunk *			out;		     /* Request header block */
+    unsigned long		next_id;
+    int				active;
+    int				max_streams;
+    long			initial_window;
+    long			max_frame;
+    long			send_window;
+    long			recv_window;
+    long			consumed;     /* Read since last WINDOW_UPDATE */
+    BOOL			written;
+    BOOL			goaway;
+    unsigned long		last_id;	/* Last stream server handles */
+    BOOL			broken;
+    BOOL			reading;
+    BOOL			zombie;		   /* Closed while reading */
+    HTTimer *			timer;		   /* For calling done requests */
+};
+
+PRIVATE const HTInputStreamClass HTTP2SessionClass;
+
+/* ------------------------------------------------------------------------- */
+/*				  WRITING FRAMES			     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTTP2_write (HTInputStream * me, const char * b, long l)
+{
+    if (me->output && !me->broken && l > 0) {
+	(*me->output->isa->put_block)(me->output, b, (int) l);
+	me->written = YES;
+    }
+}
+
+PRIVATE void HTTP2_frame (HTInputStream * me, int type, int flags,
+			  unsigned long id, long length)
+{
+    char header[FRAME_HEADER];
+    header[0] = (char) ((length >> 16) & 0xFF);
+    header[1] = (char) ((length >> 8) & 0xFF);
+    header[2] = (char) (length & 0xFF);
+    header[3] = (char) type;
+    header[4] = (char) flags;
+    header[5] = (char) ((id >> 24) & 0x7F);
+    header[6] = (char) ((id >> 16) & 0xFF);
+    header[7] = (char) ((id >> 8) & 0xFF);
+    header[8] = (char) (id & 0xFF);
+    HTTP2_write(me, header, FRAME_HEADER);
+}
+
+PRIVATE void HTTP2_putLong (char * p, unsigned long value)
+{
+    p[0] = (char) ((value >> 24) & 0xFF);
+    p[1] = (char) ((value >> 16) & 0xFF);
+    p[2] = (char) ((value >> 8) & 0xFF);
+    p[3] = (char) (value & 0xFF);
+}
+
+PRIVATE unsigned long HTTP2_getLong (const unsigned char * p)
+{
+    return ((unsigned long) p[0] << 24) | ((unsigned long) p[1] << 16) |
+	((unsigned long) p[2] << 8) | (unsigned long) p[3];
+}
+
+PRIVATE void HTTP2_windowUpdate (HTInputStream * me, unsigned long id,
+				 long increment)
+{
+    char payload[4];
+    HTTP2_putLong(payload, (unsigned long) increment);
+    HTTP2_frame(me, H2_WINDOW_UPDATE, 0, id, 4);
+    HTTP2_write(me, payload, 4);
+}
+
+PRIVATE void HTTP2_reset (HTInputStream * me, unsigned long id, int error)
+{
+    char payload[4];
+    HTTRACE(PROT_TRACE, "HTTP/2...... Resetting stream %lu with error %d\n" _
+	    id _ error);
+    HTTP2_putLong(payload, (unsigned long) error);
+    HTTP2_frame(me, H2_RST_STREAM, 0, id, 4);
+    HTTP2_write(me, payload, 4);
+}
+
+/*
+**  Give back receive window for data which is out of the way, either
+**  because the read stream took it or because nobody wants it. Updates
+**  are sent when half a window has been used so that we don't send one
+**  for every frame.
+*/
+PRIVATE void HTTP2_consumed (HTInputStream * me, HTStream * stream, long bytes)
+{
+    if (bytes <= 0) return;
+    if ((me->consumed += bytes) >= CONNECTION_WINDOW / 2) {
+	HTTP2_windowUpdate(me, 0, me->consumed);
+	me->recv_window += me->consumed;
+	me->consumed = 0;
+    }
+    if (stream && stream->state == H2_OPEN && !stream->eos &&
+	(stream->consumed += bytes) >= STREAM_WINDOW / 2) {
+	HTTP2_windowUpdate(me, stream->id, stream->consumed);
+	stream->recv_window += stream->consumed;
+	stream->consumed = 0;
+    }
+}
+
+PRIVATE void HTTP2_flushOutput (HTInputStream * me)
+{
+    if (me->output && me->written) {
+	me->written = NO;
+	(*me->output->isa->flush)(me->output);
+    }
+}
+
+/*
+**  A connection error means that we can't trust anything on the
+**  connection anymore. We say goodbye and let the requests be recovered
+**  on a new connection.
+*/
+PRIVATE BOOL HTTP2_error (HTInputStream * me, int error, const char * msg)
+{
+    char payload[8];
+    HTTRACE(PROT_TRACE, "HTTP/2...... Connection error %d: %s\n" _ error _ msg);
+    HTTP2_putLong(payload, 0);
+    HTTP2_putLong(payload+4, (unsigned long) error);
+    HTTP2_frame(me, H2_GOAWAY, 0, 0, 8);
+    HTTP2_write(me, payload, 8);
+    HTTP2_flushOutput(me);
+    me->broken = YES;
+    return NO;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				 REQUEST STREAMS			     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void HTTP2Stream_delete (HTStream * me)
+{
+    HTChunk_delete(me->header);
+    HTChunk_delete(me->body);
+    HTChunk_delete(me->pending);
+    HT_FREE(me->fields);
+    HT_FREE(me);
+}
+
+PRIVATE HTStream * HTTP2_find (HTInputStream * me, unsigned long id)
+{
+    HTList * cur = me->streams;
+    HTStream * pres;
+    while ((pres = (HTStream *) HTList_nextObject(cur)))
+	if (pres->id == id) return pres;
+    return NULL;
+}
+
+/*
+**  Send as much of the body as the flow control windows allow. Unless we
+**  are told to send everything, small pieces are held back until we have
+**  a full frame or the end of the body.
+*/
+PRIVATE void HTTP2Stream_sendData (HTStream * me, BOOL all)
+{
+    HTInputStream * session = me->session;
+    BOOL sent = NO;
+    while (me->state == H2_OPEN && !me->ended) {
+	long pending = me->body ? HTChunk_size(me->body) - me->offset : 0;
+	long bytes = pending;
+	int flags;
+	if (!all && !me->end && pending < session->max_frame) break;
+	if (bytes > me->send_window) bytes = me->send_window;
+	if (bytes > session->send_window) bytes = session->send_window;
+	if (bytes > session->max_frame) bytes = session->max_frame;
+	if (bytes <= 0 && !(pending == 0 && me->end)) break;
+	flags = (bytes == pending && me->end) ? H2_END_STREAM : 0;
+	HTTP2_frame(session, H2_DATA, flags, me->id, bytes);
+	if (bytes > 0) {
+	    HTTP2_write(session, HTChunk_data(me->body) + me->offset, bytes);
+	    me->offset += bytes;
+	    me->send_window -= bytes;
+	    session->send_window -= bytes;
+	}
+	if (flags) me->ended = YES;
+	sent = YES;
+	if (bytes == pending) break;
+    }
+    if (me->body && me->offset >= HTChunk_size(me->body)) {
+	HTChunk_clear(me->body);
+	me->offset = 0;
+    }
+    if (sent) HTTP2_flushOutput(session);
+}
+
+/*
+**  Encode the request header and send it. This is done when the stream
+**  starts rather than when the header is ready as header blocks must be
+**  sent in the order they are encoded.
+*/
+PRIVATE void HTTP2Stream_start (HTStream * me)
+{
+    HTInputStream * session = me->session;
+    HTChunk * out = session->out;
+    const char * path = me->uri;
+    const char * data;
+    int size, fragment, cnt;
+    int weight = 1 + HTNet_priority(me->net) * 255 / HT_PRIORITY_MAX;
+    char priority[5];
+    BOOL end;
+
+    if (!strncasecomp(path, "http://", 7) || !strncasecomp(path, "https://", 8)) {
+	path = strchr(strstr(path, "//") + 2, '/');
+	if (!path) path = "/";
+    }
+    if (!*path) path = "/";
+    HTChunk_clear(out);
+    HTHPack_encode(session->encoder, out, ":method", me->method, NO);
+    HTHPack_encode(session->encoder, out, ":scheme", "http", NO);
+    HTHPack_encode(session->encoder, out, ":authority",
+		   me->authority ? me->authority : HTHost_name(session->host),
+		   NO);
+    HTHPack_encode(session->encoder, out, ":path", path, NO);
+    for (cnt = 0; cnt < me->nfields; cnt += 2) {
+	const char * name = me->fields[cnt];
+	BOOL sensitive = !strcmp(name, "authorization") ||
+	    !strcmp(name, "proxy-authorization");
+	HTHPack_encode(session->encoder, out, name, me->fields[cnt+1], sensitive);
+    }
+
+    me->id = session->next_id;
+    session->next_id += 2;
+    session->active++;
+    me->state = H2_OPEN;
+    me->send_window = session->initial_window;
+    me->recv_window = STREAM_WINDOW;
+    if (weight > 256) weight = 256;
+    if (weight < 1) weight = 1;
+    HTTRACE(PROT_TRACE, "HTTP/2...... Stream %lu is %s %s with weight %d\n" _
+	    me->id _ me->method _ path _ weight);
+
+    /* The priority goes first and the rest goes in CONTINUATION frames */
+    end = me->end && (!me->body || HTChunk_size(me->body) == 0);
+    data = HTChunk_data(out);
+    size = HTChunk_size(out);
+    fragment = size < session->max_frame - 5 ? size : session->max_frame - 5;
+    HTTP2_putLong(priority, 0);
+    priority[4] = (char) (weight - 1);
+    HTTP2_frame(session, H2_HEADERS,
+		H2_PRIORITY_FLAG | (fragment == size ? H2_END_HEADERS : 0) |
+		(end ? H2_END_STREAM : 0), me->id, fragment + 5);
+    HTTP2_write(session, priority, 5);
+    HTTP2_write(session, data, fragment);
+    while (fragment < size) {
+	int next = size - fragment;
+	if (next > session->max_frame) next = session->max_frame;
+	HTTP2_frame(session, H2_CONTINUATION,
+		    fragment + next == size ? H2_END_HEADERS : 0, me->id, next);
+	HTTP2_write(session, data + fragment, next);
+	fragment += next;
+    }
+    if (end) me->ended = YES;
+
+    /* We don't need the HTTP/1 header anymore */
+    HTChunk_delete(me->header);
+    me->header = NULL;
+    HT_FREE(me->fields);
+    me->method = me->uri = me->authority = NULL;
+    me->nfields = 0;
+
+    HTTP2Stream_sendData(me, NO);
+}
+
+/*
+**  Once the server has said goodbye we let the streams it still handles
+**  finish. Then the host gets a close notification so that the requests
+**  left over are recovered on a new connection when the last one is done.
+*/
+PRIVATE void HTTP2_goingAway (HTInputStream * me)
+{
+    if (me->goaway && !HTHost_closeNotification(me->host)) {
+	HTList * cur = me->streams;
+	HTStream * pres;
+	while ((pres = (HTStream *) HTList_nextObject(cur)))
+	    if (pres->id && pres->id <= me->last_id) return;
+	HTTRACE(PROT_TRACE, "HTTP/2...... No more streams on session %p\n" _ me);
+	HTHost_setCloseNotification(me->host, YES);
+    }
+}
+
+/*
+**  Start waiting streams as long as the server lets us, the most
+**  important request first.
+*/
+PRIVATE void HTTP2_startWaiting (HTInputStream * me)
+{
+    while (me->output && !me->goaway && !me->broken &&
+	   me->active < me->max_streams) {
+	HTList * cur = me->streams;
+	HTStream * pres;
+	HTStream * best = NULL;
+	while ((pres = (HTStream *) HTList_nextObject(cur))) {
+	    if (pres->state == H2_WAITING &&
+		(!best || HTNet_priority(pres->net) > HTNet_priority(best->net)))
+		best = pres;
+	}
+	if (!best) break;
+	if (me->next_id > MAX_STREAM_ID) {
+	    HTTRACE(PROT_TRACE, "HTTP/2...... Out of stream ids on %p\n" _ me);
+	    me->goaway = YES;
+	    me->last_id = MAX_STREAM_ID;
+	    HTTP2_goingAway(me);
+	    break;
+	}
+	HTTP2Stream_start(best);
+    }
+}
+
+/*
+**  Send whatever the flow control windows now allow
+*/
+PRIVATE void HTTP2_resume (HTInputStream * me)
+{
+    HTList * cur = me->streams;
+    HTStream * pres;
+    while ((pres = (HTStream *) HTList_nextObject(cur))) {
+	if (pres->state == H2_OPEN && !pres->ended)
+	    HTTP2Stream_sendData(pres, YES);
+    }
+    HTTP2_startWaiting(me);
+}
+
+/*
+**  The stream is done. If we are still sending then we tell the server
+**  unless it was the server that reset the stream (error is negative).
+*/
+PRIVATE void HTTP2Stream_close (HTStream * me, int result, int error)
+{
+    HTInputStream * session = me->session;
+    me->done = YES;
+    me->result = result;
+    if (me->pending) {
+	HTTP2_consumed(session, NULL, HTChunk_size(me->pending) - me->unflowed);
+	HTChunk_clear(me->pending);
+	me->unflowed = 0;
+    }
+    if (me->state == H2_OPEN) {
+	if (error >= 0 && !(error == H2_NO_ERROR && me->ended))
+	    HTTP2_reset(session, me->id, error);
+	session->active--;
+    }
+    me->state = H2_CLOSED;
+    HTTP2_startWaiting(session);
+}
+
+/*
+**  The request doesn't need the stream anymore. It is freed now unless
+**  the session is reading in which case we wait until it is done.
+*/
+PRIVATE void HTTP2Stream_detach (HTStream * me)
+{
+    HTInputStream * session = me->session;
+    if (session) {
+	if (me->pending)
+	    HTTP2_consumed(session, NULL, HTChunk_size(me->pending) - me->unflowed);
+	if (me->state == H2_OPEN) {
+	    HTTP2_reset(session, me->id, H2_CANCEL);
+	    session->active--;
+	    me->state = H2_CLOSED;
+	}
+	HTList_removeObject(session->streams, me);
+	me->detached = YES;
+	HTTP2_startWaiting(session);
+	HTTP2_goingAway(session);
+	HTTP2_flushOutput(session);
+	if (session->reading) {
+	    HTList_addObject(session->graveyard, me);
+	    return;
+	}
+    }
+    HTTP2Stream_delete(me);
+}
+
+PRIVATE char * HTTP2_nextLine (char ** pstr)
+{
+    char * line = *pstr;
+    char * eol = strchr(line, LF);
+    if (!eol) return NULL;
+    *pstr = eol + 1;
+    if (eol > line && *(eol-1) == CR) eol--;
+    *eol = '\0';
+    return line;
+}
+
+/*
+**  Split the HTTP/1 request header into the request line and the header
+**  fields. Names are put in lower case and fields which are about the
+**  connection rather than the request are left out.
+*/
+PRIVATE BOOL HTTP2Stream_parseHeader (HTStream * me)
+{
+    char * ptr = HTChunk_data(me->header);
+    char * line;
+    int lines = 0;
+    for (line = ptr; (line = strchr(line, LF)) != NULL; line++) lines++;
+    if ((me->fields = (char **) HT_MALLOC(2 * lines * sizeof(char *))) == NULL)
+	HT_OUTOFMEM("HTTP2Stream_parseHeader");
+    if ((line = HTTP2_nextLine(&ptr)) == NULL ||
+	(me->method = HTNextField(&line)) == NULL ||
+	(me->uri = HTNextField(&line)) == NULL)
+	return NO;
+    while ((line = HTTP2_nextLine(&ptr)) != NULL && *line) {
+	char * value = strchr(line, ':');
+	char * p;
+	if (!value) continue;
+	*value++ = '\0';
+	for (p = line; *p; p++) *p = TOLOWER(*p);
+	while (*value == ' ' || *value == '\t') value++;
+	for (p = value + strlen(value); p > value && isspace((int) *(p-1)); p--);
+	*p = '\0';
+	if (!strcmp(line, "host")) {
+	    me->authority = value;
+	    continue;
+	} else if (!strcmp(line, "content-length")) {
+	    me->length = atol(value);
+	} else if (!strcmp(line, "transfer-encoding")) {
+	    if (strstr(value, "chunked")) me->chunked = YES;
+	    continue;
+	} else if (!strcmp(line, "connection") || !strcmp(line, "keep-alive") ||
+		   !strcmp(line, "proxy-connection") ||
+		   !strcmp(line, "upgrade") || !strcmp(line, "expect") ||
+		   (!strcmp(line, "te") && strcasecomp(value, "trailers"))) {
+	    continue;
+	}
+	me->fields[me->nfields++] = line;
+	me->fields[me->nfields++] = value;
+    }
+    if (me->chunked) me->length = -1;
+    if (!HTMethod_hasEntity(HTRequest_method(me->request)) || !me->length)
+	me->end = YES;
+    return YES;
+}
+
+PRIVATE void HTTP2Stream_addBody (HTStream * me, const char * b, long l)
+{
+    if (l <= 0) return;
+    if (!me->body) me->body = HTChunk_new(FRAME_SIZE);
+    if (me->offset > 0 && me->offset >= HTChunk_size(me->body) / 2) {
+	int left = HTChunk_size(me->body) - me->offset;
+	memmove(HTChunk_data(me->body), HTChunk_data(me->body) + me->offset, left);
+	HTChunk_setSize(me->body, left);
+	me->offset = 0;
+    }
+    HTChunk_putb(me->body, b, (int) l);
+}
+
+/*
+**  HTTP/2 has its own framing so a chunked body is decoded before it is
+**  sent. The last chunk marks the end of the body.
+*/
+PRIVATE void HTTP2Stream_dechunk (HTStream * me, const char * b, long l)
+{
+    while (l > 0 && !me->end) {
+	if (me->chunk_state == CHUNK_DATA) {
+	    long bytes = l < me->chunk_left ? l : me->chunk_left;
+	    HTTP2Stream_addBody(me, b, bytes);
+	    b += bytes;
+	    l -= bytes;
+	    if ((me->chunk_left -= bytes) == 0) me->chunk_state = CHUNK_CRLF;
+	    continue;
+	}
+	switch (me->chunk_state) {
+	case CHUNK_SIZE:
+	    if (isxdigit((int) *b))
+		me->chunk_left = me->chunk_left * 16 +
+		    (isdigit((int) *b) ? *b - '0' : TOLOWER(*b) - 'a' + 10);
+	    else if (*b == ';')
+		me->chunk_state = CHUNK_EXTENSION;
+	    else if (*b == LF)
+		me->chunk_state = me->chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+	    break;
+	case CHUNK_EXTENSION:
+	    if (*b == LF)
+		me->chunk_state = me->chunk_left ? CHUNK_DATA : CHUNK_TRAILER;
+	    break;
+	case CHUNK_CRLF:
+	    if (*b == LF) me->chunk_state = CHUNK_SIZE;
+	    break;
+	case CHUNK_TRAILER:
+	    if (*b == LF) {
+		if (!me->chunk_left) me->end = YES;
+		me->chunk_left = 0;
+	    } else if (*b != CR)
+		me->chunk_left++;
+	    break;
+	default:
+	    break;
+	}
+	b++;
+	l--;
+    }
+}
+
+PRIVATE int HTTP2Stream_putBody (HTStream * me, const char * b, int l)
+{
+    if (me->end) return HT_OK;
+    if (me->chunked)
+	HTTP2Stream_dechunk(me, b, l);
+    else {
+	if (me->length >= 0 && l > me->length) l = (int) me->length;
+	HTTP2Stream_addBody(me, b, l);
+	if (me->length >= 0 && (me->length -= l) == 0) me->end = YES;
+    }
+    if (me->state == H2_OPEN) HTTP2Stream_sendData(me, NO);
+    return HT_OK;
+}
+
+/*
+**  Collect the request header until the empty line. The rest is body.
+*/
+PRIVATE int HTTP2Stream_put_block (HTStream * me, const char * b, int l)
+{
+    if (!me->session || !me->session->output) return HT_ERROR;
+    if (me->state == H2_HEADER) {
+	int start = HTChunk_size(me->header);
+	const char * data;
+	int size, cnt;
+	HTChunk_putb(me->header, b, l);
+	data = HTChunk_data(me->header);
+	size = HTChunk_size(me->header);
+	for (cnt = start > 3 ? start - 3 : 0; cnt + 3 < size; cnt++) {
+	    if (data[cnt] == CR && data[cnt+1] == LF &&
+		data[cnt+2] == CR && data[cnt+3] == LF)
+		break;
+	}
+	if (cnt + 3 >= size) return HT_OK;
+
+	/* Anything after the header is body */
+	cnt += 4;
+	HTChunk_terminate(me->header);
+	if (!HTTP2Stream_parseHeader(me)) {
+	    HTTRACE(PROT_TRACE, "HTTP/2...... Bad request header\n");
+	    return HT_ERROR;
+	}
+	me->state = H2_WAITING;
+	data = HTChunk_data(me->header);
+	if (cnt < size) HTTP2Stream_putBody(me, data + cnt, size - cnt);
+	HTTP2_startWaiting(me->session);
+	return HT_OK;
+    }
+    return HTTP2Stream_putBody(me, b, l);
+}
+
+PRIVATE int HTTP2Stream_put_string (HTStream * me, const char * s)
+{
+    return HTTP2Stream_put_block(me, s, (int) strlen(s));
+}
+
+PRIVATE int HTTP2Stream_put_character (HTStream * me, char c)
+{
+    return HTTP2Stream_put_block(me, &c, 1);
+}
+
+PRIVATE int HTTP2Stream_flush (HTStream * me)
+{
+    HTInputStream * session = me->session;
+    if (!session || !session->output) return HT_ERROR;
+    if (me->state == H2_OPEN) HTTP2Stream_sendData(me, YES);
+    me->session->written = NO;
+    return (*session->output->isa->flush)(session->output);
+}
+
+PRIVATE int HTTP2Stream_free (HTStream * me)
+{
+    HTTP2Stream_detach(me);
+    return HT_OK;
+}
+
+PRIVATE int HTTP2Stream_abort (HTStream * me, HTList * e)
+{
+    HTTRACE(PROT_TRACE, "HTTP/2...... ABORTING stream %lu\n" _ me->id);
+    HTTP2Stream_detach(me);
+    return HT_ERROR;
+}
+
+PRIVATE const HTStreamClass HTTP2StreamClass =
+{
+    "HTTP2Stream",
+    HTTP2Stream_flush,
+    HTTP2Stream_free,
+    HTTP2Stream_abort,
+    HTTP2Stream_put_character,
+    HTTP2Stream_put_string,
+    HTTP2Stream_put_block
+};
+
+/* ------------------------------------------------------------------------- */
+/*				  READING FRAMES			     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  Hand a piece of the response to the read stream of the request. Like
+**  the socket reader, we take WOULD BLOCK and PAUSE to mean that the data
+**  wasn't used so we must push it again later. Returns NO in that case.
+*/
+PRIVATE BOOL HTTP2_push (HTStream * stream, const char * b, int l)
+{
+    HTStream * target = HTNet_readStream(stream->net);
+    int status;
+    if (!target || stream->loaded || stream->done) return YES;
+    status = (*target->isa->put_block)(target, b, l);
+    if (status == HT_WOULD_BLOCK || status == HT_PAUSE) {
+	HTTRACE(PROT_TRACE, "HTTP/2...... Stream %lu target %s\n" _ stream->id _
+		status == HT_PAUSE ? "PAUSED" : "WOULD BLOCK");
+	return NO;
+    } else if (status == HT_LOADED)
+	stream->loaded = YES;
+    else if (status < 0) {
+	HTTRACE(PROT_TRACE, "HTTP/2...... Stream %lu target ERROR %d\n" _
+		stream->id _ status);
+	HTTP2Stream_close(stream, HT_ERROR, H2_CANCEL);
+    }
+    return YES;
+}
+
+/*
+**  Data which is subject to flow control only gives back window once the
+**  read stream has taken it. What it doesn't take is kept in order.
+*/
+PRIVATE void HTTP2_deliver (HTStream * stream, const char * b, int l,
+			    BOOL flow)
+{
+    if (stream->done || l <= 0) return;
+    if (!stream->pending || !HTChunk_size(stream->pending)) {
+	if (HTTP2_push(stream, b, l)) {
+	    if (flow) HTTP2_consumed(stream->session, stream, l);
+	    return;
+	}
+	if (!stream->pending) stream->pending = HTChunk_new(FRAME_SIZE);
+    }
+    if (!flow) stream->unflowed += l;
+    HTChunk_putb(stream->pending, b, l);
+}
+
+/*
+**  Turn each header field into an HTTP/1 header line. The status comes
+**  first as the pseudo header fields must come before the others.
+*/
+PRIVATE int HTTP2_field (void * context, const char * name, int name_len,
+			 const char * value, int value_len)
+{
+    HTInputStream * me = (HTInputStream *) context;
+    if ((me->list_size += name_len + value_len + 32) > MAX_HEADER_LIST) {
+	HTTRACE(PROT_TRACE, "HTTP/2...... Header list bigger than %d bytes\n" _
+		MAX_HEADER_LIST);
+	return HT_ERROR;
+    }
+    if (memchr(name, CR, name_len) || memchr(name, LF, name_len) ||
+	memchr(value, CR, value_len) || memchr(value, LF, value_len)) {
+	me->malformed = YES;
+    } else if (*name == ':') {
+	if (name_len == 7 && !strncmp(name, ":status", 7) && value_len == 3 &&
+	    !me->status && isdigit((int) *value)) {
+	    me->status = atoi(value);
+	    HTChunk_puts(me->text, "HTTP/2.0 ");
+	    HTChunk_putb(me->text, value, 3);
+	    HTChunk_putb(me->text, "\r\n", 2);
+	} else
+	    me->malformed = YES;
+    } else if (!me->status) {
+	me->malformed = YES;
+    } else if (!(name_len == 10 && !strncmp(name, "connection", 10)) &&
+	       !(name_len == 10 && !strncmp(name, "keep-alive", 10)) &&
+	       !(name_len == 17 && !strncmp(name, "transfer-encoding", 17))) {
+	HTChunk_putb(me->text, name, name_len);
+	HTChunk_putb(me->text, ": ", 2);
+	HTChunk_putb(me->text, value, value_len);
+	HTChunk_putb(me->text, "\r\n", 2);
+    }
+    return HT_OK;
+}
+
+PRIVATE void HTTP2_endStream (HTInputStream * me, HTStream * stream)
+{
+    if (!stream->response) {
+	HTRequest_addError(stream->request, ERR_FATAL, NO, HTERR_BAD_REPLY,
+			   NULL, 0, "HTTP2_read");
+	HTTP2Stream_close(stream, HT_ERROR, H2_PROTOCOL_ERROR);
+    } else
+	HTTP2Stream_close(stream, HT_LOADED, H2_NO_ERROR);
+}
+
+/*
+**  Push what the read stream didn't take last time. The stream ends when
+**  all of it has been taken.
+*/
+PRIVATE void HTTP2Stream_drain (HTStream * me)
+{
+    if (me->done) return;
+    if (me->pending && HTChunk_size(me->pending) > 0) {
+	long flow = HTChunk_size(me->pending) - me->unflowed;
+	if (!HTTP2_push(me, HTChunk_data(me->pending), HTChunk_size(me->pending)))
+	    return;
+	HTChunk_clear(me->pending);
+	me->unflowed = 0;
+	HTTP2_consumed(me->session, me, flow);
+	if (me->done) return;
+    }
+    if (me->eos) HTTP2_endStream(me->session, me);
+}
+
+/*
+**  A complete header block. It must be decoded even if we don't care
+**  about the stream as the decoder must see everything the encoder sent.
+*/
+PRIVATE BOOL HTTP2_headerBlock (HTInputStream * me)
+{
+    HTStream * stream = HTTP2_find(me, me->block_id);
+    HTChunk_clear(me->text);
+    me->list_size = 0;
+    me->status = 0;
+    me->malformed = NO;
+    if (HTHPack_decode(me->decoder, HTChunk_data(me->block),
+		       HTChunk_size(me->block), HTTP2_field, me) != HT_OK) {
+	/* Asking again would only get us the same header list */
+	if (me->list_size > MAX_HEADER_LIST) {
+	    HTTP2_error(me, H2_ENHANCE_YOUR_CALM, "header list too big");
+	    if (stream && !stream->done) HTTP2Stream_close(stream, HT_ERROR, -1);
+	    return NO;
+	}
+	return HTTP2_error(me, H2_COMPRESSION_ERROR, "bad header block");
+    }
+    HTChunk_clear(me->block);
+    if (!stream || stream->done) return YES;
+
+    if (!stream->response) {
+	if (me->malformed || !me->status) {
+	    HTRequest_addError(stream->request, ERR_FATAL, NO, HTERR_BAD_REPLY,
+			       NULL, 0, "HTTP2_read");
+	    HTTP2Stream_close(stream, HT_ERROR, H2_PROTOCOL_ERROR);
+	    return YES;
+	}
+	HTTRACE(PROT_TRACE, "HTTP/2...... Stream %lu got status %d\n" _
+		stream->id _ me->status);
+	if (me->status >= 200) stream->response = YES;
+	HTChunk_putb(me->text, "\r\n", 2);
+	HTTP2_deliver(stream, HTChunk_data(me->text), HTChunk_size(me->text), NO);
+
+	/*
+	**  The MIME parser takes a body without a length on a persistent
+	**  connection as the sign of an HTTP/1.0 server. Here the end of
+	**  the stream is the end of the body.
+	*/
+	if (!me->goaway && HTHost_closeNotification(me->host))
+	    HTHost_setCloseNotification(me->host, NO);
+    }
+    if (me->block_end && !stream->done) {
+	stream->eos = YES;
+	HTTP2Stream_drain(stream);
+    }
+    return YES;
+}
+
+PRIVATE BOOL HTTP2_data (HTInputStream * me, int flags, unsigned long id,
+			 const unsigned char * p, long len)
+{
+    HTStream * stream;
+    long body = len;
+    if (!id) return HTTP2_error(me, H2_PROTOCOL_ERROR, "DATA on stream 0");
+    if (flags & H2_PADDED) {
+	if (len < 1 || p[0] >= len)
+	    return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad padding");
+	body = len - 1 - p[0];
+	p++;
+    }
+    if ((me->recv_window -= len) < 0)
+	return HTTP2_error(me, H2_FLOW_CONTROL_ERROR, "connection window overrun");
+    if ((stream = HTTP2_find(me, id)) == NULL || stream->done || stream->eos) {
+	HTTP2_consumed(me, NULL, len);
+	return YES;
+    }
+    if ((stream->recv_window -= len) < 0 || !stream->response) {
+	HTTP2_consumed(me, NULL, len);
+	HTRequest_addError(stream->request, ERR_FATAL, NO, HTERR_BAD_REPLY,
+			   NULL, 0, "HTTP2_read");
+	HTTP2Stream_close(stream, HT_ERROR, stream->response ?
+			  H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+	return YES;
+    }
+    HTTP2_consumed(me, stream, len - body);			  /* Padding */
+    if (body > 0) {
+	HTRequest * request = stream->request;
+	HTAlertCallback * cbf = HTAlert_find(HT_PROG_READ);
+	if (HTNet_rawBytesCount(stream->net))
+	    HTNet_addBytesRead(stream->net, body);
+	if (cbf) {
+	    int tr = HTNet_bytesRead(stream->net);
+	    (*cbf)(request, HT_PROG_READ, HT_MSG_NULL, NULL, &tr, NULL);
+	}
+	HTTP2_deliver(stream, (const char *) p, (int) body, YES);
+    }
+    if (!stream->done && (flags & H2_END_STREAM)) {
+	stream->eos = YES;
+	HTTP2Stream_drain(stream);
+    }
+    return YES;
+}
+
+PRIVATE BOOL HTTP2_settings (HTInputStream * me, int flags,
+			     const unsigned char * p, long len)
+{
+    if (flags & H2_ACK) {
+	if (len) return HTTP2_error(me, H2_FRAME_SIZE_ERROR, "bad SETTINGS ACK");
+	return YES;
+    }
+    if (len % 6) return HTTP2_error(me, H2_FRAME_SIZE_ERROR, "bad SETTINGS");
+    for (; len > 0; p += 6, len -= 6) {
+	int setting = (p[0] << 8) | p[1];
+	unsigned long value = HTTP2_getLong(p+2);
+	switch (setting) {
+	case H2_HEADER_TABLE_SIZE:
+	    HTHPack_setMaxSize(me->encoder,
+			       value > HT_HPACK_TABLE_SIZE ? HT_HPACK_TABLE_SIZE :
+			       (int) value);
+	    break;
+	case H2_MAX_STREAMS:
+	    me->max_streams = value > 0x7FFF ? 0x7FFF : (int) value;
+	    break;
+	case H2_INITIAL_WINDOW:
+	    if (value > MAX_WINDOW)
+		return HTTP2_error(me, H2_FLOW_CONTROL_ERROR, "bad window");
+	    {
+		long delta = (long) value - me->initial_window;
+		HTList * cur = me->streams;
+		HTStream * pres;
+		while ((pres = (HTStream *) HTList_nextObject(cur))) {
+		    if (pres->state == H2_OPEN) pres->send_window += delta;
+		}
+		me->initial_window = (long) value;
+	    }
+	    break;
+	case H2_MAX_FRAME:
+	    if (value < FRAME_SIZE || value > MAX_FRAME_SIZE)
+		return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad frame size");
+	    me->max_frame = (long) value;
+	    break;
+	default:
+	    break;
+	}
+    }
+    HTTRACE(PROT_TRACE, "HTTP/2...... Server allows %d streams, window %ld, frames of %ld bytes\n" _
+	    me->max_streams _ me->initial_window _ me->max_frame);
+    HTTP2_frame(me, H2_SETTINGS, H2_ACK, 0, 0);
+    HTTP2_resume(me);
+    return YES;
+}
+
+PRIVATE BOOL HTTP2_dispatch (HTInputStream * me, int type, int flags,
+			     unsigned long id, const unsigned char * p, long len)
+{
+    if (me->continuation && type != H2_CONTINUATION)
+	return HTTP2_error(me, H2_PROTOCOL_ERROR, "expected CONTINUATION");
+
+    switch (type) {
+    case H2_DATA:
+	return HTTP2_data(me, flags, id, p, len);
+
+    case H2_HEADERS:
+	if (!id) return HTTP2_error(me, H2_PROTOCOL_ERROR, "HEADERS on stream 0");
+	if (flags & H2_PADDED) {
+	    if (len < 1 || p[0] >= len)
+		return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad padding");
+	    len -= 1 + p[0];
+	    p++;
+	}
+	if (flags & H2_PRIORITY_FLAG) {
+	    if (len < 5) return HTTP2_error(me, H2_FRAME_SIZE_ERROR, "bad HEADERS");
+	    p += 5;
+	    len -= 5;
+	}
+	HTChunk_clear(me->block);
+	HTChunk_putb(me->block, (const char *) p, (int) len);
+	me->block_id = id;
+	me->block_end = (flags & H2_END_STREAM) != 0;
+	if (flags & H2_END_HEADERS) return HTTP2_headerBlock(me);
+	me->continuation = YES;
+	return YES;
+
+    case H2_CONTINUATION:
+	if (!me->continuation || id != me->block_id)
+	    return HTTP2_error(me, H2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+	HTChunk_putb(me->block, (const char *) p, (int) len);
+	if (HTChunk_size(me->block) > MAX_HEADER_BLOCK)
+	    return HTTP2_error(me, H2_PROTOCOL_ERROR, "header block too big");
+	if (flags & H2_END_HEADERS) {
+	    me->continuation = NO;
+	    return HTTP2_headerBlock(me);
+	}
+	return YES;
+
+    case H2_PRIORITY:
+	if (len != 5) return HTTP2_error(me, H2_FRAME_SIZE_ERROR, "bad PRIORITY");
+	return YES;
+
+    case H2_RST_STREAM:
+	if (!id || len != 4)
+	    return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad RST_STREAM");
+	{
+	    HTStream * stream = HTTP2_find(me, id);
+	    HTTRACE(PROT_TRACE, "HTTP/2...... Server reset stream %lu with error %lu\n" _
+		    id _ HTTP2_getLong(p));
+	    if (stream && !stream->done) {
+		if (!stream->loaded)
+		    HTRequest_addError(stream->request, ERR_FATAL, NO,
+				       HTERR_BAD_REPLY, NULL, 0, "HTTP2_read");
+		HTTP2Stream_close(stream, stream->loaded ? HT_LOADED : HT_ERROR, -1);
+	    }
+	}
+	return YES;
+
+    case H2_SETTINGS:
+	if (id) return HTTP2_error(me, H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+	return HTTP2_settings(me, flags, p, len);
+
+    case H2_PUSH_PROMISE:
+	return HTTP2_error(me, H2_PROTOCOL_ERROR, "push is disabled");
+
+    case H2_PING:
+	if (id || len != 8) return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad PING");
+	if (!(flags & H2_ACK)) {
+	    HTTP2_frame(me, H2_PING, H2_ACK, 0, 8);
+	    HTTP2_write(me, (const char *) p, 8);
+	}
+	return YES;
+
+    case H2_GOAWAY:
+	if (id || len < 8) return HTTP2_error(me, H2_PROTOCOL_ERROR, "bad GOAWAY");
+	me->last_id = HTTP2_getLong(p) & MAX_STREAM_ID;
+	HTTRACE(PROT_TRACE, "HTTP/2...... Server going away after stream %lu with error %lu\n" _
+		me->last_id _ HTTP2_getLong(p+4));
+	me->goaway = YES;
+	{
+	    HTList * cur = me->streams;
+	    HTStream * pres;
+
+	    /* Streams the server never saw are left for the recovery */
+	    while ((pres = (HTStream *) HTList_nextObject(cur))) {
+		if (pres->state == H2_OPEN && pres->id > me->last_id) {
+		    pres->state = H2_CLOSED;
+		    me->active--;
+		}
+	    }
+	}
+	HTTP2_goingAway(me);
+	return YES;
+
+    case H2_WINDOW_UPDATE:
+	if (len != 4) return HTTP2_error(me, H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+	{
+	    long increment = (long) (HTTP2_getLong(p) & MAX_WINDOW);
+	    if (!id) {
+		if (!increment || increment > MAX_WINDOW - me->send_window)
+		    return HTTP2_error(me, H2_FLOW_CONTROL_ERROR, "bad window");
+		me->send_window += increment;
+		HTTP2_resume(me);
+	    } else {
+		HTStream * stream = HTTP2_find(me, id);
+		if (stream && stream->state == H2_OPEN) {
+		    if (!increment || increment > MAX_WINDOW - stream->send_window) {
+			HTRequest_addError(stream->request, ERR_FATAL, NO,
+					   HTERR_BAD_REPLY, NULL, 0, "HTTP2_read");
+			HTTP2Stream_close(stream, HT_ERROR, H2_FLOW_CONTROL_ERROR);
+		    } else {
+			stream->send_window += increment;
+			HTTP2Stream_sendData(stream, YES);
+		    }
+		}
+	    }
+	}
+	return YES;
+
+    default:						 /* Ignore unknown */
+	return YES;
+    }
+}
+
+/*
+**  Handle all complete frames in the buffer and return how many bytes we
+**  used or -1 if the connection is broken.
+*/
+PRIVATE int HTTP2_frames (HTInputStream * me, const char * data, int length)
+{
+    const unsigned char * p = (const unsigned char *) data;
+    int done = 0;
+    while (length - done >= FRAME_HEADER && !me->zombie) {
+	const unsigned char * f = p + done;
+	long flen = ((long) f[0] << 16) | ((long) f[1] << 8) | (long) f[2];
+	if (flen > FRAME_SIZE) {
+	    HTTP2_error(me, H2_FRAME_SIZE_ERROR, "frame too big");
+	    return -1;
+	}
+	if (length - done < FRAME_HEADER + flen) break;
+	if (!HTTP2_dispatch(me, f[3], f[4], HTTP2_getLong(f+5) & MAX_STREAM_ID,
+			    f + FRAME_HEADER, flen))
+	    return -1;
+	done += FRAME_HEADER + flen;
+    }
+    return done;
+}
+
+/*
+**  Read what is on the socket and handle the frames
+*/
+PRIVATE void HTTP2_readSocket (HTInputStream * me)
+{
+    const char * data;
+    int b_read, length, used;
+    while ((b_read = NETREAD(me->sockfd, me->buffer, INPUT_BUFFER_SIZE)) < 0) {
+#ifdef EAGAIN
+	if (socerrno==EAGAIN || socerrno==EWOULDBLOCK)      /* POSIX */
+#else
+	if (socerrno==EWOULDBLOCK) 			      /* BSD */
+#endif
+	    return;
+#ifdef EINTR
+	if (socerrno == EINTR) continue;
+#endif
+	HTTRACE(STREAM_TRACE, "HTTP/2...... Read error %d on socket %d\n" _
+		socerrno _ me->sockfd);
+	me->broken = YES;
+	return;
+    }
+    if (!b_read) {
+	HTTRACE(STREAM_TRACE, "HTTP/2...... FIN received on socket %d\n" _ me->sockfd);
+	me->broken = YES;
+	return;
+    }
+    HTTRACEDATA(me->buffer, b_read, "Reading from socket %d" _ me->sockfd);
+    HTStats_count(HTStats_forHost(me->host), HT_STATS_BYTES_IN, b_read);
+
+    /* Only copy the data if we have part of a frame from last time */
+    if (HTChunk_size(me->input) > 0) {
+	HTChunk_putb(me->input, me->buffer, b_read);
+	data = HTChunk_data(me->input);
+	length = HTChunk_size(me->input);
+    } else {
+	data = me->buffer;
+	length = b_read;
+    }
+    if ((used = HTTP2_frames(me, data, length)) < 0) return;
+    if (data == me->buffer) {
+	if (used < length) HTChunk_putb(me->input, data + used, length - used);
+    } else if (used > 0) {
+	memmove(HTChunk_data(me->input), data + used, length - used);
+	HTChunk_setSize(me->input, length - used);
+    }
+}
+
+/*
+**  Tell the requests which are done about it, one at a time as each call
+**  can change the list of streams.
+*/
+PRIVATE void HTTP2_notify (HTInputStream * me)
+{
+    while (!me->zombie) {
+	HTList * cur = me->streams;
+	HTStream * pres;
+	while ((pres = (HTStream *) HTList_nextObject(cur)) &&
+	       (!pres->done || pres->notified));
+	if (!pres) break;
+	pres->notified = YES;
+	HTTRACE(PROT_TRACE, "HTTP/2...... Stream %lu is done, calling net %p\n" _
+		pres->id _ pres->net);
+	(*pres->net->event.cbf)(me->sockfd, pres->net->event.param, HTEvent_READ);
+    }
+}
+
+PRIVATE void HTTP2Session_delete (HTInputStream * me)
+{
+    HTList * cur = me->streams;
+    HTStream * pres;
+    HTTRACE(PROT_TRACE, "HTTP/2...... Deleting session %p\n" _ me);
+    if (me->timer) HTTimer_delete(me->timer);
+    while ((pres = (HTStream *) HTList_nextObject(cur))) pres->session = NULL;
+    HTList_delete(me->streams);
+    cur = me->graveyard;
+    while ((pres = (HTStream *) HTList_nextObject(cur))) HTTP2Stream_delete(pres);
+    HTList_delete(me->graveyard);
+    HTHPack_delete(me->encoder);
+    HTHPack_delete(me->decoder);
+    HTChunk_delete(me->input);
+    HTChunk_delete(me->block);
+    HTChunk_delete(me->text);
+    HTChunk_delete(me->out);
+    HT_FREE(me->buffer);
+    HT_FREE(me);
+}
+
+PRIVATE void HTTP2_cleanup (HTInputStream * me)
+{
+    HTStream * pres;
+    while ((pres = (HTStream *) HTList_removeLastObject(me->graveyard)))
+	HTTP2Stream_delete(pres);
+    if (me->zombie) HTTP2Session_delete(me);
+}
+
+PRIVATE int NotifyEvent (HTTimer * timer, void * param, HTEventType type)
+{
+    HTInputStream * me = (HTInputStream *) param;
+    if (timer != me->timer)
+	HTDEBUGBREAK("HTTP/2 timer %p not in sync\n" _ timer);
+    HTTimer_delete(me->timer);
+    me->timer = NULL;
+    me->reading = YES;
+    HTTP2_notify(me);
+    me->reading = NO;
+    HTTP2_cleanup(me);
+    return HT_OK;
+}
+
+/*
+**  Give all streams with data left over another go. We start over when
+**  one gets rid of it as the list of streams may have changed.
+*/
+PRIVATE void HTTP2_drainAll (HTInputStream * me)
+{
+    HTList * cur = me->streams;
+    HTStream * pres;
+    while ((pres = (HTStream *) HTList_nextObject(cur))) {
+	if (pres->pending && HTChunk_size(pres->pending) > 0 && !pres->done) {
+	    HTTP2Stream_drain(pres);
+	    if (pres->done || !HTChunk_size(pres->pending)) cur = me->streams;
+	}
+    }
+}
+
+/*
+**  Read for everybody. The caller gets its status from HTTP2_read. The
+**  other requests which are done are called from a timer as they may
+**  be further up the stack, for example launching the caller.
+*/
+PRIVATE void HTTP2_process (HTInputStream * me, HTStream * caller)
+{
+    me->reading = YES;
+    HTHost_setRemainingRead(me->host, 0);
+    if (!me->broken) HTTP2_readSocket(me);
+    if (!me->zombie) {
+	HTList * cur = me->streams;
+	HTStream * pres;
+	HTTP2_drainAll(me);
+	HTTP2_flushOutput(me);
+	while ((pres = (HTStream *) HTList_nextObject(cur))) {
+	    if (pres->done && !pres->notified && pres != caller) {
+		if (!me->timer)
+		    me->timer = HTTimer_new(NULL, NotifyEvent, me, 1, YES, NO);
+		break;
+	    }
+	}
+    }
+    me->reading = NO;
+}
+
+PUBLIC int HTTP2_read (HTStream * stream)
+{
+    HTInputStream * me = stream ? stream->session : NULL;
+    int status;
+    if (!me) return HT_CLOSED;
+    if (!stream->detached) HTTP2Stream_drain(stream);
+    if (!me->reading) HTTP2_process(me, stream);
+    if (stream->detached)
+	status = HT_WOULD_BLOCK;
+    else if (stream->done)
+	status = stream->result;
+    else if (me->broken || me->zombie)
+	status = HT_CLOSED;
+    else {
+	HTHost_register(me->host, stream->net, HTEvent_READ);
+	status = HT_WOULD_BLOCK;
+    }
+    if (!me->reading) HTTP2_cleanup(me);
+    return status;
+}
+
+/* ------------------------------------------------------------------------- */
+/*				  SESSION STREAM			     */
+/* ------------------------------------------------------------------------- */
+
+PRIVATE int HTTP2Session_flush (HTInputStream * me)
+{
+    return me->output ? (*me->output->isa->flush)(me->output) : HT_OK;
+}
+
+/*
+**  The channel calls free every time a request is done with it. The
+**  read streams belong to the requests so there is nothing to do here.
+*/
+PRIVATE int HTTP2Session_free (HTInputStream * me)
+{
+    return HT_OK;
+}
+
+PRIVATE int HTTP2Session_abort (HTInputStream * me, HTList * e)
+{
+    return HT_ERROR;
+}
+
+PRIVATE int HTTP2Session_read (HTInputStream * me)
+{
+    if (!me->reading) {
+	HTTP2_process(me, NULL);
+	HTTP2_cleanup(me);
+    }
+    return HT_WOULD_BLOCK;
+}
+
+PRIVATE int HTTP2Session_close (HTInputStream * me)
+{
+    HTTRACE(PROT_TRACE, "HTTP/2...... Closing session %p\n" _ me);
+    me->output = NULL;
+    me->broken = YES;
+    if (me->reading)
+	me->zombie = YES;
+    else
+	HTTP2Session_delete(me);
+    return HT_OK;
+}
+
+PRIVATE int HTTP2Session_consumed (HTInputStream * me, size_t bytes)
+{
+    return HT_OK;
+}
+
+PRIVATE const HTInputStreamClass HTTP2SessionClass =
+{
+    "HTTP2Session",
+    HTTP2Session_flush,
+    HTTP2Session_free,
+    HTTP2Session_abort,
+    HTTP2Session_read,
+    HTTP2Session_close,
+    HTTP2Session_consumed
+};
+
+/*
+**  Find the session on the channel of the host or start a new one which
+**  replaces the socket reader.
+*/
+PRIVATE HTInputStream * HTTP2_session (HTHost * host)
+{
+    HTChannel * ch = HTHost_channel(host);
+    HTInputStream * me = HTChannel_input(ch);
+    char settings[18];
+    if (!ch) return NULL;
+    if (me && me->isa == &HTTP2SessionClass) return me;
+
+    /* Closing the reader would also free the read stream of the request */
+    if (me) {
+	HTNet * net = HTHost_getReadNet(host);
+	HTStream * target = HTNet_readStream(net);
+	HTNet_setReadStream(net, NULL);
+	(*me->isa->close)(me);
+	HTNet_setReadStream(net, target);
+    }
+
+    if ((me = (HTInputStream *) HT_CALLOC(1, sizeof(HTInputStream))) == NULL ||
+	(me->buffer = (char *) HT_MALLOC(INPUT_BUFFER_SIZE)) == NULL)
+	HT_OUTOFMEM("HTTP2_session");
+    me->isa = &HTTP2SessionClass;
+    me->host = host;
+    me->sockfd = HTChannel_socket(ch);
+    me->output = (HTStream *) HTChannel_getChannelOStream(ch);
+    me->encoder = HTHPack_new(HT_HPACK_TABLE_SIZE);
+    me->decoder = HTHPack_new(HT_HPACK_TABLE_SIZE);
+    me->streams = HTList_new();
+    me->graveyard = HTList_new();
+    me->input = HTChunk_new(FRAME_SIZE);
+    me->block = HTChunk_new(1024);
+    me->text = HTChunk_new(1024);
+    me->out = HTChunk_new(1024);
+    me->next_id = 1;
+    me->max_streams = DEFAULT_STREAMS;
+    me->initial_window = DEFAULT_WINDOW;
+    me->max_frame = FRAME_SIZE;
+    me->send_window = DEFAULT_WINDOW;
+    me->recv_window = CONNECTION_WINDOW;
+    HTChannel_setInput(ch, me);
+    HTTRACE(PROT_TRACE, "HTTP/2...... New session %p on socket %d\n" _ me _ me->sockfd);
+
+    /* The preface, our settings and a bigger connection window */
+    HTTP2_write(me, PREFACE, sizeof(PREFACE) - 1);
+    settings[0] = 0;
+    settings[1] = H2_ENABLE_PUSH;
+    HTTP2_putLong(settings+2, 0);
+    settings[6] = 0;
+    settings[7] = H2_INITIAL_WINDOW;
+    HTTP2_putLong(settings+8, STREAM_WINDOW);
+    settings[12] = 0;
+    settings[13] = H2_MAX_HEADER_LIST;
+    HTTP2_putLong(settings+14, MAX_HEADER_LIST);
+    HTTP2_frame(me, H2_SETTINGS, 0, 0, 18);
+    HTTP2_write(me, settings, 18);
+    HTTP2_windowUpdate(me, 0, CONNECTION_WINDOW - DEFAULT_WINDOW);
+    return me;
+}
+
+PUBLIC HTStream * HTTP2Request_new (HTRequest * request, HTHost * host)
+{
+    HTInputStream * session = HTTP2_session(host);
+    HTStream * me;
+    if (!session) return HTErrorStream();
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+	HT_OUTOFMEM("HTTP2Request_new");
+    me->isa = &HTTP2StreamClass;
+    me->session = session;
+    me->request = request;
+    me->net = HTRequest_net(request);
+    me->header = HTChunk_new(512);
+    me->length = -1;
+    HTList_appendObject(session->streams, me);
+    return me;
+}
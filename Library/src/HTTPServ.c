@@ -18,6 +18,7 @@
 #include "WWWCore.h"
 #include "HTHeader.h"
 #include "HTMIMERq.h"
+#include "HTReqMan.h"
 #include "HTNetMan.h"
 #include "HTTPUtil.h"
 #include "HTTPRes.h"
@@ -43,6 +44,7 @@ typedef struct _https_info {
     HTList *	clients;		          /* List of client requests */
     HTTPState	state;			  /* Current State of the connection */
     HTNet *	net;
+    BOOL	stats;			    /* Next client asks for statistics */
 } https_info;
 
 /* The HTTP Receive Stream */
@@ -60,6 +62,8 @@ struct _HTInputStream {
     const HTInputStreamClass *	isa;
 };
 
+PRIVATE char * StatsPath = NULL;		  /* Where to serve statistics */
+
 /* ------------------------------------------------------------------------- */
 
 /*	ServerCleanup
@@ -148,7 +152,7 @@ PRIVATE int MakeReplyPipe (HTStream * me, HTRequest * client)
 	HTFormat format = HTAnchor_format(anchor);
 	me->target = (format == WWW_UNKNOWN) ?
 	    HTTPResponse_new(client, me->target, YES, HTTP_11) :
-	    HTMIMERequest_new(client,
+	    HTMIMEReply_new(client,
 	        HTTPResponse_new(client,me->target, NO, HTTP_11), YES);
     }
     return HT_OK;
@@ -251,6 +255,10 @@ PRIVATE int ParseRequest (HTStream * me)
     }
     HTRequest_setMethod(client, method);
 
+    /* Is it a request for the statistics? */
+    me->http->stats = (StatsPath && method == METHOD_GET && request_uri &&
+		       !strcmp(request_uri, StatsPath));
+
     /* Find an anchor for the request URI */
     if (request_uri) {
 	char * uri = HTParse(request_uri, "file:", PARSE_ALL);
@@ -367,6 +375,43 @@ PRIVATE HTStream * HTTPReceive_new (HTRequest * request, https_info * http)
 
 /* ------------------------------------------------------------------------- */
 
+/*
+**	Write the request statistics as a complete response directly on the
+**	channel and free the reply stream of the client request as it is not
+**	going to be loaded.
+*/
+PRIVATE int ServeStats (HTRequest * client)
+{
+    HTStream * reply = client->orig_output_stream;
+    HTStream * target = reply->target;
+    HTChunk * text = HTStats_text();
+    char header[128];
+    HTTRACE(PROT_TRACE, "Serv HTTP... Serving statistics\n");
+    sprintf(header, "%s 200 OK%c%cContent-Type: text/plain%c%cContent-Length: %d%c%c%c%c",
+	    HTTP_VERSION, CR, LF, CR, LF, HTChunk_size(text), CR, LF, CR, LF);
+    (*target->isa->put_string)(target, header);
+    (*target->isa->put_block)(target, HTChunk_data(text), HTChunk_size(text));
+    HTChunk_delete(text);
+    HTNoFreeStream_delete(client->output_stream);
+    client->output_stream = client->orig_output_stream = NULL;
+    HT_FREE(reply);
+    return (*target->isa->flush)(target);
+}
+
+PUBLIC BOOL HTServHTTP_setStatsPath (const char * path)
+{
+    if (path && *path)
+	StrAllocCopy(StatsPath, path);
+    else
+	HT_FREE(StatsPath);
+    return YES;
+}
+
+PUBLIC const char * HTServHTTP_statsPath (void)
+{
+    return StatsPath;
+}
+
 /*	HTServHTTP
 **	----------
 **	Serv Document using HTTP.
@@ -388,6 +433,7 @@ PUBLIC int HTServHTTP (SOCKET soc, HTRequest * request)
     if ((http = (https_info *) HT_CALLOC(1, sizeof(https_info))) == NULL)
 	HT_OUTOFMEM("HTServHTTP");
     http->server = request;
+    http->net = net;
     http->state = HTTPS_BEGIN;
     http->clients = HTList_new();
     HTNet_setContext(net, http);
@@ -473,7 +519,12 @@ PRIVATE int ServEvent (SOCKET soc, void * pVoid, HTEventType type)
 	case HTTPS_LOAD_CLIENT:
 	{
 	    HTRequest * client = HTList_removeFirstObject(http->clients);
-	    HTLoad(client, NO);
+	    if (http->stats) {
+		http->stats = NO;
+		ServeStats(client);
+		HTRequest_delete(client);
+	    } else
+		HTLoad(client, NO);
 	    http->state = HTTPS_BEGIN;
 	    break;
 	}
@@ -28,9 +28,31 @@ struct _HTTimer {
     BOOL	repetitive;
     void *	param;		/* Client supplied context */
     HTTimerCallback * cbf;
+    int		index;		/* Position in heap, TIMER_IDLE or TIMER_UNUSED */
+    unsigned long sequence;	/* Orders timers with the same expiry */
+    HTTimer *	next;		/* Next unused timer */
 };
 
-PRIVATE HTList * Timers = NULL;			   /* List of timers */
+/*
+**  Active timers are kept in a binary min-heap ordered by expiration time
+**  so that we can find the next one in O(1) and insert, refresh and delete
+**  in O(log n). Each timer knows its own position in the heap so that we
+**  don't have to search for it.
+**
+**  Callers may hand us a timer which has already been deleted, so deleted
+**  timers are never given back to the system. They are kept on a list of
+**  unused timers and handed out again by HTTimer_new. That way the index
+**  of a deleted timer can always be read and is never a slot in the heap.
+*/
+#define TIMER_HEAP_SIZE		64	    /* Initial number of heap slots */
+#define TIMER_IDLE		(-1)	  /* Not in the heap, not deleted */
+#define TIMER_UNUSED		(-2)	      /* Deleted, on the unused list */
+
+PRIVATE HTTimer ** Timers = NULL;		       /* Heap of timers */
+PRIVATE int TimerCount = 0;
+PRIVATE int TimerAllocated = 0;
+PRIVATE unsigned long TimerSequence = 0;
+PRIVATE HTTimer * UnusedTimers = NULL;
 
 PRIVATE HTTimerSetCallback * SetPlatformTimer = NULL;
 PRIVATE HTTimerSetCallback * DeletePlatformTimer = NULL;
@@ -50,32 +72,119 @@ PRIVATE HTTimer * InTimer = NULL;
 
 #endif /* !WATCH_RECURSION */
 
+/* ------------------------------------------------------------------------- */
+/*				TIMER HEAP				     */
+/* ------------------------------------------------------------------------- */
+
+/*
+**  Timers with the same expiry go off in the reverse order of when they
+**  were last set, as they always did when the timers were kept in a list
+*/
+#define TIMER_BEFORE(a, b) \
+	((a)->expires < (b)->expires || \
+	 ((a)->expires == (b)->expires && (a)->sequence > (b)->sequence))
+
+PRIVATE void TimerHeap_place (int index, HTTimer * timer)
+{
+    Timers[index] = timer;
+    timer->index = index;
+}
+
+PRIVATE void TimerHeap_up (int index)
+{
+    HTTimer * timer = Timers[index];
+    while (index > 0) {
+	int parent = (index-1) / 2;
+	if (!TIMER_BEFORE(timer, Timers[parent])) break;
+	TimerHeap_place(index, Timers[parent]);
+	index = parent;
+    }
+    TimerHeap_place(index, timer);
+}
+
+PRIVATE void TimerHeap_down (int index)
+{
+    HTTimer * timer = Timers[index];
+    for (;;) {
+	int child = 2*index + 1;
+	if (child >= TimerCount) break;
+	if (child+1 < TimerCount && TIMER_BEFORE(Timers[child+1], Timers[child]))
+	    child++;
+	if (!TIMER_BEFORE(Timers[child], timer)) break;
+	TimerHeap_place(index, Timers[child]);
+	index = child;
+    }
+    TimerHeap_place(index, timer);
+}
+
+PRIVATE void TimerHeap_add (HTTimer * timer)
+{
+    if (TimerCount >= TimerAllocated) {
+	int size = TimerAllocated ? TimerAllocated*2 : TIMER_HEAP_SIZE;
+	if ((Timers = (HTTimer **) HT_REALLOC(Timers, size*sizeof(HTTimer *))) == NULL)
+	    HT_OUTOFMEM("TimerHeap_add");
+	TimerAllocated = size;
+    }
+    TimerHeap_place(TimerCount++, timer);
+    TimerHeap_up(timer->index);
+}
+
+PRIVATE void TimerHeap_remove (HTTimer * timer)
+{
+    int index = timer->index;
+    HTTimer * last;
+    if (index < 0 || index >= TimerCount || Timers[index] != timer) return;
+    timer->index = TIMER_IDLE;
+    last = Timers[--TimerCount];
+    if (last != timer) {
+	TimerHeap_place(index, last);
+	if (index > 0 && TIMER_BEFORE(last, Timers[(index-1)/2]))
+	    TimerHeap_up(index);
+	else
+	    TimerHeap_down(index);
+    }
+}
+
+/*
+**  The expiration time of a timer already in the heap has changed
+*/
+PRIVATE void TimerHeap_update (HTTimer * timer)
+{
+    int index = timer->index;
+    if (index > 0 && TIMER_BEFORE(timer, Timers[(index-1)/2]))
+	TimerHeap_up(index);
+    else
+	TimerHeap_down(index);
+}
+
+#define TimerHeap_isMember(t) \
+	((t)->index >= 0 && (t)->index < TimerCount && Timers[(t)->index] == (t))
+
+/* ------------------------------------------------------------------------- */
+
 /* JK: used by Amaya */
 PUBLIC BOOL HTTimer_expireAll (void)
 {
-  HTList * cur;
   HTTimer * timer;
-  if (Timers) {
+  int cnt;
+  if (TimerCount > 0) {
     /*
     **  first delete all plattform specific timers to
     **  avoid having a concurrent callback
     */
-    cur = Timers;
-    while ((timer = (HTTimer *) HTList_nextObject(cur))) {
-      if (DeletePlatformTimer) DeletePlatformTimer(timer);
+    for (cnt = 0; cnt < TimerCount; cnt++) {
+      if (DeletePlatformTimer) DeletePlatformTimer(Timers[cnt]);
     }
  
     /*
     ** simulate a timer timeout thru timer_dispatch
     ** to kill its context
     */
-    cur = Timers;
-    while ((timer = (HTTimer *) HTList_nextObject(cur))) {
+    while (TimerCount > 0) {
+      timer = Timers[0];
           /* avoid having it being refreshed */
       timer->repetitive = NO;
       HTTimer_dispatch (timer);
-      /* as the timer is erased, we start again from the top of the list */
-      cur = Timers;
     }
     return YES;
   }
@@ -89,13 +198,11 @@ PUBLIC BOOL HTTimer_expireAll (void)
 **  timer with the next expiration time if repetitive. Otherwise we just leave
 **  it
 */
-PRIVATE int Timer_dispatch (HTList * cur, HTList * last)
+PRIVATE int Timer_dispatch (HTTimer * timer)
 {
-    HTTimer * timer;
     int ret = HT_ERROR;
 
-    timer = (HTTimer *)HTList_objectOf(cur);
-    if (timer == NULL) {
+    if (timer == NULL || !TimerHeap_isMember(timer)) {
 #if 0
         HTDEBUGBREAK("Timer dispatch couldn't find a timer\n");
 #endif
@@ -112,7 +219,7 @@ PRIVATE int Timer_dispatch (HTList * cur, HTList * last)
     if (timer->repetitive)
 	HTTimer_new(timer, timer->cbf, timer->param, timer->millis, YES, YES);
     else
-	HTList_quickRemoveElement(cur, last);
+	TimerHeap_remove(timer);
     HTTRACE(THD_TRACE, "Timer....... Dispatch timer %p\n" _ timer);
     ret = (*timer->cbf) (timer, timer->param, HTEvent_TIMEOUT);
     return ret;
@@ -160,13 +267,16 @@ PUBLIC BOOL HTTimer_isRelative (HTTimer * timer)
 
 PUBLIC BOOL HTTimer_delete (HTTimer * timer)
 {
-    HTList * last;
-    HTList * cur;
+    if (!timer || timer->index == TIMER_UNUSED) {
+	HTTRACE(THD_TRACE, "Timer....... Timer %p already deleted\n" _ timer);
+	return NO;
+    }
     CHECKME(timer);
-    if ((cur = HTList_elementOf(Timers, (void *)timer, &last)) == NULL) CLEARME(timer);
-    if (HTList_quickRemoveElement(cur, last)) {
+    if (TimerHeap_isMember(timer)) {
+	TimerHeap_remove(timer);
 	HTTRACE(THD_TRACE, "Timer....... Deleted active timer %p\n" _ timer);
     } else { 
+	CLEARME(timer);
 	HTTRACE(THD_TRACE, "Timer....... Deleted expired timer %p\n" _ timer);
     }
 
@@ -176,7 +286,9 @@ PUBLIC BOOL HTTimer_delete (HTTimer * timer)
     if (DeletePlatformTimer) DeletePlatformTimer(timer);
 
     CLEARME(timer);
-    HT_FREE(timer);
+    timer->index = TIMER_UNUSED;
+    timer->next = UnusedTimers;
+    UnusedTimers = timer;
     return YES;
 }
 
@@ -184,11 +296,9 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
 			      void * param, ms_t millis, BOOL relative,
 			      BOOL repetitive)
 {
-    HTList * last;
-    HTList * cur;
     ms_t now = HTGetTimeInMillis();
     ms_t expires;
-    HTTimer * pres;
+    BOOL found = NO;
 
     CHECKME(timer);
     expires = millis;
@@ -197,42 +307,35 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     else
 	millis = expires-now;
 
-    if (Timers == NULL)
-	Timers = HTList_new();
-
     if (timer) {
 
 	/*	if a timer is specified, it should already exist
 	 */
-	if ((cur = HTList_elementOf(Timers, (void *)timer, &last)) == NULL) {
+	if (!TimerHeap_isMember(timer)) {
 	    HTDEBUGBREAK("Timer %p not found\n" _ timer);
 	    CLEARME(timer);
 	    return NULL;
 	}
-	HTList_quickRemoveElement(cur, last);
+	found = YES;
 	HTTRACE(THD_TRACE, "Timer....... Found timer %p with callback %p, context %p, and %s timeout %d\n" _ 
 		    timer _ cbf _ param _ relative ? "relative" : "absolute" _ millis);
-	/* could optimize by sorting from last when ((HTList *)(last->object))->expires < expires (most common case) */
     } else {
 
-	/*	create a new timer
+	/*	create a new timer or reuse one that has been deleted
 	 */
-	if ((timer = (HTTimer *) HT_CALLOC(1, sizeof(HTTimer))) == NULL)
+	if (UnusedTimers) {
+	    timer = UnusedTimers;
+	    UnusedTimers = timer->next;
+	    memset((void *) timer, '\0', sizeof(HTTimer));
+	} else if ((timer = (HTTimer *) HT_CALLOC(1, sizeof(HTTimer))) == NULL)
 	    HT_OUTOFMEM("HTTimer_new");
-	last = Timers;
+	timer->index = TIMER_IDLE;
 	HTTRACE(THD_TRACE, "Timer....... Created %s timer %p with callback %p, context %p, and %s timeout %d\n" _ 
 		    repetitive ? "repetitive" : "one shot" _ 
 		    timer _ cbf _ param _ 
 		    relative ? "relative" : "absolute" _ millis);
     }
 
-    /*
-    **  Sort new element into list
-    */
-    for (cur = last; 
-	 (pres = (HTTimer *) HTList_nextObject(cur)) != NULL && pres->expires < expires; 
-	 last = cur);
-
     /*
     **  If the expiration is 0 then we still register it but dispatch it immediately.
     */
@@ -244,12 +347,17 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     timer->millis = millis;
     timer->relative = relative;
     timer->repetitive = repetitive;
+    timer->sequence = TimerSequence++;
     SETME(timer);
 
     /*
-    **	add to list if timer is new
+    **	Sort the timer into the heap - new timers are added at the bottom,
+    **	existing ones are moved to their new position
     */
-    cur = HTList_addList(last, (void *)timer);
+    if (found)
+	TimerHeap_update(timer);
+    else
+	TimerHeap_add(timer);
 
     /*
     **  Call any platform specific timer handler
@@ -257,7 +365,7 @@ PUBLIC HTTimer * HTTimer_new (HTTimer * timer, HTTimerCallback * cbf,
     if (SetPlatformTimer) SetPlatformTimer(timer);
 
     /* Check if the timer object has already expired. If so then dispatch */
-    if (timer->expires <= now) Timer_dispatch(cur, last);
+    if (timer->expires <= now) Timer_dispatch(timer);
 
     CLEARME(timer);
     return timer;
@@ -275,10 +383,11 @@ PUBLIC BOOL HTTimer_refresh (HTTimer * timer, ms_t now)
 
 PUBLIC BOOL HTTimer_deleteAll (void)
 {
-    HTList * cur = Timers;
-    HTTimer * pres;
+    BOOL found = NO;
     if (Timers) {
-	while ((pres = (HTTimer *) HTList_nextObject(cur))) {
+	int cnt;
+	for (cnt = 0; cnt < TimerCount; cnt++) {
+	    HTTimer * pres = Timers[cnt];
 
 	    /*
 	    **  Call any platform specific timer handler
@@ -286,19 +395,22 @@ PUBLIC BOOL HTTimer_deleteAll (void)
 	    if (DeletePlatformTimer) DeletePlatformTimer(pres);
 	    HT_FREE(pres);
 	}
-	HTList_delete(Timers);
-	Timers = NULL;
-	return YES;
+	HT_FREE(Timers);
+	TimerCount = TimerAllocated = 0;
+	found = YES;
     }
-    return NO;
+    while (UnusedTimers) {
+	HTTimer * pres = UnusedTimers;
+	UnusedTimers = pres->next;
+	HT_FREE(pres);
+	found = YES;
+    }
+    return found;
 }
 
 PUBLIC int HTTimer_dispatch (HTTimer * timer)
 {
-    HTList * cur;
-    HTList * last = Timers;
-    cur = HTList_elementOf(Timers, (void *)timer, &last);
-    return Timer_dispatch(cur, last);
+    return Timer_dispatch(timer);
 }
 
 /*
@@ -311,30 +423,20 @@ PUBLIC BOOL HTTimer_hasTimerExpired (HTTimer * timer)
 
 PUBLIC int HTTimer_next (ms_t * pSoonest)
 {
-    HTList * cur = Timers;
-    HTList * last = Timers;
     HTTimer * pres;
     ms_t now = HTGetTimeInMillis();
     int ret = HT_OK;
 
     /*
-    **  Dispatch all timers that have expired
+    **  Dispatch all timers that have expired. The top of the heap is always
+    **  the next one to expire.
     */
-    while (Timers && (pres = (HTTimer *) HTList_nextObject(cur))) {
-	if (pres->expires <= now) {
-	    if ((ret = Timer_dispatch(cur, last)) != HT_OK) break;
-	    cur = last = Timers;
-	} else {
-	    last = cur;
-	}	
+    while (TimerCount > 0 && (pres = Timers[0])->expires <= now) {
+	if ((ret = Timer_dispatch(pres)) != HT_OK) break;
     }
 
     if (pSoonest) {
-	/*
-	**	First element in Timers is the next to expire.
-	*/
-	HTList * cur = Timers;	/* for now */
-	pres = (HTTimer *) HTList_nextObject(cur);
+	pres = TimerCount > 0 ? Timers[0] : NULL;
 	*pSoonest = pres ? pres->expires - now : 0;
     }
     return ret;
@@ -344,9 +446,9 @@ PUBLIC int HTTimer_next (ms_t * pSoonest)
 extern void CheckSockEvent(HTTimer * timer, HTTimerCallback * cbf, void * param);
 PRIVATE void CheckTimers(void)
 {
-    HTList * cur = Timers;
-    HTTimer * pres;
-    while ((pres = (HTTimer *) HTList_nextObject(cur))) {
+    int cnt;
+    for (cnt = 0; cnt < TimerCount; cnt++) {
+	HTTimer * pres = Timers[cnt];
 	CheckSockEvent(pres, pres->cbf, pres->param);
     }
 }
@@ -508,7 +508,7 @@ PUBLIC time_t HTParseTime (const char * str, HTUserProfile * up, BOOL expand)
 	tm.tm_hour < 0  ||  tm.tm_hour > 23  ||
 	tm.tm_mday < 1  ||  tm.tm_mday > 31  ||
 	tm.tm_mon  < 0  ||  tm.tm_mon  > 11  ||
-	tm.tm_year <70  ||  tm.tm_year >120) {
+	tm.tm_year <70  ||  tm.tm_year >200) {
 	HTTRACE(CORE_TRACE, "ERROR....... Parsed illegal time: %02d.%02d.%02d %02d:%02d:%02d\n" _ 
 	       tm.tm_mday _ tm.tm_mon+1 _ tm.tm_year _ 
 	       tm.tm_hour _ tm.tm_min _ tm.tm_sec);
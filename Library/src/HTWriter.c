@@ -53,6 +53,71 @@ PRIVATE int HTWriter_abort (HTOutputStream * me, HTList * e)
     return HT_ERROR;
 }
 
+/*
+**	Handle a failed write on the socket. HT_CONTINUE means that the call
+**	was interrupted and should be tried again and HT_WOULD_BLOCK that we
+**	have registered for a WRITE event. Otherwise the error is added to
+**	the request and HT_CLOSED or HT_ERROR is returned.
+*/
+PRIVATE int HTWriter_error (HTOutputStream * me, HTNet * net, char * where)
+{
+    HTHost * host = me->host;
+#ifdef EAGAIN
+    if (socerrno == EAGAIN || socerrno == EWOULDBLOCK)	      /* POSIX, SVR4 */
+#else
+    if (socerrno == EWOULDBLOCK)				      /* BSD */
+#endif
+    {
+	HTHost_register(host, net, HTEvent_WRITE);
+	return HT_WOULD_BLOCK;
+#ifdef EINTR
+    } else if (socerrno == EINTR) {
+	/*
+	**	EINTR	A signal was caught during the  write  opera-
+	**		tion and no data was transferred.
+	*/
+	HTTRACE(STREAM_TRACE, "Write Socket call interrupted - try again\n");
+	return HT_CONTINUE;
+#endif
+    }
+    host->broken_pipe = YES;
+#ifdef EPIPE
+    if (socerrno == EPIPE) {
+	/* JK: an experimental bug solution proposed by
+	   Olga and Mikhael */
+	HTTRACE(STREAM_TRACE, "Write Socket got EPIPE\n");
+	HTHost_unregister(host, net, HTEvent_WRITE);
+	HTHost_register(host, net, HTEvent_CLOSE);
+	/* @@ JK: seems that some functions check the errors 
+	   as part of the flow control */
+	HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO, where);
+	return HT_CLOSED;
+    }
+#endif /* EPIPE */
+    /* all errors that aren't EPIPE */
+    HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO, where);
+    return HT_ERROR;
+}
+
+/*
+**	Account for bytes that have gone out on the socket
+*/
+PRIVATE void HTWriter_written (HTOutputStream * me, HTNet * net, int bytes)
+{
+    HTNet_addBytesWritten(net, bytes);
+    HTStats_count(HTStats_forHost(me->host), HT_STATS_BYTES_OUT, bytes);
+    HTTRACE(STREAM_TRACE, "Write Socket %d bytes written to %d\n" _
+	    bytes _ HTChannel_socket(HTHost_channel(me->host)));
+    {
+	HTAlertCallback *cbf = HTAlert_find(HT_PROG_WRITE);
+	if (cbf) {
+	    int tw = HTNet_bytesWritten(net);
+	    (*cbf)(net->request, HT_PROG_WRITE,
+		   HT_MSG_NULL, NULL, &tw, NULL);
+	}
+    }
+}
+
 /*	Write to the socket
 **
 ** According to Solaris 2.3 man on write:
@@ -126,62 +191,20 @@ PRIVATE int HTWriter_write (HTOutputStream * me, const char * buf, int len)
     /* Write data to the network */
     while (wrtp < limit) {
 	if ((b_write = NETWRITE(soc, wrtp, len)) < 0) {
-#ifdef EAGAIN
-	    if (socerrno == EAGAIN || socerrno == EWOULDBLOCK)/* POSIX, SVR4 */
-#else
-	    if (socerrno == EWOULDBLOCK)			      /* BSD */
-#endif
-	    {
-		HTHost_register(host, net, HTEvent_WRITE);
+	    int status = HTWriter_error(me, net, "NETWRITE");
+	    if (status == HT_CONTINUE) continue;
+	    if (status == HT_WOULD_BLOCK) {
 		me->offset = wrtp - buf;
 		HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (offset %d)\n" _ soc _ me->offset);
-		return HT_WOULD_BLOCK;
-#ifdef EINTR
-	    } else if (socerrno == EINTR) {
-		/*
-		**	EINTR	A signal was caught during the  write  opera-
-		**		tion and no data was transferred.
-		*/
-		HTTRACE(STREAM_TRACE, "Write Socket call interrupted - try again\n");
-		continue;
-#endif
-	    } else {
-		host->broken_pipe = YES;
-#ifdef EPIPE
-	        if (socerrno == EPIPE) {
-		    /* JK: an experimental bug solution proposed by
-                       Olga and Mikhael */
-		    HTTRACE(STREAM_TRACE, "Write Socket got EPIPE\n");
-		    HTHost_unregister(host, net, HTEvent_WRITE);
-		    HTHost_register(host, net, HTEvent_CLOSE);
-		    /* @@ JK: seems that some functions check the errors 
-		       as part of the flow control */
-                    HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
-					     "NETWRITE");
-		    return HT_CLOSED;		    
-		}
-#endif /* EPIPE */
-		/* all errors that aren't EPIPE */
-		HTRequest_addSystemError(net->request, ERR_FATAL, socerrno, NO,
-					 "NETWRITE");
-		return HT_ERROR;
 	    }
+	    return status;
 	}
 
 	/* We do this unconditionally, should we check to see if we ever blocked? */
 	HTTRACEDATA(wrtp, b_write, "Writing to socket %d" _ soc);
-	HTNet_addBytesWritten(net, b_write);
+	HTWriter_written(me, net, b_write);
 	wrtp += b_write;
 	len -= b_write;
-	HTTRACE(STREAM_TRACE, "Write Socket %d bytes written to %d\n" _ b_write _ soc);
-	{
-	    HTAlertCallback *cbf = HTAlert_find(HT_PROG_WRITE);
-	    if (cbf) {
-		int tw = HTNet_bytesWritten(net);
-		(*cbf)(net->request, HT_PROG_WRITE,
-		       HT_MSG_NULL, NULL, &tw, NULL);
-	    }
-	}
     }
 #ifdef NOT_ASCII
     HT_FREE(me->ascbuf);
@@ -189,6 +212,102 @@ PRIVATE int HTWriter_write (HTOutputStream * me, const char * buf, int len)
     return HT_OK;
 }
 
+/*	Gather Write
+**	------------
+**	Write as much as the socket takes of a vector of blocks with a single
+**	system call. Unlike the put_block method no state is kept between
+**	calls - the caller gets the number of bytes written and must call
+**	again with whatever is left. HT_WOULD_BLOCK is returned if nothing
+**	could be written.
+*/
+PUBLIC int HTWriter_writev (HTOutputStream * me, HTIOVec * vector, int count,
+			    int * written)
+{
+    HTHost * host = me ? me->host : NULL;
+    HTNet * net = host ? HTHost_getWriteNet(host) : NULL;
+    SOCKET soc;
+    int b_write;
+    if (written) *written = 0;
+    if (!net || !vector || count <= 0) return HT_ERROR;
+    soc = HTChannel_socket(HTHost_channel(host));
+    if (count > HT_IOV_MAX) count = HT_IOV_MAX;
+    while (1) {
+#ifdef HAVE_WRITEV
+	struct iovec iov[HT_IOV_MAX];
+	int cnt;
+	for (cnt = 0; cnt < count; cnt++) {
+	    iov[cnt].iov_base = (void *) vector[cnt].base;
+	    iov[cnt].iov_len = vector[cnt].len;
+	}
+	b_write = NETWRITEV(soc, iov, count);
+#else
+	b_write = NETWRITE(soc, vector->base, vector->len);
+#endif
+	if (b_write < 0) {
+	    int status = HTWriter_error(me, net, "NETWRITEV");
+	    if (status == HT_CONTINUE) continue;
+	    if (status == HT_WOULD_BLOCK)
+		HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (%d blocks)\n" _ soc _ count);
+	    return status;
+	}
+	break;
+    }
+    HTWriter_written(me, net, b_write);
+    if (written) *written = b_write;
+    return HT_OK;
+}
+
+/*	Write from a File
+**	-----------------
+**	Write up to len bytes from the file descriptor starting at offset
+**	directly to the socket. Where we have sendfile() the data doesn't
+**	pass through user space at all. Otherwise it is read through a
+**	small buffer on the stack. As for HTWriter_writev, the caller must
+**	call again with whatever is left.
+*/
+PUBLIC int HTWriter_sendfile (HTOutputStream * me, int fd, long offset,
+			      long len, long * written)
+{
+    HTHost * host = me ? me->host : NULL;
+    HTNet * net = host ? HTHost_getWriteNet(host) : NULL;
+    SOCKET soc;
+    long b_write;
+    if (written) *written = 0;
+    if (!net || fd < 0 || len <= 0) return HT_ERROR;
+    soc = HTChannel_socket(HTHost_channel(host));
+    while (1) {
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	off_t start = (off_t) offset;
+	b_write = sendfile(soc, fd, &start, (size_t) len);
+#else
+	char buf[OUTPUT_FILE_BUFFER];
+	int b_read;
+	if (lseek(fd, (off_t) offset, SEEK_SET) < 0 ||
+	    (b_read = read(fd, buf, len < OUTPUT_FILE_BUFFER ?
+			   (int) len : OUTPUT_FILE_BUFFER)) < 0) {
+	    HTRequest_addSystemError(net->request, ERR_FATAL, errno, NO, "read");
+	    return HT_ERROR;
+	}
+	b_write = b_read ? NETWRITE(soc, buf, b_read) : 0;
+#endif
+	if (b_write < 0) {
+	    int status = HTWriter_error(me, net, "sendfile");
+	    if (status == HT_CONTINUE) continue;
+	    if (status == HT_WOULD_BLOCK)
+		HTTRACE(STREAM_TRACE, "Write Socket WOULD BLOCK %d (file %d)\n" _ soc _ fd);
+	    return status;
+	}
+	break;
+    }
+    if (!b_write) {
+	HTTRACE(STREAM_TRACE, "Write Socket file %d ended before %ld bytes\n" _ fd _ len);
+	return HT_ERROR;
+    }
+    HTWriter_written(me, net, (int) b_write);
+    if (written) *written = b_write;
+    return HT_OK;
+}
+
 /*	Character handling
 **	------------------
 */
@@ -14,6 +14,8 @@
 #include "WWWCore.h"
 #include "HTZip.h"					 /* Implemented here */
 
+#ifdef HT_ZLIB
+
 #ifdef WWW_MSWINDOWS
 #define ZLIB_DLL
 #endif
@@ -28,6 +30,11 @@ struct _HTStream {
     HTRequest *			request;
     HTStream *			target;			/* Our output target */
     z_stream *			zstream;		      /* Zlib stream */
+    uLong			flushed;     /* Deflated input at last flush */
+    int				pending;  /* Output the target hasn't taken */
+    int				taken;	 /* Input zlib has of blocked block */
+    BOOL			ended;		    /* Deflater has been ended */
+    BOOL			finished;	     /* End has been passed on */
     char 			outbuf [OUTBUF_SIZE]; 	    /* Inflated data */
 };
 
@@ -42,7 +49,9 @@ PRIVATE BOOL Zlib_init (HTStream * me, int level)
 	 (level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION))) {
 	int status;
 	HTTRACE(STREAM_TRACE, "Zlib Inflate Init stream %p with compression level %d\n" _ me _ level);
-	if ((status = inflateInit(me->zstream)) != Z_OK) {
+
+	/* Take both zlib and gzip headers */
+	if ((status = inflateInit2(me->zstream, MAX_WBITS + 32)) != Z_OK) {
 	    HTTRACE(STREAM_TRACE, "Zlib........ Failed with status %d\n" _ status);
 	    return NO;
 	}
@@ -184,11 +193,167 @@ PRIVATE const HTStreamClass HTInflate =
     HTZLibInflate_write
 }; 
 
+/* ------------------------------------------------------------------------- */
+
+/*
+**	Run the deflater over the input and pass on what comes out. Unless
+**	we are flushing, zlib keeps what it can't compress yet until next time.
+**	If the target would block then we are called again with the same
+**	block, so we keep the output it didn't take and remember how much of
+**	the input zlib has already got.
+*/
+PRIVATE int HTZLibDeflate_deflate (HTStream * me, const char * buf, int len,
+				   int flush)
+{
+    if (me->pending) {
+	me->state = (*me->target->isa->put_block)(me->target, me->outbuf,
+						   me->pending);
+	if (me->state != HT_OK) return me->state;
+	me->pending = 0;
+    }
+    if (me->taken > len) me->taken = 0;
+    me->zstream->next_in = (unsigned char *) buf + me->taken;
+    me->zstream->avail_in = len - me->taken;
+    do {
+	int status;
+	int bytes;
+	me->zstream->next_out = (unsigned char *) me->outbuf;
+	me->zstream->avail_out = OUTBUF_SIZE;
+	status = deflate(me->zstream, flush);
+	if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+	    HTTRACE(STREAM_TRACE, "Zlib Deflate Deflate returned %d\n" _ status);
+	    return HT_ERROR;
+	}
+	if ((bytes = OUTBUF_SIZE - me->zstream->avail_out) > 0) {
+	    me->state = (*me->target->isa->put_block)(me->target, me->outbuf,
+						       bytes);
+	    if (me->state != HT_OK) {
+		if (me->state == HT_WOULD_BLOCK) {
+		    me->pending = bytes;
+		    me->taken = len - me->zstream->avail_in;
+		}
+		return me->state;
+	    }
+	}
+    } while (me->zstream->avail_out == 0);
+    me->taken = 0;
+    return HT_OK;
+}
+
+PRIVATE BOOL HTZLibDeflate_terminate (HTStream * me)
+{
+    int status;
+    HTTRACE(STREAM_TRACE, "Results..... Deflated outgoing data: inflated %lu, deflated %lu, factor %.2f\n" _ 
+		me->zstream->total_in _ me->zstream->total_out _ 
+		me->zstream->total_out == 0 ? 0.0 :
+		(double) me->zstream->total_in / me->zstream->total_out);
+    if ((status = deflateEnd(me->zstream)) != Z_OK) {
+	HTTRACE(STREAM_TRACE, "Zlib........ Failed with status %d\n" _ status);
+	return NO;
+    }
+    return YES;
+}
+
+/*
+**	Write what is left and the trailer. Like the chunked encoder, we pass
+**	on a zero length block to say that this is the end. Either may block
+**	in which case we are called again.
+*/
+PRIVATE int HTZLibDeflate_finish (HTStream * me)
+{
+    int status;
+    if (!me->ended) {
+	if ((status = HTZLibDeflate_deflate(me, NULL, 0, Z_FINISH)) == HT_WOULD_BLOCK)
+	    return status;
+	HTZLibDeflate_terminate(me);
+	me->ended = YES;
+	if (status != HT_OK) {
+	    me->finished = YES;
+	    return status;
+	}
+    }
+    if ((status = (*me->target->isa->put_block)(me->target, me->outbuf, 0)) != HT_WOULD_BLOCK)
+	me->finished = YES;
+    return status;
+}
+
+/*
+**	A flush pushes out what has been written since the last flush so that
+**	the other end can get going on it
+*/
+PRIVATE int HTZLibDeflate_flush (HTStream * me)
+{
+    if (!me->ended && me->zstream->total_in > me->flushed) {
+	int status = HTZLibDeflate_deflate(me, NULL, 0, Z_SYNC_FLUSH);
+	if (status != HT_OK) return status;
+	me->flushed = me->zstream->total_in;
+    }
+    return (*me->target->isa->flush)(me->target);
+}
+
+PRIVATE int HTZLibDeflate_free (HTStream * me)
+{
+    int status = HT_OK;
+    if (!me->finished && HTZLibDeflate_finish(me) == HT_WOULD_BLOCK)
+	return HT_WOULD_BLOCK;
+    if ((status = (*me->target->isa->_free)(me->target)) == HT_WOULD_BLOCK)
+	return HT_WOULD_BLOCK;
+    HTTRACE(STREAM_TRACE, "Zlib Deflate FREEING...\n");
+    HT_FREE(me->zstream);
+    HT_FREE(me);
+    return status;
+}
+
+PRIVATE int HTZLibDeflate_abort (HTStream * me, HTList * e)
+{
+    HTTRACE(STREAM_TRACE, "Zlib Deflate ABORTING...\n");
+    if (!me->ended) deflateEnd(me->zstream);
+    (*me->target->isa->abort)(me->target, NULL);
+    HT_FREE(me->zstream);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+/*
+**	A zero length block ends the body
+*/
+PRIVATE int HTZLibDeflate_write (HTStream * me, const char * buf, int len)
+{
+    if (me->finished) return HT_LOADED;
+    if (len > 0 && !me->ended) return HTZLibDeflate_deflate(me, buf, len, Z_NO_FLUSH);
+    return buf ? HTZLibDeflate_finish(me) : HT_OK;
+}
+
+PRIVATE int HTZLibDeflate_put_character (HTStream * me, char c)
+{
+    return HTZLibDeflate_write(me, &c, 1);
+}
+
+PRIVATE int HTZLibDeflate_put_string (HTStream * me, const char * s)
+{
+    return HTZLibDeflate_write(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass HTDeflate =
+{		
+    "ZlibDeflate",
+    HTZLibDeflate_flush,
+    HTZLibDeflate_free,
+    HTZLibDeflate_abort,
+    HTZLibDeflate_put_character,
+    HTZLibDeflate_put_string,
+    HTZLibDeflate_write
+}; 
+
+/* ------------------------------------------------------------------------- */
+
 PUBLIC BOOL HTZLib_setCompressionLevel (int level)
 {
-    if (level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION) {
+    if (level == Z_DEFAULT_COMPRESSION ||
+	(level >= Z_BEST_SPEED && level <= Z_BEST_COMPRESSION)) {
 	CompressionLevel = level;
 	HTTRACE(STREAM_TRACE, "Zlib........ Compression level set to %d\n" _ level);
+	return YES;
     }
     return NO;
 }
@@ -218,3 +383,37 @@ PUBLIC HTStream * HTZLib_inflate (HTRequest *	request,
     HTTRACE(STREAM_TRACE, "Zlib Inflate Stream created\n");
     return me;
 }
+
+/*
+**	The gzip coding gets a gzip header and trailer, anything else is
+**	taken to be the zlib format which HTTP calls deflate
+*/
+PUBLIC HTStream * HTZLib_deflate (HTRequest *	request,
+				  void *	param,
+				  HTEncoding	coding,
+				  HTStream *	target)
+{
+    HTStream * me = NULL;
+    BOOL gzip = (coding == WWW_CODING_GZIP || coding == HTAtom_for("x-gzip"));
+    int status;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL ||
+	(me->zstream = (z_stream *) HT_CALLOC(1, sizeof(z_stream))) == NULL)
+	HT_OUTOFMEM("HTZLib_deflate");
+    me->isa = &HTDeflate;
+    me->state = HT_OK;
+    me->request = request;
+    me->target = target ? target : HTErrorStream();
+    if ((status = deflateInit2(me->zstream, CompressionLevel, Z_DEFLATED,
+			       gzip ? MAX_WBITS + 16 : MAX_WBITS, 8,
+			       Z_DEFAULT_STRATEGY)) != Z_OK) {
+	HTTRACE(STREAM_TRACE, "Zlib Deflate Init failed with status %d\n" _ status);
+	HT_FREE(me->zstream);
+	HT_FREE(me);
+	return HTErrorStream();
+    }
+    HTTRACE(STREAM_TRACE, "Zlib Deflate Stream %p created for %s with compression level %d\n" _ 
+		me _ gzip ? "gzip" : "deflate" _ CompressionLevel);
+    return me;
+}
+
+#endif /* HT_ZLIB */
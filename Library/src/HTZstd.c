@@ -0,0 +1,151 @@
+/*								       HTZstd.c
+**	ZSTANDARD DECODING MODULE
+**
+**	(c) COPYRIGHT MIT 1995.
+**	Please first read the full copyright statement in the file COPYRIGH.
+**	@(#) $Id$
+**
+**	This module requires the zstd library in order to compile/link
+*/
+
+/* Library include files */
+#include "wwwsys.h"
+#include "WWWUtil.h"
+#include "WWWCore.h"
+#include "HTZstd.h"					 /* Implemented here */
+
+#ifdef HT_ZSTD
+
+#include <zstd.h>
+
+#define OUTBUF_SIZE		32768
+
+struct _HTStream {
+    const HTStreamClass *	isa;
+    int				state;
+    HTRequest *			request;
+    HTStream *			target;			/* Our output target */
+    ZSTD_DStream *		dstream;		     /* Zstd decoder */
+    unsigned long		total_in;
+    unsigned long		total_out;
+    char 			outbuf [OUTBUF_SIZE];	 /* Decompressed data */
+};
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE void Zstd_terminate (HTStream * me)
+{
+    HTTRACE(STREAM_TRACE, "Zstd Decode. Terminating stream %p\n" _ me);
+    HTTRACE(STREAM_TRACE, "Results..... Decompressed incoming data: compressed %lu, decompressed %lu, factor %.2f\n" _
+	    me->total_in _ me->total_out _
+	    me->total_in == 0 ? 0.0 : (double) me->total_out / me->total_in);
+    ZSTD_freeDStream(me->dstream);
+    me->dstream = NULL;
+}
+
+PRIVATE int HTZstdDecode_flush (HTStream * me)
+{
+    return (*me->target->isa->flush)(me->target);
+}
+
+PRIVATE int HTZstdDecode_free (HTStream * me)
+{
+    int status = HT_OK;
+    if (me->dstream) Zstd_terminate(me);
+    if ((status = (*me->target->isa->_free)(me->target)) == HT_WOULD_BLOCK)
+	return HT_WOULD_BLOCK;
+    HTTRACE(STREAM_TRACE, "Zstd Decode. FREEING...\n");
+    HT_FREE(me);
+    return status;
+}
+
+PRIVATE int HTZstdDecode_abort (HTStream * me, HTList * e)
+{
+    HTTRACE(STREAM_TRACE, "Zstd Decode. ABORTING...\n");
+    if (me->dstream) Zstd_terminate(me);
+    (*me->target->isa->abort)(me->target, NULL);
+    HT_FREE(me);
+    return HT_ERROR;
+}
+
+/*
+**	A zstd body may have more than one frame so we just keep going when
+**	a frame ends. The decoder may hold back output until we give it a new
+**	output buffer so we go on as long as it fills the one it has got.
+*/
+PRIVATE int HTZstdDecode_write (HTStream * me, const char * buf, int len)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    if (me->state != HT_OK) return me->state;
+    in.src = buf;
+    in.size = len;
+    in.pos = 0;
+    do {
+	size_t status;
+	out.dst = me->outbuf;
+	out.size = OUTBUF_SIZE;
+	out.pos = 0;
+	status = ZSTD_decompressStream(me->dstream, &out, &in);
+	if (ZSTD_isError(status)) {
+	    HTTRACE(STREAM_TRACE, "Zstd Decode. Failed: %s\n" _ ZSTD_getErrorName(status));
+	    return (me->state = HT_ERROR);
+	}
+	if (out.pos > 0) {
+	    int state = (*me->target->isa->put_block)(me->target, me->outbuf,
+						      (int) out.pos);
+	    me->total_out += out.pos;
+	    if (state != HT_OK) return state;
+	}
+    } while (in.pos < in.size || out.pos == out.size);
+    me->total_in += len;
+    return HT_OK;
+}
+
+PRIVATE int HTZstdDecode_put_character (HTStream * me, char c)
+{
+    return HTZstdDecode_write(me, &c, 1);
+}
+
+PRIVATE int HTZstdDecode_put_string (HTStream * me, const char * s)
+{
+    return HTZstdDecode_write(me, s, (int) strlen(s));
+}
+
+PRIVATE const HTStreamClass HTZstdDecode =
+{
+    "ZstdDecode",
+    HTZstdDecode_flush,
+    HTZstdDecode_free,
+    HTZstdDecode_abort,
+    HTZstdDecode_put_character,
+    HTZstdDecode_put_string,
+    HTZstdDecode_write
+};
+
+PUBLIC HTStream * HTZstd_decode (HTRequest *	request,
+				 void *		param,
+				 HTEncoding	coding,
+				 HTStream *	target)
+{
+    HTStream * me = NULL;
+    size_t status;
+    if ((me = (HTStream *) HT_CALLOC(1, sizeof(HTStream))) == NULL)
+	HT_OUTOFMEM("HTZstd_decode");
+    me->isa = &HTZstdDecode;
+    me->state = HT_OK;
+    me->request = request;
+    me->target = target ? target : HTErrorStream();
+    if ((me->dstream = ZSTD_createDStream()) == NULL)
+	HT_OUTOFMEM("HTZstd_decode");
+    if (ZSTD_isError(status = ZSTD_initDStream(me->dstream))) {
+	HTTRACE(STREAM_TRACE, "Zstd Decode. Init failed: %s\n" _ ZSTD_getErrorName(status));
+	ZSTD_freeDStream(me->dstream);
+	HT_FREE(me);
+	return HTErrorStream();
+    }
+    HTTRACE(STREAM_TRACE, "Zstd Decode. Stream created\n");
+    return me;
+}
+
+#endif /* HT_ZSTD */
@@ -24,10 +24,61 @@
 #include "HTUtils.h"
 #include "HTString.h"
 #include "HTChunk.h"
+#include "HTList.h"
 #include "SGML.h"
 
 #define INVALID (-1)
 
+/*
+**	Perfect hash over a sorted table of names, for instance the tags of a
+**	DTD or the attributes of a tag. The names are hashed with FNV-1a in
+**	lower case starting from a seed which is searched for when the table
+**	is built so that all the names end up in different slots. If no seed
+**	is found, or the table isn't sorted so that the binary search would
+**	work, then there are no slots and we do the binary search instead.
+*/
+#define SGML_HASH_MAXBITS	12		  /* Max 4096 slots per table */
+#define SGML_HASH_SEEDS		256	     /* Seeds to try before growing */
+
+typedef struct _SGMLHash {
+    unsigned long	seed;
+    int			bits;
+    short *		slots;			      /* Name index + 1 or 0 */
+} SGMLHash;
+
+/*
+**	One index for each DTD that we have seen. Tags that share the same
+**	attribute table share the attribute hash as well.
+*/
+typedef struct _SGMLIndex {
+    const SGML_dtd *	dtd;
+    HTTag *		tags;
+    int			number_of_tags;
+    SGMLHash		tag_hash;
+    SGMLHash **		attr_hash;			  /* One for each tag */
+} SGMLIndex;
+
+PRIVATE HTList * SGMLIndexes = NULL;
+
+/*
+**	The text skipping, the runs and the perfect hashes can be turned off
+**	so that the parser can be checked against the byte by byte version
+*/
+PRIVATE BOOL SGMLFastScan = YES;
+
+/*
+**	Tag and attribute names are ASCII so we don't need the locale
+*/
+#define SGML_LOWER(c)	((c) >= 'A' && (c) <= 'Z' ? (c) + ('a' - 'A') : (c))
+
+/*
+**	Plain text is skipped a word at a time. HAS_BYTE is true if any of
+**	the bytes in the word w is c.
+*/
+#define ONES		(~0UL / 0xFF)
+#define HAS_ZERO(w)	(((w) - ONES) & ~(w) & (ONES * 0x80))
+#define HAS_BYTE(w, c)	HAS_ZERO((w) ^ (ONES * (unsigned char) (c)))
+
 /*	The State (context) of the parser
 **
 **	This is passed with each call to make the parser reentrant
@@ -57,6 +108,7 @@ struct _HTStream
 	HTStructuredClass *actions;	/* target class  */
 	HTStructured *target;		/* target object */
 
+	SGMLIndex *index;		/* Perfect hashes for the DTD */
 	HTTag *current_tag;
 	int current_attribute_number;
 	SGMLContent contents;		/* current content mode */
@@ -71,10 +123,228 @@ struct _HTStream
 #define PUTC(ch) ((*context->actions->put_character)(context->target, ch))
 #define PUTB(b,l) ((*context->actions->put_block)(context->target, b, l))
 
+/*	Perfect Hash of Names
+**	---------------------
+*/
+#define SGML_NAME(base, stride, i) \
+	(*(char **) ((char *) (base) + (i) * (stride)))
+
+PRIVATE unsigned long SGMLHash_value (unsigned long seed, const char * s)
+    {
+	unsigned long h = seed;
+	for ( ; *s; s++)
+		h = ((h ^ SGML_LOWER((unsigned char) *s)) * 16777619UL) &
+			0xFFFFFFFFUL;
+	return h;
+    }
+
+PRIVATE BOOL SGMLHash_build (SGMLHash * me, void * base, int stride, int n)
+    {
+	int i, bits;
+	unsigned long seed;
+
+	/* The binary search must find every name or we can't do better */
+	for (i = 1; i < n; i++)
+		if (strcasecomp(SGML_NAME(base, stride, i-1),
+				SGML_NAME(base, stride, i)) >= 0)
+			return NO;
+
+	for (bits = 1; (1 << bits) < 8 * n; bits++);
+	for ( ; bits <= SGML_HASH_MAXBITS; bits++)
+	    {
+		int size = 1 << bits;
+		if ((me->slots = (short *) HT_CALLOC(size, sizeof(short))) == NULL)
+			HT_OUTOFMEM("SGMLHash_build");
+		for (seed = 1; seed <= SGML_HASH_SEEDS; seed++)
+		    {
+			for (i = 0; i < n; i++)
+			    {
+				unsigned long slot = SGMLHash_value(seed,
+					SGML_NAME(base, stride, i)) >> (32 - bits);
+				if (me->slots[slot]) break;
+				me->slots[slot] = i + 1;
+			    }
+			if (i == n)
+			    {
+				me->seed = seed;
+				me->bits = bits;
+				return YES;
+			    }
+			memset(me->slots, 0, size * sizeof(short));
+		    }
+		HT_FREE(me->slots);
+	    }
+	HTTRACE(SGML_TRACE, "SGML Hash... No perfect hash for %d names\n" _ n);
+	return NO;
+    }
+
+/*
+**	Returns the index of the name or -1 if not found. If there is no hash
+**	then return -2 and let the caller search the table.
+*/
+PRIVATE int SGMLHash_find (SGMLHash * me, void * base, int stride,
+			   const char * s)
+    {
+	int i;
+	const char * p;
+	if (!SGMLFastScan || !me || !me->slots) return -2;
+	i = me->slots[SGMLHash_value(me->seed, s) >> (32 - me->bits)] - 1;
+	if (i < 0) return -1;
+	for (p = SGML_NAME(base, stride, i);
+	     *p && SGML_LOWER((unsigned char) *p) == SGML_LOWER((unsigned char) *s);
+	     p++, s++);
+	return (!*p && !*s) ? i : -1;
+    }
+
+PRIVATE SGMLIndex * SGMLIndex_find (const SGML_dtd * dtd)
+    {
+	HTList * cur = SGMLIndexes;
+	SGMLIndex * pres;
+	int i, j;
+
+	while ((pres = (SGMLIndex *) HTList_nextObject(cur)))
+		if (pres->dtd == dtd && pres->tags == dtd->tags &&
+		    pres->number_of_tags == dtd->number_of_tags)
+			return pres;
+
+	/* Not seen this DTD before so build an index for it */
+	if ((pres = (SGMLIndex *) HT_CALLOC(1, sizeof(SGMLIndex))) == NULL ||
+	    (pres->attr_hash = (SGMLHash **)
+	     HT_CALLOC(dtd->number_of_tags + 1, sizeof(SGMLHash *))) == NULL)
+		HT_OUTOFMEM("SGMLIndex_find");
+	pres->dtd = dtd;
+	pres->tags = dtd->tags;
+	pres->number_of_tags = dtd->number_of_tags;
+	SGMLHash_build(&pres->tag_hash, &dtd->tags[0].name, sizeof(HTTag),
+		       dtd->number_of_tags);
+	for (i = 0; i < dtd->number_of_tags; i++)
+	    {
+		HTTag * tag = &dtd->tags[i];
+		for (j = 0; j < i; j++)
+			if (dtd->tags[j].attributes == tag->attributes &&
+			    dtd->tags[j].number_of_attributes ==
+			    tag->number_of_attributes)
+				break;
+		if (j < i)
+			pres->attr_hash[i] = pres->attr_hash[j];
+		else if (tag->number_of_attributes > 0)
+		    {
+			if ((pres->attr_hash[i] = (SGMLHash *)
+			     HT_CALLOC(1, sizeof(SGMLHash))) == NULL)
+				HT_OUTOFMEM("SGMLIndex_find");
+			SGMLHash_build(pres->attr_hash[i], &tag->attributes[0].name,
+				       sizeof(HTAttr), tag->number_of_attributes);
+		    }
+	    }
+	if (!SGMLIndexes) SGMLIndexes = HTList_new();
+	HTList_addObject(SGMLIndexes, pres);
+	return pres;
+    }
+
+PRIVATE void SGMLIndex_delete (SGMLIndex * me)
+    {
+	int i, j;
+	for (i = 0; i < me->number_of_tags; i++)
+	    {
+		/* A shared attribute hash is freed with the last tag using it */
+		for (j = i + 1; j < me->number_of_tags; j++)
+			if (me->attr_hash[j] == me->attr_hash[i]) break;
+		if (j == me->number_of_tags && me->attr_hash[i])
+		    {
+			HT_FREE(me->attr_hash[i]->slots);
+			HT_FREE(me->attr_hash[i]);
+		    }
+	    }
+	HT_FREE(me->attr_hash);
+	HT_FREE(me->tag_hash.slots);
+	HT_FREE(me);
+    }
+
+/*	Collect Runs of Characters
+**	--------------------------
+**
+**	Returns the number of bytes at the start of the block that the state
+**	would just add to the string (or skip), one by one.
+*/
+PRIVATE int SGMLTokenSpan (sgml_state state, const char * b, int l)
+    {
+	const char * p = b;
+	const char * end = b + l;
+	switch (state)
+	    {
+	    case S_tag:
+	    case S_end:
+		while (p < end && isalnum((int) *p)) p++;
+		break;
+
+	    case S_attr:
+		while (p < end && !isspace((int) *p) && *p != '>' && *p != '=')
+			p++;
+		break;
+
+	    case S_value:
+		while (p < end && !isspace((int) *p) && *p != '>') p++;
+		break;
+
+	    case S_squoted:
+		while (p < end && *p != '\'' && *p && *p != '\n' && *p != '\r')
+			p++;
+		break;
+
+	    case S_dquoted:
+		while (p < end && *p != '"' && *p && *p != '\n' && *p != '\r')
+			p++;
+		break;
+
+	    case S_com:
+		while (p < end && *p != '-') p++;
+		break;
+
+	    case S_junk_tag:
+		while (p < end && *p != '>') p++;
+		break;
+
+	    default:
+		break;
+	    }
+	return p - b;
+    }
+
+/*	Skip Plain Text
+**	---------------
+**
+**	Returns the number of bytes at the start of the block that are plain
+**	text and don't change the state of the parser in S_text.
+*/
+PRIVATE int SGMLTextSpan (const char * b, int l)
+    {
+	const char * p = b;
+	const char * end = b + l;
+	unsigned long w;
+	while (end - p >= (int) sizeof(w))
+	    {
+		memcpy(&w, p, sizeof(w));
+		if (HAS_BYTE(w, '<') || HAS_BYTE(w, '&') || HAS_BYTE(w, '\n')
+#ifdef ISO_2022_JP
+		    || HAS_BYTE(w, '\033')
+#endif
+		    )
+			break;
+		p += sizeof(w);
+	    }
+	while (p < end && *p != '<' && *p != '&' && *p != '\n'
+#ifdef ISO_2022_JP
+	       && *p != '\033'
+#endif
+	       )
+		p++;
+	return p - b;
+    }
+
 /*	Find Attribute Number
 **	---------------------
 */
-PRIVATE int SGMLFindAttribute  (HTTag* tag, const char * s)
+PRIVATE int SGMLFindAttribute  (HTStream * context, HTTag* tag, const char * s)
     {
 	HTAttr* attributes = tag->attributes;
 
@@ -82,6 +352,10 @@ PRIVATE int SGMLFindAttribute  (HTTag* tag, const char * s)
 
 	assert(tag->number_of_attributes <= MAX_ATTRIBUTES);
 
+	if ((i = SGMLHash_find(context->index->attr_hash[tag - context->dtd->tags],
+			       attributes, sizeof(HTAttr), s)) != -2)
+		return i;
+
 	for(low=0, high=tag->number_of_attributes;
 	    high > low ;
 	    diff < 0 ? (low = i+1) : (high = i) )
@@ -107,7 +381,7 @@ PRIVATE void handle_attribute_name (HTStream * context, const char * s)
 	/* Note: if tag==NULL, we are skipping unknown tag... */
 	if (tag)
 	    {
-		int i = SGMLFindAttribute(tag, s);
+		int i = SGMLFindAttribute(context, tag, s);
 		if (i >= 0)
 		    {
 			context->current_attribute_number = i;
@@ -191,6 +465,7 @@ PRIVATE void start_element (HTStream * context)
     {
 	int i;
 	char *value[MAX_ATTRIBUTES];
+	char *data = HTChunk_data(context->string);
 	HTTag *tag = context->current_tag;
 
 	HTTRACE(SGML_TRACE, "Start <%s>\n" _ tag->name);
@@ -204,7 +479,7 @@ PRIVATE void start_element (HTStream * context)
 	*/
 	for (i = 0; i < MAX_ATTRIBUTES; ++i)
 		value[i] = context->value[i] < 0 ? NULL :
-			HTChunk_data(context->string) + context->value[i];
+			data + context->value[i];
 	(*context->actions->start_element)
 		(context->target,
 		 tag - context->dtd->tags,
@@ -217,7 +492,7 @@ PRIVATE void start_element (HTStream * context)
 **		------------------------
 **
 ** On entry,
-**	dtd	points to dtd structire including valid tag list
+**	context	has the dtd structure including valid tag list
 **	string	points to name of tag in question
 **
 ** On exit,
@@ -225,9 +500,13 @@ PRIVATE void start_element (HTStream * context)
 **		NULL		tag not found
 **		else		address of tag structure in dtd
 */
-PRIVATE HTTag * SGMLFindTag (const SGML_dtd* dtd, const char * string)
+PRIVATE HTTag * SGMLFindTag (HTStream * context, const char * string)
     {
+	const SGML_dtd * dtd = context->dtd;
 	int high, low, i, diff;
+	if ((i = SGMLHash_find(&context->index->tag_hash, &dtd->tags[0].name,
+			       sizeof(HTTag), string)) != -2)
+		return i >= 0 ? &dtd->tags[i] : NULL;
 	for(low=0, high=dtd->number_of_tags;
 	    high > low ;
 	    diff < 0 ? (low = i+1) : (high = i))
@@ -273,14 +552,35 @@ PRIVATE int SGML_abort  (HTStream * context, HTList * e)
 
 PRIVATE int SGML_write (HTStream * context, const char * b, int l)
     {
-	const SGML_dtd	*dtd = context->dtd;
 	HTChunk	*string = context->string;
 	const char *text = b;
 	int count = 0;
 	
 	while (l-- > 0)
 	    {
-		char c = *b++;
+		char c;
+		if (!SGMLFastScan)
+			;
+		else if (context->state == S_text)
+		    {
+			int skip = SGMLTextSpan(b, l+1);
+			b += skip;
+			count += skip;
+			if ((l -= skip) < 0) break;
+		    }
+		else
+		    {
+			int run = SGMLTokenSpan(context->state, b, l+1);
+			if (run > 0)
+			    {
+				if (context->state != S_com &&
+				    context->state != S_junk_tag)
+					HTChunk_putb(string, b, run);
+				b += run;
+				if ((l -= run) < 0) break;
+			    }
+		    }
+		c = *b++;
 		switch(context->state)
 		    {
 		    got_element_open:
@@ -525,7 +825,7 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				break;
 			    }
 			    HTChunk_terminate(string);
-			    context->current_tag  = SGMLFindTag(dtd, HTChunk_data(string));
+			    context->current_tag  = SGMLFindTag(context, HTChunk_data(string));
 			    if (context->current_tag == NULL) {
 				HTTRACE(SGML_TRACE, "*** Unknown element %s\n" _ HTChunk_data(string));
 				(*context->actions->unparsed_begin_element)
@@ -656,7 +956,7 @@ PRIVATE int SGML_write (HTStream * context, const char * b, int l)
 				char * first;
 				HTChunk_terminate(string);
 				if ((first=HTChunk_data(string))!=NULL && *first != '\0')
-				        t = SGMLFindTag(dtd, HTChunk_data(string));
+				        t = SGMLFindTag(context, HTChunk_data(string));
 				else
 				    	/* Empty end tag */
 					/* Original code popped here one
@@ -821,6 +1121,7 @@ PUBLIC HTStream *SGML_new(const SGML_dtd * dtd, HTStructured * target)
     context->isa = &SGMLParser;
     context->string = HTChunk_new(128);	/* Grow by this much */
     context->dtd = dtd;
+    context->index = SGMLIndex_find(dtd);
     context->target = target;
     context->actions = (HTStructuredClass*)(((HTStream*)target)->isa);
     /* Ugh: no OO */
@@ -830,6 +1131,33 @@ PUBLIC HTStream *SGML_new(const SGML_dtd * dtd, HTStructured * target)
     return context;
 }
 
+/*	Delete the Perfect Hashes
+**	-------------------------
+**
+**	Must only be called when there are no parsers running
+*/
+PUBLIC void SGML_deleteAll (void)
+{
+    if (SGMLIndexes) {
+	HTList * cur = SGMLIndexes;
+	SGMLIndex * pres;
+	while ((pres = (SGMLIndex *) HTList_nextObject(cur)))
+	    SGMLIndex_delete(pres);
+	HTList_delete(SGMLIndexes);
+	SGMLIndexes = NULL;
+    }
+}
+
+PUBLIC void SGML_setFastScan (BOOL mode)
+{
+    SGMLFastScan = mode;
+}
+
+PUBLIC BOOL SGML_fastScan (void)
+{
+    return SGMLFastScan;
+}
+
 PUBLIC HTTag * SGML_findTag (SGML_dtd * dtd, int element_number)
 {
     return (dtd && element_number>=0 && element_number<dtd->number_of_tags) ?
@@ -13,6 +13,15 @@
 **	PURPOSE. See W3C License http://www.w3.org/Consortium/Legal/ for more
 **	details.
 **
+**	The queue is a ring buffer that doubles in size when it fills up so
+**	that adding and removing at either end is O(1). If a spill file is
+**	set then objects added at the tail beyond the in-memory limit are
+**	encoded as lines of text and written to the file. They are read back
+**	in batches when the ring buffer runs empty, and the part of the file
+**	that has been read is cut off as we go. As the ring buffer always
+**	holds the front of the queue and the file holds the back, the order
+**	is preserved.
+**
 **  Authors:
 **	JP		John Punin
 **
@@ -22,42 +31,267 @@
 
 #include "HTQueue.h"
 
-HTList * HTQueue_new(void)
+#define QUEUE_MIN_SIZE		64
+
+struct _HTQueue {
+    void **		ring;
+    int			size;			       /* Always power of two */
+    int			head;			/* Index of the first object */
+    int			count;			  /* Objects in the ring buffer */
+
+    /* Spilling to disk */
+    char *		file;
+    FILE *		fp;
+    int			max_memory;	    /* Max objects in the ring buffer */
+    long		read_off;
+    long		write_off;
+    int			spilled;		  /* Objects in the spill file */
+    HTQueueEncoder *	encode;
+    HTQueueDecoder *	decode;
+    void *		context;
+    HTChunk *		line;
+};
+
+/* ------------------------------------------------------------------------- */
+
+PRIVATE BOOL HTQueue_grow (HTQueue * me)
+{
+    int size = me->size ? me->size << 1 : QUEUE_MIN_SIZE;
+    void ** ring;
+    int cnt;
+    if ((ring = (void **) HT_MALLOC(size * sizeof(void *))) == NULL)
+	HT_OUTOFMEM("HTQueue_grow");
+    for (cnt = 0; cnt < me->count; cnt++)
+	ring[cnt] = me->ring[(me->head + cnt) & (me->size - 1)];
+    HT_FREE(me->ring);
+    me->ring = ring;
+    me->size = size;
+    me->head = 0;
+    return YES;
+}
+
+PRIVATE BOOL HTQueue_pushTail (HTQueue * me, void * object)
+{
+    if (me->count >= me->size) HTQueue_grow(me);
+    me->ring[(me->head + me->count) & (me->size - 1)] = object;
+    me->count++;
+    return YES;
+}
+
+/*
+**	Write a line to the end of the spill file
+*/
+PRIVATE BOOL HTQueue_write (HTQueue * me, const char * line)
 {
-  return HTList_new();
+    if (fseek(me->fp, me->write_off, SEEK_SET) < 0 ||
+	fputs(line, me->fp) == EOF || putc('\n', me->fp) == EOF) {
+	HTTRACE(APP_TRACE, "Queue....... Can't write to spill file `%s\'\n" _ me->file);
+	return NO;
+    }
+    me->write_off = ftell(me->fp);
+    me->spilled++;
+    return YES;
 }
 
-BOOL HTQueue_delete(HTList *me)
+PRIVATE BOOL HTQueue_spill (HTQueue * me, void * object)
 {
-  return HTList_delete(me);
+    char * line = (*me->encode)(me->context, object);
+    BOOL status = line ? HTQueue_write(me, line) : NO;
+    HT_FREE(line);
+    return status;
 }
 
-BOOL HTQueue_enqueue(HTList *me,void *newObject)
+/*
+**	Move the lines we haven't read yet to the beginning of the spill file
+**	and cut off the rest. We only do this when at least half of the file
+**	has been read so the copy never overwrites what it is copying, and
+**	if something goes wrong the file is left as it was.
+*/
+PRIVATE BOOL HTQueue_compact (HTQueue * me)
 {
-  return  HTList_addObject(me,newObject);
+    char buf[BUFSIZ];
+    long from = me->read_off;
+    long to = 0;
+    while (from < me->write_off) {
+	size_t len = me->write_off - from < (long) sizeof(buf) ?
+	    (size_t) (me->write_off - from) : sizeof(buf);
+	if (fseek(me->fp, from, SEEK_SET) < 0 ||
+	    fread(buf, 1, len, me->fp) != len ||
+	    fseek(me->fp, to, SEEK_SET) < 0 ||
+	    fwrite(buf, 1, len, me->fp) != len) {
+	    HTTRACE(APP_TRACE, "Queue....... Can't compact spill file `%s\'\n" _ me->file);
+	    return NO;
+	}
+	from += len;
+	to += len;
+    }
+    if (fflush(me->fp) == EOF) return NO;
+#ifdef HAVE_FTRUNCATE
+    if (ftruncate(fileno(me->fp), to) < 0)
+	HTTRACE(APP_TRACE, "Queue....... Can't truncate spill file `%s\'\n" _ me->file);
+#endif
+    HTTRACE(APP_TRACE, "Queue....... Compacted `%s\' from %ld to %ld bytes\n" _
+	    me->file _ me->write_off _ to);
+    me->read_off = 0;
+    me->write_off = to;
+    return YES;
 }
-BOOL HTQueue_append(HTList *me,void *newObject)
+
+/*
+**	Read back up to max_memory objects from the front of the spill file.
+**	When at least half of the file has been read we move the rest to the
+**	front so that the file only holds what is still queued.
+*/
+PRIVATE BOOL HTQueue_unspill (HTQueue * me)
 {
-  return  HTList_appendObject(me,newObject);
+    int loaded = 0;
+    if (fflush(me->fp) == EOF || fseek(me->fp, me->read_off, SEEK_SET) < 0)
+	return NO;
+    while (me->spilled > 0 && loaded < me->max_memory) {
+	int ch;
+	HTChunk_clear(me->line);
+	while ((ch = getc(me->fp)) != EOF && ch != '\n')
+	    HTChunk_putc(me->line, (char) ch);
+	if (ch == EOF) {
+	    HTTRACE(APP_TRACE, "Queue....... Spill file `%s\' truncated\n" _ me->file);
+	    me->spilled = 0;
+	    break;
+	}
+	me->spilled--;
+	{
+	    char * line = HTChunk_data(me->line);
+	    void * object = (*me->decode)(me->context, line ? line : "");
+	    if (object) {
+		HTQueue_pushTail(me, object);
+		loaded++;
+	    }
+	}
+    }
+    me->read_off = ftell(me->fp);
+    if (me->spilled <= 0) {
+	me->read_off = me->write_off = 0;
+#ifdef HAVE_FTRUNCATE
+	if (ftruncate(fileno(me->fp), 0) < 0)
+	    HTTRACE(APP_TRACE, "Queue....... Can't truncate spill file `%s\'\n" _ me->file);
+#endif
+    } else if (me->read_off >= me->write_off - me->read_off)
+	HTQueue_compact(me);
+    HTTRACE(APP_TRACE, "Queue....... Loaded %d objects from `%s\', %d left\n" _
+	    loaded _ me->file _ me->spilled);
+    return YES;
 }
 
-BOOL HTQueue_dequeue(HTList *me)
+/* ------------------------------------------------------------------------- */
+
+PUBLIC HTQueue * HTQueue_new (void)
 {
-  return HTList_removeFirstObject(me) ? YES : NO;
+    HTQueue * me;
+    if ((me = (HTQueue *) HT_CALLOC(1, sizeof(HTQueue))) == NULL)
+	HT_OUTOFMEM("HTQueue_new");
+    HTQueue_grow(me);
+    return me;
 }
 
-BOOL HTQueue_isEmpty(HTList *me)
+PUBLIC BOOL HTQueue_delete (HTQueue * me)
 {
-  return HTList_isEmpty(me);
+    if (me) {
+	if (me->fp) {
+	    fclose(me->fp);
+	    REMOVE(me->file);
+	}
+	HT_FREE(me->file);
+	HTChunk_delete(me->line);
+	HT_FREE(me->ring);
+	HT_FREE(me);
+	return YES;
+    }
+    return NO;
 }
 
-void * HTQueue_headOfQueue(HTList *me)
+PUBLIC BOOL HTQueue_setSpill (HTQueue * me, const char * file, int max_memory,
+			      HTQueueEncoder * encode, HTQueueDecoder * decode,
+			      void * context)
 {
-  return HTList_firstObject(me);
+    if (me && file && encode && decode && !me->fp) {
+	if ((me->fp = fopen(file, "w+b")) == NULL) {
+	    HTTRACE(APP_TRACE, "Queue....... Can't open spill file `%s\'\n" _ file);
+	    return NO;
+	}
+	StrAllocCopy(me->file, file);
+	me->max_memory = max_memory > 0 ? max_memory : HT_QUEUE_MEMORY;
+	me->encode = encode;
+	me->decode = decode;
+	me->context = context;
+	me->line = HTChunk_new(256);
+	return YES;
+    }
+    return NO;
 }
 
-int HTQueue_count(HTList *me)
+PUBLIC BOOL HTQueue_enqueue (HTQueue * me, void * newObject)
 {
-  return HTList_count(me);
+    if (me) {
+	if (me->fp && (me->spilled > 0 || me->count >= me->max_memory) &&
+	    HTQueue_spill(me, newObject))
+	    return YES;
+	return HTQueue_pushTail(me, newObject);
+    }
+    return NO;
 }
 
+PUBLIC BOOL HTQueue_isSpilling (HTQueue * me)
+{
+    return (me && me->fp && (me->spilled > 0 || me->count >= me->max_memory));
+}
+
+PUBLIC BOOL HTQueue_enqueueLine (HTQueue * me, const char * line)
+{
+    if (me && me->fp && line) {
+	void * object;
+	if (HTQueue_isSpilling(me) && HTQueue_write(me, line)) return YES;
+	if ((object = (*me->decode)(me->context, line)) != NULL)
+	    return HTQueue_pushTail(me, object);
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTQueue_append (HTQueue * me, void * newObject)
+{
+    if (me) {
+	if (me->count >= me->size) HTQueue_grow(me);
+	me->head = (me->head - 1) & (me->size - 1);
+	me->ring[me->head] = newObject;
+	me->count++;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTQueue_dequeue (HTQueue * me)
+{
+    if (me && HTQueue_headOfQueue(me)) {
+	me->head = (me->head + 1) & (me->size - 1);
+	me->count--;
+	return YES;
+    }
+    return NO;
+}
+
+PUBLIC BOOL HTQueue_isEmpty (HTQueue * me)
+{
+    return me ? (me->count + me->spilled == 0) : YES;
+}
+
+PUBLIC void * HTQueue_headOfQueue (HTQueue * me)
+{
+    if (me) {
+	if (!me->count && me->spilled > 0) HTQueue_unspill(me);
+	if (me->count) return me->ring[me->head];
+    }
+    return NULL;
+}
+
+PUBLIC int HTQueue_count (HTQueue * me)
+{
+    return me ? me->count + me->spilled : -1;
+}
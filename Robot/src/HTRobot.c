@@ -43,6 +43,12 @@ PRIVATE HTComparer HitSort, FormatSort, LastModifiedSort, TitleSort;
 PRIVATE HText_new	RHText_new;
 PRIVATE HText_delete	RHText_delete;
 PRIVATE HText_foundLink	RHText_foundLink;
+PRIVATE HTFoundLinks	RHText_foundLinks;
+
+/*
+**  Documents waiting in the spill file of the queue
+*/
+PRIVATE BOOL queue_seen (Robot * mr, const char * uri);
 
 /* ------------------------------------------------------------------------- */
 
@@ -811,6 +817,13 @@ PRIVATE BOOL Robot_delete (Robot * mr)
 #endif
 
 	if (mr->queue) HTQueue_delete(mr->queue);
+	if (mr->spilled) {
+	    int pos = 0;
+	    int * hits;
+	    while ((hits = (int *) HTHashtable_nextObject(mr->spilled, &pos)))
+		HT_FREE(hits);
+	    HTHashtable_delete(mr->spilled);
+	}
 	HT_FREE(mr->cwd);
 	HT_FREE(mr->prefix);
 	HT_FREE(mr->img_prefix);
@@ -911,6 +924,9 @@ PRIVATE BOOL check_constraints(Robot * mr, char *prefix, char *uri)
 */
 PUBLIC void Cleanup (Robot * me, int status)
 {
+    /* Save the pipeline depths while we still have the host objects */
+    if (me && me->pipefile) HTHost_savePipelineDepths(me->pipefile);
+
     /*
     **  First we clean up the robot itself and calculate the various
     **  statistics. This can actually take some time as a lot of data
@@ -1034,6 +1050,12 @@ PUBLIC int redirection_handler (HTRequest * request, HTResponse * response,
 	    HT_FREE(uri);
 	    return HT_OK;
 	}
+	if (queue_seen(mr, redirection_parent_addr)) {
+	    if (SHOW_QUIET(mr)) HTPrint("............ Already queued\n");
+	    HT_FREE(redirection_parent_addr);
+	    HT_FREE(uri);
+	    return HT_OK;
+	}
 
 	/* Now call the default libwww handler for actually carrying it out */
 	if (mr->redir_code==0 || mr->redir_code==status) {
@@ -1183,6 +1205,111 @@ PUBLIC int bfs_terminate_handler (HTRequest * request, HTResponse * response,
     return HT_OK;
 }
 
+/*
+**  The BFS queue can be spilled to disk. A queued document is written
+**  as the method, the depth and its address. Documents that are queued
+**  while the queue is spilling go straight to the file and neither get
+**  a HyperDoc nor keep their anchor until they are read back, so all we
+**  remember about them is their address and how often we have seen it.
+*/
+PRIVATE char * queue_line (HTMethod method, int depth, const char * uri)
+{
+    char * line;
+    if ((line = (char *) HT_MALLOC(strlen(uri) + 32)) == NULL)
+	HT_OUTOFMEM("queue_line");
+    sprintf(line, "%d %d %s", (int) method, depth, uri);
+    return line;
+}
+
+PRIVATE char * queue_encode (void * context, void * object)
+{
+    HyperDoc * hd = (HyperDoc *) object;
+    char * uri = HTAnchor_address((HTAnchor *) hd->anchor);
+    char * line = NULL;
+    if (uri) {
+	line = queue_line(hd->method, hd->depth, uri);
+	HT_FREE(uri);
+    }
+    return line;
+}
+
+PRIVATE void * queue_decode (void * context, const char * line)
+{
+    Robot * mr = (Robot *) context;
+    int method, depth;
+    const char * uri = line;
+    if (sscanf(line, "%d %d", &method, &depth) == 2) {
+	int fields = 2;
+	while (*uri && fields > 0)
+	    if (*uri++ == ' ') fields--;
+	if (*uri) {
+	    HTParentAnchor * dest = HTAnchor_parent(HTAnchor_findAddress(uri));
+	    HyperDoc * hd = HTAnchor_document(dest);
+	    int * hits = mr->spilled ?
+		(int *) HTHashtable_object(mr->spilled, uri) : NULL;
+	    if (!hd) {
+		hd = HyperDoc_new(mr, dest, depth);
+		if (hits) hd->hits = *hits;
+	    } else if (hits)
+		hd->hits += *hits;
+	    if (hits) {
+		HTHashtable_removeObject(mr->spilled, uri);
+		HT_FREE(hits);
+	    }
+	    hd->method = (HTMethod) method;
+	    return hd;
+	}
+    }
+    HTTRACE(APP_TRACE, "Robot....... Bad queue entry `%s'\n" _ line);
+    return NULL;
+}
+
+/*
+**  Remove the link to a spilled document and delete its anchor unless
+**  other links still point at it
+*/
+PRIVATE void queue_forget (HTChildAnchor * source, HTAnchor * dest)
+{
+    HTParentAnchor * parent = HTAnchor_parent(dest);
+    HTLink_remove((HTAnchor *) source, dest);
+    if (!HTAnchor_document(parent)) HTAnchor_delete(parent);
+}
+
+PRIVATE void queue_spill (Robot * mr, HTChildAnchor * source, HTAnchor * dest,
+			  const char * uri, int depth)
+{
+    char * line = queue_line(METHOD_HEAD, depth, uri);
+    int * hits;
+    if ((hits = (int *) HT_MALLOC(sizeof(int))) == NULL)
+	HT_OUTOFMEM("queue_spill");
+    *hits = 1;
+    HTHashtable_addObject(mr->spilled, uri, hits);
+    HTQueue_enqueueLine(mr->queue, line);
+    HT_FREE(line);
+    queue_forget(source, dest);
+}
+
+/*
+**  Count a hit on a document that is waiting in the spill file
+*/
+PRIVATE BOOL queue_seen (Robot * mr, const char * uri)
+{
+    int * hits = mr->spilled ? (int *) HTHashtable_object(mr->spilled, uri) : NULL;
+    if (hits) (*hits)++;
+    return hits ? YES : NO;
+}
+
+PUBLIC BOOL Robot_setQueueFile (Robot * mr, const char * file, int max_memory)
+{
+    if (mr && mr->queue &&
+	HTQueue_setSpill(mr->queue, file, max_memory,
+			 queue_encode, queue_decode, mr)) {
+	if (!mr->spilled) mr->spilled = HTHashtable_new(0);
+	return YES;
+    }
+    return NO;
+}
+
 PUBLIC void Serving_queue(Robot *mr)
 {
   BOOL abort = NO;
@@ -1250,25 +1377,25 @@ PUBLIC BOOL Robot_registerHTMLParser (void)
 {
     HText_registerCDCallback(RHText_new, RHText_delete);
     HText_registerLinkCallback(RHText_foundLink);
+
+    /*
+    ** We only need the links from HTML documents so we don't need the full
+    ** HTML parser. As the link extractor is registered after the default
+    ** converters with the same quality, it is the one that is picked.
+    */
+    HTMLinks_setCallback(RHText_foundLinks);
+    HTConversion_add(HTFormat_conversion(), "text/html", "www/present",
+		     HTMLToLinks, 1.0, 0.0, 0.0);
     return YES;
 }
 
-PRIVATE HText * RHText_new (HTRequest * request, HTParentAnchor * anchor,
-			    HTStream * stream)
+/*
+**	Check whether the meta tags of a document tell us not to follow links
+*/
+PRIVATE BOOL RHText_follow (Robot * mr, HTParentAnchor * anchor)
 {
-    HText * me;
-    Finger * finger = (Finger *) HTRequest_context(request);
-    Robot * mr = finger->robot;
     char * robots = NULL;
-
-    if ((me = (HText *) HT_CALLOC(1, sizeof(HText))) == NULL)
-	HT_OUTOFMEM("RHText_new");
-
-    /* Bind the HText object together with the Request Object */
-    me->request = request;
-    me->follow = YES;
-
-    /* Check to see if we have any meta tags */
+    BOOL follow = YES;
     if (!(mr->flags & MR_NOMETATAGS) && (robots = HTAnchor_robots(anchor)) != NULL) {
 	char * strval = NULL;
 	char * ptr = NULL;
@@ -1277,12 +1404,30 @@ PRIVATE HText * RHText_new (HTRequest * request, HTParentAnchor * anchor,
 	ptr = strval;
 	while ((token = HTNextField(&ptr)) != NULL) {
 	    if (!strcasecomp(token, "nofollow")) {
-		me->follow = NO;
+		follow = NO;
 		break;
 	    }
 	}
 	HT_FREE(strval);
     }
+    return follow;
+}
+
+PRIVATE HText * RHText_new (HTRequest * request, HTParentAnchor * anchor,
+			    HTStream * stream)
+{
+    HText * me;
+    Finger * finger = (Finger *) HTRequest_context(request);
+    Robot * mr = finger->robot;
+
+    if ((me = (HText *) HT_CALLOC(1, sizeof(HText))) == NULL)
+	HT_OUTOFMEM("RHText_new");
+
+    /* Bind the HText object together with the Request Object */
+    me->request = request;
+
+    /* Check to see if we have any meta tags */
+    me->follow = RHText_follow(mr, anchor);
 
     /* Add this HyperDoc object to our list */
     if (!mr->htext) mr->htext = HTList_new();
@@ -1314,6 +1459,7 @@ PRIVATE void RHText_foundAnchor (HText * text, HTChildAnchor * anchor)
 	/* These are new variables */
 	HyperDoc * nhd = NULL;
 	BOOL follow = YES;
+	BOOL spill = NO;
 
 	/* These three variables were moved */
 	/*HTParentAnchor * last_anchor = HTRequest_parent(text->request);*/
@@ -1324,9 +1470,12 @@ PRIVATE void RHText_foundAnchor (HText * text, HTChildAnchor * anchor)
 	if (!uri) return;
 	if (SHOW_QUIET(mr)) HTPrint("Robot....... Found `%s\' - \n", uri ? uri : "NULL\n");
 
-        if (hd) {
+        if (hd || queue_seen(mr, uri)) {
 	    if (SHOW_QUIET(mr)) HTPrint("............ Already checked\n");
-            hd->hits++;
+	    if (hd)
+		hd->hits++;
+	    else
+		queue_forget(anchor, dest);
 #ifdef HT_MYSQL
 	    if (mr->sqllog) {
 		char * ref_addr = HTAnchor_address((HTAnchor *) referer);
@@ -1360,15 +1509,23 @@ PRIVATE void RHText_foundAnchor (HText * text, HTChildAnchor * anchor)
 	if (mr->ndoc == 0) /* Number of Documents is reached */
 	  follow = NO;
 
+	/* Documents going straight to the spill file don't get a HyperDoc */
+	if (mr->flags & MR_LINK && mr->flags & MR_BFS && match && follow)
+	    spill = HTQueue_isSpilling(mr->queue);
+
 	/* Test whether we already have a hyperdoc for this document */
 	if (!hd && dest_parent) {
-	    nhd = HyperDoc_new(mr, dest_parent, depth);
+	    if (!spill) nhd = HyperDoc_new(mr, dest_parent, depth);
 	    mr->cdepth[depth]++;
 	}
 
 	/* Test whether we already have a hyperdoc for this document */
         if (mr->flags & MR_LINK && match && dest_parent && follow && !hd) {
-	    if (mr->flags & MR_BFS) {
+	    if (spill) {
+		queue_spill(mr, anchor, dest, uri, depth);
+		(mr->cq)++;
+		if(mr->ndoc > 0) mr->ndoc--;
+	    } else if (mr->flags & MR_BFS) {
 		nhd->method = METHOD_HEAD;
 		HTQueue_enqueue(mr->queue, (void *) nhd);
 		(mr->cq)++;
@@ -1435,9 +1592,9 @@ PRIVATE void RHText_foundImage (HText * text, HTChildAnchor * anchor,
 	    BOOL match = YES;
 
 	    if (!uri) return;
-	    if (hd) {
+	    if (hd || queue_seen(mr, uri)) {
 		if (SHOW_QUIET(mr)) HTPrint("............ Already checked\n");
-		hd->hits++;
+		if (hd) hd->hits++;
 #ifdef HT_MYSQL
 		if (mr->sqllog) {
 		    char * ref_addr = HTAnchor_address((HTAnchor *) referer);
@@ -1526,6 +1683,23 @@ PRIVATE void RHText_foundLink (HText * text,
     }
 }
 
+/*
+**	Links found by the HTML link extractor. There is no HText object for
+**	the document so we make one on the fly for each batch of links.
+*/
+PRIVATE void RHText_foundLinks (HTRequest * request,
+				HTFoundLink * links, int count)
+{
+    Finger * finger = (Finger *) HTRequest_context(request);
+    HText text;
+    int i;
+    text.request = request;
+    text.follow = RHText_follow(finger->robot, HTRequest_anchor(request));
+    for (i = 0; i < count; i++)
+	RHText_foundLink(&text, links[i].element_number,
+			 links[i].attribute_number, links[i].anchor, NULL, NULL);
+}
+
 PUBLIC char * get_robots_txt(char * uri)
 {
     char *str = NULL;
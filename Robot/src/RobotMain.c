@@ -25,6 +25,7 @@
 
 #include "HTRobMan.h"
 #include "RobotTxt.h"
+#include <signal.h>
 
 #define SHOW_QUIET(mr)		((mr) && !((mr)->flags & MR_QUIET))
 #define SHOW_REAL_QUIET(mr)	((mr) && !((mr)->flags & MR_REAL_QUIET))
@@ -81,6 +82,16 @@ int main (int argc, char ** argv)
     /* Initiate W3C Reference Library with a robot profile */
     HTProfile_newRobot(APP_NAME, APP_VERSION);
 
+#ifdef SIGPIPE
+    /*
+    ** With several persistent connections per host we are bound to
+    ** write a request now and then on a connection which the server
+    ** just closed. The write fails with EPIPE and the request is
+    ** recovered, so don't let the signal kill us first.
+    */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
     /* Need our own trace and print functions */
     HTPrint_setCallback(printer);
     HTTrace_setCallback(tracer);
@@ -216,10 +227,47 @@ int main (int argc, char ** argv)
 		    atoi(argv[++arg]) : 0;
 		if (waits > 0) mr->waits = waits;
 
+	    /* Asynchronous DNS lookups, optionally using our own name server */
+	    } else if (!strcmp(argv[arg], "-adns")) {
+		HTResolver_setAsync(YES);
+		if (arg+1 < argc && *argv[arg+1] != '-') {
+		    char * server = argv[++arg];
+		    char * port = strchr(server, ':');
+		    if (port) *port++ = '\0';
+		    HTResolver_addServer(server, port ? atoi(port) : 0);
+		}
+
+	    /* Parallel connects to multihomed hosts */
+	    } else if (!strcmp(argv[arg], "-parallel")) {
+		HTDoConnect_setParallel(YES);
+		if (arg+1 < argc && *argv[arg+1] != '-')
+		    HTDoConnect_setParallelDelay(atol(argv[++arg]));
+
+	    /* Also connect using IPv6 addresses */
+	    } else if (!strcmp(argv[arg], "-ipv6")) {
+		HTDoConnect_setIPv6(YES);
+
 	    /* Force no pipelined requests */
 	    } else if (!strcmp(argv[arg], "-nopipe")) {
 		HTTP_setConnectionMode(HTTP_11_NO_PIPELINING);
 
+	    /* Connections per host */
+	    } else if (!strcmp(argv[arg], "-pool")) {
+		int max = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : DEFAULT_POOL_MAX;
+		int min = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : HTHost_defaultPoolMin();
+		HTHost_setDefaultPoolSize(HTMIN(min, max), max);
+
+	    /* Remember pipeline depths between runs */
+	    } else if (!strcmp(argv[arg], "-pipefile")) {
+		mr->pipefile = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    argv[++arg] : DEFAULT_PIPE_FILE;
+
+	    /* Talk HTTP/2 to servers known to speak it */
+	    } else if (!strcmp(argv[arg], "-h2c")) {
+		HTTP_setConnectionMode(HTTP_20_PRIOR_KNOWLEDGE);
+
 	    /* Stream write flush delay in ms */
 	    } else if (!strcmp(argv[arg], "-delay")) {
 		int delay = (arg+1 < argc && *argv[arg+1] != '-') ?
@@ -297,6 +345,13 @@ int main (int argc, char ** argv)
 	    } else if (!strcmp(argv[arg], "-bfs")) { 
 		mr->flags |= MR_BFS;
 
+	    /* spill the BFS queue to this file */
+	    } else if (!strcmp(argv[arg], "-queuefile")) { 
+		mr->queuefile = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    argv[++arg] : DEFAULT_QUEUE_FILE;
+		mr->queuemem = (arg+1 < argc && *argv[arg+1] != '-') ?
+		    atoi(argv[++arg]) : 0;
+
 	    /* run in quiet mode */
 	    } else if (!strcmp(argv[arg], "-q")) { 
 		mr->flags |= MR_QUIET;
@@ -571,6 +626,16 @@ int main (int argc, char ** argv)
     /* Reject Log file specified? */
     if (mr->rejectfile) mr->reject = HTLog_open(mr->rejectfile, YES, YES);
 
+    /* Pipeline depths from an earlier run? */
+    if (mr->pipefile) HTHost_loadPipelineDepths(mr->pipefile);
+
+    /* Queue spill file specified? */
+    if (mr->queuefile && !Robot_setQueueFile(mr, mr->queuefile, mr->queuemem)) {
+	if (SHOW_REAL_QUIET(mr))
+	    HTPrint("Can't open queue file `%s'\n", mr->queuefile);
+	Cleanup(mr, -1);
+    }
+
 #ifdef HT_POSIX_REGEX
     if(!(mr->flags & MR_NOROBOTSTXT))
       {